@@ -0,0 +1,118 @@
+// Copyright (C) 2017-2023 Grupa Pracuj S.A.
+// This file is part of the "Hermes" library.
+// For conditions of distribution and use, see copyright notice in license.txt.
+
+#include "LegacyURLTool.hpp"
+
+#include "hermes.hpp"
+
+LegacyURLTool::LegacyURLTool(const std::string& pURL)
+{
+    const size_t protocolOffset = 3;
+
+    mURL = pURL;
+
+    if (mURL.length() == 0) return;
+
+    const size_t protocolPos = mURL.find("://");
+
+    if (protocolPos != std::string::npos)
+    {
+        mProtocol = mURL.data();
+        mProtocolLength = protocolPos;
+
+        mSecure = (mProtocolLength == 3 && mURL.compare(0, mProtocolLength, "wss")) == 0 || (mProtocolLength == 5 && mURL.compare(0, mProtocolLength, "https") == 0);
+    }
+
+    size_t hostEndPos = mURL.find('/', mProtocolLength + protocolOffset);
+
+    if (hostEndPos == std::string::npos)
+    {
+        mURL += '/';
+        hostEndPos = mURL.length() - 1;
+    }
+
+    size_t portPos = mURL.find(':', mProtocolLength + protocolOffset);
+
+    if (portPos != std::string::npos)
+    {
+        auto port = mURL.substr(portPos + 1, hostEndPos - (portPos + 1));
+
+        try
+        {
+            mPort = static_cast<uint16_t>(std::stoul(port));
+            mPortLength = hostEndPos - portPos;
+        }
+        catch (std::exception& e)
+        {
+            hms::Hermes::getInstance()->getLogger()->print(hms::ELogLevel::Error, "Url parsing port conversion fail: '%'", mURL);
+        }
+    }
+    else
+    {
+        portPos = hostEndPos;
+    }
+
+    size_t parameterPos = mURL.find('?', hostEndPos);
+
+    if (parameterPos != std::string::npos)
+    {
+        mParameter = mURL.data() + parameterPos;
+        mParameterLength = mURL.length() - parameterPos;
+    }
+
+    mHost = mURL.data() + (mProtocolLength != 0 ? mProtocolLength + protocolOffset : 0);
+    mHostLength = portPos - (mProtocolLength != 0 ? mProtocolLength + protocolOffset : 0);
+
+    mPath = mURL.data() + hostEndPos;
+    mPathLength = mURL.length() - mParameterLength - hostEndPos;
+}
+
+const std::string& LegacyURLTool::getURL() const
+{
+    return mURL;
+}
+
+const char* LegacyURLTool::getProtocol(size_t& pLength) const
+{
+    pLength = mProtocolLength;
+    return mProtocol;
+}
+
+const char* LegacyURLTool::getHost(size_t& pLength, bool pIncludePort) const
+{
+    pLength = mHostLength + (pIncludePort ? mPortLength : 0);
+    return mHost;
+}
+
+const char* LegacyURLTool::getPath(size_t& pLength, bool pIncludeParameter) const
+{
+    pLength = mPathLength + (pIncludeParameter ? mParameterLength : 0);
+    return mPath;
+}
+
+const char* LegacyURLTool::getParameter(size_t& pLength) const
+{
+    pLength = mParameterLength;
+    return mParameter;
+}
+
+uint16_t LegacyURLTool::getPort() const
+{
+    return mPort;
+}
+
+bool LegacyURLTool::isSecure() const
+{
+    return mSecure;
+}
+
+std::string LegacyURLTool::getHttpURL(bool pBase) const
+{
+    const size_t protocolLength = mProtocolLength == 0 ? 0 : mProtocolLength + 3;
+
+    if (mURL.length() == 0)
+        return "";
+    else
+        return (mSecure ? "https://" : "http://") + (pBase ? mURL.substr(protocolLength, mURL.length() - (mPathLength + mParameterLength + protocolLength)) : mURL.substr(protocolLength));
+}
@@ -0,0 +1,46 @@
+// Copyright (C) 2017-2023 Grupa Pracuj S.A.
+// This file is part of the "Hermes" library.
+// For conditions of distribution and use, see copyright notice in license.txt.
+
+#ifndef _LEGACY_URL_TOOL_HPP_
+#define _LEGACY_URL_TOOL_HPP_
+
+#include <cstdint>
+#include <string>
+
+// hms::tools::URLTool as it was before it was rebuilt on hms::tools::URLView, kept only to compare both parsers.
+class LegacyURLTool
+{
+public:
+    explicit LegacyURLTool(const std::string& pURL);
+
+    const std::string& getURL() const;
+    const char* getProtocol(size_t& pLength) const;
+    const char* getHost(size_t& pLength, bool pIncludePort = false) const;
+    const char* getPath(size_t& pLength, bool pIncludeParameter = false) const;
+    const char* getParameter(size_t& pLength) const;
+    uint16_t getPort() const;
+    bool isSecure() const;
+
+    std::string getHttpURL(bool pBase = false) const;
+
+private:
+    LegacyURLTool() = delete;
+    LegacyURLTool(const LegacyURLTool& pTool) = delete;
+    LegacyURLTool(LegacyURLTool&& pTool) = delete;
+
+    std::string mURL;
+    const char* mProtocol = nullptr;
+    const char* mHost = nullptr;
+    const char* mPath = nullptr;
+    const char* mParameter = nullptr;
+    uint16_t mPort = 0;
+    size_t mProtocolLength = 0;
+    size_t mHostLength = 0;
+    size_t mPathLength = 0;
+    size_t mPortLength = 0;
+    size_t mParameterLength = 0;
+    bool mSecure = false;
+};
+
+#endif
@@ -0,0 +1,241 @@
+// Copyright (C) 2017-2023 Grupa Pracuj S.A.
+// This file is part of the "Hermes" library.
+// For conditions of distribution and use, see copyright notice in license.txt.
+
+// Compares hms::tools::URLTool with the parser it replaced on random and corpus URLs and measures the throughput of both.
+// Usage: 02.URLParser [-n count] [-s seed] [-r rounds] [corpus file with one URL per line...]
+// Build it with NDEBUG=1 for meaningful timings.
+
+#include "LegacyURLTool.hpp"
+
+#include "hmsTools.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <vector>
+
+namespace
+{
+    std::string createURL(std::mt19937& pRandom)
+    {
+        static const std::vector<std::string> scheme = {"", "http://", "https://", "HTTPS://", "ws://", "wss://", "ftp://", "http:/", "1http://"};
+        static const std::vector<std::string> userInfo = {"", "", "", "user@", "user:password@", "a@b@"};
+        static const std::vector<std::string> host = {"example.com", "api.example.com", "127.0.0.1", "localhost", "[::1]", "[2001:db8::1]", "[::1", "", "xn--bcher-kva.example"};
+        static const std::vector<std::string> port = {"", "", "", ":80", ":8080", ":65535", ":65536", ":0", ":", ":8o", ":99999999999999999999"};
+        static const std::vector<std::string> path = {"", "", "/", "/a/b", "/v1/users/42", "/path;x=1", "/a:b/c", "/%7Euser", "//double"};
+        static const std::vector<std::string> query = {"", "", "?", "?a=1", "?a=1&b=%20", "?redirect=http://other/x", "?a?b"};
+        static const std::vector<std::string> fragment = {"", "", "", "#", "#top", "#a?b", "#/x:y"};
+        static const std::string alphabet = ":/?#@[]%.a0 ";
+
+        auto pick = [&pRandom](const std::vector<std::string>& lpPart) -> const std::string&
+        {
+            return lpPart[std::uniform_int_distribution<size_t>(0, lpPart.size() - 1)(pRandom)];
+        };
+
+        std::string url = pick(scheme) + pick(userInfo) + pick(host) + pick(port) + pick(path) + pick(query) + pick(fragment);
+
+        // A part of the URLs is mutated, so separators also show up where the grammar above doesn't put them.
+        const size_t mutationCount = std::uniform_int_distribution<size_t>(0, 3)(pRandom) == 0 ? std::uniform_int_distribution<size_t>(1, 3)(pRandom) : 0;
+        for (size_t i = 0; i < mutationCount; ++i)
+        {
+            const size_t position = std::uniform_int_distribution<size_t>(0, url.size())(pRandom);
+            const char sign = alphabet[std::uniform_int_distribution<size_t>(0, alphabet.size() - 1)(pRandom)];
+
+            switch (std::uniform_int_distribution<int>(0, 2)(pRandom))
+            {
+            case 0:
+                url.insert(position, 1, sign);
+                break;
+            case 1:
+                if (position < url.size())
+                    url[position] = sign;
+                break;
+            default:
+                if (position < url.size())
+                    url.erase(position, 1);
+                break;
+            }
+        }
+
+        return url;
+    }
+
+    template<typename T>
+    std::map<std::string, std::string> createResult(const T& pTool)
+    {
+        auto toString = [](const char* lpData, size_t lpLength) -> std::string
+        {
+            return lpData != nullptr ? std::string(lpData, lpLength) : std::string();
+        };
+
+        size_t length = 0;
+        std::map<std::string, std::string> result;
+        const char* data = pTool.getProtocol(length);
+        result["protocol"] = toString(data, length);
+        data = pTool.getHost(length);
+        result["host"] = toString(data, length);
+        data = pTool.getHost(length, true);
+        result["host with port"] = toString(data, length);
+        data = pTool.getPath(length);
+        result["path"] = toString(data, length);
+        data = pTool.getPath(length, true);
+        result["path with parameter"] = toString(data, length);
+        data = pTool.getParameter(length);
+        result["parameter"] = toString(data, length);
+        result["port"] = std::to_string(pTool.getPort());
+        result["secure"] = pTool.isSecure() ? "true" : "false";
+        result["url"] = pTool.getURL();
+        result["http url"] = pTool.getHttpURL();
+        result["http base url"] = pTool.getHttpURL(true);
+
+        return result;
+    }
+
+    // Every part of the new parser has to lie inside of its URL.
+    bool isInside(const hms::tools::URLTool& pTool)
+    {
+        const char* begin = pTool.getURL().data();
+        const char* end = begin + pTool.getURL().size();
+        std::pair<const char*, size_t> part[4];
+        part[0].first = pTool.getProtocol(part[0].second);
+        part[1].first = pTool.getHost(part[1].second, true);
+        part[2].first = pTool.getPath(part[2].second, true);
+        part[3].first = pTool.getParameter(part[3].second);
+
+        for (const auto& v : part)
+        {
+            if (v.second > 0 && (v.first == nullptr || v.first < begin || v.first + v.second > end))
+                return false;
+        }
+
+        return true;
+    }
+
+    template<typename T>
+    double measure(const std::vector<std::string>& pURL, size_t pRoundCount, size_t& pChecksum)
+    {
+        const auto startTime = std::chrono::steady_clock::now();
+
+        for (size_t i = 0; i < pRoundCount; ++i)
+        {
+            for (const auto& url : pURL)
+            {
+                T tool(url);
+                size_t length = 0;
+                pChecksum += reinterpret_cast<uintptr_t>(tool.getHost(length, true)) + length + tool.getPort();
+                tool.getPath(length, true);
+                pChecksum += length;
+            }
+        }
+
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    }
+}
+
+int main(int pArgumentsCount, char* pArguments[])
+{
+    size_t count = 100000;
+    size_t roundCount = 10;
+    uint32_t seed = 2017;
+    std::vector<std::string> url;
+
+    for (int i = 1; i < pArgumentsCount; ++i)
+    {
+        if (i + 1 < pArgumentsCount && strcmp(pArguments[i], "-n") == 0)
+        {
+            count = std::stoul(pArguments[++i]);
+        }
+        else if (i + 1 < pArgumentsCount && strcmp(pArguments[i], "-s") == 0)
+        {
+            seed = static_cast<uint32_t>(std::stoul(pArguments[++i]));
+        }
+        else if (i + 1 < pArgumentsCount && strcmp(pArguments[i], "-r") == 0)
+        {
+            roundCount = std::max<size_t>(1, std::stoul(pArguments[++i]));
+        }
+        else
+        {
+            std::ifstream corpus(pArguments[i]);
+            if (!corpus.is_open())
+            {
+                std::cerr << "Couldn't open corpus file '" << pArguments[i] << "'\n";
+                return 1;
+            }
+
+            for (std::string line; std::getline(corpus, line);)
+            {
+                if (line.size() > 0 && line.back() == '\r')
+                    line.pop_back();
+
+                url.push_back(std::move(line));
+            }
+        }
+    }
+
+    std::mt19937 random(seed);
+    for (size_t i = 0; i < count; ++i)
+        url.push_back(createURL(random));
+
+    // The new parser differs from the old one on purpose, e.g. in fragments, userinfo and the wss scheme, so differences are reported with examples instead of failing.
+    const size_t exampleLimit = 3;
+    std::map<std::string, size_t> differenceCount;
+    std::map<std::string, std::vector<std::string>> differenceExample;
+    size_t outsideCount = 0;
+
+    for (const auto& v : url)
+    {
+        LegacyURLTool legacyTool(v);
+        hms::tools::URLTool tool(v);
+
+        if (!isInside(tool))
+        {
+            ++outsideCount;
+            std::cout << "Part outside of the URL: '" << v << "'\n";
+        }
+
+        const auto legacyResult = createResult(legacyTool);
+        const auto result = createResult(tool);
+
+        for (const auto& part : result)
+        {
+            const auto& legacyPart = legacyResult.at(part.first);
+            if (legacyPart != part.second)
+            {
+                ++differenceCount[part.first];
+
+                auto& example = differenceExample[part.first];
+                if (example.size() < exampleLimit)
+                    example.push_back("'" + v + "': '" + legacyPart + "' -> '" + part.second + "'");
+            }
+        }
+    }
+
+    std::cout << "Compared " << url.size() << " URLs\n";
+    for (const auto& v : differenceCount)
+    {
+        std::cout << "  " << v.first << " differs in " << v.second << " URLs\n";
+        for (const auto& example : differenceExample[v.first])
+            std::cout << "    " << example << "\n";
+    }
+
+    size_t byteCount = 0;
+    for (const auto& v : url)
+        byteCount += v.size();
+
+    size_t checksum = 0;
+    const double legacyTime = measure<LegacyURLTool>(url, roundCount, checksum);
+    const double time = measure<hms::tools::URLTool>(url, roundCount, checksum);
+    const double parseCount = static_cast<double>(url.size() * roundCount);
+    const double megabyteCount = static_cast<double>(byteCount * roundCount) / (1024.0 * 1024.0);
+
+    std::cout << "Throughput over " << roundCount << " rounds (checksum " << checksum << ")\n";
+    std::cout << "  old: " << legacyTime * 1e9 / parseCount << " ns per URL, " << megabyteCount / legacyTime << " MB/s\n";
+    std::cout << "  new: " << time * 1e9 / parseCount << " ns per URL, " << megabyteCount / time << " MB/s\n";
+
+    return outsideCount == 0 ? 0 : 1;
+}
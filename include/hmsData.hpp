@@ -20,6 +20,7 @@ namespace hms
     namespace crypto
     {
         enum class ECryptoMode : int;
+        class Encryptor;
     }
 
     enum class EDataSharedType : int
@@ -55,6 +56,7 @@ namespace hms
         
         virtual bool seek(int64_t pPosition, bool pRelative = false) = 0;
         virtual bool flush() = 0;
+        virtual bool commit() { return flush(); };
         
         virtual size_t getPosition() const = 0;
         virtual bool isOpen() const = 0;
@@ -85,6 +87,59 @@ namespace hms
         size_t mPosition = 0;
         size_t mSize = 0;
     };
+    
+#if defined(__APPLE__) || defined(__linux__)
+    class DescriptorWriter : public DataWriter
+    {
+    public:
+        DescriptorWriter(int32_t pDescriptor, bool pCloseOnDestroy);
+        // In the atomic mode data is written to a temporary file which replaces pFilePath on commit, otherwise it is removed on destroy.
+        DescriptorWriter(const std::string& pFilePath, bool pAppend, bool pAtomic);
+        virtual ~DescriptorWriter();
+        
+        virtual size_t write(const void* pBuffer, size_t pSize) override;
+        virtual size_t write(const std::string& pText) override;
+        virtual size_t write(const std::vector<uint8_t>& pBuffer) override;
+        
+        virtual bool seek(int64_t pPosition, bool pRelative = false) override;
+        virtual bool flush() override;
+        virtual bool commit() override;
+        
+        virtual size_t getPosition() const override;
+        virtual bool isOpen() const override;
+        
+    private:
+        std::string mFilePath;
+        std::string mTemporaryFilePath;
+        int32_t mDescriptor = -1;
+        bool mCloseOnDestroy = false;
+        size_t mPosition = 0;
+    };
+#endif
+    
+    class CipherWriter : public DataWriter
+    {
+    public:
+        CipherWriter(std::unique_ptr<DataWriter> pWriter, const std::string& pKey, const std::string& pIV, crypto::ECryptoMode pCryptoMode);
+        virtual ~CipherWriter();
+        
+        virtual size_t write(const void* pBuffer, size_t pSize) override;
+        virtual size_t write(const std::string& pText) override;
+        virtual size_t write(const std::vector<uint8_t>& pBuffer) override;
+        
+        virtual bool seek(int64_t pPosition, bool pRelative = false) override;
+        virtual bool flush() override;
+        virtual bool commit() override;
+        
+        virtual size_t getPosition() const override;
+        virtual bool isOpen() const override;
+        
+    private:
+        std::unique_ptr<DataWriter> mWriter;
+        std::unique_ptr<crypto::Encryptor> mEncryptor;
+        std::vector<uint8_t> mBuffer;
+        size_t mPosition = 0;
+    };
         
     class MemoryWriter : public DataWriter
     {
@@ -246,7 +301,7 @@ namespace hms
         bool writeFile(const std::string& pFileName, const std::vector<uint8_t>& pDataBuffer, crypto::ECryptoMode pCryptoMode = static_cast<crypto::ECryptoMode>(0), bool pClearContent = true) const;
         
         std::unique_ptr<DataReader> getDataReader(const std::string& pFileName) const;
-        std::unique_ptr<DataWriter> getDataWriter(const std::string& pFileName, bool pAppend = false) const;
+        std::unique_ptr<DataWriter> getDataWriter(const std::string& pFileName, bool pAppend = false, crypto::ECryptoMode pCryptoMode = static_cast<crypto::ECryptoMode>(0), bool pAtomic = false) const;
         
         void addStorageLoader(std::unique_ptr<DataStorageLoader> pLoader);
         void addStorageReader(std::unique_ptr<DataStorageReader> pReader);
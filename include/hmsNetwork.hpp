@@ -7,7 +7,9 @@
 
 #include <array>
 #include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <mutex>
@@ -16,6 +18,7 @@
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -28,6 +31,8 @@ namespace hms
         class URLTool;
     }
     
+    class DataReader;
+    class DataWriter;
     class NetworkManager;
 
     enum class ENetworkCertificate : int32_t
@@ -37,6 +42,26 @@ namespace hms
         Content
     };
 
+    enum class ENetworkCompression : int32_t
+    {
+        Default = 0,
+        Disable,
+        Enable
+    };
+
+    enum class ENetworkCacheStore : int32_t
+    {
+        File = 0,
+        Pack
+    };
+
+    enum class ENetworkCacheMode : int32_t
+    {
+        Default = 0,
+        StaleWhileRevalidate,
+        StaleIfError
+    };
+
     enum class ENetworkCode : int32_t
     {
         OK = 0,
@@ -44,8 +69,15 @@ namespace hms
         LostConnection,
         Timeout,
         Cancel,
+        Overload,
         Unknown = 100
     };
+    
+    enum class ENetworkLimiter : int32_t
+    {
+        AIMD = 0,
+        Gradient
+    };
 
     enum class ENetworkRequest : int32_t
     {
@@ -59,7 +91,8 @@ namespace hms
     enum class ENetworkResponse : int32_t
     {
         Message = 0,
-        RawData
+        RawData,
+        Stream
     };
         
     enum class ENetworkWebSocketDisconnect : int32_t
@@ -90,6 +123,7 @@ namespace hms
         TimeoutInMilliseconds = 0,
         Redirect,
         DisableSSLVerifyPeer,
+        Coalescing,
         Count
     };
 
@@ -99,9 +133,32 @@ namespace hms
         virtual ~NetworkResponseDataTaskBackground() = default;
     };
 
+    class NetworkTiming
+    {
+    public:
+        // Microseconds since the start of the transfer until the host was resolved, the connection and the TLS handshake were done, the request
+        // was about to be sent, the first byte of the response arrived and the transfer ended, as reported by curl.
+        int64_t mNameLookup = 0;
+        int64_t mConnect = 0;
+        int64_t mAppConnect = 0;
+        int64_t mPreTransfer = 0;
+        int64_t mStartTransfer = 0;
+        int64_t mTotal = 0;
+        // Microseconds the request waited for a thread of the pool and a transfer of the scheduler, and the response waited for the main thread.
+        int64_t mQueue = 0;
+        int64_t mDispatch = 0;
+        // Connections opened by the transfer, 0 means it reused an idle one.
+        int64_t mConnectionCount = 0;
+        int64_t mRequestSize = 0;
+        int64_t mHeaderSize = 0;
+    };
+    
     class NetworkResponse
     {
     public:
+        // Value of the first header with this name compared without regard to case, nullptr when the response doesn't have it.
+        const std::string* getHeader(const std::string& pName) const;
+        
         ENetworkCode mCode = ENetworkCode::Unknown;
         int32_t mHttpCode = -1;
         std::vector<std::pair<std::string, std::string>> mHeader;
@@ -109,6 +166,78 @@ namespace hms
         std::vector<uint8_t> mRawData;
         std::unique_ptr<NetworkResponseDataTaskBackground> mDataTaskBackground;
         std::string mMethod;
+        std::pair<int64_t /* received */, int64_t /* decoded */> mDownloadSize = {0, 0};
+        std::pair<int64_t /* sent */, int64_t /* source */> mUploadSize = {0, 0};
+        NetworkTiming mTiming;
+    };
+
+    class NetworkRetryPolicy
+    {
+    public:
+        // Number of retries after the first attempt.
+        uint32_t mCount = 0;
+        // Failed transfers which are retried, ENetworkCode::Unknown stands for each curl error without its own code.
+        std::vector<ENetworkCode> mCode = {ENetworkCode::LostConnection, ENetworkCode::Timeout, ENetworkCode::Unknown};
+        // Responses with these HTTP codes are retried, a Retry-After header of such response takes precedence over the backoff.
+        std::vector<int32_t> mHttpCode = {408, 429, 502, 503, 504};
+        // Only requests of these types are retried, by default the idempotent ones. A POST may have taken effect on the server before the failure.
+        std::vector<ENetworkRequest> mRequestType = {ENetworkRequest::Get, ENetworkRequest::Head, ENetworkRequest::Put, ENetworkRequest::Delete};
+        // The delay in milliseconds before the first retry, multiplied by mMultiplier for each next one up to mMaxDelay.
+        uint32_t mDelay = 100;
+        uint32_t mMaxDelay = 10000;
+        float mMultiplier = 2.0f;
+        // Part of the delay which is random, 0 keeps the delay as it is, 1 picks it from the whole range.
+        float mJitter = 0.5f;
+        // Time in milliseconds since the first attempt after which a request isn't retried anymore, 0 means no limit.
+        uint32_t mMaxElapsedTime = 0;
+    };
+
+    class NetworkLimiterPolicy
+    {
+    public:
+        // AIMD grows the window by one per window of successful transfers, Gradient scales it by the ratio of the long-term and the current RTT.
+        ENetworkLimiter mAlgorithm = ENetworkLimiter::Gradient;
+        // The window of concurrent transfers starts at mInitialLimit and stays between mMinLimit and mMaxLimit.
+        uint32_t mInitialLimit = 4;
+        uint32_t mMinLimit = 1;
+        uint32_t mMaxLimit = 200;
+        // A failed transfer, a 429 or 5xx response or a transfer longer than mTimeout milliseconds shrinks the window by mBackoff, 0 means no timeout.
+        float mBackoff = 0.9f;
+        uint32_t mTimeout = 0;
+        // Gradient: the current RTT tolerated above the long-term one and the number of transfers the long-term RTT is averaged over.
+        float mTolerance = 1.5f;
+        uint32_t mWindow = 100;
+        // A request which finds mMaxQueueSize requests waiting for the window is shed with ENetworkCode::Overload, 0 means no limit.
+        uint32_t mMaxQueueSize = 0;
+    };
+
+    class NetworkHedgePolicy
+    {
+    public:
+        // A duplicate is sent when no response arrives within the mPercentile latency of recent transfers of the API, kept between mMinDelay
+        // and mMaxDelay milliseconds. mMaxDelay is used until the API has enough transfers to measure.
+        float mPercentile = 0.95f;
+        uint32_t mMinDelay = 10;
+        uint32_t mMaxDelay = 1000;
+        // Part of the hedged requests of an API which may send a duplicate.
+        float mRatio = 0.1f;
+        // Base URL which replaces the URL of the API in the duplicate, empty keeps the same URL.
+        std::string mUrl;
+    };
+
+    class NetworkKeepAlive
+    {
+    public:
+        // An idle connection is reused at most mIdleTime seconds after its last transfer and any connection at most mLifeTime seconds
+        // after it was opened, 0 means no limit of the lifetime.
+        uint32_t mIdleTime = 118;
+        uint32_t mLifeTime = 0;
+        // Idle connections kept by each thread of the pool.
+        uint32_t mConnectionCount = 5;
+        // TCP keep-alive probes are sent after mProbeIdle seconds of silence and then each mProbeInterval seconds.
+        bool mProbe = false;
+        uint32_t mProbeIdle = 60;
+        uint32_t mProbeInterval = 60;
     };
 
     class NetworkRequest
@@ -120,13 +249,69 @@ namespace hms
         std::vector<std::pair<std::string, std::string>> mParameter = {};
         std::vector<std::pair<std::string, std::string>> mHeader = {};
         std::string mRequestBody;
+        std::shared_ptr<DataReader> mRequestReader;
+        bool mRequestChunked = false;
+        ENetworkCompression mRequestCompression = ENetworkCompression::Default;
+        ENetworkCompression mResponseCompression = ENetworkCompression::Default;
         std::function<void(NetworkResponse)> mCallback;
         std::function<std::unique_ptr<NetworkResponseDataTaskBackground>(const NetworkResponse&)> mTaskBackground;
         std::function<void(int64_t, int64_t, int64_t, int64_t)> mProgress;
+        std::function<bool(const uint8_t* lpData, size_t lpSize)> mStream;
+        std::shared_ptr<DataWriter> mResponseWriter;
         uint32_t mRepeatCount = 0;
+        std::shared_ptr<const NetworkRetryPolicy> mRetryPolicy;
+        // Only GET and HEAD requests without a reader, a writer or a stream are hedged, the first response wins and the other transfer is canceled.
+        std::shared_ptr<const NetworkHedgePolicy> mHedgePolicy;
         bool mAllowRecovery = true;        
+        bool mAllowCoalescing = true;
         bool mAllowCache = false;
         uint32_t mCacheLifetime = 8640000;
+        // Cache-Control, Expires and the validators of a response are used only when enabled, otherwise mCacheLifetime applies.
+        bool mCacheHeader = false;
+        ENetworkCacheMode mCacheMode = ENetworkCacheMode::Default;
+    };
+    
+    class NetworkCacheStatistics
+    {
+    public:
+        uint64_t mHitCount = 0;
+        uint64_t mMissCount = 0;
+        uint64_t mConditionalCount = 0;
+        uint64_t mNotModifiedCount = 0;
+        uint64_t mNotModifiedSize = 0;
+        uint64_t mStaleCount = 0;
+    };
+    
+    class NetworkSchedulerStatistics
+    {
+    public:
+        uint64_t mQueueSize = 0;
+        uint64_t mActiveCount = 0;
+        uint64_t mQueuedCount = 0;
+        uint64_t mWaitTime = 0;
+        uint64_t mMaxWaitTime = 0;
+        uint64_t mShedCount = 0;
+        uint32_t mLimit = 0;
+        uint32_t mRtt = 0;
+        uint64_t mHedgeCount = 0;
+        uint64_t mHedgeWinCount = 0;
+    };
+    
+    class NetworkMetrics
+    {
+    public:
+        // Quantile of the latency histogram in microseconds, it's the upper bound of the bucket holding the quantile.
+        int64_t getLatency(float pPercentile) const;
+        
+        uint64_t mRequestCount = 0;
+        std::vector<std::pair<ENetworkCode, uint64_t /* count */>> mCodeCount;
+        uint64_t mDownloadSize = 0;
+        uint64_t mUploadSize = 0;
+        uint64_t mCacheHitCount = 0;
+        uint64_t mCacheMissCount = 0;
+        uint64_t mRetryCount = 0;
+        std::vector<std::pair<int64_t /* upper bound */, uint64_t /* count */>> mLatency;
+        int64_t mLatencySum = 0;
     };
         
     class NetworkWebSocket
@@ -154,8 +339,17 @@ namespace hms
         void cancel();
         bool isCancel() const;
         
+        void pause();
+        void resume();
+        bool isPause() const;
+        
     private:
+        friend NetworkManager;
+        
         std::atomic<uint32_t> mCancel = {0};
+        std::atomic<uint32_t> mPause = {0};
+        std::atomic<uint32_t> mResume = {0};
+        std::shared_ptr<const NetworkRequestHandle> mParent;
     };
     
     class NetworkWebSocketHandle
@@ -310,6 +504,25 @@ namespace hms
          \param pDefaultHeader List of headers, simple element may look like this: "{"Content-Type", "application/json; charset=UTF-8"}". */
         void setDefaultHeader(std::vector<std::pair<std::string, std::string>> pDefaultHeader);
         
+        //! Get the compression settings.
+        /** \return Pair of flags, the first one for a response decompression and the second one for a request body compression. */
+        std::pair<bool /* response */, bool /* request */> getCompression() const;
+        
+        //! Set the compression settings.
+        /** Settings are used by each request called through this API which leaves its compression as ENetworkCompression::Default.
+         \param pResponse If set to True, a compressed response (gzip, deflate and brotli or zstd if supported by curl) is negotiated with the server and decoded on the fly.
+         \param pRequest If set to True, a request body is compressed on the fly with gzip and sent with the "Content-Encoding" header. */
+        void setCompression(bool pResponse, bool pRequest);
+        
+        //! Get the retry policy.
+        /** \return The policy used by requests called through this API without their own one. */
+        std::shared_ptr<const NetworkRetryPolicy> getRetryPolicy() const;
+        
+        //! Set the retry policy.
+        /** Retries are scheduled in the thread pool of the network manager after the delay of the policy, they don't block a thread meanwhile.
+         \param pRetryPolicy The policy, nullptr leaves retries to the mRepeatCount of a request. */
+        void setRetryPolicy(std::shared_ptr<const NetworkRetryPolicy> pRetryPolicy);
+        
         //! Register a post request callback.
         /** This feature is useful when you want to do some cyclic operation after a request call.
          \param pCallback Method which will be executed after a request.
@@ -356,12 +569,32 @@ namespace hms
         
     private:
         friend class NetworkManager;
+        
+        // Default headers without duplicates, with lowercase names, their hashes and an index of the hashes, compiled once into a curl list shared by all transfers.
+        class HeaderBlock
+        {
+        public:
+            HeaderBlock(const std::vector<std::pair<std::string, std::string>>& pHeader);
+            HeaderBlock(const HeaderBlock& pOther) = delete;
+            ~HeaderBlock();
+            
+            HeaderBlock& operator=(const HeaderBlock& pOther) = delete;
+            
+            std::vector<std::pair<std::string, std::string>> mHeader;
+            std::vector<uint64_t> mHash;
+            std::unordered_multimap<uint64_t, size_t> mIndex;
+            curl_slist* mList = nullptr;
+        };
 
         size_t mId = 0;
         std::string mName;
         std::string mUrl;
 
         std::vector<std::pair<std::string, std::string>> mDefaultHeader;
+        std::shared_ptr<const HeaderBlock> mHeaderBlock;
+        bool mResponseCompression = false;
+        bool mRequestCompression = false;
+        std::shared_ptr<const NetworkRetryPolicy> mRetryPolicy;
         std::shared_ptr<std::vector<std::pair<std::function<void(const NetworkResponse&)>, std::string>>> mCallbackContinious;
 
         std::weak_ptr<NetworkRecovery> mRecovery;
@@ -373,8 +606,18 @@ namespace hms
         struct ProgressData
         {
             std::function<void(int64_t lpDN, int64_t lpDT, int64_t lpUN, int64_t lpUT)> mProgressTask = nullptr;
+            std::function<bool(const uint8_t* lpData, size_t lpSize)> mStreamTask = nullptr;
+            std::shared_ptr<DataWriter> mWriter;
+            std::shared_ptr<DataReader> mReader;
+            std::shared_ptr<DataReader> mReaderSource;
+            bool mReaderChunked = false;
+            size_t mWriteSize = 0;
+            std::string* mResponseMessage = nullptr;
             std::shared_ptr<NetworkRequestHandle> mRequestHandle;
+            std::function<bool()> mCancelCondition = nullptr;
             std::atomic<uint32_t>* mTerminateAbort = nullptr;
+            void* mHandle = nullptr;
+            bool mPaused = false;
         };
     
         bool initialize(int64_t pTimeout, int32_t pThreadPoolId, int32_t pWebSocketThreadPoolId, std::pair<ENetworkCertificate /* type */, std::string /* file path or content */> pCertificate);
@@ -389,11 +632,17 @@ namespace hms
             {
                 result = std::shared_ptr<T>(new T(pId, std::move(pName), std::move(pUrl), std::forward<U>(pArgument)...), std::bind(&NetworkManager::deleterNetworkAPI, std::placeholders::_1));
             
-                std::lock_guard<std::mutex> lock(mApiMutex);
-                if (pId >= mApi.size())
-                    mApi.resize(pId + 1);
+                {
+                    std::lock_guard<std::mutex> lock(mApiMutex);
+                    if (pId >= mApi.size())
+                        mApi.resize(pId + 1);
 
-                mApi[pId] = result;
+                    mApi[pId] = result;
+                }
+                
+                const uint32_t preconnectCount = mPreconnectCount.load();
+                if (preconnectCount > 0)
+                    preconnect(pId, preconnectCount);
             }
             
             return result;
@@ -417,20 +666,107 @@ namespace hms
         int64_t getProgressTimePeriod() const;
         void setProgressTimePeriod(int64_t pTimePeriod);
         
+        // Preconnecting sends pCount requests without a body to the URL of the API from the threads of the pool in advance, each of them leaves a
+        // keep-alive connection in the handle of its thread and the resolved host and the TLS session in the shared cache. A count above the thread
+        // count of the pool reuses those connections. APIs added with a preconnect count set are warmed up at once.
+        void preconnect(size_t pApiId, uint32_t pCount);
+        uint32_t getPreconnectCount() const;
+        void setPreconnectCount(uint32_t pCount);
+        
+        NetworkKeepAlive getKeepAlive() const;
+        void setKeepAlive(NetworkKeepAlive pKeepAlive);
+        
+        std::vector<std::string> getCoalescingHeader() const;
+        void setCoalescingHeader(std::vector<std::string> pHeader);
+        uint64_t getCoalescingCount() const;
+        
+        // Retries of all requests are limited by a budget. Each request adds pRatio of a retry to it and pMinimum retries per second are added
+        // regardless of the traffic. The budget keeps at most the retries of 100 requests and a second.
+        std::pair<float /* ratio */, uint32_t /* minimum */> getRetryBudget() const;
+        void setRetryBudget(float pRatio, uint32_t pMinimum);
+        uint64_t getRetryCount() const;
+        
+        // Limits of concurrent transfers of an API and of a host, 0 means no limit. Requests over a limit wait in the queue of their API
+        // without holding a thread, free transfers are shared between waiting APIs in proportion to their weights.
+        uint32_t getConcurrencyLimit(size_t pApiId) const;
+        void setConcurrencyLimit(size_t pApiId, uint32_t pLimit);
+        uint32_t getSchedulingWeight(size_t pApiId) const;
+        void setSchedulingWeight(size_t pApiId, uint32_t pWeight);
+        uint32_t getHostConcurrencyLimit() const;
+        void setHostConcurrencyLimit(uint32_t pLimit);
+        
+        // The limiter adapts the concurrency limit of an API to the RTT and the failures of its transfers, a static limit still caps its window.
+        std::shared_ptr<const NetworkLimiterPolicy> getConcurrencyLimiter(size_t pApiId) const;
+        void setConcurrencyLimiter(size_t pApiId, std::shared_ptr<const NetworkLimiterPolicy> pPolicy);
+        
+        // Requests of the API waiting for a transfer and running transfers at the moment, mQueuedCount requests waited mWaitTime milliseconds in total.
+        // mLimit is the current limit of the API (0 without any) and mRtt the long-term RTT in milliseconds measured by its limiter.
+        // mHedgeCount duplicates were sent for hedged requests and mHedgeWinCount of them responded first.
+        NetworkSchedulerStatistics getSchedulerStatistics(size_t pApiId) const;
+        
+        // Transfers of API requests are counted by result code together with their sizes and a latency histogram with 8 buckets per power of two
+        // microseconds. Threads record into separate shards without locks, shards are merged when the metrics are read.
+        NetworkMetrics getMetrics(size_t pApiId) const;
+        
+        // Metrics of all APIs in the Prometheus text exposition format.
+        std::string exportMetrics() const;
+        bool exportMetrics(DataWriter& pWriter) const;
+        
         void appendParameter(std::string& pURL, const std::vector<std::pair<std::string, std::string>>& pParameter) const;
         void decodeURL(std::string& pData) const;
         void encodeURL(std::string& pData) const;
         
-        bool initCache(const std::string& pDirectoryPath, unsigned pFileCountLimit, unsigned pFileSizeLimit);
+        bool initCache(const std::string& pDirectoryPath, unsigned pFileCountLimit, unsigned pFileSizeLimit, size_t pMemorySizeLimit = 0, uint64_t pTotalSizeLimit = 0, ENetworkCacheStore pStore = ENetworkCacheStore::File);
         void clearCache();
         
+        // Hits count fresh responses served from the cache. A stale response with a validator is revalidated with If-None-Match/If-Modified-Since,
+        // mNotModifiedCount of mConditionalCount such requests were answered with 304, serving mNotModifiedSize bytes from the cache.
+        NetworkCacheStatistics getCacheStatistics() const;
+        
+        // Time in milliseconds after the expiry of a response, during which StaleWhileRevalidate and StaleIfError requests may still use it.
+        // Such responses are kept by initCache, so it should be set before the cache is initialized.
+        uint32_t getCacheStaleLifetime() const;
+        void setCacheStaleLifetime(uint32_t pLifetime);
+        
+        // Responses are written to the cache in the background. With sync enabled each write is flushed to the storage,
+        // before the response becomes visible in the cache index.
+        bool getCacheSync() const;
+        void setCacheSync(bool pSync);
+        
+        // Responses of at least this many bytes are stored compressed with deflate, 0 disables compression.
+        uint32_t getCacheCompressionThreshold() const;
+        void setCacheCompressionThreshold(uint32_t pThreshold);
+        
+        // Values of these request headers are a part of the cache key, by default Accept, Accept-Encoding, Accept-Language, Authorization and Cookie,
+        // so a response isn't served to a request with other credentials even when the server doesn't send Vary. Names are compared without regard to case.
+        std::vector<std::string> getCacheKeyHeader() const;
+        void setCacheKeyHeader(std::vector<std::string> pHeader);
+        
+        /** The default cache key is the request url with sorted query parameters followed by the headers set by setCacheKeyHeader.
+         \param pFunction Creates the cache key of a request instead, the key is hashed before use. A request with an empty key isn't cached.
+         */
+        void setCacheKeyFunction(std::function<std::string(const NetworkRequest& lpParam)> pFunction);
+        
         std::shared_ptr<NetworkWebSocketHandle> connectWebSocket(NetworkWebSocket pParam);
         
     private:
         friend class Hermes;
+        friend NetworkAPI;
+        friend NetworkRecovery;
         friend NetworkWebSocketHandle;
+        
+        enum class ETransfer : int32_t
+        {
+            Acquired = 0,
+            Queued,
+            Shed,
+            Bypassed
+        };
 
         class Certificate;
+        class MemoryCache;
+        class MetricsData;
+        class PackCache;
         
         class CacheFileData
         {
@@ -440,18 +776,136 @@ namespace hms
             public:
                 uint64_t mTimestamp = 0;
                 uint32_t mLifetime = 0;
-                uint16_t mFlagsAndSize = 0;
+                uint16_t mFlags = 0;
+                uint16_t mKeySize = 0;
             };
 
             Header mHeader;
             
             bool mStringType = false;
+            bool mValidator = false;
+            bool mCompressed = false;
+            bool mVary = false;
             bool mIsValid = false;
+            uint64_t mSize = 0;
             
             std::string mFullFilePath;
-            std::string mUrl;
+            std::string mKey;
+            
+            CacheFileData* mPrevious = nullptr;
+            CacheFileData* mNext = nullptr;
         };
 
+        class CoalescedRequest
+        {
+        public:
+            class Follower
+            {
+            public:
+                std::function<void(NetworkResponse)> mCallback;
+                std::function<std::unique_ptr<NetworkResponseDataTaskBackground>(const NetworkResponse&)> mTaskBackground;
+                std::shared_ptr<NetworkRequestHandle> mRequestHandle;
+            };
+            
+            std::vector<Follower> mFollower;
+            std::mutex mMutex;
+        };
+
+        class CachePolicy
+        {
+        public:
+            std::string mETag;
+            std::string mLastModified;
+            std::vector<std::string> mVary;
+            uint32_t mLifetime = 0;
+            bool mStore = true;
+        };
+        
+        class CacheValidator
+        {
+        public:
+            std::string mETag;
+            std::string mLastModified;
+            std::vector<std::string> mVary;
+            uint32_t mLifetime = 0;
+            bool mStale = false;
+            NetworkResponse mResponse;
+        };
+        
+        class RequestState
+        {
+        public:
+            NetworkRetryPolicy mRetryPolicy;
+            uint32_t mRetryCount = 0;
+            bool mRetry = false;
+            bool mTransfer = false;
+            std::chrono::steady_clock::time_point mStartTime;
+            std::chrono::steady_clock::time_point mRequestTime;
+            std::string mCacheKey;
+            CacheValidator mCacheValidator;
+            std::shared_ptr<CoalescedRequest> mCoalescedRequest;
+            std::string mCoalescingKey;
+        };
+        
+        class SchedulerTask
+        {
+        public:
+            NetworkRequest mParam;
+            std::shared_ptr<NetworkRequestHandle> mRequestHandle;
+            std::shared_ptr<RequestState> mState;
+            std::string mHost;
+            std::chrono::steady_clock::time_point mTime;
+        };
+        
+        class SchedulerFlow
+        {
+        public:
+            static constexpr size_t LatencyCount = 100;
+            static constexpr size_t LatencyMinimum = 20;
+            
+            std::deque<SchedulerTask> mTask;
+            uint32_t mLimit = 0;
+            uint32_t mWeight = 1;
+            uint32_t mActiveCount = 0;
+            double mFinishTag = 0.0;
+            std::shared_ptr<const NetworkLimiterPolicy> mLimiter;
+            double mLimiterLimit = 0.0;
+            double mLimiterRtt = 0.0;
+            uint64_t mQueuedCount = 0;
+            uint64_t mWaitTime = 0;
+            uint64_t mMaxWaitTime = 0;
+            uint64_t mShedCount = 0;
+            std::vector<uint32_t> mLatency;
+            size_t mLatencyIndex = 0;
+            double mHedgeBudget = 0.0;
+            uint64_t mHedgeCount = 0;
+            uint64_t mHedgeWinCount = 0;
+            bool mHedge = false;
+        };
+        
+        class HedgeData
+        {
+        public:
+            std::function<void(NetworkResponse)> mCallback;
+            std::function<std::unique_ptr<NetworkResponseDataTaskBackground>(const NetworkResponse&)> mTaskBackground;
+            std::shared_ptr<NetworkRequestHandle> mRequestHandle;
+            std::shared_ptr<NetworkRequestHandle> mHedgeHandle;
+            std::atomic<uint32_t> mWinner = {0};
+        };
+        
+        class CacheWriteData
+        {
+        public:
+            std::string mKey;
+            std::shared_ptr<const std::string> mContent;
+            bool mStringType = false;
+            uint64_t mTimestamp = 0;
+            uint64_t mVaryHash = 0;
+            CachePolicy mPolicy;
+            // Filled by the cache writer, the content is stored as it is while it's empty.
+            std::string mCompressedContent;
+        };
+        
         class MultiRequestData
         {
         public:
@@ -462,14 +916,20 @@ namespace hms
             void* mHandle = nullptr;
             std::vector<char> mErrorBuffer;
             NetworkRequest* mParam = nullptr;
+            std::string mCacheKey;
+            CacheValidator mCacheValidator;
         };
         
         class RequestSettings
         {
         public:
-            std::array<bool, static_cast<size_t>(ENetworkFlag::Count)> mFlag = {false, false, false};
+            std::array<bool, static_cast<size_t>(ENetworkFlag::Count)> mFlag = {false, false, false, false};
             int64_t mTimeout = 0;
             int64_t mProgressTimePeriod = 0;
+            std::shared_ptr<const std::vector<std::string>> mCoalescingHeader;
+            std::shared_ptr<const std::vector<std::string>> mCacheKeyHeader;
+            std::shared_ptr<const std::function<std::string(const NetworkRequest&)>> mCacheKeyFunction;
+            NetworkKeepAlive mKeepAlive;
         };
     
         NetworkManager();
@@ -483,15 +943,60 @@ namespace hms
         static void deleterNetworkAPI(NetworkAPI* pObject);
         static void deleterNetworkRecovery(NetworkRecovery* pObject);
         
-        std::vector<std::pair<std::string, std::string>> createUniqueHeader(const std::vector<std::pair<std::string, std::string>>& pHeader) const;
+        static size_t writeStream(char* pData, size_t pCount, size_t pSize, ProgressData* pUserData);
+        static bool finishWriter(ProgressData& pProgressData, ENetworkCode& pCode);
+        static std::shared_ptr<DataReader> compressRequestBody(NetworkRequest& pParam);
+        static void readTransferSize(void* pHandle, const ProgressData& pProgressData, size_t pDecodedSize, NetworkResponse& pResponse);
+        static void readTransferTime(void* pHandle, std::chrono::steady_clock::time_point pRequestTime, std::chrono::steady_clock::time_point pStartTime, NetworkResponse& pResponse);
+        static NetworkResponse copyResponse(const NetworkResponse& pResponse);
+        
+        std::string createCoalescingKey(const NetworkRequest& pParam, const NetworkAPI::HeaderBlock* pHeaderBlock, const std::vector<std::string>& pHeader) const;
+        
+        void scheduleRequest(NetworkRequest pParam, std::shared_ptr<NetworkRequestHandle> pRequestHandle, size_t pApiId, std::shared_ptr<RequestState> pState, uint32_t pDelay);
+        ETransfer acquireTransfer(size_t pApiId, const std::string& pHost, const std::function<SchedulerTask()>& pTask);
+        void releaseTransfer(size_t pApiId, const std::string& pHost, int64_t pTime, bool pDrop);
+        void updateLimiter(SchedulerFlow& pFlow, int64_t pTime, bool pDrop) const;
+        void shedRequest(NetworkRequest pParam, CacheValidator& pCacheValidator, std::shared_ptr<CoalescedRequest> pCoalescedRequest, const std::string& pCoalescingKey, ENetworkCode pCode = ENetworkCode::Overload);
+        void updateSchedulerState();
+        static uint32_t getTransferLimit(const SchedulerFlow& pFlow);
+        void hedgeRequest(NetworkRequest pParam, std::shared_ptr<NetworkRequestHandle> pRequestHandle, size_t pApiId);
+        void dispatchTransfer();
+        bool createRetryDelay(RequestState& pState, ENetworkRequest pRequestType, ENetworkCode pCode, int32_t pHttpCode, const std::vector<std::pair<std::string, std::string>>& pHeader, uint32_t& pDelay);
+        void depositRetryBudget();
+        std::shared_ptr<MetricsData> getMetricsData(size_t pApiId);
+        
+        std::vector<std::pair<std::string, std::string>> createUniqueHeader(const std::vector<std::pair<std::string, std::string>>& pHeader, const NetworkAPI::HeaderBlock* pHeaderBlock) const;
+        std::shared_ptr<const NetworkAPI::HeaderBlock> getHeaderBlock(size_t pApiId) const;
+        static curl_slist* createHeaderList(const std::vector<std::pair<std::string, std::string>>& pHeader, const NetworkAPI::HeaderBlock* pHeaderBlock, curl_slist*& pLink);
+        static void freeHeaderList(curl_slist* pList, curl_slist* pLink, const NetworkAPI::HeaderBlock* pHeaderBlock);
 
-        void configureHandle(void* pHandle, ENetworkRequest pRequestType, ENetworkResponse pResponseType, const std::string& pRequestUrl, const std::string& pRequestBody, std::string* pResponseMessage, std::vector<uint8_t>* pResponseRawData, std::vector<std::pair<std::string, std::string>>* pResponseHeader, curl_slist* pHeader, int64_t pTimeout, std::array<bool, static_cast<size_t>(ENetworkFlag::Count)> pFlag, ProgressData* pProgressData, char* pErrorBuffer) const;
+        void configureHandle(void* pHandle, ENetworkRequest pRequestType, ENetworkResponse pResponseType, const std::string& pRequestUrl, const std::string& pRequestBody, std::string* pResponseMessage, std::vector<uint8_t>* pResponseRawData, std::vector<std::pair<std::string, std::string>>* pResponseHeader, curl_slist* pHeader, bool pDecompress, const RequestSettings& pRequestSettings, ProgressData* pProgressData, char* pErrorBuffer) const;
         
+        void* getHandle();
         void resetHandle(void* pHandle) const;
         
         CacheFileData decodeCacheHeader(const std::string& pFilePath) const;
-        NetworkResponse getResponseFromCache(const std::string& pUrl);
-        bool cacheResponse(const NetworkResponse& pResponse, const std::string& pUrl, u_int32_t pLifetime);
+        void linkCacheFile(CacheFileData& pData);
+        void unlinkCacheFile(CacheFileData& pData);
+        void trimCache(std::vector<std::string>& pRemovedFilePath);
+        void removeCacheFile(std::vector<std::string> pFilePath) const;
+        bool loadCacheManifest(const std::string& pDirectoryPath, uint64_t pTimestamp, std::vector<CacheFileData>& pInfo, std::vector<std::string>& pRemovedFilePath) const;
+        void writeCacheManifest();
+        void journalCacheFile(const CacheFileData& pData);
+        void journalCacheFile(const std::vector<std::string>& pRemovedFilePath);
+        void appendCacheManifest(const std::string& pRecord, size_t pRecordCount);
+        void flushCacheManifest();
+        std::string createCacheKey(const NetworkRequest& pParam, const NetworkAPI::HeaderBlock* pHeaderBlock, const RequestSettings& pSettings) const;
+        NetworkResponse getResponseFromCache(const std::string& pKey, const NetworkRequest& pParam, const NetworkAPI::HeaderBlock* pHeaderBlock, CacheValidator* pValidator, bool pStale);
+        bool cacheResponse(const NetworkResponse& pResponse, const std::string& pKey, const NetworkRequest& pParam, const NetworkAPI::HeaderBlock* pHeaderBlock, const CachePolicy& pPolicy);
+        void applyCacheValidator(const CacheValidator& pValidator, NetworkRequest& pParam);
+        bool finishCacheValidation(CacheValidator& pValidator, NetworkResponse& pResponse, CachePolicy& pPolicy);
+        bool serveStaleResponse(CacheValidator& pValidator, NetworkResponse& pResponse);
+        void revalidateCache(const NetworkRequest& pParam, const NetworkAPI::HeaderBlock* pHeaderBlock, const std::string& pKey);
+        void writeCache();
+        void writeCacheFile(const std::vector<std::shared_ptr<CacheWriteData>>& pData, bool pSync);
+        
+        static CachePolicy createCachePolicy(const std::vector<std::pair<std::string, std::string>>& pHeader, uint32_t pLifetime, bool pUseHeader);
 
         std::weak_ptr<NetworkManager> mWeakThis;
         
@@ -499,13 +1004,19 @@ namespace hms
         mutable std::mutex mApiMutex;
         std::vector<std::shared_ptr<NetworkRecovery>> mRecovery;
         mutable std::mutex mRecoveryMutex;
-        std::vector<CacheFileData> mCacheFileInfo;
-        std::unordered_map<std::string, size_t> mCacheFileIndex;
+        std::unordered_map<std::string, CacheFileData> mCacheFileIndex;
+        CacheFileData* mCacheFileFirst = nullptr;
+        CacheFileData* mCacheFileLast = nullptr;
 
         std::unordered_map<std::thread::id, void*> mHandle;
         std::mutex mHandleMutex;
         std::unordered_map<std::thread::id, void*> mMultiHandle;
         std::mutex mMultiHandleMutex;
+        void* mShareHandle = nullptr;
+        std::unique_ptr<std::mutex[]> mShareMutex;
+        std::atomic<uint32_t> mPreconnectCount {0};
+        std::unordered_map<std::string, std::shared_ptr<CoalescedRequest>> mCoalescedRequest;
+        std::mutex mCoalescedRequestMutex;
 
         int32_t mThreadPoolId = -1;
         int32_t mWebSocketThreadPoolId = -1;
@@ -514,12 +1025,56 @@ namespace hms
         std::atomic<uint32_t> mInitialized {0};
         std::atomic<uint32_t> mCacheInitialized {0};
         std::atomic<uint32_t> mTerminateAbort {0};
+        std::atomic<uint64_t> mCoalescingCount {0};
+        std::atomic<uint64_t> mRetryCount {0};
+        
+        float mRetryBudgetRatio = 0.2f;
+        uint32_t mRetryBudgetMinimum = 10;
+        double mRetryBudget = 0.0;
+        std::chrono::steady_clock::time_point mRetryBudgetTime;
+        std::mt19937 mRetryRandomGenerator;
+        mutable std::mutex mRetryMutex;
+        
+        std::unordered_map<size_t, SchedulerFlow> mSchedulerFlow;
+        std::unordered_map<std::string, uint32_t> mSchedulerHost;
+        uint32_t mHostConcurrencyLimit = 0;
+        double mSchedulerVirtualTime = 0.0;
+        std::atomic<uint32_t> mSchedulerActive {0};
+        mutable std::mutex mSchedulerMutex;
+        
+        std::unordered_map<size_t, std::shared_ptr<MetricsData>> mMetrics;
+        mutable std::mutex mMetricsMutex;
         
         unsigned mCacheFileCountLimit = 0;
         unsigned mCacheFileSizeLimit = 0;
+        uint64_t mCacheSize = 0;
+        uint64_t mCacheSizeLimit = 0;
         std::mutex mCacheMutex;
         std::string mCacheDirectoryPath;
-        const char mCacheMagicWord[5] = { 'Y', 'G', 'G', '_', 'H'};
+        std::unique_ptr<MemoryCache> mMemoryCache;
+        std::atomic<uint64_t> mCacheHitCount {0};
+        std::atomic<uint64_t> mCacheMissCount {0};
+        std::atomic<uint64_t> mCacheConditionalCount {0};
+        std::atomic<uint64_t> mCacheNotModifiedCount {0};
+        std::atomic<uint64_t> mCacheNotModifiedSize {0};
+        std::atomic<uint64_t> mCacheStaleCount {0};
+        std::atomic<uint32_t> mCacheStaleLifetime {0};
+        std::unordered_set<std::string> mCacheRevalidation;
+        std::mutex mCacheRevalidationMutex;
+        std::unordered_map<std::string, std::shared_ptr<CacheWriteData>> mCacheWrite;
+        std::mutex mCacheWriteMutex;
+        std::mutex mCacheWriterMutex;
+        bool mCacheWriteScheduled = false;
+        std::atomic<uint32_t> mCacheSync {0};
+        std::atomic<uint32_t> mCacheCompressionThreshold {0};
+        std::shared_ptr<PackCache> mPackCache;
+        const char mCacheMagicWord[5] = { 'Y', 'G', 'G', '_', 'F'};
+        const char mCacheManifestMagicWord[5] = { 'Y', 'G', 'G', '_', 'J'};
+        int32_t mCacheManifest = -1;
+        std::mutex mCacheManifestMutex;
+        size_t mCacheManifestRecordCount = 0;
+        std::string mCacheManifestSnapshot;
+        std::string mCacheManifestJournal;
         
         std::mt19937 mRandomGenerator;
 
@@ -85,6 +85,19 @@ namespace hms
             assert(threadPool != mThreadPool.cend());
             threadPool->second->push(std::make_pair(createCondition(pDelayMs), std::bind(std::forward<M>(pMethod), std::forward<P>(pParameter)...)));
         }
+        
+        template<typename M, typename... P>
+        void executeDelayed(int32_t pThreadPoolId, int32_t pDelayMs, M&& pMethod, P&&... pParameter)
+        {
+            assert(pThreadPoolId >= 0 && pDelayMs > 0);
+            
+            if (!mInitialized)
+                return;
+
+            auto threadPool = mThreadPool.find(pThreadPoolId);
+            assert(threadPool != mThreadPool.cend());
+            threadPool->second->push(std::make_pair(createCondition(pDelayMs, false), std::bind(std::forward<M>(pMethod), std::forward<P>(pParameter)...)));
+        }
 
     private:
         friend class Hermes;
@@ -131,7 +144,7 @@ namespace hms
 
             void flush(std::function<void()> pCallback);
             
-            void push(std::pair<std::function<int32_t()>, std::function<void()>> pTask);
+            void push(std::pair<std::function<int32_t(bool)>, std::function<void()>> pTask);
             void pushContinuous(std::pair<std::function<bool()>, std::function<void()>> pTask);
             
             void update(size_t pIndex);
@@ -141,7 +154,7 @@ namespace hms
             std::vector<std::pair<std::thread, AtomicWrapper<uint32_t>>> mThreads;
             std::condition_variable mCondition;
             mutable std::mutex mMutex;
-            std::queue<std::pair<std::function<int32_t()>, std::function<void()>>> mTask;
+            std::queue<std::pair<std::function<int32_t(bool)>, std::function<void()>>> mTask;
             std::queue<std::pair<std::function<bool()>, std::function<void()>>> mTaskContinuous;
             std::atomic<uint32_t> mTerminate {0};
             std::function<void()> mFlushCallback;
@@ -160,7 +173,7 @@ namespace hms
 
         void enqueueMainThreadTask(std::function<void()> pTask);
         void dequeueMainThreadTask();
-        std::function<int32_t()> createCondition(int32_t pDelayMs) const;
+        std::function<int32_t(bool)> createCondition(int32_t pDelayMs, bool pMainThread = true) const;
 
 #if defined(ANDROID) || defined(__ANDROID__)
         static int32_t messageHandlerAndroid(int32_t pFd, int32_t pEvent, void* pData);
@@ -6,7 +6,9 @@
 #define _HMS_TOOLS_HPP_
 
 #include <cstdint>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace hms
@@ -24,6 +26,39 @@ namespace tools
         return byte[0];
     };
     
+    // Parts of an URL as defined by RFC 3986, found in a single pass without copying the URL. The views point into the parsed string, so it has to outlive them.
+    // The authority of an URL without a scheme starts at its beginning, the host keeps the brackets of an IPv6 literal and the query and fragment exclude '?' and '#'.
+    class URLView
+    {
+    public:
+        explicit URLView(std::string_view pURL);
+        
+        bool isValid() const;
+        std::string_view getScheme() const;
+        std::string_view getUserInfo() const;
+        std::string_view getHost() const;
+        std::string_view getPort() const;
+        std::string_view getPath() const;
+        std::string_view getQuery() const;
+        std::string_view getFragment() const;
+        // 0 without a port and when it isn't a number up to 65535.
+        uint16_t getPortNumber() const;
+        
+        // Percent-decoding is done only on demand, invalid escape sequences are left as they are.
+        static std::string decode(std::string_view pData);
+        
+    private:
+        std::string_view mScheme;
+        std::string_view mUserInfo;
+        std::string_view mHost;
+        std::string_view mPort;
+        std::string_view mPath;
+        std::string_view mQuery;
+        std::string_view mFragment;
+        uint16_t mPortNumber = 0;
+        bool mValid = false;
+    };
+    
     class URLTool
     {
     public:
@@ -80,6 +115,30 @@ namespace crypto
     std::vector<uint8_t> encrypt(const std::vector<uint8_t>& pBuffer, const std::string& pKey, const std::string& pIV, ECryptoMode pMode);
     std::string decrypt(const std::string& pData, const std::string& pKey, const std::string& pIV, ECryptoMode pMode);
     std::vector<uint8_t> decrypt(const std::vector<uint8_t>& pBuffer, const std::string& pKey, const std::string& pIV, ECryptoMode pMode);
+    
+    class Encryptor
+    {
+    public:
+        Encryptor(const std::string& pKey, const std::string& pIV, ECryptoMode pMode);
+        Encryptor(const Encryptor& pOther) = delete;
+        Encryptor(Encryptor&& pOther) = delete;
+        ~Encryptor();
+        
+        Encryptor& operator=(const Encryptor& pOther) = delete;
+        Encryptor& operator=(Encryptor&& pOther) = delete;
+        
+        // Encrypts all complete blocks, the rest is kept until the next call.
+        void update(const uint8_t* pData, size_t pSize, std::vector<uint8_t>& pOutput);
+        // Pads the remaining data with end of text characters, the same way as DataManager::writeFile does.
+        void finalize(std::vector<uint8_t>& pOutput);
+        
+        bool isValid() const;
+        
+    private:
+        class Context;
+        
+        std::unique_ptr<Context> mContext;
+    };
 }
 }
 
@@ -8,9 +8,13 @@
 
 #if defined(__APPLE__) || defined(__linux__)
 #include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #endif
 
+#include <cerrno>
+
 namespace hms
 {
 
@@ -182,6 +186,209 @@ namespace hms
         return mStream.is_open();
     }
     
+    /* DescriptorWriter */
+    
+#if defined(__APPLE__) || defined(__linux__)
+    DescriptorWriter::DescriptorWriter(int32_t pDescriptor, bool pCloseOnDestroy) : mDescriptor(pDescriptor), mCloseOnDestroy(pCloseOnDestroy)
+    {
+        if (mDescriptor >= 0)
+        {
+            const off_t position = lseek(mDescriptor, 0, SEEK_CUR);
+            mPosition = position > 0 ? static_cast<size_t>(position) : 0;
+        }
+    }
+    
+    DescriptorWriter::DescriptorWriter(const std::string& pFilePath, bool pAppend, bool pAtomic) : mFilePath(pFilePath), mCloseOnDestroy(true)
+    {
+        assert(!(pAppend && pAtomic));
+        
+        if (pAtomic)
+        {
+            mTemporaryFilePath = pFilePath + ".XXXXXX";
+            mDescriptor = mkstemp(&mTemporaryFilePath[0]);
+            
+            if (mDescriptor < 0)
+                mTemporaryFilePath.clear();
+        }
+        else
+        {
+            mDescriptor = open(pFilePath.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (pAppend ? O_APPEND : O_TRUNC), 0644);
+            
+            if (mDescriptor >= 0 && pAppend)
+            {
+                const off_t position = lseek(mDescriptor, 0, SEEK_END);
+                mPosition = position > 0 ? static_cast<size_t>(position) : 0;
+            }
+        }
+    }
+    
+    DescriptorWriter::~DescriptorWriter()
+    {
+        if (mDescriptor >= 0 && (mCloseOnDestroy || !mTemporaryFilePath.empty()))
+            close(mDescriptor);
+        
+        // Not committed, so the target file is left untouched.
+        if (!mTemporaryFilePath.empty())
+            unlink(mTemporaryFilePath.c_str());
+    }
+    
+    size_t DescriptorWriter::write(const void* pBuffer, size_t pSize)
+    {
+        size_t writeCount = 0;
+        
+        while (mDescriptor >= 0 && writeCount < pSize)
+        {
+            const ssize_t result = ::write(mDescriptor, reinterpret_cast<const char*>(pBuffer) + writeCount, pSize - writeCount);
+            
+            if (result > 0)
+                writeCount += static_cast<size_t>(result);
+            else if (result < 0 && errno != EINTR)
+                break;
+        }
+        
+        mPosition += writeCount;
+        
+        return writeCount;
+    }
+    
+    size_t DescriptorWriter::write(const std::string& pText)
+    {
+        return write(pText.data(), pText.size());
+    }
+    
+    size_t DescriptorWriter::write(const std::vector<uint8_t>& pBuffer)
+    {
+        return write(pBuffer.data(), pBuffer.size());
+    }
+    
+    bool DescriptorWriter::seek(int64_t pPosition, bool pRelative)
+    {
+        bool success = false;
+        
+        if (mDescriptor >= 0)
+        {
+            const off_t position = lseek(mDescriptor, static_cast<off_t>(pPosition), pRelative ? SEEK_CUR : SEEK_SET);
+            if (position >= 0)
+            {
+                mPosition = static_cast<size_t>(position);
+                success = true;
+            }
+        }
+        
+        return success;
+    }
+    
+    bool DescriptorWriter::flush()
+    {
+        return mDescriptor >= 0 && fsync(mDescriptor) == 0;
+    }
+    
+    bool DescriptorWriter::commit()
+    {
+        bool success = flush();
+        
+        if (!mTemporaryFilePath.empty())
+        {
+            success &= close(mDescriptor) == 0;
+            mDescriptor = -1;
+            
+            if (success)
+                success = fchmodat(AT_FDCWD, mTemporaryFilePath.c_str(), 0644, 0) == 0 && rename(mTemporaryFilePath.c_str(), mFilePath.c_str()) == 0;
+            
+            if (success)
+                mTemporaryFilePath.clear();
+        }
+        
+        return success;
+    }
+    
+    size_t DescriptorWriter::getPosition() const
+    {
+        return mPosition;
+    }
+    
+    bool DescriptorWriter::isOpen() const
+    {
+        return mDescriptor >= 0;
+    }
+#endif
+    
+    /* CipherWriter */
+    
+    CipherWriter::CipherWriter(std::unique_ptr<DataWriter> pWriter, const std::string& pKey, const std::string& pIV, crypto::ECryptoMode pCryptoMode) : mWriter(std::move(pWriter)), mEncryptor(std::make_unique<crypto::Encryptor>(pKey, pIV, pCryptoMode))
+    {
+        assert(mWriter != nullptr);
+    }
+    
+    CipherWriter::~CipherWriter()
+    {
+    }
+    
+    size_t CipherWriter::write(const void* pBuffer, size_t pSize)
+    {
+        size_t writeCount = 0;
+        
+        if (isOpen())
+        {
+            mBuffer.clear();
+            mEncryptor->update(reinterpret_cast<const uint8_t*>(pBuffer), pSize, mBuffer);
+            
+            if (mWriter->write(mBuffer.data(), mBuffer.size()) == mBuffer.size())
+            {
+                writeCount = pSize;
+                mPosition += writeCount;
+            }
+        }
+        
+        return writeCount;
+    }
+    
+    size_t CipherWriter::write(const std::string& pText)
+    {
+        return write(pText.data(), pText.size());
+    }
+    
+    size_t CipherWriter::write(const std::vector<uint8_t>& pBuffer)
+    {
+        return write(pBuffer.data(), pBuffer.size());
+    }
+    
+    bool CipherWriter::seek(int64_t, bool)
+    {
+        // Random access would break the cipher chain.
+        return false;
+    }
+    
+    bool CipherWriter::flush()
+    {
+        return mWriter->flush();
+    }
+    
+    bool CipherWriter::commit()
+    {
+        bool success = false;
+        
+        if (isOpen())
+        {
+            mBuffer.clear();
+            mEncryptor->finalize(mBuffer);
+            
+            success = mWriter->write(mBuffer.data(), mBuffer.size()) == mBuffer.size() && mWriter->commit();
+        }
+        
+        return success;
+    }
+    
+    size_t CipherWriter::getPosition() const
+    {
+        return mPosition;
+    }
+    
+    bool CipherWriter::isOpen() const
+    {
+        return mWriter->isOpen() && mEncryptor->isValid();
+    }
+    
     /* MemoryWriter */
     
     MemoryWriter::MemoryWriter(void* pMemory, size_t pSize, bool pDeleteOnClose) : mBuffer(pMemory), mDeleteBufferOnClose(pDeleteOnClose), mSize(pSize)
@@ -934,9 +1141,41 @@ namespace hms
         return reader;
     }
     
-    std::unique_ptr<DataWriter> DataManager::getDataWriter(const std::string& pFileName, bool pAppend) const
+    std::unique_ptr<DataWriter> DataManager::getDataWriter(const std::string& pFileName, bool pAppend, crypto::ECryptoMode pCryptoMode, bool pAtomic) const
     {
-        return std::unique_ptr<DataWriter>(new FileWriter(mWorkingDirectory + pFileName, pAppend));
+        std::unique_ptr<DataWriter> writer = nullptr;
+        const bool encrypt = mCipher != nullptr && pCryptoMode != crypto::ECryptoMode::None;
+        
+        // Cipher chain can't be continued from an existing file.
+        assert(!(encrypt && pAppend));
+        
+        if (pAtomic)
+        {
+#if defined(__APPLE__) || defined(__linux__)
+            writer = std::unique_ptr<DataWriter>(new DescriptorWriter(mWorkingDirectory + pFileName, pAppend, pAtomic));
+#else
+            // The atomic replace needs POSIX descriptors, elsewhere the file is written in place.
+            writer = std::unique_ptr<DataWriter>(new FileWriter(mWorkingDirectory + pFileName, pAppend));
+#endif
+        }
+        else
+        {
+            writer = std::unique_ptr<DataWriter>(new FileWriter(mWorkingDirectory + pFileName, pAppend));
+        }
+        
+        if (encrypt)
+        {
+            std::string key, iv;
+            mCipher(key, iv);
+            
+            writer = std::unique_ptr<DataWriter>(new CipherWriter(std::move(writer), key, iv, pCryptoMode));
+            
+            // TODO find reliable way to clear strings without compiler optimizing it away
+            key.clear();
+            iv.clear();
+        }
+        
+        return writer;
     }
     
     void DataManager::addStorageLoader(std::unique_ptr<DataStorageLoader> pLoader)
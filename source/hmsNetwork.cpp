@@ -6,8 +6,11 @@
 
 #include "hermes.hpp"
 #include "curl/curl.h"
+#include "zlib.h"
 
 #include <cassert>
+#include <cmath>
+#include <cstring>
 #include <sstream>
 #include <utility>
 #include <algorithm>
@@ -15,12 +18,18 @@
 #include <chrono>
 #include <tuple>
 #include <iomanip>
+#include <iterator>
 #include <fstream>
 #include <chrono>
 #include <ctime>
 #include <limits>
+#include <list>
+#include <map>
 #include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 namespace hms
 {
@@ -31,57 +40,43 @@ namespace hms
     {
         if (pData != nullptr)
         {
-            auto separate = [](const std::string& lpSource, std::pair<std::string, std::string>& lpDestination) -> void
+            auto checkSign = [](char c) -> bool
             {
-                auto checkSign = [](char c) -> bool
-                {
-                    bool status = false;
-                    
-                    switch (c)
-                    {
-                        case '\n':
-                        case '\r':
-                        case '\t':
-                        case ' ':
-                            status = true;
-                            break;
-                        default:
-                            break;
-                    }
-                    
-                    return status;
-                };
+                return c == '\n' || c == '\r' || c == '\t' || c == ' ';
+            };
+            
+            // The line is split in place, the name ends at the first colon and the value may contain colons itself (dates, urls).
+            // Only the ends of both are trimmed, so the value keeps its inner whitespace.
+            const size_t size = pCount * pSize;
+            const char* end = pData + size;
+            const char* separator = static_cast<const char*>(std::memchr(pData, ':', size));
+            
+            if (separator != nullptr)
+            {
+                const char* nameBegin = pData;
+                const char* nameEnd = separator;
+                const char* valueBegin = separator + 1;
+                const char* valueEnd = end;
                 
-                std::pair<std::string, std::string> destination = {"", ""};
-                std::istringstream ss(lpSource);
-                std::string component = "";
-
-                while (std::getline(ss, component, ':'))
-                {
-                    if (!component.empty())
-                    {
-                        std::string* element = (destination.first.size() > 0) ? &destination.second : &destination.first;
-                        *element = component;
-                    }
-                }
+                while (nameBegin < nameEnd && checkSign(*nameBegin))
+                    ++nameBegin;
+                while (nameEnd > nameBegin && checkSign(*(nameEnd - 1)))
+                    --nameEnd;
+                while (valueBegin < valueEnd && checkSign(*valueBegin))
+                    ++valueBegin;
+                while (valueEnd > valueBegin && checkSign(*(valueEnd - 1)))
+                    --valueEnd;
                 
-                if (destination.first.size() > 0 && destination.second.size())
+                if (nameBegin < nameEnd && valueBegin < valueEnd)
                 {
-                    destination.first.erase(std::remove_if(destination.first.begin(), destination.first.end(), checkSign), destination.first.end());
-                    destination.second.erase(std::remove_if(destination.second.begin(), destination.second.end(), checkSign), destination.second.end());
+                    if (pUserData->capacity() == 0)
+                        pUserData->reserve(16);
                     
-                    lpDestination = destination;
+                    pUserData->emplace_back(std::piecewise_construct, std::forward_as_tuple(nameBegin, nameEnd), std::forward_as_tuple(valueBegin, valueEnd));
                 }
-            };
-            
-            std::string data(pData, pCount * pSize);            
-            std::pair<std::string, std::string> element("", "");            
-            separate(data, element);
-
-            if (element.first.size() > 0 && element.second.size() > 0)
-                pUserData->push_back(element);
+            }
             
-            return static_cast<int>(pCount * pSize);
+            return static_cast<int>(size);
         }
         
         return 0;
@@ -110,13 +105,81 @@ namespace hms
         return 0;
     }
     
+    static size_t CURL_WRITER_DATAWRITER_CALLBACK(char* pData, size_t pCount, size_t pSize, NetworkManager::ProgressData* pUserData)
+    {
+        if (pData != nullptr)
+        {
+            const size_t dataSize = pCount * pSize;
+            long httpCode = 0;
+            curl_easy_getinfo(pUserData->mHandle, CURLINFO_RESPONSE_CODE, &httpCode);
+            
+            // Only a successful body ends up in the writer, an error body is received as a regular message.
+            if (httpCode >= 200 && httpCode <= 299)
+            {
+                const size_t writeCount = pUserData->mWriter->write(pData, dataSize);
+                pUserData->mWriteSize += writeCount;
+                return writeCount;
+            }
+            
+            pUserData->mResponseMessage->append(pData, dataSize);
+            return dataSize;
+        }
+        
+        return 0;
+    }
+    
+    static size_t CURL_READER_CALLBACK(char* pData, size_t pCount, size_t pSize, NetworkManager::ProgressData* pUserData)
+    {
+        if (pData != nullptr && pUserData != nullptr && pUserData->mReader != nullptr)
+        {
+            const size_t readCount = pUserData->mReader->read(pData, pCount * pSize);
+            if (readCount > 0 || pUserData->mReader->isOpen())
+                return readCount;
+        }
+        
+        return CURL_READFUNC_ABORT;
+    }
+    
+    static int CURL_SEEK_CALLBACK(NetworkManager::ProgressData* pUserData, curl_off_t pOffset, int pOrigin)
+    {
+        if (pUserData == nullptr || pUserData->mReader == nullptr)
+            return CURL_SEEKFUNC_CANTSEEK;
+        
+        bool status = false;
+        
+        switch (pOrigin)
+        {
+        case SEEK_SET:
+            status = pUserData->mReader->seek(static_cast<int64_t>(pOffset));
+            break;
+        case SEEK_CUR:
+            status = pUserData->mReader->seek(static_cast<int64_t>(pOffset), true);
+            break;
+        case SEEK_END:
+            status = pUserData->mReader->seek(static_cast<int64_t>(pUserData->mReader->getSize()) + static_cast<int64_t>(pOffset));
+            break;
+        default:
+            break;
+        }
+        
+        return status ? CURL_SEEKFUNC_OK : CURL_SEEKFUNC_FAIL;
+    }
+    
     static int CURL_PROGRESS_CALLBACK(NetworkManager::ProgressData* pUserData, curl_off_t pDownloadTotal, curl_off_t pDownloadNow, curl_off_t pUploadTotal, curl_off_t pUploadNow)
     {
         int result = 0;
     
         if (pUserData != nullptr)
         {
-            result = static_cast<int>(pUserData->mTerminateAbort->load()) + static_cast<int>(pUserData->mRequestHandle->isCancel());
+            result = static_cast<int>(pUserData->mTerminateAbort->load()) + static_cast<int>(pUserData->mCancelCondition != nullptr ? pUserData->mCancelCondition() : pUserData->mRequestHandle->isCancel());
+
+            // curl_easy_pause must be called from the thread running the transfer, so the pause state requested through the handle is applied here.
+            const bool pause = pUserData->mRequestHandle->isPause();
+            if (result == 0 && pUserData->mHandle != nullptr && pause != pUserData->mPaused)
+            {
+                pUserData->mPaused = pause;
+                curl_easy_pause(pUserData->mHandle, pause ? CURLPAUSE_RECV : CURLPAUSE_CONT);
+            }
 
             if (pUserData->mProgressTask != nullptr)
                 pUserData->mProgressTask(static_cast<int64_t>(pDownloadNow), static_cast<int64_t>(pDownloadTotal), static_cast<int64_t>(pUploadNow), static_cast<int64_t>(pUploadTotal));
@@ -125,6 +188,16 @@ namespace hms
         return result;
     }
     
+    static void CURL_SHARE_LOCK_CALLBACK(CURL*, curl_lock_data pData, curl_lock_access, std::mutex* pUserData)
+    {
+        pUserData[static_cast<size_t>(pData)].lock();
+    }
+    
+    static void CURL_SHARE_UNLOCK_CALLBACK(CURL*, curl_lock_data pData, std::mutex* pUserData)
+    {
+        pUserData[static_cast<size_t>(pData)].unlock();
+    }
+    
     static int CURL_WAIT_ON_SOCKET(curl_socket_t pSockfd, int pForRecv, long pTimeoutMS)
     {
         struct timeval tv;
@@ -149,2031 +222,6115 @@ namespace hms
         res = select(pSockfd + 1, &infd, &outfd, &errfd, &tv);
         return res;
     }
-
-    class NetworkManager::Certificate
+    
+    /* header */
+    
+    static uint64_t HEADER_NAME_HASH(const std::string& pName)
     {
-    public:
-        Certificate(ENetworkCertificate pType, std::string pData) : mType(pType), mData(std::move(pData)), mBlob({})
+        uint64_t hash = 14695981039346656037ULL;
+        for (char c : pName)
         {
-            if (mType == ENetworkCertificate::Content)
-            {
-                mBlob.data = mData.data();
-                mBlob.len = mData.size();
-                mBlob.flags = CURL_BLOB_NOCOPY;
-            }
+            hash ^= static_cast<uint64_t>(std::tolower(static_cast<unsigned char>(c)));
+            hash *= 1099511628211ULL;
         }
-
-        ENetworkCertificate mType = ENetworkCertificate::None; 
-        std::string mData;
-        curl_blob mBlob = {};
-    };
-
-    void NetworkRequestHandle::cancel()
+        
+        return hash;
+    }
+    
+    static bool HEADER_NAME_EQUAL(const std::string& pName1, const std::string& pName2)
     {
-        mCancel.store(1);
+        return pName1.size() == pName2.size() && std::equal(pName1.begin(), pName1.end(), pName2.begin(), [](char lpSign1, char lpSign2) -> bool
+        {
+            return std::tolower(static_cast<unsigned char>(lpSign1)) == std::tolower(static_cast<unsigned char>(lpSign2));
+        });
     }
     
-    bool NetworkRequestHandle::isCancel() const
+    // Names of different headers may share a hash, so the names found under the hash are compared as well.
+    static bool HEADER_INDEX_FIND(const std::unordered_multimap<uint64_t, size_t>& pIndex, uint64_t pHash, const std::string& pName, const std::vector<std::pair<std::string, std::string>>& pHeader)
     {
-        return static_cast<bool>(mCancel.load());
+        auto range = pIndex.equal_range(pHash);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (HEADER_NAME_EQUAL(pHeader[it->second].first, pName))
+                return true;
+        }
+        
+        return false;
     }
     
-    NetworkWebSocketHandle::ControlBlock::~ControlBlock()
+    // Appends a header with a lowercase name after the last node of the list, so building a list doesn't walk it again for each header.
+    static void HEADER_APPEND(curl_slist*& pList, curl_slist*& pTail, const std::string& pName, const std::string& pValue)
     {
-        if (mHandle != nullptr)
-            curl_easy_cleanup(mHandle);
+        std::string singleHeader;
+        singleHeader.reserve(pName.size() + pValue.size() + 2);
+        std::transform(pName.begin(), pName.end(), std::back_inserter(singleHeader), [](char c) -> char { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+        singleHeader += ": ";
+        singleHeader += pValue;
+        
+        curl_slist* node = curl_slist_append(pTail, singleHeader.c_str());
+        if (node == nullptr)
+            return;
+        
+        if (pList == nullptr)
+        {
+            pList = node;
+            pTail = node;
+        }
+        else
+        {
+            pTail = pTail->next;
+        }
     }
     
-    /* NetworkWebSocketHandle */
+    /* url */
     
-    NetworkWebSocketHandle::~NetworkWebSocketHandle()
+    static const std::array<bool, 256> URL_UNRESERVED = []() -> std::array<bool, 256>
     {
-        uint32_t terminated = 0;
-        mControlBlock->mTerminate.compare_exchange_strong(terminated, 1);
+        std::array<bool, 256> table = {};
+        
+        for (int c = '0'; c <= '9'; ++c)
+            table[static_cast<size_t>(c)] = true;
+        for (int c = 'A'; c <= 'Z'; ++c)
+            table[static_cast<size_t>(c)] = true;
+        for (int c = 'a'; c <= 'z'; ++c)
+            table[static_cast<size_t>(c)] = true;
+        for (char c : {'-', '.', '_', '~'})
+            table[static_cast<unsigned char>(c)] = true;
+        
+        return table;
+    }();
+    
+    static size_t URL_ENCODE_SIZE(const char* pData, size_t pSize)
+    {
+        size_t size = pSize;
+        for (size_t i = 0; i < pSize; ++i)
+            size += URL_UNRESERVED[static_cast<unsigned char>(pData[i])] ? 0 : 2;
+        
+        return size;
     }
     
-    void NetworkWebSocketHandle::sendMessage(const std::string& pMessage, std::function<void(ENetworkCode)> pCallback)
+    // Runs of unreserved characters are appended at once, only the characters between them are escaped one by one.
+    static void URL_ENCODE_APPEND(std::string& pOutput, const char* pData, size_t pSize)
     {
-        std::string message = packMessage(pMessage);
+        static const char hexData[] = "0123456789abcdef";
         
-        auto controlBlock = mControlBlock;
-        auto messageTask = [message = std::move(message), pCallback = std::move(pCallback), controlBlock]() mutable -> void
+        size_t begin = 0;
+        
+        for (size_t i = 0; i < pSize; ++i)
         {
-            if (controlBlock->mHandle != nullptr)
+            const unsigned char sign = static_cast<unsigned char>(pData[i]);
+            if (URL_UNRESERVED[sign])
+                continue;
+            
+            pOutput.append(pData + begin, i - begin);
+            
+            const char escape[3] = {'%', hexData[sign >> 4], hexData[sign & 15]};
+            pOutput.append(escape, 3);
+            
+            begin = i + 1;
+        }
+        
+        pOutput.append(pData + begin, pSize - begin);
+    }
+    
+    /* CompressionReader */
+    
+    // Compresses data of the source reader with gzip on the fly. Size of the compressed data isn't known in advance, so getSize returns 0 and only a rewind to the beginning is supported.
+    class CompressionReader : public DataReader
+    {
+    public:
+        explicit CompressionReader(std::shared_ptr<DataReader> pReader) : mReader(std::move(pReader)), mBuffer(16384)
+        {
+            memset(&mStream, 0, sizeof(mStream));
+            mOpen = mReader != nullptr && deflateInit2(&mStream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+            mInitialized = mOpen;
+        }
+        
+        virtual ~CompressionReader()
+        {
+            if (mInitialized)
+                deflateEnd(&mStream);
+        }
+        
+        virtual size_t read(void*) override
+        {
+            return 0;
+        }
+        
+        virtual size_t read(void* pBuffer, size_t pSize) override
+        {
+            if (!mOpen || mFinished || pSize == 0)
+                return 0;
+            
+            mStream.next_out = reinterpret_cast<Bytef*>(pBuffer);
+            mStream.avail_out = static_cast<uInt>(std::min(pSize, static_cast<size_t>(std::numeric_limits<uInt>::max())));
+            
+            const uInt outputSize = mStream.avail_out;
+            
+            while (mStream.avail_out > 0 && !mFinished)
             {
-                unsigned tryCount = 0;                
-                curl_socket_t socketfd;
-                CURLcode cCode = curl_easy_getinfo(controlBlock->mHandle, CURLINFO_ACTIVESOCKET, &socketfd);
-                
-                if (cCode != CURLE_OK)
+                if (mStream.avail_in == 0 && !mSourceEnd)
                 {
-                    if (pCallback != nullptr)
-                    {
-                        Hermes::getInstance()->getTaskManager()->execute(-1, [lpCallback = std::move(pCallback), cCode]() -> void
-                        {
-                            lpCallback(static_cast<ENetworkCode>(static_cast<int32_t>(ENetworkCode::Unknown) + static_cast<int32_t>(cCode)));
-                        });
-                    }
-
-                    return;
+                    const size_t readCount = mReader->read(mBuffer.data(), mBuffer.size());
+                    mStream.next_in = mBuffer.data();
+                    mStream.avail_in = static_cast<uInt>(readCount);
+                    mSourceEnd = readCount == 0;
                 }
                 
-                uint32_t terminateAbort = 0;
-                
-                do
+                const int error = deflate(&mStream, mSourceEnd ? Z_FINISH : Z_NO_FLUSH);
+                if (error == Z_STREAM_END)
                 {
-                    if (tryCount != 0)
-                        CURL_WAIT_ON_SOCKET(socketfd, 1, 1000);
-                    
-                    size_t sendCount = 0;
-                    cCode = curl_easy_send(controlBlock->mHandle, message.c_str(), message.size(), &sendCount);
-                    
-                    tryCount++;
+                    mFinished = true;
                 }
-                while ((terminateAbort = controlBlock->mTerminate.load()) == 0 && cCode == CURLE_AGAIN && tryCount < 3);
-                
-                if (terminateAbort == 0)
+                else if (error != Z_OK && error != Z_BUF_ERROR)
                 {
-                    if (pCallback != nullptr)
-                    {
-                        ENetworkCode code = cCode == CURLE_OK ? ENetworkCode::OK : static_cast<ENetworkCode>(static_cast<int32_t>(ENetworkCode::Unknown) + static_cast<int32_t>(cCode));
-                        Hermes::getInstance()->getTaskManager()->execute(-1, [lpCallback = std::move(pCallback), code]() -> void
-                        {
-                            lpCallback(code);
-                        });
-                    }
+                    mOpen = false;
+                    return 0;
                 }
             }
-        };
-
-        std::lock_guard<std::mutex> lock(mMessage.second);
-        mMessage.first.push(std::move(messageTask));
-    }
+            
+            const size_t readCount = outputSize - mStream.avail_out;
+            mPosition += readCount;
+            
+            return readCount;
+        }
+        
+        virtual void read(std::string& pText) override
+        {
+            while (mOpen && !mFinished)
+                read(pText, mBuffer.size());
+        }
+        
+        virtual void read(std::string& pText, size_t pSize) override
+        {
+            const size_t offset = pText.size();
+            pText.resize(offset + pSize);
+            pText.resize(offset + read(&pText[offset], pSize));
+        }
+        
+        virtual void read(std::vector<uint8_t>& pBuffer) override
+        {
+            while (mOpen && !mFinished)
+                read(pBuffer, mBuffer.size());
+        }
+        
+        virtual void read(std::vector<uint8_t>& pBuffer, size_t pSize) override
+        {
+            const size_t offset = pBuffer.size();
+            pBuffer.resize(offset + pSize);
+            pBuffer.resize(offset + read(&pBuffer[offset], pSize));
+        }
+        
+        virtual bool seek(int64_t pPosition, bool pRelative = false) override
+        {
+            if (pRelative ? static_cast<int64_t>(mPosition) + pPosition != 0 : pPosition != 0)
+                return false;
+            
+            if (!mInitialized || !mReader->seek(0) || deflateReset(&mStream) != Z_OK)
+                return false;
+            
+            mStream.avail_in = 0;
+            mPosition = 0;
+            mSourceEnd = false;
+            mFinished = false;
+            mOpen = true;
+            
+            return true;
+        }
+        
+        virtual size_t getPosition() const override
+        {
+            return mPosition;
+        }
+        
+        virtual size_t getSize() const override
+        {
+            return 0;
+        }
+        
+        virtual bool isOpen() const override
+        {
+            return mOpen;
+        }
+        
+    private:
+        std::shared_ptr<DataReader> mReader;
+        std::vector<Bytef> mBuffer;
+        z_stream mStream;
+        size_t mPosition = 0;
+        bool mInitialized = false;
+        bool mOpen = false;
+        bool mSourceEnd = false;
+        bool mFinished = false;
+    };
     
-    void NetworkWebSocketHandle::initialize(int32_t pThreadPoolId, NetworkWebSocket pParam, NetworkManager* pNetworkManager)
+    /* CacheInflater */
+    
+    // Inflates a raw deflate stream given in parts straight into a buffer of the size of the original content.
+    class CacheInflater
     {
-        assert(pNetworkManager != nullptr);
+    public:
+        CacheInflater(char* pOutput, size_t pSize)
+        {
+            memset(&mStream, 0, sizeof(mStream));
+            mInitialized = pSize <= std::numeric_limits<uInt>::max() && inflateInit2(&mStream, -MAX_WBITS) == Z_OK;
+            mStream.next_out = reinterpret_cast<Bytef*>(pOutput);
+            mStream.avail_out = static_cast<uInt>(pSize);
+        }
         
-        auto controlBlock = std::make_shared<ControlBlock>();
-        mControlBlock = controlBlock;
+        CacheInflater(const CacheInflater& pOther) = delete;
+        CacheInflater(CacheInflater&& pOther) = delete;
         
-        pNetworkManager->appendParameter(pParam.mUrl, pParam.mParameter);
-        tools::URLTool url(pParam.mUrl);
-        curl_socket_t socketfd = 0;
-
-        auto certificate = pNetworkManager->mCertificate;
-        NetworkManager::RequestSettings requestSettings;
+        ~CacheInflater()
         {
-            std::lock_guard<std::mutex> lock(pNetworkManager->mRequestSettingsMutex);
-            requestSettings = pNetworkManager->mRequestSettings;
+            if (mInitialized)
+                inflateEnd(&mStream);
         }
         
-        auto weakThis = mWeakThis;
-        Hermes::getInstance()->getTaskManager()->executeContinuous(pThreadPoolId, [controlBlock]() -> bool
-        {
-            return controlBlock->mTerminate.load() == 2;
-        }, [pParam = std::move(pParam), controlBlock, url, socketfd, certificate = std::move(certificate), requestSettings = std::move(requestSettings), weakThis]() mutable -> void
+        CacheInflater& operator=(const CacheInflater& pOther) = delete;
+        CacheInflater& operator=(CacheInflater&& pOther) = delete;
+        
+        bool push(const char* pData, size_t pSize)
         {
-            auto strongThis = weakThis.lock();
-            if (strongThis != nullptr)
+            while (mInitialized && !mError && !mFinished && pSize > 0)
             {
-                if (!controlBlock->mInitialized)
-                {
-                    controlBlock->mTime = {std::chrono::steady_clock::now(), std::chrono::steady_clock::now()};
+                const uInt size = static_cast<uInt>(std::min(pSize, static_cast<size_t>(std::numeric_limits<uInt>::max())));
+                mStream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(pData));
+                mStream.avail_in = size;
+                
+                const int error = inflate(&mStream, Z_NO_FLUSH);
+                const size_t readSize = size - mStream.avail_in;
+                
+                if (error == Z_STREAM_END)
+                    mFinished = true;
+                else if (error != Z_OK || readSize == 0)
+                    mError = true;
+                
+                pData += readSize;
+                pSize -= readSize;
+            }
+            
+            return mInitialized && !mError;
+        }
+        
+        // The stream has to end exactly when the buffer is filled.
+        bool isFinished() const
+        {
+            return mInitialized && !mError && mFinished && mStream.avail_out == 0;
+        }
+        
+    private:
+        z_stream mStream;
+        bool mInitialized = false;
+        bool mError = false;
+        bool mFinished = false;
+    };
 
-                    controlBlock->mHandle = curl_easy_init();
-                    if (controlBlock->mHandle != nullptr)
-                    {
-                        curl_easy_setopt(controlBlock->mHandle, CURLOPT_URL, url.getHttpURL().c_str());
-                        curl_easy_setopt(controlBlock->mHandle, CURLOPT_CONNECT_ONLY, 1L);
-                        curl_easy_setopt(controlBlock->mHandle, CURLOPT_SSL_VERIFYPEER, !requestSettings.mFlag[static_cast<size_t>(ENetworkFlag::DisableSSLVerifyPeer)] ? 1L : 0L);
-
-                        if (certificate->mType == ENetworkCertificate::Path)
-                            curl_easy_setopt(controlBlock->mHandle, CURLOPT_CAINFO, certificate->mData.c_str());
-                        else if (certificate->mType == ENetworkCertificate::Content)
-                            curl_easy_setopt(controlBlock->mHandle, CURLOPT_CAINFO_BLOB, &certificate->mBlob);
-                        
-                        CURLcode result = curl_easy_perform(controlBlock->mHandle);
-                        if (result == CURLE_OK)
-                        {
-                            result = curl_easy_getinfo(controlBlock->mHandle, CURLINFO_LASTSOCKET, &socketfd);
-                            if (result == CURLE_OK)
-                            {
-                                result = static_cast<CURLcode>(strongThis->sendUpgradeHeader(url, pParam.mHeader, strongThis->mSecWebSocketAccept));
-                                if (result == CURLE_OK)
-                                {
-                                    controlBlock->mInitialized = true;
-                                }
-                                else
-                                {
-                                    Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Socket header message fail for url '%'. CURL CODE %, message: '%'", url.getURL(), result, curl_easy_strerror(result));
-                                    controlBlock->mDisconnect = ENetworkWebSocketDisconnect::Header;
-                                    controlBlock->mTerminate.store(1);
-                                }
-                            }
-                            else
-                            {
-                                Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Socket get info failure for url '%'. CURL CODE %, message: '%'", pParam.mUrl, result, curl_easy_strerror(result));
-                                controlBlock->mDisconnect = ENetworkWebSocketDisconnect::InitialConnection;
-                                controlBlock->mTerminate.store(1);
-                            }
-                        }
-                        else
-                        {
-                            Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Socket connection failure for url '%'. CURL CODE %, message: '%'", pParam.mUrl, result, curl_easy_strerror(result));
-                            controlBlock->mDisconnect = ENetworkWebSocketDisconnect::InitialConnection;
-                            controlBlock->mTerminate.store(1);
-                        }
-                    }
-                    else
-                    {
-                        Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Curl easy init fail for socket.");
-                        controlBlock->mDisconnect = ENetworkWebSocketDisconnect::InitialConnection;
-                        controlBlock->mTerminate.store(1);
-                    }
-                }
-
-                if (controlBlock->mInitialized)
-                {
-                    const size_t bufferLength = 2048;
-                    char buffer[bufferLength];
-                    std::string data;
-                    bool error = false;
+    /* NetworkManager::MemoryCache */
     
-                    do
-                    {
-                        size_t readCount = 0;
-                        CURLcode result = curl_easy_recv(controlBlock->mHandle, buffer, bufferLength * sizeof(char), &readCount);
-                        if (result != CURLE_OK && result != CURLE_AGAIN)
-                        {
-                            Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Socket read fail for url '%'. CURL CODE %, message: '%'", url.getURL(), result, curl_easy_strerror(result));
-                            controlBlock->mDisconnect = ENetworkWebSocketDisconnect::Other;
-                            controlBlock->mTerminate.store(1);
-                            error = true;
-                            
-                            break;
-                        }
-                        else if (readCount > 0)
-                        {
-                            data.append(buffer, readCount);
-                        }
-                        else
-                        {
-                            if (!data.empty())
-                                controlBlock->mTime.first = std::chrono::steady_clock::now();
-                            
-                            break;
-                        }
-                    }
-                    while (true);
-
-                    if (!error)
-                    {
-                        if (!data.empty())
-                        {
-                            if (strongThis->mHeaderCheck)
-                            {
-                                strongThis->mHeaderCheck = false;
-                                
-                                const std::string acceptKey = "Sec-WebSocket-Accept: ";
-                                size_t keyPos = data.find(acceptKey);
-                                size_t codePos = data.find("HTTP/1.1 101 Switching Protocols");
-                                
-                                if (codePos != std::string::npos && keyPos != std::string::npos && data.length() >= keyPos + acceptKey.length() + strongThis->mSecWebSocketAccept.length() && data.substr(keyPos + acceptKey.length(), strongThis->mSecWebSocketAccept.length()).compare(strongThis->mSecWebSocketAccept) == 0)
-                                {
-                                    if (pParam.mConnectCallback != nullptr)
-                                    {
-                                        Hermes::getInstance()->getTaskManager()->execute(-1, [connectCallback = std::move(pParam.mConnectCallback)]() -> void
-                                        {
-                                            connectCallback();
-                                        });
-                                    }
-                                }
-                                else
-                                {
-                                    Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Socket invalid handshake.");
-                                    controlBlock->mDisconnect = ENetworkWebSocketDisconnect::Handshake;
-                                    controlBlock->mTerminate.store(1);
-                                    error = true;
-                                }
-                            }
-                            else
-                            {
-                                auto frame = strongThis->unpackMessage(data);
-                                if (!strongThis->handleFrame(frame, strongThis->mFrames, pParam.mMessageCallback))
-                                {
-                                    
-                                    controlBlock->mDisconnect = ENetworkWebSocketDisconnect::Close;
-                                    controlBlock->mTerminate.store(1);
-                                    error = true;
-                                }
-                            }
-                        }
-                        
-                        if (pParam.mTimeout == std::chrono::milliseconds::zero() || (pParam.mTimeout > std::chrono::milliseconds::zero() && std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - controlBlock->mTime.first) < pParam.mTimeout))
-                        {
-                            CURL_WAIT_ON_SOCKET(socketfd, 1, 1000);
-                        }
-                        else
-                        {
-                            controlBlock->mDisconnect = ENetworkWebSocketDisconnect::Timeout;
-                            controlBlock->mTerminate.store(1);
-                            error = true;
-                        }
-                        
-                        if (!error)
-                        {
-                            std::lock_guard<std::mutex> lock(strongThis->mMessage.second);
-                            while (!strongThis->mMessage.first.empty())
-                            {
-                                strongThis->mMessage.first.front();
-                                strongThis->mMessage.first.pop();
-                            }
-                        }
-                    }
-                }
-            }
+    // Recently used cache responses kept in memory above the disk cache. Entries are spread over shards, each with its own lock, LRU list and part of the byte budget.
+    class NetworkManager::MemoryCache
+    {
+    public:
+        explicit MemoryCache(size_t pSizeLimit) : mShardSizeLimit(pSizeLimit / ShardCount)
+        {
+        }
+        
+        std::pair<std::shared_ptr<const std::string>, bool /* string type */> get(const std::string& pKey, uint64_t pTimestamp)
+        {
+            Shard& shard = getShard(pKey);
             
-            if (controlBlock->mTerminate.load() == 1)
-            {
-                if (controlBlock->mInitialized)
-                {
-                    std::string message = strongThis->packMessage("", ENetworkWebSocketOpCode::Close);
-
-                    size_t readCount = 0;
-                    CURLcode result = curl_easy_send(controlBlock->mHandle, message.c_str(), message.length(), &readCount);
-                    if (result != CURLE_OK)
-                        Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Close send failed. CURLcode %", static_cast<int32_t>(result));
-                }
+            std::lock_guard<std::mutex> lock(shard.mMutex);
+            auto it = shard.mIndex.find(pKey);
+            if (it == shard.mIndex.end())
+                return {nullptr, false};
             
-                if (pParam.mDisconnectCallback != nullptr)
-                {
-                    auto disconnect = controlBlock->mDisconnect;
-                    auto difference = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - controlBlock->mTime.second);
-                    Hermes::getInstance()->getTaskManager()->execute(-1, [disconnectCallback = std::move(pParam.mDisconnectCallback), disconnect, difference]() mutable -> void
-                    {
-                        disconnectCallback(disconnect, difference);
-                    });
-                }
-                
-                controlBlock->mTerminate.store(2);
+            const Entry& entry = *it->second;
+            if (pTimestamp < entry.mTimestamp || (pTimestamp - entry.mTimestamp) >= entry.mLifetime)
+            {
+                erase(shard, it);
+                return {nullptr, false};
             }
-        });
-    }
-
-    int32_t NetworkWebSocketHandle::sendUpgradeHeader(const tools::URLTool& pUrl, const std::vector<std::pair<std::string, std::string>>& pHeader, std::string& pSecAccept) const
-    {
-        CURLcode code = CURLE_OK;
-        
-        std::string key = crypto::getRandomCryptoBytes(16);
-        key = crypto::encodeBase64(reinterpret_cast<const unsigned char*>(key.data()), key.size());
-        
-        std::string shaAccept = crypto::getSHA1Digest(key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11");
-        pSecAccept = crypto::encodeBase64(reinterpret_cast<const unsigned char*>(shaAccept.data()), shaAccept.size());
+            
+            shard.mEntry.splice(shard.mEntry.begin(), shard.mEntry, it->second);
+            
+            return {entry.mContent, entry.mStringType};
+        }
         
-        std::string header = "GET ";
-        header.reserve(1024);
+        void put(const std::string& pKey, std::shared_ptr<const std::string> pContent, bool pStringType, uint64_t pTimestamp, uint32_t pLifetime)
+        {
+            Shard& shard = getShard(pKey);
+            const size_t size = sizeof(Entry) + pKey.size() + pContent->size();
+            
+            std::lock_guard<std::mutex> lock(shard.mMutex);
+            auto it = shard.mIndex.find(pKey);
+            if (it != shard.mIndex.end())
+                erase(shard, it);
+            
+            if (size > mShardSizeLimit)
+                return;
+            
+            shard.mEntry.push_front({pKey, std::move(pContent), pTimestamp, pLifetime, size, pStringType});
+            shard.mIndex.emplace(pKey, shard.mEntry.begin());
+            shard.mSize += size;
+            
+            while (shard.mSize > mShardSizeLimit)
+                erase(shard, shard.mIndex.find(shard.mEntry.back().mKey));
+        }
         
-        size_t pathLength = 0;
-        const char* path = pUrl.getPath(pathLength, true);
-        header.append(path, pathLength);
+        void clear()
+        {
+            for (auto& shard : mShard)
+            {
+                std::lock_guard<std::mutex> lock(shard.mMutex);
+                shard.mIndex.clear();
+                shard.mEntry.clear();
+                shard.mSize = 0;
+            }
+        }
         
-        header += " HTTP/1.1\r\nHost: ";
+    private:
+        static constexpr size_t ShardCount = 16;
         
-        size_t hostLength = 0;
-        const char* host = pUrl.getHost(hostLength, true);
-        header.append(host, hostLength);
+        class Entry
+        {
+        public:
+            std::string mKey;
+            std::shared_ptr<const std::string> mContent;
+            uint64_t mTimestamp;
+            uint32_t mLifetime;
+            size_t mSize;
+            bool mStringType;
+        };
         
-        header += "\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: " + key + "\r\nSec-WebSocket-Version: 13\r\nOrigin: " + pUrl.getHttpURL(false) + "\r\n";
+        class Shard
+        {
+        public:
+            std::list<Entry> mEntry;
+            std::unordered_map<std::string, std::list<Entry>::iterator> mIndex;
+            size_t mSize = 0;
+            std::mutex mMutex;
+        };
         
-        for (auto& v : pHeader)
-            header += v.first + ": " + v.second + "\r\n";
+        Shard& getShard(const std::string& pKey)
+        {
+            return mShard[std::hash<std::string>()(pKey) % ShardCount];
+        }
         
-        header += "\r\n";
-        header.shrink_to_fit();
+        void erase(Shard& pShard, std::unordered_map<std::string, std::list<Entry>::iterator>::iterator pIterator)
+        {
+            pShard.mSize -= pIterator->second->mSize;
+            pShard.mEntry.erase(pIterator->second);
+            pShard.mIndex.erase(pIterator);
+        }
         
-        size_t sendCount = 0;
-        code = curl_easy_send(mControlBlock->mHandle, header.c_str(), header.length(), &sendCount);
+        const size_t mShardSizeLimit;
+        std::array<Shard, ShardCount> mShard;
+    };
+
+    /*
+     PACK SEGMENT FORMAT
+     
+     rest    - records appended one after another, a torn record at the end of a segment is cut off during load
+     
+     RECORD FORMAT
+     5 bytes - beginning of a proper record: 01011001 01000111 01000111 01011111 01010000
+     8 bytes - timestamp
+     4 bytes - lifetime
+     2 bytes - flags; 1 marks a string type response, 2 marks a validator block after the key, 4 marks compressed content, 8 marks a vary block
+     4 bytes - number of bytes key will occupy
+     4 bytes - number of bytes validator block, vary block and content will occupy
+     4 bytes - CRC32 of timestamp, lifetime, flags, sizes, key, validator block, vary block and content
+     x bytes - key
+     x bytes - validator block, only when marked by the flags
+     x bytes - vary block, only when marked by the flags
+     x bytes - content
+     
+     VALIDATOR BLOCK FORMAT
+     2 bytes - number of bytes ETag will occupy
+     x bytes - ETag
+     2 bytes - number of bytes Last-Modified will occupy
+     x bytes - Last-Modified
+     
+     VARY BLOCK FORMAT
+     2 bytes - number of header names
+     for each header name:
+     2 bytes - number of bytes header name will occupy
+     x bytes - lowercase header name
+     8 bytes - hash of the values of these headers in the request which received the response
+     
+     COMPRESSED CONTENT FORMAT
+     8 bytes - number of bytes the original content occupies
+     rest    - raw deflate stream of the original content
+    */
+    
+    static bool CACHE_IS_ALIVE(uint64_t pTimestamp, uint64_t pStoredTimestamp, uint64_t pLifetime)
+    {
+        return pTimestamp >= pStoredTimestamp && (pTimestamp - pStoredTimestamp) < pLifetime;
+    }
+    
+    // FNV-1a, hashes are stored on the disk, so they mustn't depend on the standard library implementation.
+    static uint64_t CACHE_HASH(const char* pData, size_t pSize, uint64_t pHash = 14695981039346656037ULL)
+    {
+        for (size_t i = 0; i < pSize; ++i)
+        {
+            pHash ^= static_cast<uint8_t>(pData[i]);
+            pHash *= 1099511628211ULL;
+        }
         
-        return code;
+        return pHash;
     }
     
-    std::string NetworkWebSocketHandle::packMessage(const std::string& pMessage, ENetworkWebSocketOpCode pOpCode) const
+    // Entries are looked up by the key alone, so it's a SHA-1 digest of the material, wide enough that different requests don't share a response.
+    static std::string CACHE_KEY_HASH(const std::string& pMaterial)
     {
-        std::string message;
+        static const char lookup[] = "0123456789abcdef";
         
-        uint8_t codes = static_cast<uint8_t>(pOpCode);
-        uint8_t payloadLength = 0x80;
-        uint8_t mask[4] = {0};
-        uint16_t payloadLength16 = 0;
-        uint64_t payloadLength64 = 0;
+        const std::string digest = crypto::getSHA1Digest(pMaterial);
+        std::string key(digest.size() * 2, '0');
         
-        if (pMessage.length() <= 125)
+        for (size_t i = 0; i < digest.size(); ++i)
         {
-            payloadLength |= static_cast<uint8_t>(pMessage.length());
-            
-            message.reserve(sizeof(codes) + sizeof(payloadLength) + sizeof(mask) + pMessage.length());
+            key[i * 2] = lookup[static_cast<unsigned char>(digest[i]) >> 4];
+            key[i * 2 + 1] = lookup[static_cast<unsigned char>(digest[i]) & 0xF];
         }
-        else if (pMessage.length() <= std::numeric_limits<uint16_t>::max())
+        
+        return key;
+    }
+    
+    // Headers are matched the way createUniqueHeader does it, the first occurrence of a name is used and the default headers come after the request ones.
+    static uint64_t CACHE_VARY_HASH(const std::vector<std::string>& pVary, const std::vector<std::pair<std::string, std::string>>& pHeader, const std::vector<std::pair<std::string, std::string>>* pDefaultHeader)
+    {
+        uint64_t hash = CACHE_HASH(nullptr, 0);
+        
+        for (const auto& name : pVary)
         {
-            payloadLength |= 126;
-            payloadLength16 = pMessage.length();
-            payloadLength16 = tools::isLittleEndian() ? tools::byteSwap16(payloadLength16) : payloadLength16;
+            auto findHeader = [&name](const std::pair<std::string, std::string>& lpHeader) -> bool
+            {
+                return lpHeader.first.size() == name.size() && std::equal(name.begin(), name.end(), lpHeader.first.begin(), [](char lpSign1, char lpSign2) -> bool
+                {
+                    return lpSign1 == std::tolower(static_cast<unsigned char>(lpSign2));
+                });
+            };
             
-            message.reserve(sizeof(codes) + sizeof(payloadLength) + sizeof(payloadLength16) + sizeof(mask) + pMessage.size());
+            const std::pair<std::string, std::string>* header = nullptr;
+            
+            auto it = std::find_if(pHeader.begin(), pHeader.end(), findHeader);
+            if (it != pHeader.end())
+            {
+                header = &(*it);
+            }
+            else if (pDefaultHeader != nullptr)
+            {
+                auto defaultIt = std::find_if(pDefaultHeader->begin(), pDefaultHeader->end(), findHeader);
+                if (defaultIt != pDefaultHeader->end())
+                    header = &(*defaultIt);
+            }
+            
+            hash = CACHE_HASH(name.data(), name.size() + 1, hash);
+            hash = header != nullptr ? CACHE_HASH(header->second.data(), header->second.size() + 1, hash) : CACHE_HASH("\1", 1, hash);
         }
-        else
+        
+        return hash;
+    }
+    
+    static std::string CACHE_VARY_ENCODE(const std::vector<std::string>& pVary, uint64_t pHash)
+    {
+        std::string vary;
+        
+        const uint16_t count = static_cast<uint16_t>(std::min(pVary.size(), static_cast<size_t>(std::numeric_limits<uint16_t>::max())));
+        vary.append(reinterpret_cast<const char*>(&count), sizeof(count));
+        
+        for (size_t i = 0; i < count; ++i)
         {
-            payloadLength |= 127;
-            payloadLength64 = pMessage.length();
-            payloadLength64 = tools::isLittleEndian() ? tools::byteSwap64(payloadLength64) : payloadLength64;
-            
-            message.reserve(sizeof(codes) + sizeof(payloadLength) + sizeof(payloadLength64) + sizeof(mask) + pMessage.size());
+            const uint16_t size = static_cast<uint16_t>(std::min(pVary[i].size(), static_cast<size_t>(std::numeric_limits<uint16_t>::max())));
+            vary.append(reinterpret_cast<const char*>(&size), sizeof(size));
+            vary.append(pVary[i].data(), size);
         }
         
-        message.append(reinterpret_cast<const char*>(&codes), sizeof(codes));
-        message.append(reinterpret_cast<const char*>(&payloadLength), sizeof(payloadLength));
+        vary.append(reinterpret_cast<const char*>(&pHash), sizeof(pHash));
         
-        if (payloadLength16 > 0)
-            message.append(reinterpret_cast<const char*>(&payloadLength16), sizeof(payloadLength16));
-        else if (payloadLength64 > 0)
-            message.append(reinterpret_cast<const char*>(&payloadLength64), sizeof(payloadLength64));
+        return vary;
+    }
+    
+    static bool CACHE_VARY_DECODE(const char* pData, size_t pSize, size_t& pVarySize, std::vector<std::string>* pVary, uint64_t* pHash)
+    {
+        size_t offset = 0;
+        uint16_t count = 0;
         
-        memcpy(mask, crypto::getRandomCryptoBytes(4).data(), sizeof(mask));
-        message.append(reinterpret_cast<const char*>(mask), sizeof(mask));
+        if (pSize < sizeof(count))
+            return false;
         
-        if (pMessage.length() > 0)
+        memcpy(&count, pData, sizeof(count));
+        offset += sizeof(count);
+        
+        for (uint16_t i = 0; i < count; ++i)
         {
-            uint8_t maskedMessage[pMessage.size()];
-            memcpy(maskedMessage, pMessage.data(), pMessage.size());
+            uint16_t size = 0;
+            if (offset + sizeof(size) > pSize)
+                return false;
             
-            for (size_t i = 0; i < pMessage.size(); i++)
-                maskedMessage[i] ^= mask[i % 4];
+            memcpy(&size, pData + offset, sizeof(size));
+            offset += sizeof(size);
             
-            message.append(reinterpret_cast<const char*>(maskedMessage), pMessage.size());
+            if (offset + size > pSize)
+                return false;
+            
+            if (pVary != nullptr)
+                pVary->emplace_back(pData + offset, size);
+            
+            offset += size;
         }
         
-        return message;
+        if (offset + sizeof(uint64_t) > pSize)
+            return false;
+        
+        if (pHash != nullptr)
+            memcpy(pHash, pData + offset, sizeof(uint64_t));
+        
+        pVarySize = offset + sizeof(uint64_t);
+        
+        return true;
     }
     
-    std::vector<NetworkWebSocketHandle::Frame> NetworkWebSocketHandle::unpackMessage(const std::string& pMessage) const
+    // The output is dropped if it wouldn't be smaller than the content.
+    static bool CACHE_DEFLATE(const std::string& pContent, std::string& pOutput)
     {
-        std::vector<Frame> frames;
+        const uint64_t size = pContent.size();
+        pOutput.clear();
+        
+        if (size <= sizeof(size) || size > std::numeric_limits<uInt>::max())
+            return false;
+        
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        
+        if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            return false;
+        
+        pOutput.resize(pContent.size());
+        memcpy(&pOutput[0], &size, sizeof(size));
+        
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(pContent.data()));
+        stream.avail_in = static_cast<uInt>(pContent.size());
+        stream.next_out = reinterpret_cast<Bytef*>(&pOutput[sizeof(size)]);
+        stream.avail_out = static_cast<uInt>(pOutput.size() - sizeof(size));
+        
+        const int error = deflate(&stream, Z_FINISH);
+        deflateEnd(&stream);
+        
+        if (error != Z_STREAM_END)
+        {
+            pOutput.clear();
+            return false;
+        }
+        
+        pOutput.resize(sizeof(size) + stream.total_out);
+        
+        return true;
+    }
     
-        if (pMessage.length() == 0)
-            return frames;
-
-        const bool isLittleEndian = tools::isLittleEndian();
+    static bool CACHE_INFLATE(const char* pData, size_t pSize, size_t pSizeLimit, std::string& pContent)
+    {
+        uint64_t size = 0;
+        if (pSize < sizeof(size))
+            return false;
         
-        bool loopContinue = false;
-        size_t frameOffset = 0;
+        memcpy(&size, pData, sizeof(size));
+        if (size > pSizeLimit)
+            return false;
         
-        do
+        pContent.assign(static_cast<size_t>(size), '\0');
+        CacheInflater inflater(&pContent[0], pContent.size());
+        
+        return inflater.push(pData + sizeof(size), pSize - sizeof(size)) && inflater.isFinished();
+    }
+    
+    static std::string CACHE_VALIDATOR_ENCODE(const std::string& pETag, const std::string& pLastModified)
+    {
+        std::string validator;
+        
+        for (const std::string* v : {&pETag, &pLastModified})
         {
-            Frame frame;
+            const uint16_t size = static_cast<uint16_t>(std::min(v->size(), static_cast<size_t>(std::numeric_limits<uint16_t>::max())));
+            validator.append(reinterpret_cast<const char*>(&size), sizeof(size));
+            validator.append(v->data(), size);
+        }
+        
+        return validator;
+    }
+    
+    static bool CACHE_VALIDATOR_DECODE(const char* pData, size_t pSize, size_t& pValidatorSize, std::string* pETag, std::string* pLastModified)
+    {
+        pValidatorSize = 0;
+        
+        for (std::string* v : {pETag, pLastModified})
+        {
+            uint16_t size = 0;
+            if (pValidatorSize + sizeof(size) > pSize)
+                return false;
             
-            if (frameOffset + sizeof(frame.mCode) + sizeof(frame.mPayloadLength) > pMessage.length())
+            memcpy(&size, pData + pValidatorSize, sizeof(size));
+            pValidatorSize += sizeof(size);
+            
+            if (pValidatorSize + size > pSize)
+                return false;
+            
+            if (v != nullptr)
+                v->assign(pData + pValidatorSize, size);
+            
+            pValidatorSize += size;
+        }
+        
+        return true;
+    }
+    
+    static bool PACK_WRITE(int32_t pDescriptor, const char* pData, size_t pSize)
+    {
+        size_t offset = 0;
+        
+        while (offset < pSize)
+        {
+            const ssize_t writeCount = write(pDescriptor, pData + offset, pSize - offset);
+            if (writeCount < 0 && errno == EINTR)
+                continue;
+            
+            if (writeCount <= 0)
+                return false;
+            
+            offset += static_cast<size_t>(writeCount);
+        }
+        
+        return true;
+    }
+    
+    /* NetworkManager::PackCache */
+    
+    // Cache responses appended to segment files instead of a file per response. The index of live records is kept in memory, hits are read through
+    // memory mapped segments and segments which are mostly dead are compacted on the thread pool.
+    class NetworkManager::PackCache : public std::enable_shared_from_this<NetworkManager::PackCache>
+    {
+    public:
+        class Mapping
+        {
+        public:
+            Mapping(int32_t pDescriptor, size_t pSize) : mSize(pSize)
             {
-                Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Socket frame parsing error. Message smaller than minimal header. Message length %, frameOffset %", pMessage.length(), frameOffset);
-                
-                break;
+                void* data = pSize > 0 ? mmap(nullptr, pSize, PROT_READ, MAP_SHARED, pDescriptor, 0) : MAP_FAILED;
+                mData = data != MAP_FAILED ? static_cast<const char*>(data) : nullptr;
             }
             
-            memcpy((char*)&frame, pMessage.data() + frameOffset, sizeof(frame.mCode) + sizeof(frame.mPayloadLength));
+            Mapping(const Mapping& pOther) = delete;
+            Mapping(Mapping&& pOther) = delete;
             
-            bool useMask = frame.mPayloadLength & 0x80;
+            ~Mapping()
+            {
+                if (mData != nullptr)
+                    munmap(const_cast<char*>(mData), mSize);
+            }
             
-            size_t offset = sizeof(frame.mCode) + sizeof(frame.mPayloadLength);
-            uint64_t payloadSize = 0;
+            Mapping& operator=(const Mapping& pOther) = delete;
+            Mapping& operator=(Mapping&& pOther) = delete;
             
-            if (frame.mPayloadLength <= 125)
+            const char* mData = nullptr;
+            const size_t mSize;
+        };
+        
+        // Content of a record inside of a mapped segment. The mapping stays alive with the view, even when the segment is compacted or removed meanwhile.
+        class View
+        {
+        public:
+            std::shared_ptr<const Mapping> mMapping;
+            const char* mData = nullptr;
+            size_t mSize = 0;
+            uint64_t mTimestamp = 0;
+            uint32_t mLifetime = 0;
+            bool mStringType = false;
+            bool mFresh = false;
+            bool mStale = false;
+            bool mValidator = false;
+            bool mCompressed = false;
+            bool mVary = false;
+            std::string mETag;
+            std::string mLastModified;
+            std::vector<std::string> mVaryHeader;
+            uint64_t mVaryHash = 0;
+        };
+        
+        PackCache(std::string pDirectoryPath, unsigned pCountLimit, uint64_t pSizeLimit, int32_t pThreadPoolId, bool pSync) : mDirectoryPath(std::move(pDirectoryPath)), mCountLimit(pCountLimit), mSizeLimit(pSizeLimit), mThreadPoolId(pThreadPoolId), mSync(pSync)
+        {
+        }
+        
+        PackCache(const PackCache& pOther) = delete;
+        PackCache(PackCache&& pOther) = delete;
+        
+        ~PackCache()
+        {
+            for (auto& v : mSegment)
+                close(v.second.mDescriptor);
+        }
+        
+        PackCache& operator=(const PackCache& pOther) = delete;
+        PackCache& operator=(PackCache&& pOther) = delete;
+        
+        bool load(uint64_t pTimestamp, uint32_t pStaleLifetime)
+        {
+            DIR* dir = opendir(mDirectoryPath.c_str());
+            if (dir == NULL)
+                return false;
+            
+            std::vector<uint32_t> segmentId;
+            
+            struct dirent *file;
+            while ((file = readdir(dir)) != NULL)
             {
-                payloadSize = frame.mPayloadLength & 0x7F;
+                const std::string name = file->d_name;
+                const size_t extension = name.find(".pack");
+                if (extension > 0 && extension != std::string::npos && extension + 5 == name.size() && std::all_of(name.begin(), name.begin() + extension, [](char lpSign) -> bool { return lpSign >= '0' && lpSign <= '9'; }))
+                    segmentId.push_back(static_cast<uint32_t>(std::strtoul(name.c_str(), nullptr, 10)));
             }
-            else if (frame.mPayloadLength == 126)
+            closedir(dir);
+            
+            std::sort(segmentId.begin(), segmentId.end());
+            
+            std::lock_guard<std::mutex> writerLock(mWriterMutex);
+            std::lock_guard<std::mutex> lock(mMutex);
+            
+            for (auto id : segmentId)
             {
-                uint16_t length = 0;
+                Segment loadedSegment;
+                if (!openSegment(id, loadedSegment))
+                    continue;
                 
-                if (frameOffset + offset + sizeof(length) > pMessage.length())
+                Segment* segment = &(mSegment[id] = std::move(loadedSegment));
+                
+                Mapping mapping(segment->mDescriptor, static_cast<size_t>(segment->mSize));
+                uint64_t offset = 0;
+                
+                // A segment which can't be mapped at the moment isn't damaged, so it's left on the disk for the next load.
+                if (mapping.mData == nullptr && segment->mSize > 0)
                 {
-                    Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Socket frame parsing error. Message smaller than extended header. Message length %, frameOffset %", pMessage.length(), frameOffset);
+                    Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Cache failed to map segment at '%'", segment->mFilePath);
                     
-                    break;
+                    close(segment->mDescriptor);
+                    mSegment.erase(id);
+                    continue;
                 }
                 
-                memcpy((char*)&length, pMessage.data() + frameOffset + offset, sizeof(length));
-                payloadSize = frame.mPayloadLengthExtended = isLittleEndian ? tools::byteSwap16(length) : length;
-                
-                offset += sizeof(length);
-            }
-            else
-            {
-                if (frameOffset + offset + sizeof(frame.mPayloadLengthExtended) > pMessage.length())
+                while (offset + RecordHeaderSize <= segment->mSize)
                 {
-                    Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Socket frame parsing error. Message smaller than super extended header. Message length %, frameOffset %", pMessage.length(), frameOffset);
-                    break;
+                    const char* record = mapping.mData + offset;
+                    uint64_t timestamp = 0;
+                    uint32_t lifetime = 0;
+                    uint16_t flags = 0;
+                    uint32_t keySize = 0;
+                    uint32_t contentSize = 0;
+                    uint32_t checksum = 0;
+                    
+                    if (memcmp(record, mMagicWord, sizeof(mMagicWord)) != 0)
+                        break;
+                    
+                    memcpy(&timestamp, record + 5, sizeof(timestamp));
+                    memcpy(&lifetime, record + 13, sizeof(lifetime));
+                    memcpy(&flags, record + 17, sizeof(flags));
+                    memcpy(&keySize, record + 19, sizeof(keySize));
+                    memcpy(&contentSize, record + 23, sizeof(contentSize));
+                    memcpy(&checksum, record + 27, sizeof(checksum));
+                    
+                    const uint64_t recordSize = RecordHeaderSize + static_cast<uint64_t>(keySize) + contentSize;
+                    if (offset + recordSize > segment->mSize || checksum != computeChecksum(record, {{{record + RecordHeaderSize, static_cast<size_t>(recordSize - RecordHeaderSize)}, {nullptr, 0}, {nullptr, 0}}}))
+                        break;
+                    
+                    size_t validatorSize = 0;
+                    if ((flags & 2) != 0 && !CACHE_VALIDATOR_DECODE(record + RecordHeaderSize + keySize, contentSize, validatorSize, nullptr, nullptr))
+                        break;
+                    
+                    size_t varySize = 0;
+                    if ((flags & 8) != 0 && !CACHE_VARY_DECODE(record + RecordHeaderSize + keySize + validatorSize, contentSize - validatorSize, varySize, nullptr, nullptr))
+                        break;
+                    
+                    // Records are read from the oldest one, so a newer record of the same request replaces the previous one.
+                    std::string key(record + RecordHeaderSize, keySize);
+                    auto it = mIndex.find(key);
+                    if (it != mIndex.end())
+                        erase(it);
+                    
+                    // A stale record with a validator is kept, so it can be revalidated with a conditional request.
+                    if (CACHE_IS_ALIVE(pTimestamp, timestamp, static_cast<uint64_t>(lifetime) + pStaleLifetime) || (flags & 2) != 0)
+                        link({std::move(key), id, offset, recordSize, static_cast<uint32_t>(RecordHeaderSize + keySize + validatorSize + varySize), timestamp, lifetime, (flags & 1) != 0, (flags & 2) != 0, (flags & 4) != 0, (flags & 8) != 0});
+                    
+                    offset += recordSize;
                 }
                 
-                memcpy((char*)&frame.mPayloadLengthExtended, pMessage.data() + frameOffset + offset, sizeof(frame.mPayloadLengthExtended));
-                payloadSize = frame.mPayloadLengthExtended = isLittleEndian ? tools::byteSwap64(frame.mPayloadLengthExtended) : frame.mPayloadLengthExtended;
-                
-                offset += sizeof(frame.mPayloadLengthExtended);
-            }
-            
-            if (useMask)
-            {
-                if (frameOffset + offset + sizeof(frame.mMaskingKey) > pMessage.length())
+                if (offset < segment->mSize)
                 {
-                    Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Socket frame parsing error. Message smaller than header with mask. Message length %, frameOffset %, offset %, payload size %", pMessage.length(), frameOffset, offset, payloadSize);
+                    Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Cache cut off a damaged part of segment at '%'", segment->mFilePath);
                     
-                    break;
+                    if (ftruncate(segment->mDescriptor, static_cast<off_t>(offset)) == 0)
+                        segment->mSize = offset;
                 }
-                
-                memcpy((char*)&frame.mMaskingKey, pMessage.data() + frameOffset + offset, sizeof(frame.mMaskingKey));
-                offset += sizeof(frame.mMaskingKey);
             }
             
-            if (pMessage.length() - (frameOffset + offset) < payloadSize)
-            {
-                Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Socket frame parsing error. Payload bigger than message. Message length %, frameOffset %, offset %, payload size %", pMessage.length(), frameOffset, offset, payloadSize);
-                
-                break;
-            }
-            
-            if (!useMask)
-            {
-                frame.mPayload = pMessage.substr(frameOffset + offset, static_cast<size_t>(payloadSize));
-            }
+            // Records are appended after the last segment on the disk, even when it was skipped.
+            auto last = mSegment.rbegin();
+            Segment activeSegment;
+            if (last != mSegment.rend() && last->first == segmentId.back() && last->second.mSize < SegmentSizeLimit)
+                mActiveSegment = last->first;
+            else if (openSegment(!segmentId.empty() ? segmentId.back() + 1 : 0, activeSegment))
+                mActiveSegment = !segmentId.empty() ? segmentId.back() + 1 : 0;
             else
-            {
-                uint8_t message[payloadSize];
-                memcpy(message, pMessage.data() + frameOffset + offset, static_cast<size_t>(payloadSize));
-                
-                for (size_t i = 0; i < payloadSize; i++)
-                    message[i] ^= frame.mMaskingKey[i % 4];
-                
-                frame.mPayload.append(reinterpret_cast<const char*>(message), static_cast<size_t>(payloadSize));
-            }
+                return false;
             
-            if (pMessage.length() - (frameOffset + offset) == payloadSize)
+            if (activeSegment.mDescriptor >= 0)
+                mSegment[mActiveSegment] = std::move(activeSegment);
+            
+            trim();
+            
+            for (const auto& v : mSegment)
+                checkSegment(v.first);
+            
+            return true;
+        }
+        
+        bool get(const std::string& pKey, uint64_t pTimestamp, uint32_t pStaleLifetime, View& pView)
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            auto it = mIndex.find(pKey);
+            if (it == mIndex.end())
+                return false;
+            
+            const Entry& entry = *it->second;
+            pView.mFresh = CACHE_IS_ALIVE(pTimestamp, entry.mTimestamp, entry.mLifetime);
+            pView.mStale = !pView.mFresh && CACHE_IS_ALIVE(pTimestamp, entry.mTimestamp, static_cast<uint64_t>(entry.mLifetime) + pStaleLifetime);
+            pView.mValidator = entry.mValidator;
+            
+            if (!pView.mFresh && !pView.mStale && !entry.mValidator)
             {
-                loopContinue = false;
+                checkSegment(erase(it));
+                return false;
             }
-            else
+            
+            mEntry.splice(mEntry.begin(), mEntry, it->second);
+            
+            auto mapping = getMapping(mSegment.at(entry.mSegment), entry.mOffset + entry.mSize);
+            if (mapping == nullptr)
+                return false;
+            
+            const char* record = mapping->mData + entry.mOffset;
+            const size_t validatorOffset = RecordHeaderSize + entry.mKey.size();
+            size_t validatorSize = 0;
+            
+            // Validators are needed only by a stale response, though their size is needed to find the vary block.
+            if (entry.mValidator)
+                CACHE_VALIDATOR_DECODE(record + validatorOffset, entry.mContentOffset - validatorOffset, validatorSize, pView.mFresh ? nullptr : &pView.mETag, pView.mFresh ? nullptr : &pView.mLastModified);
+            
+            if (entry.mVary)
             {
-                loopContinue = true;
-                frameOffset += offset + payloadSize;
+                size_t varySize = 0;
+                CACHE_VARY_DECODE(record + validatorOffset + validatorSize, entry.mContentOffset - validatorOffset - validatorSize, varySize, &pView.mVaryHeader, &pView.mVaryHash);
             }
             
-            frames.push_back(std::move(frame));
+            pView.mData = record + entry.mContentOffset;
+            pView.mSize = static_cast<size_t>(entry.mSize) - entry.mContentOffset;
+            pView.mMapping = std::move(mapping);
+            pView.mTimestamp = entry.mTimestamp;
+            pView.mLifetime = entry.mLifetime;
+            pView.mStringType = entry.mStringType;
+            pView.mCompressed = entry.mCompressed;
+            pView.mVary = entry.mVary;
+            
+            return true;
         }
-        while (loopContinue);
-        
-        return frames;
-    }
-    
-    bool NetworkWebSocketHandle::handleFrame(std::vector<Frame>& pNewFrame, std::vector<Frame>& pOldFrame, std::function<void(std::string lpMessage, bool lpTextData)> pMessageCallback) const
-    {
-        bool endSent = false;
         
-        for (size_t i = pNewFrame.size(); i > 0; --i)
+        // Records of a batch are appended first and linked after the segments are flushed, so the index never refers to data which isn't durable.
+        // Appends are serialized by the writer mutex, the index mutex is taken only to link the records, so lookups don't wait for the disk.
+        bool put(const std::vector<std::shared_ptr<CacheWriteData>>& pData, bool pSync)
         {
-            uint8_t opCode = pNewFrame[i-1].mCode & 0x0F;
+            std::vector<Entry> entry;
+            entry.reserve(pData.size());
             
-            if (static_cast<ENetworkWebSocketOpCode>(opCode) == ENetworkWebSocketOpCode::Ping)
+            std::lock_guard<std::mutex> writerLock(mWriterMutex);
+            mSync = pSync;
+            
+            for (const auto& data : pData)
             {
-                pNewFrame.erase(pNewFrame.begin() + static_cast<ptrdiff_t>(i - 1));
+                const CachePolicy& policy = data->mPolicy;
+                const bool validator = policy.mETag.size() > 0 || policy.mLastModified.size() > 0;
+                const std::string validatorBlock = validator ? CACHE_VALIDATOR_ENCODE(policy.mETag, policy.mLastModified) : "";
+                const std::string varyBlock = policy.mVary.size() > 0 ? CACHE_VARY_ENCODE(policy.mVary, data->mVaryHash) : "";
+                const bool compressed = data->mCompressedContent.size() > 0;
+                const std::string& content = compressed ? data->mCompressedContent : *data->mContent;
                 
-                if (!endSent)
+                std::string record(mMagicWord, sizeof(mMagicWord));
+                const uint16_t flags = (data->mStringType ? 1 : 0) | (validator ? 2 : 0) | (compressed ? 4 : 0) | (varyBlock.size() > 0 ? 8 : 0);
+                const uint32_t keySize = static_cast<uint32_t>(data->mKey.size());
+                const uint32_t contentSize = static_cast<uint32_t>(validatorBlock.size() + varyBlock.size() + content.size());
+                
+                record.append(reinterpret_cast<const char*>(&data->mTimestamp), sizeof(data->mTimestamp));
+                record.append(reinterpret_cast<const char*>(&policy.mLifetime), sizeof(policy.mLifetime));
+                record.append(reinterpret_cast<const char*>(&flags), sizeof(flags));
+                record.append(reinterpret_cast<const char*>(&keySize), sizeof(keySize));
+                record.append(reinterpret_cast<const char*>(&contentSize), sizeof(contentSize));
+                
+                // The validator and vary blocks are written as one part.
+                const std::string block = validatorBlock + varyBlock;
+                const std::array<std::pair<const char*, size_t>, 3> part = {{{data->mKey.data(), data->mKey.size()}, {block.data(), block.size()}, {content.data(), content.size()}}};
+                const uint32_t checksum = computeChecksum(record.data(), part);
+                record.append(reinterpret_cast<const char*>(&checksum), sizeof(checksum));
+                
+                uint32_t segment = 0;
+                uint64_t offset = 0;
+                if (append(record.data(), part, segment, offset))
+                    entry.push_back({data->mKey, segment, offset, RecordHeaderSize + data->mKey.size() + block.size() + content.size(), static_cast<uint32_t>(RecordHeaderSize + data->mKey.size() + block.size()), data->mTimestamp, policy.mLifetime, data->mStringType, validator, compressed, varyBlock.size() > 0});
+                else
+                    Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Cache failed to write '%' to segment at '%'", data->mKey, mSegment.at(mActiveSegment).mFilePath);
+            }
+            
+            if (pSync)
+            {
+                // A batch may roll over to the next segment, so every segment it touched is flushed.
+                for (size_t i = 0; i < entry.size(); ++i)
                 {
-                    std::string message = packMessage("", ENetworkWebSocketOpCode::Pong);
-                    size_t sendCount = 0;
+                    if (i > 0 && entry[i].mSegment == entry[i - 1].mSegment)
+                        continue;
                     
-                    if (mControlBlock->mHandle != nullptr)
+                    const Segment& segment = mSegment.at(entry[i].mSegment);
+                    if (fsync(segment.mDescriptor) != 0)
                     {
-                        CURLcode code = curl_easy_send(mControlBlock->mHandle, message.c_str(), message.length(), &sendCount);
-                        
-                        if (code != CURLE_OK)
-                            Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Pong send failed. CURLcode %", static_cast<int32_t>(code));
+                        Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Cache failed to sync segment at '%'", segment.mFilePath);
+                        return false;
                     }
                 }
             }
-            else if (static_cast<ENetworkWebSocketOpCode>(opCode) == ENetworkWebSocketOpCode::Close)
+            
+            std::lock_guard<std::mutex> lock(mMutex);
+            std::vector<uint32_t> erasedSegment;
+            
+            for (auto& v : entry)
             {
-                pNewFrame.erase(pNewFrame.begin() + static_cast<ptrdiff_t>(i - 1));
+                auto it = mIndex.find(v.mKey);
+                if (it != mIndex.end())
+                    erasedSegment.push_back(erase(it));
                 
-                std::string message = packMessage("", ENetworkWebSocketOpCode::Close);
+                link(std::move(v));
+            }
+            
+            for (auto v : erasedSegment)
+                checkSegment(v);
+            
+            trim();
+            
+            return entry.size() == pData.size();
+        }
+        
+        void clear()
+        {
+            std::lock_guard<std::mutex> writerLock(mWriterMutex);
+            std::lock_guard<std::mutex> lock(mMutex);
+            mIndex.clear();
+            mEntry.clear();
+            mSize = 0;
+            mCompactionSegment.clear();
+            
+            for (auto& v : mSegment)
+            {
+                close(v.second.mDescriptor);
                 
-                if (mControlBlock->mHandle != nullptr)
+                if (std::remove(v.second.mFilePath.c_str()) != 0)
+                    Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Cache clear failed to delete file at '%'", v.second.mFilePath);
+            }
+            
+            mSegment.clear();
+            
+            Segment segment;
+            if (openSegment(0, segment))
+            {
+                mSegment[0] = std::move(segment);
+                mActiveSegment = 0;
+            }
+        }
+        
+    private:
+        static constexpr uint64_t SegmentSizeLimit = 8 << 20;
+        static constexpr size_t RecordHeaderSize = 31;
+        
+        class Entry
+        {
+        public:
+            std::string mKey;
+            uint32_t mSegment;
+            uint64_t mOffset;
+            uint64_t mSize;
+            uint32_t mContentOffset;
+            uint64_t mTimestamp;
+            uint32_t mLifetime;
+            bool mStringType;
+            bool mValidator;
+            bool mCompressed;
+            bool mVary;
+        };
+        
+        class Segment
+        {
+        public:
+            std::string mFilePath;
+            int32_t mDescriptor = -1;
+            uint64_t mSize = 0;
+            uint64_t mLiveSize = 0;
+            std::shared_ptr<const Mapping> mMapping;
+        };
+        
+        static uint32_t computeChecksum(const char* pHeader, const std::array<std::pair<const char*, size_t>, 3>& pPart)
+        {
+            uLong checksum = crc32(0L, reinterpret_cast<const Bytef*>(pHeader + sizeof(mMagicWord)), static_cast<uInt>(RecordHeaderSize - sizeof(mMagicWord) - sizeof(uint32_t)));
+            
+            // crc32 takes the length as uInt, so large content is processed in parts.
+            for (auto v : pPart)
+            {
+                while (v.second > 0)
                 {
-                    size_t sendCount = 0;
-                    CURLcode code = curl_easy_send(mControlBlock->mHandle, message.c_str(), message.length(), &sendCount);
-                    
-                    if (code != CURLE_OK)
-                        Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Close response send failed. CURLcode %", static_cast<int32_t>(code));
+                    const uInt size = static_cast<uInt>(std::min(v.second, static_cast<size_t>(std::numeric_limits<uInt>::max())));
+                    checksum = crc32(checksum, reinterpret_cast<const Bytef*>(v.first), size);
+                    v.first += size;
+                    v.second -= size;
                 }
-                endSent = true;
             }
-            else if (opCode > static_cast<uint8_t>(ENetworkWebSocketOpCode::Binary))
+            
+            return static_cast<uint32_t>(checksum);
+        }
+        
+        // The segment is only opened, it's added to the segments by the caller under the index mutex.
+        bool openSegment(uint32_t pId, Segment& pSegment)
+        {
+            pSegment.mFilePath = mDirectoryPath + std::to_string(pId) + ".pack";
+            pSegment.mDescriptor = open(pSegment.mFilePath.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            
+            struct stat stat_buf;
+            if (pSegment.mDescriptor < 0 || fstat(pSegment.mDescriptor, &stat_buf) != 0)
             {
-                pNewFrame.erase(pNewFrame.begin() + static_cast<ptrdiff_t>(i - 1));
+                Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Cache failed to open segment at '%'", pSegment.mFilePath);
+                
+                if (pSegment.mDescriptor >= 0)
+                    close(pSegment.mDescriptor);
+                
+                pSegment.mDescriptor = -1;
+                
+                return false;
             }
+            
+            pSegment.mSize = static_cast<uint64_t>(stat_buf.st_size);
+            
+            return true;
         }
         
-        pOldFrame.insert(pOldFrame.end(), pNewFrame.begin(), pNewFrame.end());
-        
-        ENetworkWebSocketOpCode multiFrameOpCode = ENetworkWebSocketOpCode::Continue;
-        std::vector<NetworkWebSocketHandle::Frame>::iterator firstFrameIt;
-        std::string multiMessage;
+        std::shared_ptr<const Mapping> getMapping(Segment& pSegment, uint64_t pSize)
+        {
+            // The active segment grows after it was mapped, so it's mapped again once a record beyond the current mapping is requested.
+            if (pSegment.mMapping == nullptr || pSegment.mMapping->mSize < pSize)
+            {
+                auto mapping = std::make_shared<const Mapping>(pSegment.mDescriptor, static_cast<size_t>(pSegment.mSize));
+                if (mapping->mData == nullptr)
+                {
+                    Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Cache failed to map segment at '%'", pSegment.mFilePath);
+                    return nullptr;
+                }
+                
+                pSegment.mMapping = std::move(mapping);
+            }
+            
+            return pSegment.mMapping;
+        }
         
-        for (auto it = pOldFrame.begin(); it != pOldFrame.end();)
+        // Called with the writer mutex locked. Segments are added and resized only with both mutexes locked, so the writer reads them without the index mutex.
+        bool append(const char* pHeader, const std::array<std::pair<const char*, size_t>, 3>& pPart, uint32_t& pSegment, uint64_t& pOffset)
         {
-            const bool fin = it->mCode & 0x80;
-            const uint8_t opCode = it->mCode & 0x0F;
+            Segment* segment = &mSegment.at(mActiveSegment);
+            if (segment->mSize >= SegmentSizeLimit)
+            {
+                Segment nextSegment;
+                if (openSegment(mActiveSegment + 1, nextSegment))
+                {
+                    std::lock_guard<std::mutex> lock(mMutex);
+                    const uint32_t previousSegment = mActiveSegment;
+                    mActiveSegment++;
+                    segment = &(mSegment[mActiveSegment] = std::move(nextSegment));
+                    checkSegment(previousSegment);
+                }
+            }
             
-            if (!fin)
+            bool status = PACK_WRITE(segment->mDescriptor, pHeader, RecordHeaderSize);
+            for (size_t i = 0; status && i < pPart.size(); ++i)
+                status = PACK_WRITE(segment->mDescriptor, pPart[i].first, pPart[i].second);
+            
+            if (!status)
             {
-                multiFrameOpCode = static_cast<ENetworkWebSocketOpCode>(opCode);
-                multiMessage += std::move(it->mPayload);
+                // A partially written record would stop loading of the following records, so it's cut off at once.
+                if (ftruncate(segment->mDescriptor, static_cast<off_t>(segment->mSize)) != 0)
+                {
+                    std::lock_guard<std::mutex> lock(mMutex);
+                    segment->mSize = SegmentSizeLimit;
+                }
                 
-                firstFrameIt = it++;
+                return false;
             }
-            else if (static_cast<ENetworkWebSocketOpCode>(opCode) != ENetworkWebSocketOpCode::Continue)
+            
+            std::lock_guard<std::mutex> lock(mMutex);
+            pSegment = mActiveSegment;
+            pOffset = segment->mSize;
+            segment->mSize += RecordHeaderSize + pPart[0].second + pPart[1].second + pPart[2].second;
+            
+            return true;
+        }
+        
+        void link(Entry pEntry)
+        {
+            mSegment.at(pEntry.mSegment).mLiveSize += pEntry.mSize;
+            mSize += pEntry.mSize;
+            
+            std::string key = pEntry.mKey;
+            mEntry.push_front(std::move(pEntry));
+            mIndex.emplace(std::move(key), mEntry.begin());
+        }
+        
+        uint32_t erase(std::unordered_map<std::string, std::list<Entry>::iterator>::iterator pIterator)
+        {
+            const Entry& entry = *pIterator->second;
+            const uint32_t segment = entry.mSegment;
+            
+            mSegment.at(segment).mLiveSize -= entry.mSize;
+            mSize -= entry.mSize;
+            
+            mEntry.erase(pIterator->second);
+            mIndex.erase(pIterator);
+            
+            return segment;
+        }
+        
+        void trim()
+        {
+            while (!mEntry.empty() && (mIndex.size() > mCountLimit || (mSizeLimit > 0 && mSize > mSizeLimit)))
+                checkSegment(erase(mIndex.find(mEntry.back().mKey)));
+        }
+        
+        void checkSegment(uint32_t pId)
+        {
+            const Segment& segment = mSegment.at(pId);
+            if (pId == mActiveSegment || (segment.mSize > 0 && segment.mLiveSize * 2 >= segment.mSize))
+                return;
+            
+            if (std::find(mCompactionSegment.begin(), mCompactionSegment.end(), pId) == mCompactionSegment.end())
+                mCompactionSegment.push_back(pId);
+            
+            if (!mCompaction)
             {
-                if (pMessageCallback != nullptr)
-                    Hermes::getInstance()->getTaskManager()->execute(-1, std::move(pMessageCallback), std::move(it->mPayload), static_cast<ENetworkWebSocketOpCode>(opCode) == ENetworkWebSocketOpCode::Text);
+                mCompaction = true;
                 
-                it = pOldFrame.erase(it);
+                Hermes::getInstance()->getTaskManager()->execute(mThreadPoolId, [weakThis = weak_from_this()]() -> void
+                {
+                    if (auto packCache = weakThis.lock())
+                        packCache->compact();
+                });
             }
-            else
+        }
+        
+        // Live records are copied to the active segment and the old segment is removed. The copy runs without the index mutex, records erased
+        // meanwhile are left as dead data and the index is moved to the copies only when all of them were written.
+        void compact()
+        {
+            while (true)
             {
-                multiMessage += std::move(it->mPayload);
+                std::lock_guard<std::mutex> writerLock(mWriterMutex);
+                uint32_t id = 0;
+                std::shared_ptr<const Mapping> mapping;
+                std::vector<Entry> record;
                 
-                if (pMessageCallback != nullptr)
-                    Hermes::getInstance()->getTaskManager()->execute(-1, std::move(pMessageCallback), std::move(multiMessage), multiFrameOpCode == ENetworkWebSocketOpCode::Text);
+                {
+                    std::lock_guard<std::mutex> lock(mMutex);
+                    if (mCompactionSegment.empty())
+                    {
+                        mCompaction = false;
+                        break;
+                    }
+                    
+                    id = mCompactionSegment.front();
+                    mCompactionSegment.erase(mCompactionSegment.begin());
+                    
+                    auto segment = mSegment.find(id);
+                    if (segment == mSegment.end() || id == mActiveSegment)
+                        continue;
+                    
+                    if (segment->second.mLiveSize > 0)
+                    {
+                        mapping = getMapping(segment->second, segment->second.mSize);
+                        if (mapping == nullptr)
+                            continue;
+                        
+                        for (const auto& v : mEntry)
+                        {
+                            if (v.mSegment == id)
+                                record.push_back(v);
+                        }
+                    }
+                }
                 
-                multiMessage = "";
+                bool status = true;
+                std::vector<std::pair<uint32_t, uint64_t>> location;
+                location.reserve(record.size());
                 
-                it = pOldFrame.erase(firstFrameIt, it + 1);
+                for (size_t i = 0; status && i < record.size(); ++i)
+                {
+                    const char* data = mapping->mData + record[i].mOffset;
+                    uint32_t segment = 0;
+                    uint64_t offset = 0;
+                    status = append(data, {{{data + RecordHeaderSize, static_cast<size_t>(record[i].mSize) - RecordHeaderSize}, {nullptr, 0}, {nullptr, 0}}}, segment, offset);
+                    
+                    if (status)
+                        location.push_back({segment, offset});
+                }
+                
+                // The old segment is removed only once the copied records are durable, the same way a batch of put is.
+                for (size_t i = 0; status && mSync && i < location.size(); ++i)
+                {
+                    if (i > 0 && location[i].first == location[i - 1].first)
+                        continue;
+                    
+                    const Segment& target = mSegment.at(location[i].first);
+                    if (fsync(target.mDescriptor) != 0)
+                    {
+                        Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Cache failed to sync segment at '%'", target.mFilePath);
+                        status = false;
+                    }
+                }
+                
+                if (!status)
+                    continue;
+                
+                Segment removedSegment;
+                
+                {
+                    std::lock_guard<std::mutex> lock(mMutex);
+                    
+                    for (size_t i = 0; i < record.size(); ++i)
+                    {
+                        auto it = mIndex.find(record[i].mKey);
+                        if (it == mIndex.end() || it->second->mSegment != id || it->second->mOffset != record[i].mOffset)
+                            continue;
+                        
+                        mSegment.at(id).mLiveSize -= record[i].mSize;
+                        mSegment.at(location[i].first).mLiveSize += record[i].mSize;
+                        it->second->mSegment = location[i].first;
+                        it->second->mOffset = location[i].second;
+                    }
+                    
+                    auto segment = mSegment.find(id);
+                    removedSegment = std::move(segment->second);
+                    mSegment.erase(segment);
+                }
+                
+                close(removedSegment.mDescriptor);
+                
+                if (std::remove(removedSegment.mFilePath.c_str()) != 0)
+                    Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Cache failed to delete file at '%'", removedSegment.mFilePath);
             }
         }
         
-        return !endSent;
-    }
-    
-    /* NetworkRecovery */
+        static constexpr char mMagicWord[5] = {'Y', 'G', 'G', '_', 'P'};
+        
+        const std::string mDirectoryPath;
+        const unsigned mCountLimit;
+        const uint64_t mSizeLimit;
+        const int32_t mThreadPoolId;
+        std::list<Entry> mEntry;
+        std::unordered_map<std::string, std::list<Entry>::iterator> mIndex;
+        std::map<uint32_t, Segment> mSegment;
+        std::vector<uint32_t> mCompactionSegment;
+        uint32_t mActiveSegment = 0;
+        uint64_t mSize = 0;
+        bool mCompaction = false;
+        bool mSync;
+        std::mutex mMutex;
+        std::mutex mWriterMutex;
+    };
     
-    NetworkRecovery::NetworkRecovery(size_t pId, std::string pName, Config pConfig) : mId(pId), mName(std::move(pName))
+    class NetworkManager::Certificate
     {
-        assert(pConfig.mCondition != nullptr && pConfig.mCallback != nullptr);
-
-        auto internalData = std::shared_ptr<InternalData>(new InternalData());
-        mInternalData = internalData;
-        mCondition = std::move(pConfig.mCondition);
+    public:
+        Certificate(ENetworkCertificate pType, std::string pData) : mType(pType), mData(std::move(pData)), mBlob({})
+        {
+            if (mType == ENetworkCertificate::Content)
+            {
+                mBlob.data = mData.data();
+                mBlob.len = mData.size();
+                mBlob.flags = CURL_BLOB_NOCOPY;
+            }
+        }
 
-        auto callback = [lpCallback = std::move(pConfig.mCallback), internalData](NetworkResponse lpResponse) -> void
+        ENetworkCertificate mType = ENetworkCertificate::None; 
+        std::string mData;
+        curl_blob mBlob = {};
+    };
+    
+    // Counters of an API spread over shards, so threads finishing transfers at once don't write to the same cache lines.
+    // The latency histogram has 8 linear buckets per power of two microseconds, which keeps the relative error of a bucket below 12.5%.
+    class NetworkManager::MetricsData
+    {
+    public:
+        static constexpr size_t ShardCount = 8;
+        static constexpr size_t CodeCount = static_cast<size_t>(ENetworkCode::Overload) + 2;
+        static constexpr size_t SubBucketBit = 3;
+        static constexpr size_t SubBucketCount = 1 << SubBucketBit;
+        static constexpr size_t MaxExponent = 40;
+        static constexpr size_t LatencyCount = SubBucketCount * (MaxExponent - SubBucketBit + 2);
+        
+        static size_t getCodeIndex(ENetworkCode pCode)
         {
-            internalData->mActive = false;
+            const int32_t code = static_cast<int32_t>(pCode);
+            return code >= 0 && code < static_cast<int32_t>(CodeCount) - 1 ? static_cast<size_t>(code) : CodeCount - 1;
+        }
+        
+        static ENetworkCode getCode(size_t pIndex)
+        {
+            return pIndex < CodeCount - 1 ? static_cast<ENetworkCode>(pIndex) : ENetworkCode::Unknown;
+        }
+        
+        static size_t getLatencyIndex(int64_t pTime)
+        {
+            const uint64_t value = pTime > 0 ? static_cast<uint64_t>(pTime) : 0;
+            if (value < SubBucketCount)
+                return static_cast<size_t>(value);
             
-            const ENetworkCode code = lpResponse.mCode;
-            Hermes::getInstance()->getLogger()->print(ELogLevel::Info, "Recovery: %, code: %, http: %, message: %", (code == ENetworkCode::OK) ? "passed" : "failed", static_cast<int32_t>(code), lpResponse.mHttpCode, lpResponse.mMessage);
-
-            if (lpCallback != nullptr)
-                lpCallback(std::move(lpResponse));
+            size_t exponent = SubBucketBit;
+            while (exponent < MaxExponent && (value >> (exponent + 1)) > 0)
+                ++exponent;
             
-            while (internalData->mReceiver.size() != 0)
+            if ((value >> (exponent + 1)) > 0)
+                return LatencyCount - 1;
+            
+            const size_t shift = exponent - SubBucketBit;
+            return SubBucketCount * (shift + 1) + static_cast<size_t>((value >> shift) & (SubBucketCount - 1));
+        }
+        
+        static int64_t getLatencyBound(size_t pIndex)
+        {
+            if (pIndex < SubBucketCount)
+                return static_cast<int64_t>(pIndex);
+            
+            const size_t shift = pIndex / SubBucketCount - 1;
+            const uint64_t base = SubBucketCount + pIndex % SubBucketCount;
+            return static_cast<int64_t>(((base + 1) << shift) - 1);
+        }
+        
+        void addTransfer(ENetworkCode pCode, int64_t pTime, uint64_t pDownloadSize, uint64_t pUploadSize)
+        {
+            Shard& shard = getShard();
+            shard.mCode[getCodeIndex(pCode)].fetch_add(1, std::memory_order_relaxed);
+            shard.mLatency[getLatencyIndex(pTime)].fetch_add(1, std::memory_order_relaxed);
+            shard.mLatencySum.fetch_add(static_cast<uint64_t>(std::max<int64_t>(0, pTime)), std::memory_order_relaxed);
+            shard.mDownloadSize.fetch_add(pDownloadSize, std::memory_order_relaxed);
+            shard.mUploadSize.fetch_add(pUploadSize, std::memory_order_relaxed);
+        }
+        
+        void addCache(bool pHit)
+        {
+            (pHit ? getShard().mCacheHitCount : getShard().mCacheMissCount).fetch_add(1, std::memory_order_relaxed);
+        }
+        
+        void addRetry()
+        {
+            getShard().mRetryCount.fetch_add(1, std::memory_order_relaxed);
+        }
+        
+        // Shards are summed without a lock, so counters of transfers finishing meanwhile may be a step apart.
+        NetworkMetrics getMetrics() const
+        {
+            NetworkMetrics metrics;
+            std::array<uint64_t, CodeCount> code = {};
+            std::vector<uint64_t> latency(LatencyCount, 0);
+            uint64_t latencySum = 0;
+            
+            for (const auto& v : mShard)
             {
-                auto receiver = &internalData->mReceiver.front();                
-                auto networkManager = Hermes::getInstance()->getNetworkManager();
-                auto networkAPI = (std::get<0>(*receiver) < networkManager->count()) ? networkManager->get(std::get<0>(*receiver)) : nullptr;
-
-                if (networkAPI != nullptr && code == ENetworkCode::OK)
+                for (size_t i = 0; i < CodeCount; ++i)
+                    code[i] += v.mCode[i].load(std::memory_order_relaxed);
+                
+                for (size_t i = 0; i < LatencyCount; ++i)
+                    latency[i] += v.mLatency[i].load(std::memory_order_relaxed);
+                
+                latencySum += v.mLatencySum.load(std::memory_order_relaxed);
+                metrics.mDownloadSize += v.mDownloadSize.load(std::memory_order_relaxed);
+                metrics.mUploadSize += v.mUploadSize.load(std::memory_order_relaxed);
+                metrics.mCacheHitCount += v.mCacheHitCount.load(std::memory_order_relaxed);
+                metrics.mCacheMissCount += v.mCacheMissCount.load(std::memory_order_relaxed);
+                metrics.mRetryCount += v.mRetryCount.load(std::memory_order_relaxed);
+            }
+            
+            for (size_t i = 0; i < CodeCount; ++i)
+            {
+                if (code[i] > 0)
                 {
-                    NetworkRequest* param = &std::get<1>(*receiver);
-
-                    auto defaultHeader = networkAPI->getDefaultHeader();
-                    
-                    param->mMethod = networkAPI->getUrl() + param->mMethod;
-                    param->mHeader.insert(param->mHeader.end(), defaultHeader.begin(), defaultHeader.end());
-
-                    Hermes::getInstance()->getLogger()->print(ELogLevel::Info, "Executed method from recovery: %.", param->mMethod);
-
-                    networkManager->request(std::move(*param), std::get<2>(*receiver));
+                    metrics.mCodeCount.emplace_back(getCode(i), code[i]);
+                    metrics.mRequestCount += code[i];
                 }
-                
-                internalData->mReceiver.pop();
             }
+            
+            for (size_t i = 0; i < LatencyCount; ++i)
+            {
+                if (latency[i] > 0)
+                    metrics.mLatency.emplace_back(getLatencyBound(i), latency[i]);
+            }
+            
+            metrics.mLatencySum = static_cast<int64_t>(latencySum);
+            
+            return metrics;
+        }
+        
+    private:
+        class alignas(64) Shard
+        {
+        public:
+            std::array<std::atomic<uint64_t>, CodeCount> mCode {};
+            std::array<std::atomic<uint64_t>, LatencyCount> mLatency {};
+            std::atomic<uint64_t> mLatencySum {0};
+            std::atomic<uint64_t> mDownloadSize {0};
+            std::atomic<uint64_t> mUploadSize {0};
+            std::atomic<uint64_t> mCacheHitCount {0};
+            std::atomic<uint64_t> mCacheMissCount {0};
+            std::atomic<uint64_t> mRetryCount {0};
         };
-
-        mRequestParam.mRequestType = pConfig.mRequestType;
-        mRequestParam.mResponseType = ENetworkResponse::Message;
-        mRequestParam.mMethod = std::move(pConfig.mUrl);
-        mRequestParam.mParameter = std::move(pConfig.mParameter);
-        mRequestParam.mHeader = std::move(pConfig.mHeader);
-        mRequestParam.mRequestBody = "";
-        mRequestParam.mCallback = std::move(callback);
-        mRequestParam.mTaskBackground = std::move(pConfig.mTaskBackground);
-        mRequestParam.mProgress = nullptr;
-        mRequestParam.mRepeatCount = pConfig.mRepeatCount;
-        mRequestParam.mAllowRecovery = false;
-    }
+        
+        // Each thread keeps the shard it got first, threads are assigned to shards in turn.
+        Shard& getShard()
+        {
+            static std::atomic<size_t> threadCount {0};
+            static thread_local const size_t index = threadCount.fetch_add(1, std::memory_order_relaxed) % ShardCount;
+            
+            return mShard[index];
+        }
+        
+        std::array<Shard, ShardCount> mShard;
+    };
     
-    NetworkRecovery::~NetworkRecovery()
+    /* NetworkResponse */
+    
+    const std::string* NetworkResponse::getHeader(const std::string& pName) const
     {
+        for (const auto& v : mHeader)
+        {
+            if (HEADER_NAME_EQUAL(v.first, pName))
+                return &v.second;
+        }
+        
+        return nullptr;
     }
     
-    bool NetworkRecovery::isQueueEmpty() const
-    {
-        return mInternalData->mReceiver.empty();
-    }
-    
-    bool NetworkRecovery::checkCondition(const NetworkResponse& pResponse, std::string& pRequestBody, std::vector<std::pair<std::string, std::string>>& pParameter, std::vector<std::pair<std::string, std::string>>& pHeader) const
-    {
-        return mCondition != nullptr && mCondition(pResponse, pRequestBody, pParameter, pHeader);
-    }
+    /* NetworkMetrics */
     
-    void NetworkRecovery::pushReceiver(std::tuple<size_t, NetworkRequest, std::shared_ptr<NetworkRequestHandle>> pReceiver)
+    int64_t NetworkMetrics::getLatency(float pPercentile) const
     {
-        mInternalData->mReceiver.push(std::move(pReceiver));
+        uint64_t count = 0;
+        for (const auto& v : mLatency)
+            count += v.second;
+        
+        if (count == 0)
+            return 0;
+        
+        const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(std::min(std::max(pPercentile, 0.0f), 1.0f) * static_cast<double>(count))));
+        uint64_t accumulated = 0;
+        
+        for (const auto& v : mLatency)
+        {
+            accumulated += v.second;
+            if (accumulated >= rank)
+                return v.first;
+        }
+        
+        return mLatency.back().first;
     }
-    
-    void NetworkRecovery::runRequest(std::string pRequestBody, std::vector<std::pair<std::string, std::string>> pParameter, std::vector<std::pair<std::string, std::string>> pHeader)
-    {
-        mRequestParam.mRequestBody = std::move(pRequestBody);
-
-        auto cpParameter = std::move(mRequestParam.mParameter);
-        mRequestParam.mParameter = std::move(pParameter);
-        mRequestParam.mParameter.reserve(mRequestParam.mParameter.size() + cpParameter.size());
-        mRequestParam.mParameter.insert(mRequestParam.mParameter.end(), cpParameter.begin(), cpParameter.end());
-
-        auto cpHeader = std::move(mRequestParam.mHeader);
-        mRequestParam.mHeader = std::move(pHeader);
-        mRequestParam.mHeader.reserve(mRequestParam.mHeader.size() + cpHeader.size());
-        mRequestParam.mHeader.insert(mRequestParam.mHeader.end(), cpHeader.begin(), cpHeader.end());
-
-        Hermes::getInstance()->getNetworkManager()->request(mRequestParam);
 
-        mRequestParam.mParameter = std::move(cpParameter);
-        mRequestParam.mHeader = std::move(cpHeader);
-    }
-    
-    bool NetworkRecovery::isActive() const
+    void NetworkRequestHandle::cancel()
     {
-        return mInternalData->mActive;
+        mCancel.store(1);
     }
     
-    bool NetworkRecovery::activate()
+    bool NetworkRequestHandle::isCancel() const
     {
-        bool status = !mInternalData->mActive;
-        mInternalData->mActive = true;            
-        
-        return status;
+        return static_cast<bool>(mCancel.load()) || (mParent != nullptr && mParent->isCancel());
     }
     
-    const std::vector<std::pair<std::string, std::string>>& NetworkRecovery::getHeader() const
+    void NetworkRequestHandle::pause()
     {
-        return mRequestParam.mHeader;
+        mPause.store(1);
     }
     
-    void NetworkRecovery::setHeader(const std::vector<std::pair<std::string, std::string>>& pHeader)
-    {
-        mRequestParam.mHeader = pHeader;
-    }
-        
-    const std::vector<std::pair<std::string, std::string>>& NetworkRecovery::getParameter() const
+    void NetworkRequestHandle::resume()
     {
-        return mRequestParam.mParameter;
+        mResume++;
+        mPause.store(0);
     }
     
-    void NetworkRecovery::setParameter(const std::vector<std::pair<std::string, std::string>>& pParameter)
-    {
-        mRequestParam.mParameter = pParameter;
-    }
-
-    size_t NetworkRecovery::getId() const
+    bool NetworkRequestHandle::isPause() const
     {
-        return mId;
+        return static_cast<bool>(mPause.load()) || (mParent != nullptr && mParent->isPause());
     }
     
-    const std::string& NetworkRecovery::getName() const
+    NetworkWebSocketHandle::ControlBlock::~ControlBlock()
     {
-        return mName;
+        if (mHandle != nullptr)
+            curl_easy_cleanup(mHandle);
     }
     
-    /* NetworkAPI */
+    /* NetworkWebSocketHandle */
     
-    NetworkAPI::NetworkAPI(size_t pId, std::string pName, std::string pUrl) :  mId(pId), mName(std::move(pName)), mUrl(std::move(pUrl)), mCallbackContinious(decltype(mCallbackContinious)(new std::vector<std::pair<std::function<void(const NetworkResponse&)>, std::string>>()))
+    NetworkWebSocketHandle::~NetworkWebSocketHandle()
     {
+        uint32_t terminated = 0;
+        mControlBlock->mTerminate.compare_exchange_strong(terminated, 1);
     }
     
-    NetworkAPI::~NetworkAPI()
-    {
-    }
-
-    std::shared_ptr<NetworkRequestHandle> NetworkAPI::request(NetworkRequest pParam)
+    void NetworkWebSocketHandle::sendMessage(const std::string& pMessage, std::function<void(ENetworkCode)> pCallback)
     {
-        std::shared_ptr<NetworkRequestHandle> requestHandle = std::make_shared<NetworkRequestHandle>();
-        auto callbackContinious = mCallbackContinious;
-    
-        pParam.mCallback = [responseCallback = pParam.mCallback, callbackContinious](NetworkResponse lpResponse) -> void
-        {
-            for (const auto& v : *callbackContinious)
-            {
-                if (v.first != nullptr)
-                    v.first(lpResponse);
-            }
-            
-            if (responseCallback != nullptr)
-                responseCallback(std::move(lpResponse));
-        };
-
-        std::string url = mUrl + pParam.mMethod;
-        auto recovery = mRecovery.lock();
-
-        if (pParam.mAllowRecovery && recovery != nullptr)
+        std::string message = packMessage(pMessage);
+        
+        auto controlBlock = mControlBlock;
+        auto messageTask = [message = std::move(message), pCallback = std::move(pCallback), controlBlock]() mutable -> void
         {
-            size_t copyId = mId;
-            pParam.mCallback = [recovery, copyId, url, pParam, requestHandle](NetworkResponse lpResponse) -> void
+            if (controlBlock->mHandle != nullptr)
             {
-                std::string requestBody = "";
-                std::vector<std::pair<std::string, std::string>> parameter;
-                std::vector<std::pair<std::string, std::string>> header;
+                unsigned tryCount = 0;                
+                curl_socket_t socketfd;
+                CURLcode cCode = curl_easy_getinfo(controlBlock->mHandle, CURLINFO_ACTIVESOCKET, &socketfd);
                 
-                if (recovery->isActive() || recovery->checkCondition(lpResponse, requestBody, parameter, header))
+                if (cCode != CURLE_OK)
                 {
-                    recovery->pushReceiver(std::make_tuple(copyId, std::move(pParam), requestHandle));
-
-                    if (recovery->activate())
-                        recovery->runRequest(std::move(requestBody), std::move(parameter), std::move(header));
+                    if (pCallback != nullptr)
+                    {
+                        Hermes::getInstance()->getTaskManager()->execute(-1, [lpCallback = std::move(pCallback), cCode]() -> void
+                        {
+                            lpCallback(static_cast<ENetworkCode>(static_cast<int32_t>(ENetworkCode::Unknown) + static_cast<int32_t>(cCode)));
+                        });
+                    }
 
-                    Hermes::getInstance()->getLogger()->print(ELogLevel::Info, "Queued method for recovery: %.", url);
+                    return;
                 }
-                else
+                
+                uint32_t terminateAbort = 0;
+                
+                do
                 {
-                    pParam.mCallback(std::move(lpResponse));
+                    if (tryCount != 0)
+                        CURL_WAIT_ON_SOCKET(socketfd, 1, 1000);
+                    
+                    size_t sendCount = 0;
+                    cCode = curl_easy_send(controlBlock->mHandle, message.c_str(), message.size(), &sendCount);
+                    
+                    tryCount++;
                 }
-            };
-        }
-
-        if (recovery != nullptr && recovery->isActive())
-        {
-            recovery->pushReceiver(std::make_tuple(mId, pParam, requestHandle));
+                while ((terminateAbort = controlBlock->mTerminate.load()) == 0 && cCode == CURLE_AGAIN && tryCount < 3);
+                
+                if (terminateAbort == 0)
+                {
+                    if (pCallback != nullptr)
+                    {
+                        ENetworkCode code = cCode == CURLE_OK ? ENetworkCode::OK : static_cast<ENetworkCode>(static_cast<int32_t>(ENetworkCode::Unknown) + static_cast<int32_t>(cCode));
+                        Hermes::getInstance()->getTaskManager()->execute(-1, [lpCallback = std::move(pCallback), code]() -> void
+                        {
+                            lpCallback(code);
+                        });
+                    }
+                }
+            }
+        };
 
-            Hermes::getInstance()->getLogger()->print(ELogLevel::Info, "Queued method for recovery: %.", url);
-        }
-        else
-        {
-            pParam.mMethod = std::move(url);
-            pParam.mHeader.insert(pParam.mHeader.end(), mDefaultHeader.begin(), mDefaultHeader.end());
-        
-            Hermes::getInstance()->getNetworkManager()->request(std::move(pParam), requestHandle);
-        }
-        
-        return requestHandle;
-    }
-    
-    const std::vector<std::pair<std::string, std::string>>& NetworkAPI::getDefaultHeader() const
-    {
-        return mDefaultHeader;
-    }
-    
-    void NetworkAPI::setDefaultHeader(std::vector<std::pair<std::string, std::string>> pDefaultHeader)
-    {
-        mDefaultHeader = std::move(pDefaultHeader);
+        std::lock_guard<std::mutex> lock(mMessage.second);
+        mMessage.first.push(std::move(messageTask));
     }
     
-    bool NetworkAPI::registerCallback(std::function<void(const NetworkResponse&)> pCallback, std::string pName, bool pOverwrite)
+    void NetworkWebSocketHandle::initialize(int32_t pThreadPoolId, NetworkWebSocket pParam, NetworkManager* pNetworkManager)
     {
-        auto checkItem = [pName](const std::pair<std::function<void(const NetworkResponse&)>, std::string>& lpElement) -> bool
-        {
-            if (lpElement.second == pName)
-                return true;
-            
-            return false;
-        };
+        assert(pNetworkManager != nullptr);
         
-        auto it = std::find_if(mCallbackContinious->begin(), mCallbackContinious->end(), checkItem);
+        auto controlBlock = std::make_shared<ControlBlock>();
+        mControlBlock = controlBlock;
         
-        bool status = false;
-    
-        if (it == mCallbackContinious->end())
-        {
-            mCallbackContinious->push_back(std::make_pair(std::move(pCallback), std::move(pName)));
-            status = true;
-        }
-        else if (pOverwrite)
+        pNetworkManager->appendParameter(pParam.mUrl, pParam.mParameter);
+        // The parsed url is shared by copies of the task, instead of parsing it again with each copy.
+        auto url = std::make_shared<const tools::URLTool>(pParam.mUrl);
+        curl_socket_t socketfd = 0;
+
+        auto certificate = pNetworkManager->mCertificate;
+        NetworkManager::RequestSettings requestSettings;
         {
-            *it = std::make_pair(std::move(pCallback), std::move(pName));
-            status = true;
+            std::lock_guard<std::mutex> lock(pNetworkManager->mRequestSettingsMutex);
+            requestSettings = pNetworkManager->mRequestSettings;
         }
         
-        return status;
-    }
-
-    bool NetworkAPI::unregisterCallback(std::string pName)
-    {
-        bool status = false;
-        
-        auto checkItem = [&status, pName](const std::pair<std::function<void(const NetworkResponse&)>, std::string>& lpElement) -> bool
+        auto weakThis = mWeakThis;
+        Hermes::getInstance()->getTaskManager()->executeContinuous(pThreadPoolId, [controlBlock]() -> bool
         {
-            if (lpElement.second == pName)
+            return controlBlock->mTerminate.load() == 2;
+        }, [pParam = std::move(pParam), controlBlock, url, socketfd, certificate = std::move(certificate), requestSettings = std::move(requestSettings), weakThis]() mutable -> void
+        {
+            auto strongThis = weakThis.lock();
+            if (strongThis != nullptr)
             {
-                status = true;
-                return status;
-            }
-            
-            return false;
-        };
-        
-        mCallbackContinious->erase(remove_if(mCallbackContinious->begin(), mCallbackContinious->end(), checkItem), mCallbackContinious->end());
-        
-        return status;
-    }
-    
-    std::weak_ptr<NetworkRecovery> NetworkAPI::getRecovery() const
-    {
-        return mRecovery;
-    }
-    
-    void NetworkAPI::setRecovery(std::weak_ptr<NetworkRecovery> pRecovery)
-    {
-        mRecovery = pRecovery;
-    }
-    
-    size_t NetworkAPI::getId() const
-    {
-        return mId;
-    }
-    
-    const std::string& NetworkAPI::getName() const
-    {
-        return mName;
-    }
-
-    const std::string& NetworkAPI::getUrl() const
-    {
-        return mUrl;
-    }
-    
-    /* NetworkManager */
-    
-    NetworkManager::NetworkManager() : mCertificate(std::make_shared<NetworkManager::Certificate>(ENetworkCertificate::None, ""))
-    {
-    }
-    
-    NetworkManager::~NetworkManager()
-    {
-        terminate();
-    }
-    
-    void NetworkManager::deleterNetworkAPI(NetworkAPI* pObject)
-    {
-        delete pObject;
-    }
-    
-    void NetworkManager::deleterNetworkRecovery(NetworkRecovery* pObject)
-    {
-        delete pObject;
-    }
-    
-    bool NetworkManager::initialize(int64_t pTimeout, int32_t pThreadPoolId, int32_t pSocketThreadPoolId, std::pair<ENetworkCertificate, std::string> pCertificate)
-    {
-        assert(pCertificate.first == ENetworkCertificate::None || pCertificate.second.size() > 0);
+                if (!controlBlock->mInitialized)
+                {
+                    controlBlock->mTime = {std::chrono::steady_clock::now(), std::chrono::steady_clock::now()};
 
-        uint32_t initialized = 0;
+                    controlBlock->mHandle = curl_easy_init();
+                    if (controlBlock->mHandle != nullptr)
+                    {
+                        curl_easy_setopt(controlBlock->mHandle, CURLOPT_URL, url->getHttpURL().c_str());
+                        curl_easy_setopt(controlBlock->mHandle, CURLOPT_CONNECT_ONLY, 1L);
+                        curl_easy_setopt(controlBlock->mHandle, CURLOPT_SSL_VERIFYPEER, !requestSettings.mFlag[static_cast<size_t>(ENetworkFlag::DisableSSLVerifyPeer)] ? 1L : 0L);
 
-        if (mInitialized.compare_exchange_strong(initialized, 1))
-        {
-            if (curl_global_init(CURL_GLOBAL_ALL) == CURLE_OK)
-            {
-                {
-                    std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
-                    mRequestSettings.mTimeout = pTimeout;
+                        if (certificate->mType == ENetworkCertificate::Path)
+                            curl_easy_setopt(controlBlock->mHandle, CURLOPT_CAINFO, certificate->mData.c_str());
+                        else if (certificate->mType == ENetworkCertificate::Content)
+                            curl_easy_setopt(controlBlock->mHandle, CURLOPT_CAINFO_BLOB, &certificate->mBlob);
+                        
+                        CURLcode result = curl_easy_perform(controlBlock->mHandle);
+                        if (result == CURLE_OK)
+                        {
+                            result = curl_easy_getinfo(controlBlock->mHandle, CURLINFO_LASTSOCKET, &socketfd);
+                            if (result == CURLE_OK)
+                            {
+                                result = static_cast<CURLcode>(strongThis->sendUpgradeHeader(*url, pParam.mHeader, strongThis->mSecWebSocketAccept));
+                                if (result == CURLE_OK)
+                                {
+                                    controlBlock->mInitialized = true;
+                                }
+                                else
+                                {
+                                    Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Socket header message fail for url '%'. CURL CODE %, message: '%'", url->getURL(), result, curl_easy_strerror(result));
+                                    controlBlock->mDisconnect = ENetworkWebSocketDisconnect::Header;
+                                    controlBlock->mTerminate.store(1);
+                                }
+                            }
+                            else
+                            {
+                                Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Socket get info failure for url '%'. CURL CODE %, message: '%'", pParam.mUrl, result, curl_easy_strerror(result));
+                                controlBlock->mDisconnect = ENetworkWebSocketDisconnect::InitialConnection;
+                                controlBlock->mTerminate.store(1);
+                            }
+                        }
+                        else
+                        {
+                            Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Socket connection failure for url '%'. CURL CODE %, message: '%'", pParam.mUrl, result, curl_easy_strerror(result));
+                            controlBlock->mDisconnect = ENetworkWebSocketDisconnect::InitialConnection;
+                            controlBlock->mTerminate.store(1);
+                        }
+                    }
+                    else
+                    {
+                        Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Curl easy init fail for socket.");
+                        controlBlock->mDisconnect = ENetworkWebSocketDisconnect::InitialConnection;
+                        controlBlock->mTerminate.store(1);
+                    }
                 }
-                
-                mThreadPoolId = pThreadPoolId;
-                mWebSocketThreadPoolId = pSocketThreadPoolId;
-                mCertificate = std::make_shared<NetworkManager::Certificate>(pCertificate.first, std::move(pCertificate.second));
 
-                mInitialized.store(2);
-            }
-            else
-            {
-                initialized = 1;
-                mInitialized.store(0);
-            }
-        }
-    
-        return initialized == 0;
-    }
+                if (controlBlock->mInitialized)
+                {
+                    const size_t bufferLength = 2048;
+                    char buffer[bufferLength];
+                    std::string data;
+                    bool error = false;
     
-    bool NetworkManager::terminate()
-    {
-        uint32_t terminated = 2;
+                    do
+                    {
+                        size_t readCount = 0;
+                        CURLcode result = curl_easy_recv(controlBlock->mHandle, buffer, bufferLength * sizeof(char), &readCount);
+                        if (result != CURLE_OK && result != CURLE_AGAIN)
+                        {
+                            Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Socket read fail for url '%'. CURL CODE %, message: '%'", url->getURL(), result, curl_easy_strerror(result));
+                            controlBlock->mDisconnect = ENetworkWebSocketDisconnect::Other;
+                            controlBlock->mTerminate.store(1);
+                            error = true;
+                            
+                            break;
+                        }
+                        else if (readCount > 0)
+                        {
+                            data.append(buffer, readCount);
+                        }
+                        else
+                        {
+                            if (!data.empty())
+                                controlBlock->mTime.first = std::chrono::steady_clock::now();
+                            
+                            break;
+                        }
+                    }
+                    while (true);
 
-        if (mInitialized.compare_exchange_strong(terminated, 1))
-        {
-            mTerminateAbort.store(1);
-            auto taskManager = Hermes::getInstance()->getTaskManager();
-            
-            std::atomic<uint32_t> flushStatus(0);
-            auto flushCallback = [&flushStatus]() -> void
-            {
-                flushStatus++;
-            };
-            
-            taskManager->flush(mThreadPoolId, flushCallback);
-            taskManager->flush(mWebSocketThreadPoolId, flushCallback);
-            const uint32_t loopInterrupt = mThreadPoolId != mWebSocketThreadPoolId ? 2 : 1;
-            
-            while (flushStatus.load() < loopInterrupt)
-            {
-                std::this_thread::sleep_for(std::chrono::milliseconds(5));
-            }
-            
-            {
-                std::lock_guard<std::mutex> lock(mApiMutex);
-                mApi.clear();
+                    if (!error)
+                    {
+                        if (!data.empty())
+                        {
+                            if (strongThis->mHeaderCheck)
+                            {
+                                strongThis->mHeaderCheck = false;
+                                
+                                const std::string acceptKey = "Sec-WebSocket-Accept: ";
+                                size_t keyPos = data.find(acceptKey);
+                                size_t codePos = data.find("HTTP/1.1 101 Switching Protocols");
+                                
+                                if (codePos != std::string::npos && keyPos != std::string::npos && data.length() >= keyPos + acceptKey.length() + strongThis->mSecWebSocketAccept.length() && data.substr(keyPos + acceptKey.length(), strongThis->mSecWebSocketAccept.length()).compare(strongThis->mSecWebSocketAccept) == 0)
+                                {
+                                    if (pParam.mConnectCallback != nullptr)
+                                    {
+                                        Hermes::getInstance()->getTaskManager()->execute(-1, [connectCallback = std::move(pParam.mConnectCallback)]() -> void
+                                        {
+                                            connectCallback();
+                                        });
+                                    }
+                                }
+                                else
+                                {
+                                    Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Socket invalid handshake.");
+                                    controlBlock->mDisconnect = ENetworkWebSocketDisconnect::Handshake;
+                                    controlBlock->mTerminate.store(1);
+                                    error = true;
+                                }
+                            }
+                            else
+                            {
+                                auto frame = strongThis->unpackMessage(data);
+                                if (!strongThis->handleFrame(frame, strongThis->mFrames, pParam.mMessageCallback))
+                                {
+                                    
+                                    controlBlock->mDisconnect = ENetworkWebSocketDisconnect::Close;
+                                    controlBlock->mTerminate.store(1);
+                                    error = true;
+                                }
+                            }
+                        }
+                        
+                        if (pParam.mTimeout == std::chrono::milliseconds::zero() || (pParam.mTimeout > std::chrono::milliseconds::zero() && std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - controlBlock->mTime.first) < pParam.mTimeout))
+                        {
+                            CURL_WAIT_ON_SOCKET(socketfd, 1, 1000);
+                        }
+                        else
+                        {
+                            controlBlock->mDisconnect = ENetworkWebSocketDisconnect::Timeout;
+                            controlBlock->mTerminate.store(1);
+                            error = true;
+                        }
+                        
+                        if (!error)
+                        {
+                            std::lock_guard<std::mutex> lock(strongThis->mMessage.second);
+                            while (!strongThis->mMessage.first.empty())
+                            {
+                                strongThis->mMessage.first.front();
+                                strongThis->mMessage.first.pop();
+                            }
+                        }
+                    }
+                }
             }
             
+            if (controlBlock->mTerminate.load() == 1)
             {
-                std::lock_guard<std::mutex> lock(mRecoveryMutex);
-                mRecovery.clear();
-            }
-
-            {
-                std::lock_guard<std::mutex> lock(mCacheMutex);
-                mCacheFileInfo.clear();
-                mCacheFileIndex.clear();
-            }
+                if (controlBlock->mInitialized)
+                {
+                    std::string message = strongThis->packMessage("", ENetworkWebSocketOpCode::Close);
 
-            {
-                std::lock_guard<std::mutex> lock(mHandleMutex);
+                    size_t readCount = 0;
+                    CURLcode result = curl_easy_send(controlBlock->mHandle, message.c_str(), message.length(), &readCount);
+                    if (result != CURLE_OK)
+                        Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Close send failed. CURLcode %", static_cast<int32_t>(result));
+                }
             
-                for (auto& v : mHandle)
+                if (pParam.mDisconnectCallback != nullptr)
                 {
-                    if (v.second != nullptr)
-                        curl_easy_cleanup(v.second);
+                    auto disconnect = controlBlock->mDisconnect;
+                    auto difference = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - controlBlock->mTime.second);
+                    Hermes::getInstance()->getTaskManager()->execute(-1, [disconnectCallback = std::move(pParam.mDisconnectCallback), disconnect, difference]() mutable -> void
+                    {
+                        disconnectCallback(disconnect, difference);
+                    });
                 }
                 
-                mHandle.clear();
-            }
-                
-            {
-                std::lock_guard<std::mutex> lock(mMultiHandleMutex);
-            
-                for (auto& v : mMultiHandle)
-                {
-                    if (v.second != nullptr)
-                        curl_multi_cleanup(v.second);
-                }
-                
-                mMultiHandle.clear();
-            }
-
-            curl_global_cleanup();
-            
-            {
-                std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
-                mRequestSettings.mFlag = {false, false, false};
-                mRequestSettings.mTimeout = 0;
-                mRequestSettings.mProgressTimePeriod = 0;
+                controlBlock->mTerminate.store(2);
             }
+        });
+    }
 
-            mThreadPoolId = -1;
-            mWebSocketThreadPoolId = -1;
-            mCertificate = std::make_unique<NetworkManager::Certificate>(ENetworkCertificate::None, "");
-            
-            mCacheInitialized.store(0);
-            mTerminateAbort.store(0);
-
-            mInitialized.store(0);
-        }
+    int32_t NetworkWebSocketHandle::sendUpgradeHeader(const tools::URLTool& pUrl, const std::vector<std::pair<std::string, std::string>>& pHeader, std::string& pSecAccept) const
+    {
+        CURLcode code = CURLE_OK;
         
-        return terminated == 2;
-    }
+        std::string key = crypto::getRandomCryptoBytes(16);
+        key = crypto::encodeBase64(reinterpret_cast<const unsigned char*>(key.data()), key.size());
         
-    std::shared_ptr<NetworkAPI> NetworkManager::add(size_t pId, std::string pName, std::string pUrl)
-    {
-        return add<NetworkAPI>(pId, std::move(pName), std::move(pUrl));
-    }
-    
-    size_t NetworkManager::count() const
-    {
-        std::lock_guard<std::mutex> lock(mApiMutex);
-        return mApi.size();
-    }
-    
-    std::shared_ptr<NetworkAPI> NetworkManager::get(size_t pId) const
-    {
-        std::lock_guard<std::mutex> lock(mApiMutex);
-        assert(pId < mApi.size());
-
-        return mApi[pId];
+        std::string shaAccept = crypto::getSHA1Digest(key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11");
+        pSecAccept = crypto::encodeBase64(reinterpret_cast<const unsigned char*>(shaAccept.data()), shaAccept.size());
+        
+        std::string header = "GET ";
+        header.reserve(1024);
+        
+        size_t pathLength = 0;
+        const char* path = pUrl.getPath(pathLength, true);
+        header.append(path, pathLength);
+        
+        header += " HTTP/1.1\r\nHost: ";
+        
+        size_t hostLength = 0;
+        const char* host = pUrl.getHost(hostLength, true);
+        header.append(host, hostLength);
+        
+        header += "\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: " + key + "\r\nSec-WebSocket-Version: 13\r\nOrigin: " + pUrl.getHttpURL(false) + "\r\n";
+        
+        for (auto& v : pHeader)
+            header += v.first + ": " + v.second + "\r\n";
+        
+        header += "\r\n";
+        header.shrink_to_fit();
+        
+        size_t sendCount = 0;
+        code = curl_easy_send(mControlBlock->mHandle, header.c_str(), header.length(), &sendCount);
+        
+        return code;
     }
     
-    std::shared_ptr<NetworkRecovery> NetworkManager::addRecovery(size_t pId, std::string pName, NetworkRecovery::Config pConfig)
+    std::string NetworkWebSocketHandle::packMessage(const std::string& pMessage, ENetworkWebSocketOpCode pOpCode) const
     {
-        std::shared_ptr<NetworkRecovery> result = nullptr;
-        if (mInitialized.load() == 2)
+        std::string message;
+        
+        uint8_t codes = static_cast<uint8_t>(pOpCode);
+        uint8_t payloadLength = 0x80;
+        uint8_t mask[4] = {0};
+        uint16_t payloadLength16 = 0;
+        uint64_t payloadLength64 = 0;
+        
+        if (pMessage.length() <= 125)
         {
-            result = std::shared_ptr<NetworkRecovery>(new NetworkRecovery(pId, std::move(pName), std::move(pConfig)), std::bind(&NetworkManager::deleterNetworkRecovery, std::placeholders::_1));
+            payloadLength |= static_cast<uint8_t>(pMessage.length());
+            
+            message.reserve(sizeof(codes) + sizeof(payloadLength) + sizeof(mask) + pMessage.length());
+        }
+        else if (pMessage.length() <= std::numeric_limits<uint16_t>::max())
+        {
+            payloadLength |= 126;
+            payloadLength16 = pMessage.length();
+            payloadLength16 = tools::isLittleEndian() ? tools::byteSwap16(payloadLength16) : payloadLength16;
+            
+            message.reserve(sizeof(codes) + sizeof(payloadLength) + sizeof(payloadLength16) + sizeof(mask) + pMessage.size());
+        }
+        else
+        {
+            payloadLength |= 127;
+            payloadLength64 = pMessage.length();
+            payloadLength64 = tools::isLittleEndian() ? tools::byteSwap64(payloadLength64) : payloadLength64;
+            
+            message.reserve(sizeof(codes) + sizeof(payloadLength) + sizeof(payloadLength64) + sizeof(mask) + pMessage.size());
+        }
         
-            std::lock_guard<std::mutex> lock(mRecoveryMutex);
-            if (pId >= mRecovery.size())
-                mRecovery.resize(pId + 1);
-
-            assert(mRecovery[pId] == nullptr);
-            mRecovery[pId] = result;
+        message.append(reinterpret_cast<const char*>(&codes), sizeof(codes));
+        message.append(reinterpret_cast<const char*>(&payloadLength), sizeof(payloadLength));
+        
+        if (payloadLength16 > 0)
+            message.append(reinterpret_cast<const char*>(&payloadLength16), sizeof(payloadLength16));
+        else if (payloadLength64 > 0)
+            message.append(reinterpret_cast<const char*>(&payloadLength64), sizeof(payloadLength64));
+        
+        memcpy(mask, crypto::getRandomCryptoBytes(4).data(), sizeof(mask));
+        message.append(reinterpret_cast<const char*>(mask), sizeof(mask));
+        
+        if (pMessage.length() > 0)
+        {
+            uint8_t maskedMessage[pMessage.size()];
+            memcpy(maskedMessage, pMessage.data(), pMessage.size());
+            
+            for (size_t i = 0; i < pMessage.size(); i++)
+                maskedMessage[i] ^= mask[i % 4];
+            
+            message.append(reinterpret_cast<const char*>(maskedMessage), pMessage.size());
         }
-
-        return mRecovery[pId];
+        
+        return message;
     }
     
-    size_t NetworkManager::countRecovery() const
+    std::vector<NetworkWebSocketHandle::Frame> NetworkWebSocketHandle::unpackMessage(const std::string& pMessage) const
     {
-        std::lock_guard<std::mutex> lock(mRecoveryMutex);
-        return mRecovery.size();
-    }
+        std::vector<Frame> frames;
     
-    std::shared_ptr<NetworkRecovery> NetworkManager::getRecovery(size_t pId) const
-    {
-        std::lock_guard<std::mutex> lock(mRecoveryMutex);
-        assert(pId < mRecovery.size());
+        if (pMessage.length() == 0)
+            return frames;
 
-        return mRecovery[pId];
-    }
-    
-    void NetworkManager::request(NetworkRequest pParam, std::shared_ptr<NetworkRequestHandle> pRequestHandle)
-    {
-        if (pRequestHandle == nullptr)
-            pRequestHandle = std::make_shared<NetworkRequestHandle>();
+        const bool isLittleEndian = tools::isLittleEndian();
         
-        auto weakThis = mWeakThis;
-        auto requestTask = [weakThis, pRequestHandle](NetworkRequest lpParam, RequestSettings lpRequestSettings) -> void
+        bool loopContinue = false;
+        size_t frameOffset = 0;
+        
+        do
         {
-            std::shared_ptr<NetworkManager> strongThis = weakThis.lock();
-            if (strongThis != nullptr && strongThis->mInitialized.load() == 2)
+            Frame frame;
+            
+            if (frameOffset + sizeof(frame.mCode) + sizeof(frame.mPayloadLength) > pMessage.length())
             {
-                if (lpParam.mAllowCache)
-                {
-                    NetworkResponse response = strongThis->getResponseFromCache(lpParam.mMethod);
-                    if (response.mCode == ENetworkCode::OK)
-                    {
-                        if (lpParam.mCallback != nullptr)
-                        {
-                            if (lpParam.mTaskBackground != nullptr)
-                                response.mDataTaskBackground = lpParam.mTaskBackground(response);
-
-                            auto responseHandler = std::make_shared<decltype(response)>(std::move(response));
-                            Hermes::getInstance()->getTaskManager()->execute(-1, [callback = std::move(lpParam.mCallback), responseHandler = std::move(responseHandler)]() mutable -> void
-                            {
-                                callback(std::move(*responseHandler));
-                            });
-                        }
-
-                        return;
-                    }
-                }
-
-                ENetworkCode code = ENetworkCode::Unknown;
-                long httpCode = -1;
-                std::vector<std::pair<std::string, std::string>> responseHeader;
-                std::string responseMessage = "";
-                std::vector<uint8_t> responseRawData;
+                Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Socket frame parsing error. Message smaller than minimal header. Message length %, frameOffset %", pMessage.length(), frameOffset);
                 
-                auto uniqueHeader = strongThis->createUniqueHeader(lpParam.mHeader);
-                curl_slist* header = nullptr;
-
-                for (auto& v : uniqueHeader)
+                break;
+            }
+            
+            memcpy((char*)&frame, pMessage.data() + frameOffset, sizeof(frame.mCode) + sizeof(frame.mPayloadLength));
+            
+            bool useMask = frame.mPayloadLength & 0x80;
+            
+            size_t offset = sizeof(frame.mCode) + sizeof(frame.mPayloadLength);
+            uint64_t payloadSize = 0;
+            
+            if (frame.mPayloadLength <= 125)
+            {
+                payloadSize = frame.mPayloadLength & 0x7F;
+            }
+            else if (frame.mPayloadLength == 126)
+            {
+                uint16_t length = 0;
+                
+                if (frameOffset + offset + sizeof(length) > pMessage.length())
                 {
-                    std::string singleHeader = v.first;
-                    singleHeader += ": ";
-                    singleHeader += v.second;
+                    Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Socket frame parsing error. Message smaller than extended header. Message length %, frameOffset %", pMessage.length(), frameOffset);
                     
-                    header = curl_slist_append(header, singleHeader.c_str());
+                    break;
                 }
-
-                void* handle = nullptr;
                 
+                memcpy((char*)&length, pMessage.data() + frameOffset + offset, sizeof(length));
+                payloadSize = frame.mPayloadLengthExtended = isLittleEndian ? tools::byteSwap16(length) : length;
+                
+                offset += sizeof(length);
+            }
+            else
+            {
+                if (frameOffset + offset + sizeof(frame.mPayloadLengthExtended) > pMessage.length())
                 {
-                    std::lock_guard<std::mutex> lock(strongThis->mHandleMutex);
-                    handle = strongThis->mHandle[std::this_thread::get_id()];
+                    Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Socket frame parsing error. Message smaller than super extended header. Message length %, frameOffset %", pMessage.length(), frameOffset);
+                    break;
                 }
                 
-                if (handle == nullptr)
+                memcpy((char*)&frame.mPayloadLengthExtended, pMessage.data() + frameOffset + offset, sizeof(frame.mPayloadLengthExtended));
+                payloadSize = frame.mPayloadLengthExtended = isLittleEndian ? tools::byteSwap64(frame.mPayloadLengthExtended) : frame.mPayloadLengthExtended;
+                
+                offset += sizeof(frame.mPayloadLengthExtended);
+            }
+            
+            if (useMask)
+            {
+                if (frameOffset + offset + sizeof(frame.mMaskingKey) > pMessage.length())
                 {
-                    handle = curl_easy_init();
-
-                    curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, CURL_HEADER_CALLBACK);
-                    if (strongThis->mCertificate->mType == ENetworkCertificate::Path)
-                        curl_easy_setopt(handle, CURLOPT_CAINFO, strongThis->mCertificate->mData.c_str());
-                    else if (strongThis->mCertificate->mType == ENetworkCertificate::Content)
-                        curl_easy_setopt(handle, CURLOPT_CAINFO_BLOB, &strongThis->mCertificate->mBlob);
-
-                    std::lock_guard<std::mutex> lock(strongThis->mHandleMutex);
-                    strongThis->mHandle[std::this_thread::get_id()] = handle;
+                    Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Socket frame parsing error. Message smaller than header with mask. Message length %, frameOffset %, offset %, payload size %", pMessage.length(), frameOffset, offset, payloadSize);
+                    
+                    break;
                 }
                 
-                char errorBuffer[CURL_ERROR_SIZE];
-                errorBuffer[0] = 0;
-
-                ProgressData progressData;
-                progressData.mRequestHandle = pRequestHandle;
-                progressData.mTerminateAbort = &strongThis->mTerminateAbort;
+                memcpy((char*)&frame.mMaskingKey, pMessage.data() + frameOffset + offset, sizeof(frame.mMaskingKey));
+                offset += sizeof(frame.mMaskingKey);
+            }
+            
+            if (pMessage.length() - (frameOffset + offset) < payloadSize)
+            {
+                Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Socket frame parsing error. Payload bigger than message. Message length %, frameOffset %, offset %, payload size %", pMessage.length(), frameOffset, offset, payloadSize);
                 
-                if (lpParam.mProgress != nullptr)
-                {
-                    decltype(lpParam.mProgress) progress = std::move(lpParam.mProgress);
-                    decltype(lpRequestSettings.mProgressTimePeriod) progressTimePeriod = lpRequestSettings.mProgressTimePeriod;
-                    auto lastTick = std::chrono::system_clock::now();
-                    progressData.mProgressTask = [progressTimePeriod, progress, lastTick](int64_t lpDN, int64_t lpDT, int64_t lpUN, int64_t lpUT) mutable -> void
-                    {
-                        auto thisTick = std::chrono::system_clock::now();
-                        const auto difference = std::chrono::duration_cast<std::chrono::milliseconds>(thisTick - lastTick).count();
-                        
-                        if (difference > progressTimePeriod || (lpDN != 0 && lpDN == lpDT) || (lpUN != 0 && lpUN == lpUT))
-                        {
-                            lastTick = std::chrono::system_clock::now();
-                            Hermes::getInstance()->getTaskManager()->execute(-1, progress, lpDN, lpDT, lpUN, lpUT);
-                        }
-                    };
-                }
+                break;
+            }
+            
+            if (!useMask)
+            {
+                frame.mPayload = pMessage.substr(frameOffset + offset, static_cast<size_t>(payloadSize));
+            }
+            else
+            {
+                uint8_t message[payloadSize];
+                memcpy(message, pMessage.data() + frameOffset + offset, static_cast<size_t>(payloadSize));
                 
-                std::string requestUrl = lpParam.mMethod;
-                strongThis->appendParameter(requestUrl, lpParam.mParameter);
+                for (size_t i = 0; i < payloadSize; i++)
+                    message[i] ^= frame.mMaskingKey[i % 4];
                 
-                strongThis->configureHandle(handle, lpParam.mRequestType, lpParam.mResponseType, requestUrl, lpParam.mRequestBody, &responseMessage, &responseRawData, &responseHeader, header,
-                    lpRequestSettings.mTimeout, lpRequestSettings.mFlag, &progressData, errorBuffer);
+                frame.mPayload.append(reinterpret_cast<const char*>(message), static_cast<size_t>(payloadSize));
+            }
+            
+            if (pMessage.length() - (frameOffset + offset) == payloadSize)
+            {
+                loopContinue = false;
+            }
+            else
+            {
+                loopContinue = true;
+                frameOffset += offset + payloadSize;
+            }
+            
+            frames.push_back(std::move(frame));
+        }
+        while (loopContinue);
+        
+        return frames;
+    }
+    
+    bool NetworkWebSocketHandle::handleFrame(std::vector<Frame>& pNewFrame, std::vector<Frame>& pOldFrame, std::function<void(std::string lpMessage, bool lpTextData)> pMessageCallback) const
+    {
+        bool endSent = false;
+        
+        for (size_t i = pNewFrame.size(); i > 0; --i)
+        {
+            uint8_t opCode = pNewFrame[i-1].mCode & 0x0F;
+            
+            if (static_cast<ENetworkWebSocketOpCode>(opCode) == ENetworkWebSocketOpCode::Ping)
+            {
+                pNewFrame.erase(pNewFrame.begin() + static_cast<ptrdiff_t>(i - 1));
                 
-                CURLcode curlCode = CURLE_OK;
-                unsigned step = 0;
-                unsigned terminateAbort = 0;
-
-                do
+                if (!endSent)
                 {
-                    curlCode = curl_easy_perform(handle);
-                    step++;
+                    std::string message = packMessage("", ENetworkWebSocketOpCode::Pong);
+                    size_t sendCount = 0;
+                    
+                    if (mControlBlock->mHandle != nullptr)
+                    {
+                        CURLcode code = curl_easy_send(mControlBlock->mHandle, message.c_str(), message.length(), &sendCount);
+                        
+                        if (code != CURLE_OK)
+                            Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Pong send failed. CURLcode %", static_cast<int32_t>(code));
+                    }
                 }
-                while ((terminateAbort = strongThis->mTerminateAbort.load()) == 0 && curlCode != CURLE_OK && step <= lpParam.mRepeatCount);
-
-                curl_slist_free_all(header);
-
-                strongThis->resetHandle(handle);
+            }
+            else if (static_cast<ENetworkWebSocketOpCode>(opCode) == ENetworkWebSocketOpCode::Close)
+            {
+                pNewFrame.erase(pNewFrame.begin() + static_cast<ptrdiff_t>(i - 1));
                 
-                if (terminateAbort == 0)
+                std::string message = packMessage("", ENetworkWebSocketOpCode::Close);
+                
+                if (mControlBlock->mHandle != nullptr)
                 {
-                    switch (curlCode)
-                    {
-                    case CURLE_OK:
-                        curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &httpCode);
-                        code = httpCode >= 200 && httpCode <= 299 ? ENetworkCode::OK : ENetworkCode::InvalidHttpCodeRange;
-                        break;
-                    case CURLE_COULDNT_RESOLVE_HOST:
-                        code = ENetworkCode::LostConnection;
-                        Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Lost connection: %", lpParam.mMethod);
-                        break;
-                    case CURLE_OPERATION_TIMEDOUT:
-                        code = ENetworkCode::Timeout;
-                        Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Timeout: %", lpParam.mMethod);
-                        break;
-                    case CURLE_ABORTED_BY_CALLBACK:
-                        code = ENetworkCode::Cancel;
-                        Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Cancel: %", lpParam.mMethod);
-                        break;
-                    default:
-                        code = static_cast<ENetworkCode>(static_cast<int32_t>(ENetworkCode::Unknown) + static_cast<int32_t>(curlCode));
-                        Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "CURL code: %. URL: %", curl_easy_strerror(curlCode), lpParam.mMethod);
-                        break;
-                    }
-
-                    if (lpParam.mCallback != nullptr)
-                    {
-                        NetworkResponse response;
-                        response.mCode = code;
-                        response.mHttpCode = static_cast<int32_t>(httpCode);
-                        response.mHeader = std::move(responseHeader);
-                        response.mMessage = curlCode == CURLE_OK ? std::move(responseMessage) : errorBuffer;
-                        response.mRawData = std::move(responseRawData);
-                        response.mMethod = lpParam.mMethod;
-
-                        if (response.mCode == ENetworkCode::OK && lpParam.mAllowCache)
-                            strongThis->cacheResponse(response, lpParam.mMethod, lpParam.mCacheLifetime);
-
-                        if (response.mCode != ENetworkCode::Cancel && lpParam.mTaskBackground != nullptr)
-                            response.mDataTaskBackground = lpParam.mTaskBackground(response);
-
-                        auto responseHandler = std::make_shared<decltype(response)>(std::move(response));
-                        Hermes::getInstance()->getTaskManager()->execute(-1, [callback = std::move(lpParam.mCallback), responseHandler = std::move(responseHandler)]() mutable -> void
-                        {
-                            callback(std::move(*responseHandler));
-                        });
-                    }
+                    size_t sendCount = 0;
+                    CURLcode code = curl_easy_send(mControlBlock->mHandle, message.c_str(), message.length(), &sendCount);
+                    
+                    if (code != CURLE_OK)
+                        Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Close response send failed. CURLcode %", static_cast<int32_t>(code));
                 }
+                endSent = true;
             }
-        };
+            else if (opCode > static_cast<uint8_t>(ENetworkWebSocketOpCode::Binary))
+            {
+                pNewFrame.erase(pNewFrame.begin() + static_cast<ptrdiff_t>(i - 1));
+            }
+        }
         
-        RequestSettings requestSettings;        
+        pOldFrame.insert(pOldFrame.end(), pNewFrame.begin(), pNewFrame.end());
+        
+        ENetworkWebSocketOpCode multiFrameOpCode = ENetworkWebSocketOpCode::Continue;
+        std::vector<NetworkWebSocketHandle::Frame>::iterator firstFrameIt;
+        std::string multiMessage;
+        
+        for (auto it = pOldFrame.begin(); it != pOldFrame.end();)
         {
-            std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
-            requestSettings = mRequestSettings;
+            const bool fin = it->mCode & 0x80;
+            const uint8_t opCode = it->mCode & 0x0F;
+            
+            if (!fin)
+            {
+                multiFrameOpCode = static_cast<ENetworkWebSocketOpCode>(opCode);
+                multiMessage += std::move(it->mPayload);
+                
+                firstFrameIt = it++;
+            }
+            else if (static_cast<ENetworkWebSocketOpCode>(opCode) != ENetworkWebSocketOpCode::Continue)
+            {
+                if (pMessageCallback != nullptr)
+                    Hermes::getInstance()->getTaskManager()->execute(-1, std::move(pMessageCallback), std::move(it->mPayload), static_cast<ENetworkWebSocketOpCode>(opCode) == ENetworkWebSocketOpCode::Text);
+                
+                it = pOldFrame.erase(it);
+            }
+            else
+            {
+                multiMessage += std::move(it->mPayload);
+                
+                if (pMessageCallback != nullptr)
+                    Hermes::getInstance()->getTaskManager()->execute(-1, std::move(pMessageCallback), std::move(multiMessage), multiFrameOpCode == ENetworkWebSocketOpCode::Text);
+                
+                multiMessage = "";
+                
+                it = pOldFrame.erase(firstFrameIt, it + 1);
+            }
         }
-
-        Hermes::getInstance()->getTaskManager()->execute(mThreadPoolId, [requestTask = std::move(requestTask), pParam = std::move(pParam), requestSettings = std::move(requestSettings)]() mutable -> void
-        {                                
-            requestTask(std::move(pParam), std::move(requestSettings));
-        });
+        
+        return !endSent;
     }
     
-    void NetworkManager::request(std::vector<NetworkRequest> pParam, std::vector<std::shared_ptr<NetworkRequestHandle>> pRequestHandle)
+    /* NetworkRecovery */
+    
+    NetworkRecovery::NetworkRecovery(size_t pId, std::string pName, Config pConfig) : mId(pId), mName(std::move(pName))
     {
-        if (pParam.size() == 0)
-            return;
+        assert(pConfig.mCondition != nullptr && pConfig.mCallback != nullptr);
 
-        if (pParam.size() > pRequestHandle.size())
-            pRequestHandle.resize(pParam.size());
-        
-        for (size_t i = 0; i < pRequestHandle.size(); ++i)
-        {
-            if (pRequestHandle[i] == nullptr)
-                pRequestHandle[i] = std::make_shared<NetworkRequestHandle>();
-        }
+        auto internalData = std::shared_ptr<InternalData>(new InternalData());
+        mInternalData = internalData;
+        mCondition = std::move(pConfig.mCondition);
 
-        auto weakThis = mWeakThis;
-        auto requestTask = [weakThis, pRequestHandle](std::vector<NetworkRequest> lpParam, RequestSettings lpRequestSettings) -> void
+        auto callback = [lpCallback = std::move(pConfig.mCallback), internalData](NetworkResponse lpResponse) -> void
         {
-            void* handle = nullptr;
-            size_t paramSize = lpParam.size();
-            std::vector<MultiRequestData> multiRequestData(paramSize);
-                        
-            for (size_t i = 0; i < paramSize; ++i)
-                multiRequestData[i].mParam = &lpParam[i];
+            internalData->mActive = false;
             
-            std::shared_ptr<NetworkManager> strongThis = weakThis.lock();
-            if (strongThis != nullptr && strongThis->mInitialized.load() == 2)
+            const ENetworkCode code = lpResponse.mCode;
+            Hermes::getInstance()->getLogger()->print(ELogLevel::Info, "Recovery: %, code: %, http: %, message: %", (code == ENetworkCode::OK) ? "passed" : "failed", static_cast<int32_t>(code), lpResponse.mHttpCode, lpResponse.mMessage);
+
+            if (lpCallback != nullptr)
+                lpCallback(std::move(lpResponse));
+            
+            while (internalData->mReceiver.size() != 0)
             {
-                std::vector<NetworkRequest> param;
-                param.reserve(lpParam.size());
-                
-                for (auto it = lpParam.begin(); it != lpParam.end(); it++)
+                auto receiver = &internalData->mReceiver.front();                
+                auto networkManager = Hermes::getInstance()->getNetworkManager();
+                auto networkAPI = (std::get<0>(*receiver) < networkManager->count()) ? networkManager->get(std::get<0>(*receiver)) : nullptr;
+
+                if (networkAPI != nullptr && code == ENetworkCode::OK)
                 {
-                    if (!(*it).mAllowCache)
-                    {
-                        param.push_back(std::move(*it));
-                    }
-                    else
-                    {
-                        NetworkResponse response = strongThis->getResponseFromCache(it->mMethod);
-                        if (response.mCode != ENetworkCode::OK)
-                        {
-                            param.push_back(std::move(*it));
-                        }
-                        else
-                        {
-                            if (it->mCallback != nullptr)
-                            {
-                                if (response.mCode != ENetworkCode::Cancel && it->mTaskBackground != nullptr)
-                                    response.mDataTaskBackground = it->mTaskBackground(response);
+                    NetworkRequest* param = &std::get<1>(*receiver);
+                    
+                    param->mMethod = networkAPI->getUrl() + param->mMethod;
 
-                                auto responseHandler = std::make_shared<decltype(response)>(std::move(response));
-                                Hermes::getInstance()->getTaskManager()->execute(-1, [callback = std::move(it->mCallback), responseHandler = std::move(responseHandler)]() mutable -> void
-                                {
-                                    callback(std::move(*responseHandler));
-                                });
-                            }
-                        }
-                    }
-                }
-                
-                if (param.size() == 0)
-                    return;
+                    Hermes::getInstance()->getLogger()->print(ELogLevel::Info, "Executed method from recovery: %.", param->mMethod);
 
-                {
-                    std::lock_guard<std::mutex> lock(strongThis->mMultiHandleMutex);
-                    handle = strongThis->mMultiHandle[std::this_thread::get_id()];
+                    networkManager->scheduleRequest(std::move(*param), std::get<2>(*receiver), std::get<0>(*receiver), nullptr, 0);
                 }
                 
-                if (handle == nullptr)
-                {
-                    handle = curl_multi_init();
+                internalData->mReceiver.pop();
+            }
+        };
 
-                    std::lock_guard<std::mutex> lock(strongThis->mMultiHandleMutex);
-                    strongThis->mMultiHandle[std::this_thread::get_id()] = handle;
-                }
-            
-                paramSize = param.size();
-                multiRequestData = std::vector<MultiRequestData>(paramSize);
-            
-                for (size_t i = 0; i < paramSize; ++i)
-                {
-                    multiRequestData[i].mHandle = curl_easy_init();
-                    multiRequestData[i].mParam = &param[i];
-                    multiRequestData[i].mErrorBuffer.resize(CURL_ERROR_SIZE);
-                    multiRequestData[i].mErrorBuffer[0] = 0;
+        mRequestParam.mRequestType = pConfig.mRequestType;
+        mRequestParam.mResponseType = ENetworkResponse::Message;
+        mRequestParam.mMethod = std::move(pConfig.mUrl);
+        mRequestParam.mParameter = std::move(pConfig.mParameter);
+        mRequestParam.mHeader = std::move(pConfig.mHeader);
+        mRequestParam.mRequestBody = "";
+        mRequestParam.mCallback = std::move(callback);
+        mRequestParam.mTaskBackground = std::move(pConfig.mTaskBackground);
+        mRequestParam.mProgress = nullptr;
+        mRequestParam.mRepeatCount = pConfig.mRepeatCount;
+        mRequestParam.mAllowRecovery = false;
+    }
+    
+    NetworkRecovery::~NetworkRecovery()
+    {
+    }
+    
+    bool NetworkRecovery::isQueueEmpty() const
+    {
+        return mInternalData->mReceiver.empty();
+    }
+    
+    bool NetworkRecovery::checkCondition(const NetworkResponse& pResponse, std::string& pRequestBody, std::vector<std::pair<std::string, std::string>>& pParameter, std::vector<std::pair<std::string, std::string>>& pHeader) const
+    {
+        return mCondition != nullptr && mCondition(pResponse, pRequestBody, pParameter, pHeader);
+    }
+    
+    void NetworkRecovery::pushReceiver(std::tuple<size_t, NetworkRequest, std::shared_ptr<NetworkRequestHandle>> pReceiver)
+    {
+        mInternalData->mReceiver.push(std::move(pReceiver));
+    }
+    
+    void NetworkRecovery::runRequest(std::string pRequestBody, std::vector<std::pair<std::string, std::string>> pParameter, std::vector<std::pair<std::string, std::string>> pHeader)
+    {
+        mRequestParam.mRequestBody = std::move(pRequestBody);
 
-                    curl_easy_setopt(multiRequestData[i].mHandle, CURLOPT_PRIVATE, &multiRequestData[i]);
-                    curl_easy_setopt(multiRequestData[i].mHandle, CURLOPT_HEADERFUNCTION, CURL_HEADER_CALLBACK);
-                    if (strongThis->mCertificate->mType == ENetworkCertificate::Path)
-                        curl_easy_setopt(multiRequestData[i].mHandle, CURLOPT_CAINFO, strongThis->mCertificate->mData.c_str());
-                    else if (strongThis->mCertificate->mType == ENetworkCertificate::Content)
-                        curl_easy_setopt(multiRequestData[i].mHandle, CURLOPT_CAINFO_BLOB, &strongThis->mCertificate->mBlob);
-                    
-                    auto uniqueHeader = strongThis->createUniqueHeader(param[i].mHeader);
+        auto cpParameter = std::move(mRequestParam.mParameter);
+        mRequestParam.mParameter = std::move(pParameter);
+        mRequestParam.mParameter.reserve(mRequestParam.mParameter.size() + cpParameter.size());
+        mRequestParam.mParameter.insert(mRequestParam.mParameter.end(), cpParameter.begin(), cpParameter.end());
 
-                    curl_slist* header = nullptr;
+        auto cpHeader = std::move(mRequestParam.mHeader);
+        mRequestParam.mHeader = std::move(pHeader);
+        mRequestParam.mHeader.reserve(mRequestParam.mHeader.size() + cpHeader.size());
+        mRequestParam.mHeader.insert(mRequestParam.mHeader.end(), cpHeader.begin(), cpHeader.end());
 
-                    for (auto& x : uniqueHeader)
-                    {
-                        std::string singleHeader = x.first;
-                        singleHeader += ": ";
-                        singleHeader += x.second;
-                        
-                        header = curl_slist_append(header, singleHeader.c_str());
-                    }
+        Hermes::getInstance()->getNetworkManager()->request(mRequestParam);
 
-                    multiRequestData[i].mProgressData.mRequestHandle = pRequestHandle[i];
-                    multiRequestData[i].mProgressData.mTerminateAbort = &strongThis->mTerminateAbort;
-                    
-                    if (param[i].mProgress != nullptr)
-                    {
-                        decltype(param[i].mProgress) progress = std::move(param[i].mProgress);
-                        decltype(lpRequestSettings.mProgressTimePeriod) progressTimePeriod = lpRequestSettings.mProgressTimePeriod;
-                        auto lastTick = std::chrono::system_clock::now();
-                        multiRequestData[i].mProgressData.mProgressTask = [progressTimePeriod, progress, lastTick](int64_t lpDN, int64_t lpDT, int64_t lpUN, int64_t lpUT) mutable -> void
-                        {
-                            auto thisTick = std::chrono::system_clock::now();
-                            const auto difference = std::chrono::duration_cast<std::chrono::milliseconds>(thisTick - lastTick).count();
-                            
-                            if (difference > progressTimePeriod || (lpDN != 0 && lpDN == lpDT) || (lpUN != 0 && lpUN == lpUT))
-                            {
-                                lastTick = std::chrono::system_clock::now();
-                                Hermes::getInstance()->getTaskManager()->execute(-1, progress, lpDN, lpDT, lpUN, lpUT);
-                            }
-                        };
-                    }
-                    
-                    std::string requestUrl = param[i].mMethod;
-                    strongThis->appendParameter(requestUrl, param[i].mParameter);
-                    
-                    strongThis->configureHandle(multiRequestData[i].mHandle, param[i].mRequestType, param[i].mResponseType, requestUrl, param[i].mRequestBody, &multiRequestData[i].mResponseMessage,
-                        &multiRequestData[i].mResponseRawData, &multiRequestData[i].mResponseHeader, header, lpRequestSettings.mTimeout, lpRequestSettings.mFlag, &multiRequestData[i].mProgressData,
-                        &multiRequestData[i].mErrorBuffer[0]);
-                    
-                    curl_multi_add_handle(handle, multiRequestData[i].mHandle);
-                }
+        mRequestParam.mParameter = std::move(cpParameter);
+        mRequestParam.mHeader = std::move(cpHeader);
+    }
+    
+    bool NetworkRecovery::isActive() const
+    {
+        return mInternalData->mActive;
+    }
+    
+    bool NetworkRecovery::activate()
+    {
+        bool status = !mInternalData->mActive;
+        mInternalData->mActive = true;            
+        
+        return status;
+    }
+    
+    const std::vector<std::pair<std::string, std::string>>& NetworkRecovery::getHeader() const
+    {
+        return mRequestParam.mHeader;
+    }
+    
+    void NetworkRecovery::setHeader(const std::vector<std::pair<std::string, std::string>>& pHeader)
+    {
+        mRequestParam.mHeader = pHeader;
+    }
+        
+    const std::vector<std::pair<std::string, std::string>>& NetworkRecovery::getParameter() const
+    {
+        return mRequestParam.mParameter;
+    }
+    
+    void NetworkRecovery::setParameter(const std::vector<std::pair<std::string, std::string>>& pParameter)
+    {
+        mRequestParam.mParameter = pParameter;
+    }
 
-                int activeHandle = 0;
-                uint32_t terminateAbort = 0;
+    size_t NetworkRecovery::getId() const
+    {
+        return mId;
+    }
+    
+    const std::string& NetworkRecovery::getName() const
+    {
+        return mName;
+    }
+    
+    /* NetworkAPI */
+    
+    NetworkAPI::NetworkAPI(size_t pId, std::string pName, std::string pUrl) :  mId(pId), mName(std::move(pName)), mUrl(std::move(pUrl)), mCallbackContinious(decltype(mCallbackContinious)(new std::vector<std::pair<std::function<void(const NetworkResponse&)>, std::string>>()))
+    {
+    }
+    
+    NetworkAPI::~NetworkAPI()
+    {
+    }
+    
+    NetworkAPI::HeaderBlock::HeaderBlock(const std::vector<std::pair<std::string, std::string>>& pHeader)
+    {
+        curl_slist* tail = nullptr;
+        
+        mIndex.reserve(pHeader.size());
+        
+        for (const auto& v : pHeader)
+        {
+            const uint64_t hash = HEADER_NAME_HASH(v.first);
+            if (HEADER_INDEX_FIND(mIndex, hash, v.first, mHeader))
+                continue;
+            
+            std::string name = v.first;
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            
+            HEADER_APPEND(mList, tail, name, v.second);
+            mIndex.emplace(hash, mHeader.size());
+            mHeader.push_back({std::move(name), v.second});
+            mHash.push_back(hash);
+        }
+    }
+    
+    NetworkAPI::HeaderBlock::~HeaderBlock()
+    {
+        curl_slist_free_all(mList);
+    }
+
+    std::shared_ptr<NetworkRequestHandle> NetworkAPI::request(NetworkRequest pParam)
+    {
+        std::shared_ptr<NetworkRequestHandle> requestHandle = std::make_shared<NetworkRequestHandle>();
+        auto callbackContinious = mCallbackContinious;
+        
+        if (pParam.mResponseCompression == ENetworkCompression::Default)
+            pParam.mResponseCompression = mResponseCompression ? ENetworkCompression::Enable : ENetworkCompression::Disable;
+        
+        if (pParam.mRequestCompression == ENetworkCompression::Default)
+            pParam.mRequestCompression = mRequestCompression ? ENetworkCompression::Enable : ENetworkCompression::Disable;
+        
+        if (pParam.mRetryPolicy == nullptr)
+            pParam.mRetryPolicy = mRetryPolicy;
+    
+        pParam.mCallback = [responseCallback = pParam.mCallback, callbackContinious](NetworkResponse lpResponse) -> void
+        {
+            for (const auto& v : *callbackContinious)
+            {
+                if (v.first != nullptr)
+                    v.first(lpResponse);
+            }
+            
+            if (responseCallback != nullptr)
+                responseCallback(std::move(lpResponse));
+        };
+
+        std::string url = mUrl + pParam.mMethod;
+        auto recovery = mRecovery.lock();
+
+        if (pParam.mAllowRecovery && recovery != nullptr)
+        {
+            size_t copyId = mId;
+            pParam.mCallback = [recovery, copyId, url, pParam, requestHandle](NetworkResponse lpResponse) -> void
+            {
+                std::string requestBody = "";
+                std::vector<std::pair<std::string, std::string>> parameter;
+                std::vector<std::pair<std::string, std::string>> header;
                 
-                do
+                if (recovery->isActive() || recovery->checkCondition(lpResponse, requestBody, parameter, header))
                 {
-                    long multiTimeout = -1;
-                    curl_multi_timeout(handle, &multiTimeout);
-                
-                    timeval timeout = {1, 0};
-                    
-                    if (multiTimeout >= 0)
-                    {
-                        timeout.tv_sec = multiTimeout / 1000;
-                        
-                        if (timeout.tv_sec > 1)
-                            timeout.tv_sec = 1;
-                        else
-                            timeout.tv_usec = (multiTimeout % 1000) * 1000;
-                    }
+                    recovery->pushReceiver(std::make_tuple(copyId, std::move(pParam), requestHandle));
 
-                    fd_set readFd;
-                    fd_set writeFd;
-                    fd_set exceptionFd;
+                    if (recovery->activate())
+                        recovery->runRequest(std::move(requestBody), std::move(parameter), std::move(header));
 
-                    FD_ZERO(&readFd);
-                    FD_ZERO(&writeFd);
-                    FD_ZERO(&exceptionFd);
-                    
-                    int maxFd = -1;
-         
-                    CURLMcode codeFdset = curl_multi_fdset(handle, &readFd, &writeFd, &exceptionFd, &maxFd);
-                    
-                    if (codeFdset != CURLM_OK)
-                    {
+                    Hermes::getInstance()->getLogger()->print(ELogLevel::Info, "Queued method for recovery: %.", url);
+                }
+                else
+                {
+                    pParam.mCallback(std::move(lpResponse));
+                }
+            };
+        }
+
+        if (recovery != nullptr && recovery->isActive())
+        {
+            recovery->pushReceiver(std::make_tuple(mId, pParam, requestHandle));
+
+            Hermes::getInstance()->getLogger()->print(ELogLevel::Info, "Queued method for recovery: %.", url);
+        }
+        else
+        {
+            pParam.mMethod = std::move(url);
+        
+            Hermes::getInstance()->getNetworkManager()->scheduleRequest(std::move(pParam), requestHandle, mId, nullptr, 0);
+        }
+        
+        return requestHandle;
+    }
+    
+    const std::vector<std::pair<std::string, std::string>>& NetworkAPI::getDefaultHeader() const
+    {
+        return mDefaultHeader;
+    }
+    
+    void NetworkAPI::setDefaultHeader(std::vector<std::pair<std::string, std::string>> pDefaultHeader)
+    {
+        std::shared_ptr<const HeaderBlock> headerBlock = pDefaultHeader.size() > 0 ? std::make_shared<const HeaderBlock>(pDefaultHeader) : nullptr;
+        
+        mDefaultHeader = std::move(pDefaultHeader);
+        std::atomic_store(&mHeaderBlock, std::move(headerBlock));
+    }
+    
+    std::pair<bool, bool> NetworkAPI::getCompression() const
+    {
+        return {mResponseCompression, mRequestCompression};
+    }
+    
+    void NetworkAPI::setCompression(bool pResponse, bool pRequest)
+    {
+        mResponseCompression = pResponse;
+        mRequestCompression = pRequest;
+    }
+    
+    std::shared_ptr<const NetworkRetryPolicy> NetworkAPI::getRetryPolicy() const
+    {
+        return mRetryPolicy;
+    }
+    
+    void NetworkAPI::setRetryPolicy(std::shared_ptr<const NetworkRetryPolicy> pRetryPolicy)
+    {
+        mRetryPolicy = std::move(pRetryPolicy);
+    }
+    
+    bool NetworkAPI::registerCallback(std::function<void(const NetworkResponse&)> pCallback, std::string pName, bool pOverwrite)
+    {
+        auto checkItem = [pName](const std::pair<std::function<void(const NetworkResponse&)>, std::string>& lpElement) -> bool
+        {
+            if (lpElement.second == pName)
+                return true;
+            
+            return false;
+        };
+        
+        auto it = std::find_if(mCallbackContinious->begin(), mCallbackContinious->end(), checkItem);
+        
+        bool status = false;
+    
+        if (it == mCallbackContinious->end())
+        {
+            mCallbackContinious->push_back(std::make_pair(std::move(pCallback), std::move(pName)));
+            status = true;
+        }
+        else if (pOverwrite)
+        {
+            *it = std::make_pair(std::move(pCallback), std::move(pName));
+            status = true;
+        }
+        
+        return status;
+    }
+
+    bool NetworkAPI::unregisterCallback(std::string pName)
+    {
+        bool status = false;
+        
+        auto checkItem = [&status, pName](const std::pair<std::function<void(const NetworkResponse&)>, std::string>& lpElement) -> bool
+        {
+            if (lpElement.second == pName)
+            {
+                status = true;
+                return status;
+            }
+            
+            return false;
+        };
+        
+        mCallbackContinious->erase(remove_if(mCallbackContinious->begin(), mCallbackContinious->end(), checkItem), mCallbackContinious->end());
+        
+        return status;
+    }
+    
+    std::weak_ptr<NetworkRecovery> NetworkAPI::getRecovery() const
+    {
+        return mRecovery;
+    }
+    
+    void NetworkAPI::setRecovery(std::weak_ptr<NetworkRecovery> pRecovery)
+    {
+        mRecovery = pRecovery;
+    }
+    
+    size_t NetworkAPI::getId() const
+    {
+        return mId;
+    }
+    
+    const std::string& NetworkAPI::getName() const
+    {
+        return mName;
+    }
+
+    const std::string& NetworkAPI::getUrl() const
+    {
+        return mUrl;
+    }
+    
+    /* NetworkManager */
+    
+    NetworkManager::NetworkManager() : mCertificate(std::make_shared<NetworkManager::Certificate>(ENetworkCertificate::None, ""))
+    {
+    }
+    
+    NetworkManager::~NetworkManager()
+    {
+        terminate();
+    }
+    
+    void NetworkManager::deleterNetworkAPI(NetworkAPI* pObject)
+    {
+        delete pObject;
+    }
+    
+    void NetworkManager::deleterNetworkRecovery(NetworkRecovery* pObject)
+    {
+        delete pObject;
+    }
+    
+    size_t NetworkManager::writeStream(char* pData, size_t pCount, size_t pSize, ProgressData* pUserData)
+    {
+        const size_t dataSize = pCount * pSize;
+        
+        if (pData == nullptr || pUserData == nullptr)
+            return 0;
+        
+        if (pUserData->mStreamTask == nullptr || dataSize == 0)
+            return dataSize;
+        
+        auto requestHandle = pUserData->mRequestHandle;
+        const uint32_t resume = requestHandle->mResume.load();
+        
+        if (pUserData->mStreamTask(reinterpret_cast<const uint8_t*>(pData), dataSize))
+        {
+            pUserData->mWriteSize += dataSize;
+            return dataSize;
+        }
+        
+        // The chunk is rejected and will be delivered again after resume. A resume requested while the callback was still running must not be lost.
+        requestHandle->mPause.store(1);
+        if (requestHandle->mResume.load() != resume)
+            requestHandle->mPause.store(0);
+        
+        pUserData->mPaused = true;
+        
+        return CURL_WRITEFUNC_PAUSE;
+    }
+    
+    bool NetworkManager::finishWriter(ProgressData& pProgressData, ENetworkCode& pCode)
+    {
+        bool status = true;
+        
+        if (pProgressData.mWriter != nullptr)
+        {
+            if (pCode == ENetworkCode::OK && !pProgressData.mWriter->commit())
+            {
+                pCode = static_cast<ENetworkCode>(static_cast<int32_t>(ENetworkCode::Unknown) + static_cast<int32_t>(CURLE_WRITE_ERROR));
+                status = false;
+            }
+            
+            // Release the writer on this thread, so the file is complete (or discarded) before the callback is called.
+            pProgressData.mWriter = nullptr;
+        }
+        
+        return status;
+    }
+    
+    std::shared_ptr<DataReader> NetworkManager::compressRequestBody(NetworkRequest& pParam)
+    {
+        std::shared_ptr<DataReader> source = nullptr;
+        
+        if (pParam.mRequestCompression == ENetworkCompression::Enable && (pParam.mRequestType == ENetworkRequest::Post || pParam.mRequestType == ENetworkRequest::Put))
+        {
+            // The request body has to outlive the transfer anyway, so it's read in place.
+            if (pParam.mRequestReader != nullptr)
+                source = std::move(pParam.mRequestReader);
+            else if (pParam.mRequestBody.size() > 0)
+                source = std::make_shared<MemoryReader>(pParam.mRequestBody.data(), pParam.mRequestBody.size());
+            
+            if (source != nullptr)
+            {
+                pParam.mRequestReader = std::make_shared<CompressionReader>(source);
+                pParam.mRequestChunked = true;
+                pParam.mHeader.insert(pParam.mHeader.begin(), {"Content-Encoding", "gzip"});
+            }
+        }
+        
+        return source;
+    }
+    
+    NetworkResponse NetworkManager::copyResponse(const NetworkResponse& pResponse)
+    {
+        NetworkResponse response;
+        response.mCode = pResponse.mCode;
+        response.mHttpCode = pResponse.mHttpCode;
+        response.mHeader = pResponse.mHeader;
+        response.mMessage = pResponse.mMessage;
+        response.mRawData = pResponse.mRawData;
+        response.mMethod = pResponse.mMethod;
+        response.mDownloadSize = pResponse.mDownloadSize;
+        response.mUploadSize = pResponse.mUploadSize;
+        response.mTiming = pResponse.mTiming;
+        
+        return response;
+    }
+    
+    void NetworkManager::readTransferSize(void* pHandle, const ProgressData& pProgressData, size_t pDecodedSize, NetworkResponse& pResponse)
+    {
+        curl_off_t downloadSize = 0;
+        curl_off_t uploadSize = 0;
+        
+        curl_easy_getinfo(pHandle, CURLINFO_SIZE_DOWNLOAD_T, &downloadSize);
+        curl_easy_getinfo(pHandle, CURLINFO_SIZE_UPLOAD_T, &uploadSize);
+        
+        pResponse.mDownloadSize = {static_cast<int64_t>(downloadSize), static_cast<int64_t>(pDecodedSize + pProgressData.mWriteSize)};
+        pResponse.mUploadSize = {static_cast<int64_t>(uploadSize), pProgressData.mReaderSource != nullptr ? static_cast<int64_t>(pProgressData.mReaderSource->getPosition()) : static_cast<int64_t>(uploadSize)};
+    }
+    
+    void NetworkManager::readTransferTime(void* pHandle, std::chrono::steady_clock::time_point pRequestTime, std::chrono::steady_clock::time_point pStartTime, NetworkResponse& pResponse)
+    {
+        curl_off_t time = 0;
+        long count = 0;
+        NetworkTiming& timing = pResponse.mTiming;
+        
+        curl_easy_getinfo(pHandle, CURLINFO_NAMELOOKUP_TIME_T, &time);
+        timing.mNameLookup = static_cast<int64_t>(time);
+        curl_easy_getinfo(pHandle, CURLINFO_CONNECT_TIME_T, &time);
+        timing.mConnect = static_cast<int64_t>(time);
+        curl_easy_getinfo(pHandle, CURLINFO_APPCONNECT_TIME_T, &time);
+        timing.mAppConnect = static_cast<int64_t>(time);
+        curl_easy_getinfo(pHandle, CURLINFO_PRETRANSFER_TIME_T, &time);
+        timing.mPreTransfer = static_cast<int64_t>(time);
+        curl_easy_getinfo(pHandle, CURLINFO_STARTTRANSFER_TIME_T, &time);
+        timing.mStartTransfer = static_cast<int64_t>(time);
+        curl_easy_getinfo(pHandle, CURLINFO_TOTAL_TIME_T, &time);
+        timing.mTotal = static_cast<int64_t>(time);
+        
+        curl_easy_getinfo(pHandle, CURLINFO_NUM_CONNECTS, &count);
+        timing.mConnectionCount = static_cast<int64_t>(count);
+        curl_easy_getinfo(pHandle, CURLINFO_REQUEST_SIZE, &count);
+        timing.mRequestSize = static_cast<int64_t>(count);
+        curl_easy_getinfo(pHandle, CURLINFO_HEADER_SIZE, &count);
+        timing.mHeaderSize = static_cast<int64_t>(count);
+        
+        timing.mQueue = std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(pStartTime - pRequestTime).count());
+    }
+    
+    bool NetworkManager::initialize(int64_t pTimeout, int32_t pThreadPoolId, int32_t pSocketThreadPoolId, std::pair<ENetworkCertificate, std::string> pCertificate)
+    {
+        assert(pCertificate.first == ENetworkCertificate::None || pCertificate.second.size() > 0);
+
+        uint32_t initialized = 0;
+
+        if (mInitialized.compare_exchange_strong(initialized, 1))
+        {
+            if (curl_global_init(CURL_GLOBAL_ALL) == CURLE_OK)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
+                    mRequestSettings.mTimeout = pTimeout;
+                    mRequestSettings.mCoalescingHeader = std::make_shared<const std::vector<std::string>>(std::vector<std::string>{"accept", "accept-encoding", "accept-language", "authorization", "cookie"});
+                    mRequestSettings.mCacheKeyHeader = mRequestSettings.mCoalescingHeader;
+                }
+                
+                mThreadPoolId = pThreadPoolId;
+                mWebSocketThreadPoolId = pSocketThreadPoolId;
+                mCertificate = std::make_shared<NetworkManager::Certificate>(pCertificate.first, std::move(pCertificate.second));
+                
+                // Connections stay with the handle of each thread, curl can't share them between threads safely.
+                mShareMutex = std::make_unique<std::mutex[]>(static_cast<size_t>(CURL_LOCK_DATA_LAST));
+                mShareHandle = curl_share_init();
+                curl_share_setopt(mShareHandle, CURLSHOPT_LOCKFUNC, CURL_SHARE_LOCK_CALLBACK);
+                curl_share_setopt(mShareHandle, CURLSHOPT_UNLOCKFUNC, CURL_SHARE_UNLOCK_CALLBACK);
+                curl_share_setopt(mShareHandle, CURLSHOPT_USERDATA, mShareMutex.get());
+                curl_share_setopt(mShareHandle, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+                curl_share_setopt(mShareHandle, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+                
+                {
+                    std::lock_guard<std::mutex> lock(mRetryMutex);
+                    std::random_device rd;
+                    mRetryRandomGenerator.seed(rd());
+                    mRetryBudget = static_cast<double>(mRetryBudgetMinimum);
+                    mRetryBudgetTime = std::chrono::steady_clock::now();
+                }
+
+                mInitialized.store(2);
+            }
+            else
+            {
+                initialized = 1;
+                mInitialized.store(0);
+            }
+        }
+    
+        return initialized == 0;
+    }
+    
+    bool NetworkManager::terminate()
+    {
+        uint32_t terminated = 2;
+
+        if (mInitialized.compare_exchange_strong(terminated, 1))
+        {
+            mTerminateAbort.store(1);
+            auto taskManager = Hermes::getInstance()->getTaskManager();
+            
+            std::atomic<uint32_t> flushStatus(0);
+            auto flushCallback = [&flushStatus]() -> void
+            {
+                flushStatus++;
+            };
+            
+            taskManager->flush(mThreadPoolId, flushCallback);
+            taskManager->flush(mWebSocketThreadPoolId, flushCallback);
+            const uint32_t loopInterrupt = mThreadPoolId != mWebSocketThreadPoolId ? 2 : 1;
+            
+            while (flushStatus.load() < loopInterrupt)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+            
+            {
+                std::lock_guard<std::mutex> lock(mApiMutex);
+                mApi.clear();
+            }
+            
+            {
+                std::lock_guard<std::mutex> lock(mRecoveryMutex);
+                mRecovery.clear();
+            }
+            
+            // Responses queued after the thread pool was flushed are written here.
+            if (mCacheInitialized.load() != 0)
+            {
+                writeCache();
+                flushCacheManifest();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mCacheMutex);
+                mCacheFileIndex.clear();
+                mCacheFileFirst = nullptr;
+                mCacheFileLast = nullptr;
+                mCacheSize = 0;
+                mCacheManifestRecordCount = 0;
+                mCacheManifestSnapshot.clear();
+                mCacheManifestJournal.clear();
+            }
+            
+            {
+                std::lock_guard<std::mutex> lock(mCacheManifestMutex);
+                if (mCacheManifest >= 0)
+                    close(mCacheManifest);
+                
+                mCacheManifest = -1;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mHandleMutex);
+            
+                for (auto& v : mHandle)
+                {
+                    if (v.second != nullptr)
+                        curl_easy_cleanup(v.second);
+                }
+                
+                mHandle.clear();
+            }
+                
+            {
+                std::lock_guard<std::mutex> lock(mMultiHandleMutex);
+            
+                for (auto& v : mMultiHandle)
+                {
+                    if (v.second != nullptr)
+                        curl_multi_cleanup(v.second);
+                }
+                
+                mMultiHandle.clear();
+            }
+            
+            curl_share_cleanup(mShareHandle);
+            mShareHandle = nullptr;
+            mShareMutex = nullptr;
+            mPreconnectCount.store(0);
+
+            curl_global_cleanup();
+            
+            {
+                std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
+                mRequestSettings.mFlag = {false, false, false, false};
+                mRequestSettings.mTimeout = 0;
+                mRequestSettings.mProgressTimePeriod = 0;
+                mRequestSettings.mCoalescingHeader = nullptr;
+                mRequestSettings.mCacheKeyHeader = nullptr;
+                mRequestSettings.mCacheKeyFunction = nullptr;
+                mRequestSettings.mKeepAlive = NetworkKeepAlive();
+            }
+            
+            {
+                std::lock_guard<std::mutex> lock(mCoalescedRequestMutex);
+                mCoalescedRequest.clear();
+            }
+            
+            {
+                std::lock_guard<std::mutex> lock(mRetryMutex);
+                mRetryBudgetRatio = 0.2f;
+                mRetryBudgetMinimum = 10;
+                mRetryBudget = 0.0;
+            }
+            
+            {
+                std::lock_guard<std::mutex> lock(mSchedulerMutex);
+                mSchedulerFlow.clear();
+                mSchedulerHost.clear();
+                mHostConcurrencyLimit = 0;
+                mSchedulerVirtualTime = 0.0;
+                mSchedulerActive.store(0);
+            }
+            
+            {
+                std::lock_guard<std::mutex> lock(mMetricsMutex);
+                mMetrics.clear();
+            }
+
+            mThreadPoolId = -1;
+            mWebSocketThreadPoolId = -1;
+            mCertificate = std::make_unique<NetworkManager::Certificate>(ENetworkCertificate::None, "");
+            
+            {
+                std::lock_guard<std::mutex> lock(mCacheRevalidationMutex);
+                mCacheRevalidation.clear();
+            }
+            
+            mCacheInitialized.store(0);
+            mMemoryCache = nullptr;
+            mPackCache = nullptr;
+            mTerminateAbort.store(0);
+
+            mInitialized.store(0);
+        }
+        
+        return terminated == 2;
+    }
+        
+    std::shared_ptr<NetworkAPI> NetworkManager::add(size_t pId, std::string pName, std::string pUrl)
+    {
+        return add<NetworkAPI>(pId, std::move(pName), std::move(pUrl));
+    }
+    
+    size_t NetworkManager::count() const
+    {
+        std::lock_guard<std::mutex> lock(mApiMutex);
+        return mApi.size();
+    }
+    
+    std::shared_ptr<NetworkAPI> NetworkManager::get(size_t pId) const
+    {
+        std::lock_guard<std::mutex> lock(mApiMutex);
+        assert(pId < mApi.size());
+
+        return mApi[pId];
+    }
+    
+    std::shared_ptr<NetworkRecovery> NetworkManager::addRecovery(size_t pId, std::string pName, NetworkRecovery::Config pConfig)
+    {
+        std::shared_ptr<NetworkRecovery> result = nullptr;
+        if (mInitialized.load() == 2)
+        {
+            result = std::shared_ptr<NetworkRecovery>(new NetworkRecovery(pId, std::move(pName), std::move(pConfig)), std::bind(&NetworkManager::deleterNetworkRecovery, std::placeholders::_1));
+        
+            std::lock_guard<std::mutex> lock(mRecoveryMutex);
+            if (pId >= mRecovery.size())
+                mRecovery.resize(pId + 1);
+
+            assert(mRecovery[pId] == nullptr);
+            mRecovery[pId] = result;
+        }
+
+        return mRecovery[pId];
+    }
+    
+    size_t NetworkManager::countRecovery() const
+    {
+        std::lock_guard<std::mutex> lock(mRecoveryMutex);
+        return mRecovery.size();
+    }
+    
+    std::shared_ptr<NetworkRecovery> NetworkManager::getRecovery(size_t pId) const
+    {
+        std::lock_guard<std::mutex> lock(mRecoveryMutex);
+        assert(pId < mRecovery.size());
+
+        return mRecovery[pId];
+    }
+    
+    void NetworkManager::request(NetworkRequest pParam, std::shared_ptr<NetworkRequestHandle> pRequestHandle)
+    {
+        if (pRequestHandle == nullptr)
+            pRequestHandle = std::make_shared<NetworkRequestHandle>();
+        
+        scheduleRequest(std::move(pParam), std::move(pRequestHandle), std::numeric_limits<size_t>::max(), nullptr, 0);
+    }
+    
+    void NetworkManager::scheduleRequest(NetworkRequest pParam, std::shared_ptr<NetworkRequestHandle> pRequestHandle, size_t pApiId, std::shared_ptr<RequestState> pState, uint32_t pDelay)
+    {
+        if (pState == nullptr && pParam.mHedgePolicy != nullptr && (pParam.mRequestType == ENetworkRequest::Get || pParam.mRequestType == ENetworkRequest::Head) &&
+            pParam.mRequestReader == nullptr && pParam.mResponseWriter == nullptr && pParam.mStream == nullptr)
+        {
+            hedgeRequest(std::move(pParam), std::move(pRequestHandle), pApiId);
+            return;
+        }
+        
+        // A request keeps the time it was scheduled at while it waits in the scheduler queue, the wait of a retry starts after its delay.
+        auto weakThis = mWeakThis;
+        auto requestTime = pState != nullptr && pState->mRequestTime != std::chrono::steady_clock::time_point() ? pState->mRequestTime : std::chrono::steady_clock::now() + std::chrono::milliseconds(pDelay);
+        auto metrics = pApiId != std::numeric_limits<size_t>::max() ? getMetricsData(pApiId) : nullptr;
+        auto headerBlock = pApiId != std::numeric_limits<size_t>::max() ? getHeaderBlock(pApiId) : nullptr;
+        auto requestTask = [weakThis, pRequestHandle, pApiId, pState, requestTime, metrics, headerBlock](NetworkRequest lpParam, RequestSettings lpRequestSettings) -> void
+        {
+            std::shared_ptr<NetworkManager> strongThis = weakThis.lock();
+            if (strongThis != nullptr && strongThis->mInitialized.load() == 2)
+            {
+                // Default headers of the API are sent from its precompiled header block, cache and coalescing keys read them from the block as well.
+                // A retry or a request leaving the scheduler queue continues the request, it has already been looked up in the cache and it may still lead coalesced requests.
+                CacheValidator cacheValidator;
+                std::string cacheKey;
+                std::shared_ptr<CoalescedRequest> coalescedRequest = nullptr;
+                std::string coalescingKey;
+                
+                if (pState != nullptr)
+                {
+                    cacheKey = std::move(pState->mCacheKey);
+                    cacheValidator = std::move(pState->mCacheValidator);
+                    coalescedRequest = std::move(pState->mCoalescedRequest);
+                    coalescingKey = std::move(pState->mCoalescingKey);
+                }
+                else if (lpParam.mAllowCache)
+                {
+                    cacheKey = strongThis->createCacheKey(lpParam, headerBlock.get(), lpRequestSettings);
+                }
+                
+                if (pState == nullptr && cacheKey.size() > 0)
+                {
+                    const bool allowStale = lpParam.mCacheMode != ENetworkCacheMode::Default;
+                    NetworkResponse response = strongThis->getResponseFromCache(cacheKey, lpParam, headerBlock.get(), lpParam.mCacheHeader || allowStale ? &cacheValidator : nullptr, allowStale);
+                    
+                    if (response.mCode != ENetworkCode::OK && lpParam.mCacheMode == ENetworkCacheMode::StaleWhileRevalidate && strongThis->serveStaleResponse(cacheValidator, response))
+                        strongThis->revalidateCache(lpParam, headerBlock.get(), cacheKey);
+                    
+                    if (metrics != nullptr)
+                        metrics->addCache(response.mCode == ENetworkCode::OK);
+                    
+                    if (response.mCode == ENetworkCode::OK)
+                    {
+                        if (lpParam.mCallback != nullptr)
+                        {
+                            if (lpParam.mTaskBackground != nullptr)
+                                response.mDataTaskBackground = lpParam.mTaskBackground(response);
+
+                            auto responseHandler = std::make_shared<decltype(response)>(std::move(response));
+                            Hermes::getInstance()->getTaskManager()->execute(-1, [callback = std::move(lpParam.mCallback), responseHandler = std::move(responseHandler)]() mutable -> void
+                            {
+                                callback(std::move(*responseHandler));
+                            });
+                        }
+
+                        return;
+                    }
+                    
+                    strongThis->applyCacheValidator(cacheValidator, lpParam);
+                }
+                
+                // Identical GET requests share a single transfer, later ones only wait for the response of the first one.
+                if (pState == nullptr && lpRequestSettings.mFlag[static_cast<size_t>(ENetworkFlag::Coalescing)] && lpParam.mAllowCoalescing && lpParam.mRequestType == ENetworkRequest::Get &&
+                    lpParam.mResponseType != ENetworkResponse::Stream && lpParam.mResponseWriter == nullptr && lpRequestSettings.mCoalescingHeader != nullptr)
+                {
+                    coalescingKey = strongThis->createCoalescingKey(lpParam, headerBlock.get(), *lpRequestSettings.mCoalescingHeader);
+                    
+                    std::lock_guard<std::mutex> lock(strongThis->mCoalescedRequestMutex);
+                    auto it = strongThis->mCoalescedRequest.find(coalescingKey);
+                    if (it != strongThis->mCoalescedRequest.end())
+                    {
+                        {
+                            std::lock_guard<std::mutex> followerLock(it->second->mMutex);
+                            it->second->mFollower.push_back({std::move(lpParam.mCallback), std::move(lpParam.mTaskBackground), pRequestHandle});
+                        }
+                        
+                        strongThis->mCoalescingCount.fetch_add(1);
+                        
+                        return;
+                    }
+                    
+                    coalescedRequest = std::make_shared<CoalescedRequest>();
+                    strongThis->mCoalescedRequest.emplace(coalescingKey, coalescedRequest);
+                }
+                
+                tools::URLTool url(lpParam.mMethod);
+                size_t hostLength = 0;
+                const char* hostData = url.getHost(hostLength, true);
+                std::string host(hostData != nullptr ? hostData : "", hostData != nullptr ? hostLength : 0);
+                std::transform(host.begin(), host.end(), host.begin(), ::tolower);
+                
+                // A request over the concurrency limits waits in the queue of its API without holding a thread and it is scheduled again once a transfer is free.
+                // Only a transfer counted by the scheduler is released to it.
+                bool transferCounted = pState != nullptr && pState->mTransfer;
+                if (!transferCounted)
+                {
+                    auto createTask = [&]() -> SchedulerTask
+                    {
+                        SchedulerTask task;
+                        task.mState = pState != nullptr ? pState : std::make_shared<RequestState>();
+                        task.mState->mCacheKey = std::move(cacheKey);
+                        task.mState->mCacheValidator = std::move(cacheValidator);
+                        task.mState->mCoalescedRequest = std::move(coalescedRequest);
+                        task.mState->mCoalescingKey = std::move(coalescingKey);
+                        task.mState->mRequestTime = requestTime;
+                        task.mParam = std::move(lpParam);
+                        task.mRequestHandle = pRequestHandle;
+                        task.mHost = host;
+                        task.mTime = std::chrono::steady_clock::now();
+                        
+                        return task;
+                    };
+                    
+                    const ETransfer transfer = strongThis->acquireTransfer(pApiId, host, createTask);
+                    if (transfer == ETransfer::Queued)
+                        return;
+                    
+                    if (transfer == ETransfer::Shed)
+                    {
+                        strongThis->shedRequest(std::move(lpParam), cacheValidator, std::move(coalescedRequest), coalescingKey);
+                        return;
+                    }
+                    
+                    transferCounted = transfer == ETransfer::Acquired;
+                }
+
+                ENetworkCode code = ENetworkCode::Unknown;
+                long httpCode = -1;
+                std::vector<std::pair<std::string, std::string>> responseHeader;
+                std::string responseMessage = "";
+                std::vector<uint8_t> responseRawData;
+                
+                if (pState != nullptr && pState->mRetryCount > 0 && lpParam.mRequestReader != nullptr)
+                    lpParam.mRequestReader->seek(0);
+                
+                // The request body is compressed again by a retry, so the state before the compression is kept.
+                const bool requestReader = lpParam.mRequestReader != nullptr;
+                const bool requestChunked = lpParam.mRequestChunked;
+                auto readerSource = compressRequestBody(lpParam);
+                
+                curl_slist* headerLink = nullptr;
+                curl_slist* header = createHeaderList(lpParam.mHeader, headerBlock.get(), headerLink);
+
+                void* handle = strongThis->getHandle();
+                
+                char errorBuffer[CURL_ERROR_SIZE];
+                errorBuffer[0] = 0;
+
+                ProgressData progressData;
+                progressData.mRequestHandle = pRequestHandle;
+                progressData.mTerminateAbort = &strongThis->mTerminateAbort;
+                progressData.mStreamTask = std::move(lpParam.mStream);
+                progressData.mWriter = std::move(lpParam.mResponseWriter);
+                progressData.mReader = std::move(lpParam.mRequestReader);
+                progressData.mReaderSource = std::move(readerSource);
+                progressData.mReaderChunked = lpParam.mRequestChunked;
+                
+                // The shared transfer is aborted only when all requests waiting for it are canceled.
+                if (coalescedRequest != nullptr)
+                {
+                    progressData.mCancelCondition = [pRequestHandle, coalescedRequest]() -> bool
+                    {
+                        if (!pRequestHandle->isCancel())
+                            return false;
+                        
+                        std::lock_guard<std::mutex> lock(coalescedRequest->mMutex);
+                        for (const auto& v : coalescedRequest->mFollower)
+                        {
+                            if (!v.mRequestHandle->isCancel())
+                                return false;
+                        }
+                        
+                        return true;
+                    };
+                }
+                
+                if (lpParam.mProgress != nullptr)
+                {
+                    decltype(lpParam.mProgress) progress = lpParam.mProgress;
+                    decltype(lpRequestSettings.mProgressTimePeriod) progressTimePeriod = lpRequestSettings.mProgressTimePeriod;
+                    auto lastTick = std::chrono::system_clock::now();
+                    progressData.mProgressTask = [progressTimePeriod, progress, lastTick](int64_t lpDN, int64_t lpDT, int64_t lpUN, int64_t lpUT) mutable -> void
+                    {
+                        auto thisTick = std::chrono::system_clock::now();
+                        const auto difference = std::chrono::duration_cast<std::chrono::milliseconds>(thisTick - lastTick).count();
+                        
+                        if (difference > progressTimePeriod || (lpDN != 0 && lpDN == lpDT) || (lpUN != 0 && lpUN == lpUT))
+                        {
+                            lastTick = std::chrono::system_clock::now();
+                            Hermes::getInstance()->getTaskManager()->execute(-1, progress, lpDN, lpDT, lpUN, lpUT);
+                        }
+                    };
+                }
+                
+                std::string requestUrl = lpParam.mMethod;
+                strongThis->appendParameter(requestUrl, lpParam.mParameter);
+                
+                strongThis->configureHandle(handle, lpParam.mRequestType, lpParam.mResponseType, requestUrl, lpParam.mRequestBody, &responseMessage, &responseRawData, &responseHeader, header,
+                    lpParam.mResponseCompression == ENetworkCompression::Enable, lpRequestSettings, &progressData, errorBuffer);
+                
+                if (pState == nullptr || pState->mRetryCount == 0)
+                    strongThis->depositRetryBudget();
+                
+                const auto startTime = std::chrono::steady_clock::now();
+                CURLcode curlCode = curl_easy_perform(handle);
+                const unsigned terminateAbort = strongThis->mTerminateAbort.load();
+                
+                if (curlCode == CURLE_OK)
+                    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &httpCode);
+                
+                // Canceled transfers don't tell anything about the server, so the limiter doesn't sample them.
+                const auto transferTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+                if (transferCounted)
+                    strongThis->releaseTransfer(pApiId, host, terminateAbort == 0 && curlCode != CURLE_ABORTED_BY_CALLBACK ? transferTime : -1, curlCode != CURLE_OK || httpCode == 429 || httpCode >= 500);
+
+                freeHeaderList(header, headerLink, headerBlock.get());
+
+                strongThis->resetHandle(handle);
+                
+                if (terminateAbort == 0)
+                {
+                    switch (curlCode)
+                    {
+                    case CURLE_OK:
+                        code = httpCode >= 200 && httpCode <= 299 ? ENetworkCode::OK : ENetworkCode::InvalidHttpCodeRange;
+                        break;
+                    case CURLE_COULDNT_RESOLVE_HOST:
+                        code = ENetworkCode::LostConnection;
+                        Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Lost connection: %", lpParam.mMethod);
+                        break;
+                    case CURLE_OPERATION_TIMEDOUT:
+                        code = ENetworkCode::Timeout;
+                        Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Timeout: %", lpParam.mMethod);
+                        break;
+                    case CURLE_ABORTED_BY_CALLBACK:
+                        code = ENetworkCode::Cancel;
+                        Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Cancel: %", lpParam.mMethod);
+                        break;
+                    default:
+                        code = static_cast<ENetworkCode>(static_cast<int32_t>(ENetworkCode::Unknown) + static_cast<int32_t>(curlCode));
+                        Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "CURL code: %. URL: %", curl_easy_strerror(curlCode), lpParam.mMethod);
+                        break;
+                    }
+                    
+                    if (metrics != nullptr)
+                    {
+                        curl_off_t downloadSize = 0;
+                        curl_off_t uploadSize = 0;
+                        
+                        curl_easy_getinfo(handle, CURLINFO_SIZE_DOWNLOAD_T, &downloadSize);
+                        curl_easy_getinfo(handle, CURLINFO_SIZE_UPLOAD_T, &uploadSize);
+                        
+                        metrics->addTransfer(code, transferTime, static_cast<uint64_t>(downloadSize), static_cast<uint64_t>(uploadSize));
+                    }
+                    
+                    // A request without a policy is retried mRepeatCount times after failed transfers. A response already passed to the writer or the stream can't be repeated.
+                    std::shared_ptr<RequestState> state = pState;
+                    
+                    if (code != ENetworkCode::OK && (state == nullptr || !state->mRetry) && (lpParam.mRetryPolicy != nullptr || lpParam.mRepeatCount > 0))
+                    {
+                        if (state == nullptr)
+                            state = std::make_shared<RequestState>();
+                        
+                        if (lpParam.mRetryPolicy != nullptr)
+                        {
+                            state->mRetryPolicy = *lpParam.mRetryPolicy;
+                        }
+                        else
+                        {
+                            state->mRetryPolicy.mCount = lpParam.mRepeatCount;
+                            state->mRetryPolicy.mHttpCode.clear();
+                            state->mRetryPolicy.mRequestType = {ENetworkRequest::Delete, ENetworkRequest::Get, ENetworkRequest::Post, ENetworkRequest::Put, ENetworkRequest::Head};
+                        }
+                        
+                        state->mRetry = true;
+                        state->mStartTime = startTime;
+                    }
+                    
+                    uint32_t retryDelay = 0;
+                    
+                    if (state != nullptr && state->mRetry && !pRequestHandle->isCancel() && progressData.mWriteSize == 0 &&
+                        (progressData.mWriter == nullptr || progressData.mWriter->getPosition() == 0) && strongThis->createRetryDelay(*state, lpParam.mRequestType, code, static_cast<int32_t>(httpCode), responseHeader, retryDelay))
+                    {
+                        if (progressData.mReaderSource != nullptr)
+                        {
+                            lpParam.mRequestReader = requestReader ? std::move(progressData.mReaderSource) : nullptr;
+                            lpParam.mRequestChunked = requestChunked;
+                            lpParam.mHeader.erase(lpParam.mHeader.begin());
+                        }
+                        else
+                        {
+                            lpParam.mRequestReader = std::move(progressData.mReader);
+                        }
+                        
+                        lpParam.mStream = std::move(progressData.mStreamTask);
+                        lpParam.mResponseWriter = std::move(progressData.mWriter);
+                        
+                        state->mTransfer = false;
+                        state->mRequestTime = std::chrono::steady_clock::time_point();
+                        state->mCacheKey = std::move(cacheKey);
+                        state->mCacheValidator = std::move(cacheValidator);
+                        state->mCoalescedRequest = std::move(coalescedRequest);
+                        state->mCoalescingKey = std::move(coalescingKey);
+                        
+                        if (metrics != nullptr)
+                            metrics->addRetry();
+                        
+                        strongThis->scheduleRequest(std::move(lpParam), pRequestHandle, pApiId, std::move(state), retryDelay);
+                        
+                        return;
+                    }
+                    
+                    if (!finishWriter(progressData, code))
+                        Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Response writer commit failed. URL: %", lpParam.mMethod);
+                    
+                    std::vector<CoalescedRequest::Follower> follower;
+                    
+                    if (coalescedRequest != nullptr)
+                    {
+                        std::lock_guard<std::mutex> lock(strongThis->mCoalescedRequestMutex);
+                        strongThis->mCoalescedRequest.erase(coalescingKey);
+                        
+                        std::lock_guard<std::mutex> followerLock(coalescedRequest->mMutex);
+                        follower = std::move(coalescedRequest->mFollower);
+                    }
+
+                    if (lpParam.mCallback != nullptr || follower.size() > 0)
+                    {
+                        NetworkResponse response;
+                        response.mCode = code;
+                        response.mHttpCode = static_cast<int32_t>(httpCode);
+                        response.mHeader = std::move(responseHeader);
+                        readTransferSize(handle, progressData, responseMessage.size() + responseRawData.size(), response);
+                        readTransferTime(handle, requestTime, startTime, response);
+                        response.mMessage = curlCode == CURLE_OK ? std::move(responseMessage) : errorBuffer;
+                        response.mRawData = std::move(responseRawData);
+                        response.mMethod = lpParam.mMethod;
+
+                        if (cacheKey.size() > 0)
+                        {
+                            CachePolicy cachePolicy = createCachePolicy(response.mHeader, lpParam.mCacheLifetime, lpParam.mCacheHeader);
+                            strongThis->finishCacheValidation(cacheValidator, response, cachePolicy);
+                            
+                            if (response.mCode == ENetworkCode::OK)
+                                strongThis->cacheResponse(response, cacheKey, lpParam, headerBlock.get(), cachePolicy);
+                        }
+                        
+                        // Each coalesced request gets its own copy of the response, unless it was canceled in the meantime.
+                        for (auto& v : follower)
+                        {
+                            if (v.mCallback == nullptr)
+                                continue;
+                            
+                            NetworkResponse followerResponse;
+                            if (!v.mRequestHandle->isCancel())
+                            {
+                                followerResponse = copyResponse(response);
+                            }
+                            else
+                            {
+                                followerResponse.mCode = ENetworkCode::Cancel;
+                                followerResponse.mMethod = lpParam.mMethod;
+                            }
+                            
+                            if (followerResponse.mCode != ENetworkCode::Cancel && v.mTaskBackground != nullptr)
+                                followerResponse.mDataTaskBackground = v.mTaskBackground(followerResponse);
+                            
+                            auto responseHandler = std::make_shared<decltype(followerResponse)>(std::move(followerResponse));
+                            Hermes::getInstance()->getTaskManager()->execute(-1, [callback = std::move(v.mCallback), responseHandler = std::move(responseHandler), dispatchTime = std::chrono::steady_clock::now()]() mutable -> void
+                            {
+                                responseHandler->mTiming.mDispatch = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - dispatchTime).count();
+                                callback(std::move(*responseHandler));
+                            });
+                        }
+                        
+                        if (lpParam.mCallback != nullptr)
+                        {
+                            if (coalescedRequest != nullptr && pRequestHandle->isCancel())
+                            {
+                                response = NetworkResponse();
+                                response.mCode = ENetworkCode::Cancel;
+                                response.mMethod = lpParam.mMethod;
+                            }
+                            
+                            if (lpParam.mCacheMode == ENetworkCacheMode::StaleIfError && (response.mCode == ENetworkCode::LostConnection || response.mCode == ENetworkCode::Timeout))
+                                strongThis->serveStaleResponse(cacheValidator, response);
+
+                            if (response.mCode != ENetworkCode::Cancel && lpParam.mTaskBackground != nullptr)
+                                response.mDataTaskBackground = lpParam.mTaskBackground(response);
+
+                            auto responseHandler = std::make_shared<decltype(response)>(std::move(response));
+                            Hermes::getInstance()->getTaskManager()->execute(-1, [callback = std::move(lpParam.mCallback), responseHandler = std::move(responseHandler), dispatchTime = std::chrono::steady_clock::now()]() mutable -> void
+                            {
+                                responseHandler->mTiming.mDispatch = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - dispatchTime).count();
+                                callback(std::move(*responseHandler));
+                            });
+                        }
+                    }
+                }
+            }
+            else if (strongThis != nullptr && pState != nullptr)
+            {
+                // A retry which was still waiting for its delay when the manager terminated completes as canceled.
+                strongThis->shedRequest(std::move(lpParam), pState->mCacheValidator, std::move(pState->mCoalescedRequest), pState->mCoalescingKey, ENetworkCode::Cancel);
+            }
+        };
+        
+        RequestSettings requestSettings;        
+        {
+            std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
+            requestSettings = mRequestSettings;
+        }
+
+        auto task = [requestTask = std::move(requestTask), pParam = std::move(pParam), requestSettings = std::move(requestSettings)]() mutable -> void
+        {                                
+            requestTask(std::move(pParam), std::move(requestSettings));
+        };
+        
+        if (pDelay > 0)
+            Hermes::getInstance()->getTaskManager()->executeDelayed(mThreadPoolId, static_cast<int32_t>(pDelay), std::move(task));
+        else
+            Hermes::getInstance()->getTaskManager()->execute(mThreadPoolId, std::move(task));
+    }
+    
+    void NetworkManager::request(std::vector<NetworkRequest> pParam, std::vector<std::shared_ptr<NetworkRequestHandle>> pRequestHandle)
+    {
+        if (pParam.size() == 0)
+            return;
+
+        if (pParam.size() > pRequestHandle.size())
+            pRequestHandle.resize(pParam.size());
+        
+        for (size_t i = 0; i < pRequestHandle.size(); ++i)
+        {
+            if (pRequestHandle[i] == nullptr)
+                pRequestHandle[i] = std::make_shared<NetworkRequestHandle>();
+        }
+
+        auto weakThis = mWeakThis;
+        auto requestTask = [weakThis, pRequestHandle, requestTime = std::chrono::steady_clock::now()](std::vector<NetworkRequest> lpParam, RequestSettings lpRequestSettings) -> void
+        {
+            void* handle = nullptr;
+            size_t paramSize = lpParam.size();
+            std::vector<MultiRequestData> multiRequestData(paramSize);
+                        
+            for (size_t i = 0; i < paramSize; ++i)
+                multiRequestData[i].mParam = &lpParam[i];
+            
+            std::shared_ptr<NetworkManager> strongThis = weakThis.lock();
+            if (strongThis != nullptr && strongThis->mInitialized.load() == 2)
+            {
+                std::vector<NetworkRequest> param;
+                param.reserve(lpParam.size());
+                std::vector<CacheValidator> cacheValidator;
+                cacheValidator.reserve(lpParam.size());
+                std::vector<std::string> cacheKey;
+                cacheKey.reserve(lpParam.size());
+                
+                for (auto it = lpParam.begin(); it != lpParam.end(); it++)
+                {
+                    std::string key = (*it).mAllowCache ? strongThis->createCacheKey(*it, nullptr, lpRequestSettings) : "";
+                    
+                    if (key.size() == 0)
+                    {
+                        param.push_back(std::move(*it));
+                        cacheValidator.emplace_back();
+                        cacheKey.emplace_back();
+                    }
+                    else
+                    {
+                        CacheValidator validator;
+                        const bool allowStale = it->mCacheMode != ENetworkCacheMode::Default;
+                        NetworkResponse response = strongThis->getResponseFromCache(key, *it, nullptr, it->mCacheHeader || allowStale ? &validator : nullptr, allowStale);
+                        
+                        if (response.mCode != ENetworkCode::OK && it->mCacheMode == ENetworkCacheMode::StaleWhileRevalidate && strongThis->serveStaleResponse(validator, response))
+                            strongThis->revalidateCache(*it, nullptr, key);
+                        
+                        if (response.mCode != ENetworkCode::OK)
+                        {
+                            strongThis->applyCacheValidator(validator, *it);
+                            param.push_back(std::move(*it));
+                            cacheValidator.push_back(std::move(validator));
+                            cacheKey.push_back(std::move(key));
+                        }
+                        else
+                        {
+                            if (it->mCallback != nullptr)
+                            {
+                                if (response.mCode != ENetworkCode::Cancel && it->mTaskBackground != nullptr)
+                                    response.mDataTaskBackground = it->mTaskBackground(response);
+
+                                auto responseHandler = std::make_shared<decltype(response)>(std::move(response));
+                                Hermes::getInstance()->getTaskManager()->execute(-1, [callback = std::move(it->mCallback), responseHandler = std::move(responseHandler)]() mutable -> void
+                                {
+                                    callback(std::move(*responseHandler));
+                                });
+                            }
+                        }
+                    }
+                }
+                
+                if (param.size() == 0)
+                    return;
+
+                {
+                    std::lock_guard<std::mutex> lock(strongThis->mMultiHandleMutex);
+                    handle = strongThis->mMultiHandle[std::this_thread::get_id()];
+                }
+                
+                if (handle == nullptr)
+                {
+                    handle = curl_multi_init();
+
+                    std::lock_guard<std::mutex> lock(strongThis->mMultiHandleMutex);
+                    strongThis->mMultiHandle[std::this_thread::get_id()] = handle;
+                }
+            
+                paramSize = param.size();
+                multiRequestData = std::vector<MultiRequestData>(paramSize);
+            
+                for (size_t i = 0; i < paramSize; ++i)
+                {
+                    multiRequestData[i].mHandle = curl_easy_init();
+                    multiRequestData[i].mParam = &param[i];
+                    multiRequestData[i].mCacheValidator = std::move(cacheValidator[i]);
+                    multiRequestData[i].mCacheKey = std::move(cacheKey[i]);
+                    multiRequestData[i].mErrorBuffer.resize(CURL_ERROR_SIZE);
+                    multiRequestData[i].mErrorBuffer[0] = 0;
+
+                    curl_easy_setopt(multiRequestData[i].mHandle, CURLOPT_PRIVATE, &multiRequestData[i]);
+                    curl_easy_setopt(multiRequestData[i].mHandle, CURLOPT_HEADERFUNCTION, CURL_HEADER_CALLBACK);
+                    curl_easy_setopt(multiRequestData[i].mHandle, CURLOPT_SHARE, strongThis->mShareHandle);
+                    if (strongThis->mCertificate->mType == ENetworkCertificate::Path)
+                        curl_easy_setopt(multiRequestData[i].mHandle, CURLOPT_CAINFO, strongThis->mCertificate->mData.c_str());
+                    else if (strongThis->mCertificate->mType == ENetworkCertificate::Content)
+                        curl_easy_setopt(multiRequestData[i].mHandle, CURLOPT_CAINFO_BLOB, &strongThis->mCertificate->mBlob);
+                    
+                    auto readerSource = compressRequestBody(param[i]);
+                    auto uniqueHeader = strongThis->createUniqueHeader(param[i].mHeader, nullptr);
+
+                    curl_slist* header = nullptr;
+
+                    for (auto& x : uniqueHeader)
+                    {
+                        std::string singleHeader = x.first;
+                        singleHeader += ": ";
+                        singleHeader += x.second;
+                        
+                        header = curl_slist_append(header, singleHeader.c_str());
+                    }
+
+                    multiRequestData[i].mProgressData.mRequestHandle = pRequestHandle[i];
+                    multiRequestData[i].mProgressData.mTerminateAbort = &strongThis->mTerminateAbort;
+                    multiRequestData[i].mProgressData.mStreamTask = std::move(param[i].mStream);
+                    multiRequestData[i].mProgressData.mWriter = std::move(param[i].mResponseWriter);
+                    multiRequestData[i].mProgressData.mReader = std::move(param[i].mRequestReader);
+                    multiRequestData[i].mProgressData.mReaderSource = std::move(readerSource);
+                    multiRequestData[i].mProgressData.mReaderChunked = param[i].mRequestChunked;
+                    
+                    if (param[i].mProgress != nullptr)
+                    {
+                        decltype(param[i].mProgress) progress = std::move(param[i].mProgress);
+                        decltype(lpRequestSettings.mProgressTimePeriod) progressTimePeriod = lpRequestSettings.mProgressTimePeriod;
+                        auto lastTick = std::chrono::system_clock::now();
+                        multiRequestData[i].mProgressData.mProgressTask = [progressTimePeriod, progress, lastTick](int64_t lpDN, int64_t lpDT, int64_t lpUN, int64_t lpUT) mutable -> void
+                        {
+                            auto thisTick = std::chrono::system_clock::now();
+                            const auto difference = std::chrono::duration_cast<std::chrono::milliseconds>(thisTick - lastTick).count();
+                            
+                            if (difference > progressTimePeriod || (lpDN != 0 && lpDN == lpDT) || (lpUN != 0 && lpUN == lpUT))
+                            {
+                                lastTick = std::chrono::system_clock::now();
+                                Hermes::getInstance()->getTaskManager()->execute(-1, progress, lpDN, lpDT, lpUN, lpUT);
+                            }
+                        };
+                    }
+                    
+                    std::string requestUrl = param[i].mMethod;
+                    strongThis->appendParameter(requestUrl, param[i].mParameter);
+                    
+                    strongThis->configureHandle(multiRequestData[i].mHandle, param[i].mRequestType, param[i].mResponseType, requestUrl, param[i].mRequestBody, &multiRequestData[i].mResponseMessage,
+                        &multiRequestData[i].mResponseRawData, &multiRequestData[i].mResponseHeader, header, param[i].mResponseCompression == ENetworkCompression::Enable, lpRequestSettings, &multiRequestData[i].mProgressData,
+                        &multiRequestData[i].mErrorBuffer[0]);
+                    
+                    curl_multi_add_handle(handle, multiRequestData[i].mHandle);
+                }
+
+                int activeHandle = 0;
+                uint32_t terminateAbort = 0;
+                const auto startTime = std::chrono::steady_clock::now();
+                
+                do
+                {
+                    long multiTimeout = -1;
+                    curl_multi_timeout(handle, &multiTimeout);
+                
+                    timeval timeout = {1, 0};
+                    
+                    if (multiTimeout >= 0)
+                    {
+                        timeout.tv_sec = multiTimeout / 1000;
+                        
+                        if (timeout.tv_sec > 1)
+                            timeout.tv_sec = 1;
+                        else
+                            timeout.tv_usec = (multiTimeout % 1000) * 1000;
+                    }
+
+                    fd_set readFd;
+                    fd_set writeFd;
+                    fd_set exceptionFd;
+
+                    FD_ZERO(&readFd);
+                    FD_ZERO(&writeFd);
+                    FD_ZERO(&exceptionFd);
+                    
+                    int maxFd = -1;
+         
+                    CURLMcode codeFdset = curl_multi_fdset(handle, &readFd, &writeFd, &exceptionFd, &maxFd);
+                    
+                    if (codeFdset != CURLM_OK)
+                    {
                         Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "CURL fdset code: \"%\"", curl_multi_strerror(codeFdset));
                         
-                        break;
-                    }
+                        break;
+                    }
+
+                    int codeSelect = 0;
+                 
+                    if (maxFd == -1)
+                    {
+                        timeval wait = {0, 100000};
+                        codeSelect = select(0, nullptr, nullptr, nullptr, &wait);
+                    }
+                    else
+                    {
+                        codeSelect = select(maxFd + 1, &readFd, &writeFd, &exceptionFd, &timeout);
+                    }
+                    
+                    switch (codeSelect)
+                    {
+                    case -1: // error
+                        break;
+                    case 0: // timeout
+                    default:
+                        curl_multi_perform(handle, &activeHandle);
+                        break;
+                    }
+                    
+                    CURLMsg* message = nullptr;
+                    int messageLeft = 0;
+                    
+                    while ((terminateAbort = strongThis->mTerminateAbort.load()) == 0 && (message = curl_multi_info_read(handle, &messageLeft)))
+                    {
+                        if (message->msg == CURLMSG_DONE)
+                        {
+                            CURLcode curlCode = message->data.result;
+                            MultiRequestData* requestData = nullptr;
+                            
+                            ENetworkCode code = ENetworkCode::Unknown;
+                            long httpCode = -1;
+                            
+                            curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, &requestData);
+                            
+                            switch (curlCode)
+                            {
+                            case CURLE_OK:
+                                curl_easy_getinfo(message->easy_handle, CURLINFO_RESPONSE_CODE, &httpCode);
+                                code = httpCode >= 200 && httpCode <= 299 ? ENetworkCode::OK : ENetworkCode::InvalidHttpCodeRange;
+                                break;
+                            case CURLE_COULDNT_RESOLVE_HOST:
+                                code = ENetworkCode::LostConnection;
+                                Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Lost connection: %", (requestData != nullptr) ? requestData->mParam->mMethod : "unknown");
+                                break;
+                            case CURLE_OPERATION_TIMEDOUT:
+                                code = ENetworkCode::Timeout;
+                                Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Timeout: %", (requestData != nullptr) ? requestData->mParam->mMethod : "unknown");
+                                break;
+                            case CURLE_ABORTED_BY_CALLBACK:
+                                code = ENetworkCode::Cancel;
+                                Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Cancel: %", (requestData != nullptr) ? requestData->mParam->mMethod : "unknown");
+                                break;
+                            default:
+                                code = static_cast<ENetworkCode>(static_cast<int32_t>(ENetworkCode::Unknown) + static_cast<int32_t>(curlCode));
+                                Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "CURL code: %. URL: %", curl_easy_strerror(curlCode), (requestData != nullptr) ? requestData->mParam->mMethod : "unknown");
+                                break;
+                            }
+                            
+                            if (requestData != nullptr && !finishWriter(requestData->mProgressData, code))
+                                Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Response writer commit failed. URL: %", requestData->mParam->mMethod);
+
+                            if (requestData != nullptr && requestData->mParam->mCallback != nullptr)
+                            {
+                                NetworkResponse response;
+                                response.mCode = code;
+                                response.mHttpCode = static_cast<int32_t>(httpCode);
+                                response.mHeader = std::move(requestData->mResponseHeader);
+                                readTransferSize(message->easy_handle, requestData->mProgressData, requestData->mResponseMessage.size() + requestData->mResponseRawData.size(), response);
+                                readTransferTime(message->easy_handle, requestTime, startTime, response);
+                                response.mMessage = curlCode == CURLE_OK ? std::move(requestData->mResponseMessage) : &requestData->mErrorBuffer[0];
+                                response.mRawData = std::move(requestData->mResponseRawData);
+                                response.mMethod = requestData->mParam->mMethod;
+                                
+                                if (requestData->mCacheKey.size() > 0)
+                                {
+                                    CachePolicy cachePolicy = createCachePolicy(response.mHeader, requestData->mParam->mCacheLifetime, requestData->mParam->mCacheHeader);
+                                    strongThis->finishCacheValidation(requestData->mCacheValidator, response, cachePolicy);
+                                    
+                                    if (response.mCode == ENetworkCode::OK)
+                                        strongThis->cacheResponse(response, requestData->mCacheKey, *requestData->mParam, nullptr, cachePolicy);
+                                }
+                                
+                                if (requestData->mParam->mCacheMode == ENetworkCacheMode::StaleIfError && (response.mCode == ENetworkCode::LostConnection || response.mCode == ENetworkCode::Timeout))
+                                    strongThis->serveStaleResponse(requestData->mCacheValidator, response);
+
+                                if (response.mCode != ENetworkCode::Cancel && requestData->mParam->mTaskBackground != nullptr)
+                                    response.mDataTaskBackground = requestData->mParam->mTaskBackground(response);
+
+                                auto responseHandler = std::make_shared<decltype(response)>(std::move(response));
+                                Hermes::getInstance()->getTaskManager()->execute(-1, [callback = std::move(requestData->mParam->mCallback), responseHandler = std::move(responseHandler), dispatchTime = std::chrono::steady_clock::now()]() mutable -> void
+                                {
+                                    responseHandler->mTiming.mDispatch = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - dispatchTime).count();
+                                    callback(std::move(*responseHandler));
+                                });
+                            }
+                        }
+                    }
+                }
+                while (activeHandle && terminateAbort == 0);
+            }
+            
+            for (size_t i = 0; i < paramSize; ++i)
+            {
+                if (handle != nullptr)
+                {
+                    curl_multi_remove_handle(handle, multiRequestData[i].mHandle);
+                    curl_easy_cleanup(multiRequestData[i].mHandle);
+                }
+            }
+        };
+        
+        RequestSettings requestSettings;        
+        {
+            std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
+            requestSettings = mRequestSettings;
+        }
+
+        Hermes::getInstance()->getTaskManager()->execute(mThreadPoolId, [requestTask = std::move(requestTask), pParam = std::move(pParam), requestSettings = std::move(requestSettings)]() mutable -> void
+        {
+            requestTask(std::move(pParam), std::move(requestSettings));
+        });
+    }
+    
+    int64_t NetworkManager::getTimeout() const
+    {
+        std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
+        return mRequestSettings.mTimeout;
+    }
+    
+    void NetworkManager::setTimeout(int64_t pTimeout)
+    {
+        if (mInitialized.load() == 2)
+        {
+            std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
+            mRequestSettings.mTimeout = pTimeout;
+        }
+    }
+    
+    void NetworkManager::preconnect(size_t pApiId, uint32_t pCount)
+    {
+        if (mInitialized.load() != 2)
+            return;
+        
+        std::string url;
+        
+        {
+            std::lock_guard<std::mutex> lock(mApiMutex);
+            if (pApiId < mApi.size() && mApi[pApiId] != nullptr)
+                url = mApi[pApiId]->getUrl();
+        }
+        
+        if (url.size() == 0)
+            return;
+        
+        RequestSettings requestSettings;
+        {
+            std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
+            requestSettings = mRequestSettings;
+        }
+        
+        auto weakThis = mWeakThis;
+        for (uint32_t i = 0; i < pCount; ++i)
+        {
+            Hermes::getInstance()->getTaskManager()->execute(mThreadPoolId, [weakThis, url, requestSettings]() -> void
+            {
+                std::shared_ptr<NetworkManager> strongThis = weakThis.lock();
+                if (strongThis == nullptr || strongThis->mInitialized.load() != 2)
+                    return;
+                
+                // A request without a body is sent with the handle of the thread, so the connection stays in the cache used by the next requests of the thread.
+                void* handle = strongThis->getHandle();
+                std::string responseMessage;
+                std::vector<std::pair<std::string, std::string>> responseHeader;
+                char errorBuffer[CURL_ERROR_SIZE];
+                errorBuffer[0] = 0;
+                
+                strongThis->configureHandle(handle, ENetworkRequest::Head, ENetworkResponse::Message, url, "", &responseMessage, nullptr, &responseHeader, nullptr, false, requestSettings, nullptr, errorBuffer);
+                
+                CURLcode curlCode = curl_easy_perform(handle);
+                if (curlCode != CURLE_OK)
+                    Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Preconnect failed: %. URL: %", curl_easy_strerror(curlCode), url);
+                
+                strongThis->resetHandle(handle);
+            });
+        }
+    }
+    
+    uint32_t NetworkManager::getPreconnectCount() const
+    {
+        return mPreconnectCount.load();
+    }
+    
+    void NetworkManager::setPreconnectCount(uint32_t pCount)
+    {
+        if (mInitialized.load() == 2)
+            mPreconnectCount.store(pCount);
+    }
+    
+    NetworkKeepAlive NetworkManager::getKeepAlive() const
+    {
+        std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
+        return mRequestSettings.mKeepAlive;
+    }
+    
+    void NetworkManager::setKeepAlive(NetworkKeepAlive pKeepAlive)
+    {
+        if (mInitialized.load() == 2)
+        {
+            std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
+            mRequestSettings.mKeepAlive = std::move(pKeepAlive);
+        }
+    }
+    
+    bool NetworkManager::getFlag(ENetworkFlag pFlag) const
+    {
+        assert(pFlag < ENetworkFlag::Count);
+            
+        std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
+        return mRequestSettings.mFlag[static_cast<size_t>(pFlag)];
+    }
+    
+    void NetworkManager::setFlag(ENetworkFlag pFlag, bool pState)
+    {
+        assert(pFlag < ENetworkFlag::Count);
+        
+        if (mInitialized.load() == 2)
+        {
+            std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
+            mRequestSettings.mFlag[static_cast<size_t>(pFlag)] = pState;
+        }
+    }
+    
+    int64_t NetworkManager::getProgressTimePeriod() const
+    {
+        std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
+        return mRequestSettings.mProgressTimePeriod;
+    }
+    
+    void NetworkManager::setProgressTimePeriod(int64_t pTimePeriod)
+    {
+        if (mInitialized.load() == 2)
+        {
+            std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
+            mRequestSettings.mProgressTimePeriod = pTimePeriod;
+        }
+    }
+    
+    std::vector<std::string> NetworkManager::getCoalescingHeader() const
+    {
+        std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
+        return mRequestSettings.mCoalescingHeader != nullptr ? *mRequestSettings.mCoalescingHeader : std::vector<std::string>();
+    }
+    
+    void NetworkManager::setCoalescingHeader(std::vector<std::string> pHeader)
+    {
+        // Names are compared with the lowercase names produced by createUniqueHeader.
+        for (auto& v : pHeader)
+            std::transform(v.begin(), v.end(), v.begin(), ::tolower);
+        
+        if (mInitialized.load() == 2)
+        {
+            std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
+            mRequestSettings.mCoalescingHeader = std::make_shared<const std::vector<std::string>>(std::move(pHeader));
+        }
+    }
+    
+    std::vector<std::string> NetworkManager::getCacheKeyHeader() const
+    {
+        std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
+        return mRequestSettings.mCacheKeyHeader != nullptr ? *mRequestSettings.mCacheKeyHeader : std::vector<std::string>();
+    }
+    
+    void NetworkManager::setCacheKeyHeader(std::vector<std::string> pHeader)
+    {
+        for (auto& v : pHeader)
+            std::transform(v.begin(), v.end(), v.begin(), ::tolower);
+        
+        // Names are looked up in this order, so the order of headers in a request doesn't change the key.
+        std::sort(pHeader.begin(), pHeader.end());
+        pHeader.erase(std::unique(pHeader.begin(), pHeader.end()), pHeader.end());
+        
+        if (mInitialized.load() == 2)
+        {
+            std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
+            mRequestSettings.mCacheKeyHeader = std::make_shared<const std::vector<std::string>>(std::move(pHeader));
+        }
+    }
+    
+    void NetworkManager::setCacheKeyFunction(std::function<std::string(const NetworkRequest& lpParam)> pFunction)
+    {
+        if (mInitialized.load() == 2)
+        {
+            std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
+            mRequestSettings.mCacheKeyFunction = pFunction != nullptr ? std::make_shared<const std::function<std::string(const NetworkRequest&)>>(std::move(pFunction)) : nullptr;
+        }
+    }
+    
+    uint64_t NetworkManager::getCoalescingCount() const
+    {
+        return mCoalescingCount.load();
+    }
+    
+    std::pair<float, uint32_t> NetworkManager::getRetryBudget() const
+    {
+        std::lock_guard<std::mutex> lock(mRetryMutex);
+        return {mRetryBudgetRatio, mRetryBudgetMinimum};
+    }
+    
+    void NetworkManager::setRetryBudget(float pRatio, uint32_t pMinimum)
+    {
+        if (mInitialized.load() == 2)
+        {
+            std::lock_guard<std::mutex> lock(mRetryMutex);
+            mRetryBudgetRatio = std::max(0.0f, pRatio);
+            mRetryBudgetMinimum = pMinimum;
+            mRetryBudget = std::min(mRetryBudget, 100.0 * mRetryBudgetRatio + mRetryBudgetMinimum);
+        }
+    }
+    
+    uint64_t NetworkManager::getRetryCount() const
+    {
+        return mRetryCount.load();
+    }
+    
+    uint32_t NetworkManager::getConcurrencyLimit(size_t pApiId) const
+    {
+        std::lock_guard<std::mutex> lock(mSchedulerMutex);
+        auto it = mSchedulerFlow.find(pApiId);
+        
+        return it != mSchedulerFlow.end() ? it->second.mLimit : 0;
+    }
+    
+    void NetworkManager::setConcurrencyLimit(size_t pApiId, uint32_t pLimit)
+    {
+        if (mInitialized.load() == 2)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mSchedulerMutex);
+                mSchedulerFlow[pApiId].mLimit = pLimit;
+                updateSchedulerState();
+            }
+            
+            dispatchTransfer();
+        }
+    }
+    
+    uint32_t NetworkManager::getSchedulingWeight(size_t pApiId) const
+    {
+        std::lock_guard<std::mutex> lock(mSchedulerMutex);
+        auto it = mSchedulerFlow.find(pApiId);
+        
+        return it != mSchedulerFlow.end() ? it->second.mWeight : 1;
+    }
+    
+    void NetworkManager::setSchedulingWeight(size_t pApiId, uint32_t pWeight)
+    {
+        if (mInitialized.load() == 2)
+        {
+            std::lock_guard<std::mutex> lock(mSchedulerMutex);
+            mSchedulerFlow[pApiId].mWeight = std::max(1u, pWeight);
+        }
+    }
+    
+    uint32_t NetworkManager::getHostConcurrencyLimit() const
+    {
+        std::lock_guard<std::mutex> lock(mSchedulerMutex);
+        return mHostConcurrencyLimit;
+    }
+    
+    void NetworkManager::setHostConcurrencyLimit(uint32_t pLimit)
+    {
+        if (mInitialized.load() == 2)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mSchedulerMutex);
+                mHostConcurrencyLimit = pLimit;
+                updateSchedulerState();
+            }
+            
+            dispatchTransfer();
+        }
+    }
+    
+    std::shared_ptr<const NetworkLimiterPolicy> NetworkManager::getConcurrencyLimiter(size_t pApiId) const
+    {
+        std::lock_guard<std::mutex> lock(mSchedulerMutex);
+        auto it = mSchedulerFlow.find(pApiId);
+        
+        return it != mSchedulerFlow.end() ? it->second.mLimiter : nullptr;
+    }
+    
+    void NetworkManager::setConcurrencyLimiter(size_t pApiId, std::shared_ptr<const NetworkLimiterPolicy> pPolicy)
+    {
+        if (mInitialized.load() == 2)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mSchedulerMutex);
+                SchedulerFlow& flow = mSchedulerFlow[pApiId];
+                flow.mLimiterLimit = pPolicy != nullptr ? std::min(std::max(1u, pPolicy->mMaxLimit), std::max({1u, pPolicy->mMinLimit, pPolicy->mInitialLimit})) : 0.0;
+                flow.mLimiterRtt = 0.0;
+                flow.mLimiter = std::move(pPolicy);
+                updateSchedulerState();
+            }
+            
+            dispatchTransfer();
+        }
+    }
+    
+    NetworkSchedulerStatistics NetworkManager::getSchedulerStatistics(size_t pApiId) const
+    {
+        NetworkSchedulerStatistics statistics;
+        
+        std::lock_guard<std::mutex> lock(mSchedulerMutex);
+        auto it = mSchedulerFlow.find(pApiId);
+        if (it != mSchedulerFlow.end())
+        {
+            statistics.mQueueSize = it->second.mTask.size();
+            statistics.mActiveCount = it->second.mActiveCount;
+            statistics.mQueuedCount = it->second.mQueuedCount;
+            statistics.mWaitTime = it->second.mWaitTime;
+            statistics.mMaxWaitTime = it->second.mMaxWaitTime;
+            statistics.mShedCount = it->second.mShedCount;
+            statistics.mLimit = getTransferLimit(it->second);
+            statistics.mRtt = static_cast<uint32_t>(it->second.mLimiterRtt / 1000.0);
+            statistics.mHedgeCount = it->second.mHedgeCount;
+            statistics.mHedgeWinCount = it->second.mHedgeWinCount;
+        }
+        
+        return statistics;
+    }
+    
+    NetworkMetrics NetworkManager::getMetrics(size_t pApiId) const
+    {
+        std::shared_ptr<MetricsData> metrics = nullptr;
+        
+        {
+            std::lock_guard<std::mutex> lock(mMetricsMutex);
+            auto it = mMetrics.find(pApiId);
+            if (it != mMetrics.end())
+                metrics = it->second;
+        }
+        
+        return metrics != nullptr ? metrics->getMetrics() : NetworkMetrics();
+    }
+    
+    std::string NetworkManager::exportMetrics() const
+    {
+        static const char* codeName[MetricsData::CodeCount] = {"ok", "invalid_http_code_range", "lost_connection", "timeout", "cancel", "overload", "unknown"};
+        
+        std::vector<std::pair<std::string, NetworkMetrics>> metrics;
+        
+        {
+            std::vector<std::pair<size_t, std::shared_ptr<MetricsData>>> data;
+            
+            {
+                std::lock_guard<std::mutex> lock(mMetricsMutex);
+                data.assign(mMetrics.begin(), mMetrics.end());
+            }
+            
+            std::sort(data.begin(), data.end(), [](const auto& lpA, const auto& lpB) -> bool { return lpA.first < lpB.first; });
+            
+            for (const auto& v : data)
+            {
+                std::string name;
+                
+                auto api = get(v.first);
+                const std::string& source = api != nullptr ? api->getName() : std::to_string(v.first);
+                for (char c : source)
+                {
+                    if (c == '\\' || c == '"')
+                        name += '\\';
+                    
+                    if (c == '\n')
+                        name += "\\n";
+                    else
+                        name += c;
+                }
+                
+                metrics.emplace_back(std::move(name), v.second->getMetrics());
+            }
+        }
+        
+        std::ostringstream stream;
+        stream.imbue(std::locale::classic());
+        
+        stream << "# HELP hermes_requests_total Finished transfers by result code.\n# TYPE hermes_requests_total counter\n";
+        for (const auto& v : metrics)
+        {
+            for (const auto& code : v.second.mCodeCount)
+                stream << "hermes_requests_total{api=\"" << v.first << "\",code=\"" << codeName[MetricsData::getCodeIndex(code.first)] << "\"} " << code.second << "\n";
+        }
+        
+        // Exported buckets end at powers of two microseconds, so their set doesn't change with the traffic.
+        stream << "# HELP hermes_request_duration_seconds Duration of transfers.\n# TYPE hermes_request_duration_seconds histogram\n";
+        for (const auto& v : metrics)
+        {
+            size_t index = 0;
+            uint64_t count = 0;
+            
+            for (size_t i = MetricsData::SubBucketBit; i <= 25; ++i)
+            {
+                const int64_t bound = (static_cast<int64_t>(1) << (i + 1)) - 1;
+                for (; index < v.second.mLatency.size() && v.second.mLatency[index].first <= bound; ++index)
+                    count += v.second.mLatency[index].second;
+                
+                stream << "hermes_request_duration_seconds_bucket{api=\"" << v.first << "\",le=\"" << static_cast<double>(bound + 1) / 1000000.0 << "\"} " << count << "\n";
+            }
+            
+            stream << "hermes_request_duration_seconds_bucket{api=\"" << v.first << "\",le=\"+Inf\"} " << v.second.mRequestCount << "\n";
+            stream << "hermes_request_duration_seconds_sum{api=\"" << v.first << "\"} " << static_cast<double>(v.second.mLatencySum) / 1000000.0 << "\n";
+            stream << "hermes_request_duration_seconds_count{api=\"" << v.first << "\"} " << v.second.mRequestCount << "\n";
+        }
+        
+        stream << "# HELP hermes_received_bytes_total Bytes received by transfers.\n# TYPE hermes_received_bytes_total counter\n";
+        for (const auto& v : metrics)
+            stream << "hermes_received_bytes_total{api=\"" << v.first << "\"} " << v.second.mDownloadSize << "\n";
+        
+        stream << "# HELP hermes_sent_bytes_total Bytes sent by transfers.\n# TYPE hermes_sent_bytes_total counter\n";
+        for (const auto& v : metrics)
+            stream << "hermes_sent_bytes_total{api=\"" << v.first << "\"} " << v.second.mUploadSize << "\n";
+        
+        stream << "# HELP hermes_cache_requests_total Cache lookups by result.\n# TYPE hermes_cache_requests_total counter\n";
+        for (const auto& v : metrics)
+        {
+            stream << "hermes_cache_requests_total{api=\"" << v.first << "\",result=\"hit\"} " << v.second.mCacheHitCount << "\n";
+            stream << "hermes_cache_requests_total{api=\"" << v.first << "\",result=\"miss\"} " << v.second.mCacheMissCount << "\n";
+        }
+        
+        stream << "# HELP hermes_retries_total Retried transfers.\n# TYPE hermes_retries_total counter\n";
+        for (const auto& v : metrics)
+            stream << "hermes_retries_total{api=\"" << v.first << "\"} " << v.second.mRetryCount << "\n";
+        
+        return stream.str();
+    }
+    
+    bool NetworkManager::exportMetrics(DataWriter& pWriter) const
+    {
+        const std::string text = exportMetrics();
+        
+        if (pWriter.write(text) != text.size())
+        {
+            Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Metrics export failed.");
+            return false;
+        }
+        
+        return true;
+    }
+    
+    void NetworkManager::appendParameter(std::string& pURL, const std::vector<std::pair<std::string, std::string>>& pParameter) const
+    {
+        // The exact size of the query is reserved first, so the values are encoded straight into the url without reallocations.
+        size_t size = 0;
+        
+        for (const auto& v : pParameter)
+        {
+            if (v.first.size() > 0 && v.second.size() > 0)
+                size += v.first.size() + 2 + URL_ENCODE_SIZE(v.second.data(), v.second.size());
+        }
+        
+        if (size == 0)
+            return;
+        
+        pURL.reserve(pURL.size() + size);
+        
+        bool first = true;
+        
+        for (const auto& v : pParameter)
+        {
+            if (v.first.size() > 0 && v.second.size() > 0)
+            {
+                pURL += (first) ? '?' : '&';
+                pURL += v.first;
+                pURL += '=';
+                URL_ENCODE_APPEND(pURL, v.second.data(), v.second.size());
+                
+                first = false;
+            }
+        }
+    }
+
+    void NetworkManager::decodeURL(std::string& pData) const
+    {
+        char* data = curl_unescape(pData.c_str(), static_cast<int>(pData.size()));
+        pData = data;
+        curl_free(data);
+    }
+    
+    void NetworkManager::encodeURL(std::string& pData) const
+    {
+        const size_t size = URL_ENCODE_SIZE(pData.data(), pData.size());
+        if (size == pData.size())
+            return;
+        
+        // The encoded size is known up front, so the result is built with a single allocation.
+        std::string result;
+        result.reserve(size);
+        URL_ENCODE_APPEND(result, pData.data(), pData.size());
+        pData = std::move(result);
+    }
+    
+    // Headers of the request come first, the default headers of the block follow unless the request overrides them.
+    std::vector<std::pair<std::string, std::string>> NetworkManager::createUniqueHeader(const std::vector<std::pair<std::string, std::string>>& pHeader, const NetworkAPI::HeaderBlock* pHeaderBlock) const
+    {
+        std::vector<std::pair<std::string, std::string>> header;
+        std::unordered_multimap<uint64_t, size_t> index;
+        header.reserve(pHeader.size() + (pHeaderBlock != nullptr ? pHeaderBlock->mHeader.size() : 0));
+        index.reserve(pHeader.size());
+            
+        for (const auto& v : pHeader)
+        {
+            const uint64_t headerHash = HEADER_NAME_HASH(v.first);
+            
+            if (!HEADER_INDEX_FIND(index, headerHash, v.first, header))
+            {
+                std::string headerType = v.first;
+                std::transform(headerType.begin(), headerType.end(), headerType.begin(), ::tolower);
+                
+                index.emplace(headerHash, header.size());
+                header.push_back({std::move(headerType), v.second});
+            }
+        }
+        
+        if (pHeaderBlock != nullptr)
+        {
+            const size_t headerCount = header.size();
+            
+            for (size_t i = 0; i < pHeaderBlock->mHeader.size(); ++i)
+            {
+                if (headerCount == 0 || !HEADER_INDEX_FIND(index, pHeaderBlock->mHash[i], pHeaderBlock->mHeader[i].first, header))
+                    header.push_back(pHeaderBlock->mHeader[i]);
+            }
+        }
+        
+        return header;
+    }
+    
+    std::shared_ptr<const NetworkAPI::HeaderBlock> NetworkManager::getHeaderBlock(size_t pApiId) const
+    {
+        std::shared_ptr<NetworkAPI> api = nullptr;
+        
+        {
+            std::lock_guard<std::mutex> lock(mApiMutex);
+            if (pApiId < mApi.size())
+                api = mApi[pApiId];
+        }
+        
+        return api != nullptr ? std::atomic_load(&api->mHeaderBlock) : nullptr;
+    }
+    
+    // Headers of the request come first and take precedence over the default headers of the same name. When none of the defaults is overridden,
+    // the shared list of the header block is linked after the last header of the request and pLink points to that header.
+    curl_slist* NetworkManager::createHeaderList(const std::vector<std::pair<std::string, std::string>>& pHeader, const NetworkAPI::HeaderBlock* pHeaderBlock, curl_slist*& pLink)
+    {
+        curl_slist* list = nullptr;
+        curl_slist* tail = nullptr;
+        std::unordered_multimap<uint64_t, size_t> index;
+        index.reserve(pHeader.size());
+        bool override = false;
+        
+        pLink = nullptr;
+        
+        for (size_t i = 0; i < pHeader.size(); ++i)
+        {
+            const uint64_t headerHash = HEADER_NAME_HASH(pHeader[i].first);
+            if (HEADER_INDEX_FIND(index, headerHash, pHeader[i].first, pHeader))
+                continue;
+            
+            if (pHeaderBlock != nullptr && !override)
+                override = HEADER_INDEX_FIND(pHeaderBlock->mIndex, headerHash, pHeader[i].first, pHeaderBlock->mHeader);
+            
+            HEADER_APPEND(list, tail, pHeader[i].first, pHeader[i].second);
+            index.emplace(headerHash, i);
+        }
+        
+        if (pHeaderBlock == nullptr || pHeaderBlock->mList == nullptr)
+            return list;
+        
+        if (!override)
+        {
+            if (tail == nullptr)
+                return pHeaderBlock->mList;
+            
+            tail->next = pHeaderBlock->mList;
+            pLink = tail;
+            
+            return list;
+        }
+        
+        for (size_t i = 0; i < pHeaderBlock->mHeader.size(); ++i)
+        {
+            if (!HEADER_INDEX_FIND(index, pHeaderBlock->mHash[i], pHeaderBlock->mHeader[i].first, pHeader))
+                HEADER_APPEND(list, tail, pHeaderBlock->mHeader[i].first, pHeaderBlock->mHeader[i].second);
+        }
+        
+        return list;
+    }
+    
+    void NetworkManager::freeHeaderList(curl_slist* pList, curl_slist* pLink, const NetworkAPI::HeaderBlock* pHeaderBlock)
+    {
+        if (pHeaderBlock != nullptr && pList == pHeaderBlock->mList)
+            return;
+        
+        if (pLink != nullptr)
+            pLink->next = nullptr;
+        
+        curl_slist_free_all(pList);
+    }
+
+    std::string NetworkManager::createCoalescingKey(const NetworkRequest& pParam, const NetworkAPI::HeaderBlock* pHeaderBlock, const std::vector<std::string>& pHeader) const
+    {
+        std::string key = std::to_string(static_cast<int32_t>(pParam.mResponseType));
+        key += pParam.mResponseCompression == ENetworkCompression::Enable ? "+" : "-";
+        key += pParam.mMethod;
+        appendParameter(key, pParam.mParameter);
+        
+        for (const auto& v : createUniqueHeader(pParam.mHeader, pHeaderBlock))
+        {
+            if (std::find(pHeader.begin(), pHeader.end(), v.first) != pHeader.end())
+            {
+                key += '\n';
+                key += v.first;
+                key += ": ";
+                key += v.second;
+            }
+        }
+        
+        return key;
+    }
+    
+    std::string NetworkManager::createCacheKey(const NetworkRequest& pParam, const NetworkAPI::HeaderBlock* pHeaderBlock, const RequestSettings& pSettings) const
+    {
+        std::string material;
+        
+        if (pSettings.mCacheKeyFunction != nullptr)
+        {
+            material = (*pSettings.mCacheKeyFunction)(pParam);
+            
+            return material.size() > 0 ? CACHE_KEY_HASH(material) : material;
+        }
+        
+        // Requests which differ only in the case of the scheme and host, the order of query parameters or the fragment share a key.
+        std::string url = pParam.mMethod.substr(0, pParam.mMethod.find('#'));
+        appendParameter(url, pParam.mParameter);
+        
+        const size_t queryPosition = url.find('?');
+        const size_t schemePosition = url.find("://");
+        const size_t hostEnd = schemePosition != std::string::npos && schemePosition < queryPosition ? std::min(url.find('/', schemePosition + 3), queryPosition) : 0;
+        
+        std::transform(url.begin(), url.begin() + static_cast<std::ptrdiff_t>(std::min(hostEnd, url.size())), url.begin(), ::tolower);
+        
+        material = url.substr(0, queryPosition);
+        
+        if (queryPosition != std::string::npos)
+        {
+            std::vector<std::string> query;
+            std::istringstream ss(url.substr(queryPosition + 1));
+            std::string item;
+            
+            // appendParameter starts its own query with '?' even if the url already has one.
+            while (std::getline(ss, item, '&'))
+            {
+                size_t position = 0;
+                while ((position = item.find('?')) != std::string::npos)
+                {
+                    if (position > 0)
+                        query.push_back(item.substr(0, position));
+                    
+                    item.erase(0, position + 1);
+                }
+                
+                if (item.size() > 0)
+                    query.push_back(std::move(item));
+            }
+            
+            std::sort(query.begin(), query.end());
+            
+            for (size_t i = 0; i < query.size(); ++i)
+            {
+                material += i == 0 ? '?' : '&';
+                material += query[i];
+            }
+        }
+        
+        if (pSettings.mCacheKeyHeader != nullptr && pSettings.mCacheKeyHeader->size() > 0)
+        {
+            const auto header = createUniqueHeader(pParam.mHeader, pHeaderBlock);
+            
+            for (const auto& name : *pSettings.mCacheKeyHeader)
+            {
+                auto it = std::find_if(header.begin(), header.end(), [&name](const std::pair<std::string, std::string>& lpHeader) -> bool
+                {
+                    return lpHeader.first == name;
+                });
+                
+                if (it != header.end())
+                {
+                    material += '\n';
+                    material += it->first;
+                    material += ": ";
+                    material += it->second;
+                }
+            }
+        }
+        
+        return CACHE_KEY_HASH(material);
+    }
+    
+    bool NetworkManager::createRetryDelay(RequestState& pState, ENetworkRequest pRequestType, ENetworkCode pCode, int32_t pHttpCode, const std::vector<std::pair<std::string, std::string>>& pHeader, uint32_t& pDelay)
+    {
+        const NetworkRetryPolicy& policy = pState.mRetryPolicy;
+        
+        if (pState.mRetryCount >= policy.mCount || pCode == ENetworkCode::OK || pCode == ENetworkCode::Cancel ||
+            std::find(policy.mRequestType.begin(), policy.mRequestType.end(), pRequestType) == policy.mRequestType.end())
+            return false;
+        
+        bool status = false;
+        
+        if (pCode == ENetworkCode::InvalidHttpCodeRange)
+        {
+            status = std::find(policy.mHttpCode.begin(), policy.mHttpCode.end(), pHttpCode) != policy.mHttpCode.end();
+        }
+        else
+        {
+            status = std::find_if(policy.mCode.begin(), policy.mCode.end(), [pCode](ENetworkCode lpCode) -> bool
+            {
+                return lpCode == pCode || (lpCode == ENetworkCode::Unknown && static_cast<int32_t>(pCode) > static_cast<int32_t>(ENetworkCode::Unknown));
+            }) != policy.mCode.end();
+        }
+        
+        if (!status)
+            return false;
+        
+        // Exponential backoff, the random part spreads retries of requests which failed at the same time.
+        double delay = policy.mDelay * std::pow(static_cast<double>(std::max(1.0f, policy.mMultiplier)), static_cast<double>(pState.mRetryCount));
+        delay = std::min(delay, static_cast<double>(policy.mMaxDelay));
+        
+        {
+            std::lock_guard<std::mutex> lock(mRetryMutex);
+            
+            std::uniform_real_distribution<double> dist(0.0, 1.0);
+            delay -= delay * std::min(1.0f, std::max(0.0f, policy.mJitter)) * dist(mRetryRandomGenerator);
+        }
+        
+        // Retry-After, either seconds or a date, is respected when it isn't longer than the maximum delay.
+        if (pCode == ENetworkCode::InvalidHttpCodeRange)
+        {
+            for (const auto& v : pHeader)
+            {
+                if (v.first.size() != 11 || !std::equal(v.first.begin(), v.first.end(), "retry-after", [](char lpSign1, char lpSign2) -> bool { return std::tolower(static_cast<unsigned char>(lpSign1)) == lpSign2; }))
+                    continue;
+                
+                char* end = nullptr;
+                double retryAfter = std::strtod(v.second.c_str(), &end);
+                
+                if (end == v.second.c_str())
+                {
+                    const time_t date = curl_getdate(v.second.c_str(), nullptr);
+                    retryAfter = date >= 0 ? static_cast<double>(date - std::time(nullptr)) : 0.0;
+                }
+                
+                retryAfter *= 1000.0;
+                
+                if (retryAfter > policy.mMaxDelay)
+                    return false;
+                
+                delay = std::max(delay, retryAfter);
+                break;
+            }
+        }
+        
+        if (policy.mMaxElapsedTime > 0)
+        {
+            const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - pState.mStartTime).count();
+            if (static_cast<double>(elapsed) + delay > policy.mMaxElapsedTime)
+                return false;
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock(mRetryMutex);
+            
+            const auto now = std::chrono::steady_clock::now();
+            const double second = std::chrono::duration_cast<std::chrono::duration<double>>(now - mRetryBudgetTime).count();
+            mRetryBudget = std::min(mRetryBudget + second * mRetryBudgetMinimum, 100.0 * mRetryBudgetRatio + mRetryBudgetMinimum);
+            mRetryBudgetTime = now;
+            
+            if (mRetryBudget < 1.0)
+            {
+                Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Retry budget exhausted, request is not retried: %", pCode == ENetworkCode::InvalidHttpCodeRange ? pHttpCode : static_cast<int32_t>(pCode));
+                return false;
+            }
+            
+            mRetryBudget -= 1.0;
+        }
+        
+        pState.mRetryCount++;
+        pDelay = static_cast<uint32_t>(delay);
+        mRetryCount.fetch_add(1);
+        
+        return true;
+    }
+    
+    void NetworkManager::depositRetryBudget()
+    {
+        std::lock_guard<std::mutex> lock(mRetryMutex);
+        mRetryBudget = std::min(mRetryBudget + mRetryBudgetRatio, 100.0 * mRetryBudgetRatio + mRetryBudgetMinimum);
+    }
+    
+    std::shared_ptr<NetworkManager::MetricsData> NetworkManager::getMetricsData(size_t pApiId)
+    {
+        std::lock_guard<std::mutex> lock(mMetricsMutex);
+        std::shared_ptr<MetricsData>& metrics = mMetrics[pApiId];
+        if (metrics == nullptr)
+            metrics = std::make_shared<MetricsData>();
+        
+        return metrics;
+    }
+    
+    NetworkManager::ETransfer NetworkManager::acquireTransfer(size_t pApiId, const std::string& pHost, const std::function<SchedulerTask()>& pTask)
+    {
+        // Without any limit or hedging requests don't wait for each other, so they skip the scheduler and its mutex.
+        if (mSchedulerActive.load() == 0)
+            return ETransfer::Bypassed;
+        
+        std::lock_guard<std::mutex> lock(mSchedulerMutex);
+        SchedulerFlow& flow = mSchedulerFlow[pApiId];
+        auto host = mSchedulerHost.find(pHost);
+        const uint32_t limit = getTransferLimit(flow);
+        
+        // A new request doesn't overtake the requests of its host already waiting in the queue of its API. Requests of other hosts wait only
+        // for their own host while the API is under its limit, so they don't hold it up.
+        if ((limit == 0 || flow.mActiveCount < limit) && (mHostConcurrencyLimit == 0 || host == mSchedulerHost.end() || host->second < mHostConcurrencyLimit) &&
+            std::none_of(flow.mTask.begin(), flow.mTask.end(), [&pHost](const SchedulerTask& lpTask) -> bool { return lpTask.mHost == pHost; }))
+        {
+            flow.mActiveCount++;
+            mSchedulerHost[pHost]++;
+            
+            return ETransfer::Acquired;
+        }
+        
+        if (flow.mLimiter != nullptr && flow.mLimiter->mMaxQueueSize > 0 && flow.mTask.size() >= flow.mLimiter->mMaxQueueSize)
+        {
+            flow.mShedCount++;
+            
+            return ETransfer::Shed;
+        }
+        
+        // An API which was idle starts at the current virtual time, so it can't claim the transfers it didn't use before. When nothing waits
+        // the virtual time catches up with all APIs, the transfers taken without waiting aren't held against them later.
+        if (flow.mTask.empty())
+        {
+            if (std::all_of(mSchedulerFlow.begin(), mSchedulerFlow.end(), [](const std::pair<const size_t, SchedulerFlow>& lpFlow) -> bool { return lpFlow.second.mTask.empty(); }))
+            {
+                for (const auto& v : mSchedulerFlow)
+                    mSchedulerVirtualTime = std::max(mSchedulerVirtualTime, v.second.mFinishTag);
+            }
+            
+            flow.mFinishTag = std::max(flow.mFinishTag, mSchedulerVirtualTime);
+        }
+        
+        flow.mTask.push_back(pTask());
+        flow.mQueuedCount++;
+        
+        return ETransfer::Queued;
+    }
+    
+    void NetworkManager::releaseTransfer(size_t pApiId, const std::string& pHost, int64_t pTime, bool pDrop)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mSchedulerMutex);
+            
+            auto flow = mSchedulerFlow.find(pApiId);
+            if (flow != mSchedulerFlow.end() && flow->second.mActiveCount > 0)
+            {
+                if (flow->second.mLimiter != nullptr && pTime >= 0)
+                    updateLimiter(flow->second, pTime, pDrop);
+                
+                // Latency of recent successful transfers, hedged requests wait for its percentile.
+                if (pTime >= 0 && !pDrop)
+                {
+                    const uint32_t latency = static_cast<uint32_t>(std::min<int64_t>(pTime, std::numeric_limits<uint32_t>::max()));
+                    if (flow->second.mLatency.size() < SchedulerFlow::LatencyCount)
+                        flow->second.mLatency.push_back(latency);
+                    else
+                        flow->second.mLatency[flow->second.mLatencyIndex] = latency;
+                    
+                    flow->second.mLatencyIndex = (flow->second.mLatencyIndex + 1) % SchedulerFlow::LatencyCount;
+                }
+                
+                flow->second.mActiveCount--;
+            }
+            
+            auto host = mSchedulerHost.find(pHost);
+            if (host != mSchedulerHost.end() && --host->second == 0)
+                mSchedulerHost.erase(host);
+        }
+        
+        dispatchTransfer();
+    }
+    
+    void NetworkManager::dispatchTransfer()
+    {
+        std::vector<std::pair<size_t, SchedulerTask>> ready;
+        
+        {
+            std::lock_guard<std::mutex> lock(mSchedulerMutex);
+            const auto now = std::chrono::steady_clock::now();
+            
+            // Start-time fair queuing, the API with the smallest finish tag goes next and each transfer moves its tag by the inverse of its weight.
+            // A task whose host is at its limit doesn't block the tasks of other hosts queued behind it.
+            while (true)
+            {
+                auto next = mSchedulerFlow.end();
+                std::deque<SchedulerTask>::iterator nextTask;
+                
+                for (auto it = mSchedulerFlow.begin(); it != mSchedulerFlow.end(); ++it)
+                {
+                    SchedulerFlow& flow = it->second;
+                    const uint32_t limit = getTransferLimit(flow);
+                    if (flow.mTask.empty() || (limit > 0 && flow.mActiveCount >= limit))
+                        continue;
+                    
+                    if (next != mSchedulerFlow.end() && flow.mFinishTag >= next->second.mFinishTag)
+                        continue;
+                    
+                    auto task = std::find_if(flow.mTask.begin(), flow.mTask.end(), [this](const SchedulerTask& lpTask) -> bool
+                    {
+                        if (mHostConcurrencyLimit == 0)
+                            return true;
+                        
+                        auto host = mSchedulerHost.find(lpTask.mHost);
+                        return host == mSchedulerHost.end() || host->second < mHostConcurrencyLimit;
+                    });
+                    
+                    if (task == flow.mTask.end())
+                        continue;
+                    
+                    next = it;
+                    nextTask = task;
+                }
+                
+                if (next == mSchedulerFlow.end())
+                    break;
+                
+                SchedulerFlow& flow = next->second;
+                SchedulerTask task = std::move(*nextTask);
+                flow.mTask.erase(nextTask);
+                
+                mSchedulerVirtualTime = flow.mFinishTag;
+                flow.mFinishTag += 1.0 / flow.mWeight;
+                flow.mActiveCount++;
+                mSchedulerHost[task.mHost]++;
+                
+                const auto waitTime = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now - task.mTime).count());
+                flow.mWaitTime += waitTime;
+                flow.mMaxWaitTime = std::max(flow.mMaxWaitTime, waitTime);
+                
+                task.mState->mTransfer = true;
+                ready.emplace_back(next->first, std::move(task));
+            }
+        }
+        
+        for (auto& v : ready)
+            scheduleRequest(std::move(v.second.mParam), std::move(v.second.mRequestHandle), v.first, std::move(v.second.mState), 0);
+    }
+    
+    void NetworkManager::updateSchedulerState()
+    {
+        bool active = mHostConcurrencyLimit > 0;
+        
+        for (auto it = mSchedulerFlow.begin(); it != mSchedulerFlow.end() && !active; ++it)
+            active = it->second.mLimit > 0 || it->second.mLimiter != nullptr || it->second.mHedge;
+        
+        mSchedulerActive.store(active ? 1 : 0);
+    }
+    
+    uint32_t NetworkManager::getTransferLimit(const SchedulerFlow& pFlow)
+    {
+        if (pFlow.mLimiter == nullptr)
+            return pFlow.mLimit;
+        
+        const uint32_t limit = static_cast<uint32_t>(pFlow.mLimiterLimit);
+        
+        return pFlow.mLimit > 0 ? std::min(pFlow.mLimit, limit) : limit;
+    }
+    
+    void NetworkManager::updateLimiter(SchedulerFlow& pFlow, int64_t pTime, bool pDrop) const
+    {
+        const NetworkLimiterPolicy& policy = *pFlow.mLimiter;
+        const double rtt = static_cast<double>(std::max<int64_t>(1, pTime));
+        const bool drop = pDrop || (policy.mTimeout > 0 && rtt > policy.mTimeout * 1000.0);
+        // A window which isn't filled at least by half says nothing about a larger one, so it doesn't grow.
+        const bool limited = pFlow.mActiveCount * 2 >= pFlow.mLimiterLimit;
+        double limit = pFlow.mLimiterLimit;
+        
+        if (!drop)
+            pFlow.mLimiterRtt = pFlow.mLimiterRtt > 0.0 ? pFlow.mLimiterRtt + (rtt - pFlow.mLimiterRtt) / std::max(1u, policy.mWindow) : rtt;
+        
+        if (drop)
+        {
+            limit *= std::min(1.0f, std::max(0.0f, policy.mBackoff));
+        }
+        else if (policy.mAlgorithm == ENetworkLimiter::AIMD)
+        {
+            if (limited)
+                limit += 1.0 / limit;
+        }
+        else
+        {
+            // The window shrinks as the RTT rises over the tolerated one and the square root of the window is left for requests queued at the server.
+            const double gradient = std::min(1.0, std::max(0.5, policy.mTolerance * pFlow.mLimiterRtt / rtt));
+            double nextLimit = limit * gradient + std::sqrt(limit);
+            if (!limited)
+                nextLimit = std::min(nextLimit, limit);
+            
+            limit = limit * 0.8 + nextLimit * 0.2;
+        }
+        
+        pFlow.mLimiterLimit = std::min(static_cast<double>(std::max(1u, policy.mMaxLimit)), std::max(static_cast<double>(std::max(1u, policy.mMinLimit)), limit));
+    }
+    
+    void NetworkManager::hedgeRequest(NetworkRequest pParam, std::shared_ptr<NetworkRequestHandle> pRequestHandle, size_t pApiId)
+    {
+        std::shared_ptr<const NetworkHedgePolicy> policy = std::move(pParam.mHedgePolicy);
+        
+        // Both transfers have their own handle, so the loser can be canceled alone, while canceling or pausing the request reaches both of them.
+        auto hedge = std::make_shared<HedgeData>();
+        hedge->mCallback = std::move(pParam.mCallback);
+        hedge->mTaskBackground = std::move(pParam.mTaskBackground);
+        hedge->mRequestHandle = std::make_shared<NetworkRequestHandle>();
+        hedge->mRequestHandle->mParent = pRequestHandle;
+        hedge->mHedgeHandle = std::make_shared<NetworkRequestHandle>();
+        hedge->mHedgeHandle->mParent = pRequestHandle;
+        
+        // The first response wins and the other transfer is canceled. The winner is claimed before the background task, so it runs only for the winner.
+        auto weakThis = mWeakThis;
+        auto claim = [weakThis, hedge, pApiId](bool lpHedge) -> bool
+        {
+            const uint32_t transfer = lpHedge ? 2 : 1;
+            uint32_t winner = 0;
+            if (!hedge->mWinner.compare_exchange_strong(winner, transfer))
+                return winner == transfer;
+            
+            (lpHedge ? hedge->mRequestHandle : hedge->mHedgeHandle)->cancel();
+            
+            std::shared_ptr<NetworkManager> strongThis = weakThis.lock();
+            if (lpHedge && strongThis != nullptr)
+            {
+                std::lock_guard<std::mutex> lock(strongThis->mSchedulerMutex);
+                auto it = strongThis->mSchedulerFlow.find(pApiId);
+                if (it != strongThis->mSchedulerFlow.end())
+                    it->second.mHedgeWinCount++;
+            }
+            
+            return true;
+        };
+        
+        auto createCallback = [hedge, claim](bool lpHedge) -> std::function<void(NetworkResponse)>
+        {
+            return [hedge, claim, lpHedge](NetworkResponse lpResponse) -> void
+            {
+                if (claim(lpHedge) && hedge->mCallback != nullptr)
+                    hedge->mCallback(std::move(lpResponse));
+            };
+        };
+        
+        auto createTaskBackground = [hedge, claim](bool lpHedge) -> decltype(pParam.mTaskBackground)
+        {
+            if (hedge->mTaskBackground == nullptr)
+                return nullptr;
+            
+            return [hedge, claim, lpHedge](const NetworkResponse& lpResponse) -> std::unique_ptr<NetworkResponseDataTaskBackground>
+            {
+                return claim(lpHedge) ? hedge->mTaskBackground(lpResponse) : nullptr;
+            };
+        };
+        
+        uint32_t delay = policy->mMaxDelay;
+        
+        {
+            std::lock_guard<std::mutex> lock(mSchedulerMutex);
+            SchedulerFlow& flow = mSchedulerFlow[pApiId];
+            
+            // The hedge delay needs the latency of the API, which is sampled only by transfers counted by the scheduler.
+            if (!flow.mHedge)
+            {
+                flow.mHedge = true;
+                updateSchedulerState();
+            }
+            
+            const double ratio = static_cast<double>(std::max(0.0f, policy->mRatio));
+            flow.mHedgeBudget = std::min(flow.mHedgeBudget + ratio, std::max(1.0, 10.0 * ratio));
+            
+            if (flow.mLatency.size() >= SchedulerFlow::LatencyMinimum)
+            {
+                std::vector<uint32_t> latency = flow.mLatency;
+                const size_t index = std::min(latency.size() - 1, static_cast<size_t>(std::max(0.0f, policy->mPercentile) * latency.size()));
+                std::nth_element(latency.begin(), latency.begin() + static_cast<std::ptrdiff_t>(index), latency.end());
+                delay = latency[index] / 1000;
+            }
+        }
+        
+        delay = std::min(std::max(delay, policy->mMinDelay), std::max(policy->mMinDelay, policy->mMaxDelay));
+        
+        NetworkRequest hedgeParam = pParam;
+        hedgeParam.mCallback = createCallback(true);
+        hedgeParam.mTaskBackground = createTaskBackground(true);
+        hedgeParam.mProgress = nullptr;
+        hedgeParam.mAllowCoalescing = false;
+        
+        if (policy->mUrl.size() > 0)
+        {
+            std::shared_ptr<NetworkAPI> api = nullptr;
+            
+            {
+                std::lock_guard<std::mutex> lock(mApiMutex);
+                if (pApiId < mApi.size())
+                    api = mApi[pApiId];
+            }
+            
+            if (api != nullptr && hedgeParam.mMethod.compare(0, api->getUrl().size(), api->getUrl()) == 0)
+                hedgeParam.mMethod = policy->mUrl + hedgeParam.mMethod.substr(api->getUrl().size());
+        }
+        
+        pParam.mCallback = createCallback(false);
+        pParam.mTaskBackground = createTaskBackground(false);
+        scheduleRequest(std::move(pParam), hedge->mRequestHandle, pApiId, nullptr, 0);
+        
+        // The duplicate is sent only if the first transfer is still running and the budget of the API allows it.
+        Hermes::getInstance()->getTaskManager()->executeDelayed(mThreadPoolId, static_cast<int32_t>(std::max(1u, delay)), [weakThis, hedge, pApiId, hedgeParam = std::move(hedgeParam)]() mutable -> void
+        {
+            std::shared_ptr<NetworkManager> strongThis = weakThis.lock();
+            if (strongThis == nullptr || strongThis->mInitialized.load() != 2 || hedge->mWinner.load() != 0 || hedge->mHedgeHandle->isCancel())
+                return;
+            
+            {
+                std::lock_guard<std::mutex> lock(strongThis->mSchedulerMutex);
+                SchedulerFlow& flow = strongThis->mSchedulerFlow[pApiId];
+                if (flow.mHedgeBudget < 1.0)
+                    return;
+                
+                flow.mHedgeBudget -= 1.0;
+                flow.mHedgeCount++;
+            }
+            
+            strongThis->scheduleRequest(std::move(hedgeParam), hedge->mHedgeHandle, pApiId, nullptr, 0);
+        });
+    }
+    
+    void NetworkManager::shedRequest(NetworkRequest pParam, CacheValidator& pCacheValidator, std::shared_ptr<CoalescedRequest> pCoalescedRequest, const std::string& pCoalescingKey, ENetworkCode pCode)
+    {
+        if (pCode == ENetworkCode::Overload)
+            Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Overload: %", pParam.mMethod);
+        
+        // Coalesced requests are shed together with the request they wait for.
+        std::vector<CoalescedRequest::Follower> follower;
+        
+        if (pCoalescedRequest != nullptr)
+        {
+            std::lock_guard<std::mutex> lock(mCoalescedRequestMutex);
+            mCoalescedRequest.erase(pCoalescingKey);
+            
+            std::lock_guard<std::mutex> followerLock(pCoalescedRequest->mMutex);
+            follower = std::move(pCoalescedRequest->mFollower);
+        }
+        
+        for (auto& v : follower)
+        {
+            if (v.mCallback == nullptr)
+                continue;
+            
+            NetworkResponse response;
+            response.mCode = v.mRequestHandle->isCancel() ? ENetworkCode::Cancel : pCode;
+            response.mMethod = pParam.mMethod;
+            
+            if (response.mCode != ENetworkCode::Cancel && v.mTaskBackground != nullptr)
+                response.mDataTaskBackground = v.mTaskBackground(response);
+            
+            auto responseHandler = std::make_shared<decltype(response)>(std::move(response));
+            Hermes::getInstance()->getTaskManager()->execute(-1, [callback = std::move(v.mCallback), responseHandler = std::move(responseHandler)]() mutable -> void
+            {
+                callback(std::move(*responseHandler));
+            });
+        }
+        
+        if (pParam.mCallback != nullptr)
+        {
+            NetworkResponse response;
+            response.mCode = pCode;
+            response.mMethod = pParam.mMethod;
+            
+            if (pCode == ENetworkCode::Overload && pParam.mCacheMode == ENetworkCacheMode::StaleIfError)
+                serveStaleResponse(pCacheValidator, response);
+            
+            if (pCode != ENetworkCode::Cancel && pParam.mTaskBackground != nullptr)
+                response.mDataTaskBackground = pParam.mTaskBackground(response);
+            
+            auto responseHandler = std::make_shared<decltype(response)>(std::move(response));
+            Hermes::getInstance()->getTaskManager()->execute(-1, [callback = std::move(pParam.mCallback), responseHandler = std::move(responseHandler)]() mutable -> void
+            {
+                callback(std::move(*responseHandler));
+            });
+        }
+    }
 
-                    int codeSelect = 0;
-                 
-                    if (maxFd == -1)
-                    {
-                        timeval wait = {0, 100000};
-                        codeSelect = select(0, nullptr, nullptr, nullptr, &wait);
-                    }
-                    else
-                    {
-                        codeSelect = select(maxFd + 1, &readFd, &writeFd, &exceptionFd, &timeout);
-                    }
-                    
-                    switch (codeSelect)
-                    {
-                    case -1: // error
-                        break;
-                    case 0: // timeout
-                    default:
-                        curl_multi_perform(handle, &activeHandle);
-                        break;
-                    }
-                    
-                    CURLMsg* message = nullptr;
-                    int messageLeft = 0;
-                    
-                    while ((terminateAbort = strongThis->mTerminateAbort.load()) == 0 && (message = curl_multi_info_read(handle, &messageLeft)))
-                    {
-                        if (message->msg == CURLMSG_DONE)
-                        {
-                            CURLcode curlCode = message->data.result;
-                            MultiRequestData* requestData = nullptr;
-                            
-                            ENetworkCode code = ENetworkCode::Unknown;
-                            long httpCode = -1;
-                            
-                            curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, &requestData);
-                            
-                            switch (curlCode)
-                            {
-                            case CURLE_OK:
-                                curl_easy_getinfo(message->easy_handle, CURLINFO_RESPONSE_CODE, &httpCode);
-                                code = httpCode >= 200 && httpCode <= 299 ? ENetworkCode::OK : ENetworkCode::InvalidHttpCodeRange;
-                                break;
-                            case CURLE_COULDNT_RESOLVE_HOST:
-                                code = ENetworkCode::LostConnection;
-                                Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Lost connection: %", (requestData != nullptr) ? requestData->mParam->mMethod : "unknown");
-                                break;
-                            case CURLE_OPERATION_TIMEDOUT:
-                                code = ENetworkCode::Timeout;
-                                Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Timeout: %", (requestData != nullptr) ? requestData->mParam->mMethod : "unknown");
-                                break;
-                            case CURLE_ABORTED_BY_CALLBACK:
-                                code = ENetworkCode::Cancel;
-                                Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Cancel: %", (requestData != nullptr) ? requestData->mParam->mMethod : "unknown");
-                                break;
-                            default:
-                                code = static_cast<ENetworkCode>(static_cast<int32_t>(ENetworkCode::Unknown) + static_cast<int32_t>(curlCode));
-                                Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "CURL code: %. URL: %", curl_easy_strerror(curlCode), (requestData != nullptr) ? requestData->mParam->mMethod : "unknown");
-                                break;
-                            }
+    void NetworkManager::configureHandle(void* pHandle, ENetworkRequest pRequestType, ENetworkResponse pResponseType, const std::string& pRequestUrl, const std::string& pRequestBody, std::string* pResponseMessage, std::vector<uint8_t>* pResponseRawData, std::vector<std::pair<std::string, std::string>>* pResponseHeader, curl_slist* pHeader, bool pDecompress, const RequestSettings& pRequestSettings, ProgressData* pProgressData, char* pErrorBuffer) const
+    {
+        const auto& flag = pRequestSettings.mFlag;
+        const NetworkKeepAlive& keepAlive = pRequestSettings.mKeepAlive;
+        
+        switch (pRequestType)
+        {
+        case ENetworkRequest::Delete:
+            curl_easy_setopt(pHandle, CURLOPT_NOBODY, 1);
+            curl_easy_setopt(pHandle, CURLOPT_CUSTOMREQUEST, "DELETE");
+            break;
+        case ENetworkRequest::Get:
+            curl_easy_setopt(pHandle, CURLOPT_HTTPGET, 1);
+            break;
+        case ENetworkRequest::Post:
+            curl_easy_setopt(pHandle, CURLOPT_HTTPPOST, 1);
+            curl_easy_setopt(pHandle, CURLOPT_POSTFIELDS, pRequestBody.c_str());
+            curl_easy_setopt(pHandle, CURLOPT_POSTFIELDSIZE, pRequestBody.size());
+            break;
+        case ENetworkRequest::Put:
+            curl_easy_setopt(pHandle, CURLOPT_NOBODY, 0);
+            curl_easy_setopt(pHandle, CURLOPT_CUSTOMREQUEST, "PUT");
+            curl_easy_setopt(pHandle, CURLOPT_POSTFIELDS, pRequestBody.c_str());
+            curl_easy_setopt(pHandle, CURLOPT_POSTFIELDSIZE, pRequestBody.size());
+            break;
+        case ENetworkRequest::Head:
+            curl_easy_setopt(pHandle, CURLOPT_NOBODY, 1);
+            break;
+        default:
+            // wrong request type
+            assert(false);
+            break;
+        }
+        
+        // The request reader takes precedence over the request body. Whole content of the reader is sent.
+        if (pProgressData != nullptr && pProgressData->mReader != nullptr && (pRequestType == ENetworkRequest::Post || pRequestType == ENetworkRequest::Put))
+        {
+            pProgressData->mReader->seek(0);
+            const curl_off_t size = pProgressData->mReaderChunked ? -1 : static_cast<curl_off_t>(pProgressData->mReader->getSize());
+            
+            curl_easy_setopt(pHandle, CURLOPT_POSTFIELDS, nullptr);
+            curl_easy_setopt(pHandle, CURLOPT_POST, 1L);
+            curl_easy_setopt(pHandle, CURLOPT_POSTFIELDSIZE_LARGE, size);
+            curl_easy_setopt(pHandle, CURLOPT_READFUNCTION, CURL_READER_CALLBACK);
+            curl_easy_setopt(pHandle, CURLOPT_READDATA, pProgressData);
+            curl_easy_setopt(pHandle, CURLOPT_SEEKFUNCTION, CURL_SEEK_CALLBACK);
+            curl_easy_setopt(pHandle, CURLOPT_SEEKDATA, pProgressData);
+        }
+        
+        switch (pResponseType)
+        {
+        case ENetworkResponse::Message:
+            curl_easy_setopt(pHandle, CURLOPT_WRITEFUNCTION, CURL_WRITER_MESSAGE_CALLBACK);
+            curl_easy_setopt(pHandle, CURLOPT_WRITEDATA, pResponseMessage);
+            break;
+        case ENetworkResponse::RawData:
+            curl_easy_setopt(pHandle, CURLOPT_WRITEFUNCTION, CURL_WRITER_RAWDATA_CALLBACK);
+            curl_easy_setopt(pHandle, CURLOPT_WRITEDATA, pResponseRawData);
+            break;
+        case ENetworkResponse::Stream:
+            assert(pProgressData != nullptr);
+            curl_easy_setopt(pHandle, CURLOPT_WRITEFUNCTION, NetworkManager::writeStream);
+            curl_easy_setopt(pHandle, CURLOPT_WRITEDATA, pProgressData);
+            break;
+        default:
+            // wrong response type
+            assert(false);
+            break;
+        }
+        
+        // The response writer takes precedence over the response type.
+        if (pProgressData != nullptr && pProgressData->mWriter != nullptr)
+        {
+            pProgressData->mResponseMessage = pResponseMessage;
+            curl_easy_setopt(pHandle, CURLOPT_WRITEFUNCTION, CURL_WRITER_DATAWRITER_CALLBACK);
+            curl_easy_setopt(pHandle, CURLOPT_WRITEDATA, pProgressData);
+        }
+            
+        if (flag[static_cast<size_t>(ENetworkFlag::Redirect)])
+            curl_easy_setopt(pHandle, CURLOPT_FOLLOWLOCATION, 1);
+        
+        curl_easy_setopt(pHandle, flag[static_cast<size_t>(ENetworkFlag::TimeoutInMilliseconds)] ? CURLOPT_TIMEOUT_MS : CURLOPT_TIMEOUT, pRequestSettings.mTimeout);
+        curl_easy_setopt(pHandle, CURLOPT_HEADERDATA, pResponseHeader);
+        curl_easy_setopt(pHandle, CURLOPT_HTTPHEADER, pHeader);
+        // An empty string enables all encodings supported by curl.
+        curl_easy_setopt(pHandle, CURLOPT_ACCEPT_ENCODING, pDecompress ? "" : nullptr);
+        curl_easy_setopt(pHandle, CURLOPT_URL, pRequestUrl.c_str());
+        curl_easy_setopt(pHandle, CURLOPT_ERRORBUFFER, pErrorBuffer);
+        curl_easy_setopt(pHandle, CURLOPT_SSL_VERIFYPEER, !flag[static_cast<size_t>(ENetworkFlag::DisableSSLVerifyPeer)] ? 1L : 0L);
+        
+        curl_easy_setopt(pHandle, CURLOPT_MAXAGE_CONN, static_cast<long>(keepAlive.mIdleTime));
+#if LIBCURL_VERSION_NUM >= 0x075000
+        curl_easy_setopt(pHandle, CURLOPT_MAXLIFETIME_CONN, static_cast<long>(keepAlive.mLifeTime));
+#endif
+        curl_easy_setopt(pHandle, CURLOPT_MAXCONNECTS, static_cast<long>(std::max(1u, keepAlive.mConnectionCount)));
+        curl_easy_setopt(pHandle, CURLOPT_TCP_KEEPALIVE, keepAlive.mProbe ? 1L : 0L);
+        curl_easy_setopt(pHandle, CURLOPT_TCP_KEEPIDLE, static_cast<long>(std::max(1u, keepAlive.mProbeIdle)));
+        curl_easy_setopt(pHandle, CURLOPT_TCP_KEEPINTVL, static_cast<long>(std::max(1u, keepAlive.mProbeInterval)));
 
-                            if (requestData != nullptr && requestData->mParam->mCallback != nullptr)
-                            {
-                                NetworkResponse response;
-                                response.mCode = code;
-                                response.mHttpCode = static_cast<int32_t>(httpCode);
-                                response.mHeader = std::move(requestData->mResponseHeader);
-                                response.mMessage = curlCode == CURLE_OK ? std::move(requestData->mResponseMessage) : &requestData->mErrorBuffer[0];
-                                response.mRawData = std::move(requestData->mResponseRawData);
-                                response.mMethod = requestData->mParam->mMethod;
-                                
-                                if (response.mCode == ENetworkCode::OK && requestData->mParam->mAllowCache)
-                                    strongThis->cacheResponse(response, requestData->mParam->mMethod, requestData->mParam->mCacheLifetime);
+        if (pProgressData != nullptr)
+        {
+            pProgressData->mHandle = pHandle;
+            pProgressData->mPaused = false;
+            
+            curl_easy_setopt(pHandle, CURLOPT_XFERINFOFUNCTION, CURL_PROGRESS_CALLBACK);
+            curl_easy_setopt(pHandle, CURLOPT_XFERINFODATA, pProgressData);
+            curl_easy_setopt(pHandle, CURLOPT_NOPROGRESS, 0);
+        }
+    }
+    
+    void* NetworkManager::getHandle()
+    {
+        void* handle = nullptr;
+        
+        {
+            std::lock_guard<std::mutex> lock(mHandleMutex);
+            handle = mHandle[std::this_thread::get_id()];
+        }
+        
+        if (handle == nullptr)
+        {
+            handle = curl_easy_init();
 
-                                if (response.mCode != ENetworkCode::Cancel && requestData->mParam->mTaskBackground != nullptr)
-                                    response.mDataTaskBackground = requestData->mParam->mTaskBackground(response);
+            curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, CURL_HEADER_CALLBACK);
+            curl_easy_setopt(handle, CURLOPT_SHARE, mShareHandle);
+            if (mCertificate->mType == ENetworkCertificate::Path)
+                curl_easy_setopt(handle, CURLOPT_CAINFO, mCertificate->mData.c_str());
+            else if (mCertificate->mType == ENetworkCertificate::Content)
+                curl_easy_setopt(handle, CURLOPT_CAINFO_BLOB, &mCertificate->mBlob);
 
-                                auto responseHandler = std::make_shared<decltype(response)>(std::move(response));
-                                Hermes::getInstance()->getTaskManager()->execute(-1, [callback = std::move(requestData->mParam->mCallback), responseHandler = std::move(responseHandler)]() mutable -> void
-                                {
-                                    callback(std::move(*responseHandler));
-                                });
-                            }
-                        }
+            std::lock_guard<std::mutex> lock(mHandleMutex);
+            mHandle[std::this_thread::get_id()] = handle;
+        }
+        
+        return handle;
+    }
+    
+    void NetworkManager::resetHandle(void* pHandle) const
+    {
+        curl_easy_setopt(pHandle, CURLOPT_CUSTOMREQUEST, 0);
+        curl_easy_setopt(pHandle, CURLOPT_XFERINFOFUNCTION, nullptr);
+        curl_easy_setopt(pHandle, CURLOPT_XFERINFODATA, nullptr);
+        curl_easy_setopt(pHandle, CURLOPT_NOPROGRESS, 1);
+        curl_easy_setopt(pHandle, CURLOPT_ERRORBUFFER, 0);
+        // Options of a streamed request body, the handle of the thread is reused by the next request.
+        curl_easy_setopt(pHandle, CURLOPT_POSTFIELDS, nullptr);
+        curl_easy_setopt(pHandle, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(-1));
+        curl_easy_setopt(pHandle, CURLOPT_POST, 0L);
+        curl_easy_setopt(pHandle, CURLOPT_READFUNCTION, nullptr);
+        curl_easy_setopt(pHandle, CURLOPT_READDATA, nullptr);
+        curl_easy_setopt(pHandle, CURLOPT_SEEKFUNCTION, nullptr);
+        curl_easy_setopt(pHandle, CURLOPT_SEEKDATA, nullptr);
+    }
+    
+    bool NetworkManager::initCache(const std::string& pDirectoryPath, unsigned pFileCountLimit, unsigned pFileSizeLimit, size_t pMemorySizeLimit, uint64_t pTotalSizeLimit, ENetworkCacheStore pStore)
+    {
+        if (mInitialized.load() == 2 && mCacheInitialized.load() == 0)
+        {
+            DIR* dir = NULL;
+            if (pStore == ENetworkCacheStore::Pack)
+            {
+                auto duration = std::chrono::system_clock::now().time_since_epoch();
+                uint64_t timestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(duration).count());
+                
+                std::string dirAppendPath = !pDirectoryPath.empty() && pDirectoryPath[pDirectoryPath.length()-1] != '/' ? pDirectoryPath + '/' : pDirectoryPath;
+                auto packCache = std::make_shared<PackCache>(std::move(dirAppendPath), pFileCountLimit, pTotalSizeLimit, mThreadPoolId, mCacheSync.load() != 0);
+                
+                if (packCache->load(timestamp, mCacheStaleLifetime.load()))
+                {
+                    {
+                        std::lock_guard<std::mutex> lock(mCacheMutex);
+                        mCacheFileSizeLimit = pFileSizeLimit;
+                        mCacheFileCountLimit = pFileCountLimit;
+                        mCacheSizeLimit = pTotalSizeLimit;
                     }
+                    
+                    mPackCache = std::move(packCache);
+                    mMemoryCache = pMemorySizeLimit > 0 ? std::make_unique<MemoryCache>(pMemorySizeLimit) : nullptr;
+                    
+                    mCacheInitialized.store(1);
+                }
+                else
+                {
+                    Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Failed to open cache directory at '%' during build", pDirectoryPath);
                 }
-                while (activeHandle && terminateAbort == 0);
             }
-            
-            for (size_t i = 0; i < paramSize; ++i)
+            else if ((dir = opendir(pDirectoryPath.c_str())) != NULL)
             {
-                if (handle != nullptr)
+                std::string dirAppendPath = pDirectoryPath[pDirectoryPath.length()-1] != '/' ? pDirectoryPath + '/' : pDirectoryPath;
+                
+                std::vector<CacheFileData> info;
+                info.reserve(pFileCountLimit);
+                
+                auto isDir = [](const std::string& lpFilePath) -> bool
                 {
-                    curl_multi_remove_handle(handle, multiRequestData[i].mHandle);
-                    curl_easy_cleanup(multiRequestData[i].mHandle);
+                    struct stat stat_buf;
+                    stat(lpFilePath.c_str(), &stat_buf);
+                    return S_ISDIR(stat_buf.st_mode);
+                };
+                
+                auto duration = std::chrono::system_clock::now().time_since_epoch();
+                uint64_t timestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(duration).count());
+                
+                std::vector<std::string> removedFilePath;
+                
+                // The manifest lists files in the LRU order, only when it's missing or corrupted each file has to be opened.
+                if (!loadCacheManifest(dirAppendPath, timestamp, info, removedFilePath))
+                {
+                    info.clear();
+                    removedFilePath.clear();
+                    
+                    struct dirent *file;
+                    while ((file = readdir(dir)) != NULL)
+                    {
+                        std::string fullPath = dirAppendPath + file->d_name;
+                        if (file->d_name[0] != '.' && !isDir(fullPath))
+                        {
+                            CacheFileData cache = decodeCacheHeader(fullPath);
+                            if (cache.mIsValid && (CACHE_IS_ALIVE(timestamp, cache.mHeader.mTimestamp, static_cast<uint64_t>(cache.mHeader.mLifetime) + mCacheStaleLifetime.load()) || cache.mValidator))
+                                info.push_back(std::move(cache));
+                            else if (std::remove(fullPath.c_str()) != 0)
+                                Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Cache failed to delete file at '%'", fullPath);
+                        }
+                    }
+                    
+                    std::sort(info.begin(), info.end(), [](const CacheFileData& lpFile1, const CacheFileData& lpFile2) -> bool
+                    {
+                        return lpFile1.mHeader.mTimestamp < lpFile2.mHeader.mTimestamp;
+                    });
+                }
+                closedir(dir);
+                
+                {
+                    std::lock_guard<std::mutex> lock(mCacheMutex);
+                    mCacheDirectoryPath = std::move(dirAppendPath);
+                    mCacheFileIndex.clear();
+                    mCacheFileIndex.reserve(info.size());
+                    mCacheFileFirst = nullptr;
+                    mCacheFileLast = nullptr;
+                    mCacheSize = 0;
+                    mCacheFileSizeLimit = pFileSizeLimit;
+                    mCacheFileCountLimit = pFileCountLimit;
+                    mCacheSizeLimit = pTotalSizeLimit;
+                    
+                    // Files are linked from the oldest one, so the newest file ends up at the front of the list.
+                    for (auto& v : info)
+                    {
+                        auto it = mCacheFileIndex.find(v.mKey);
+                        if (it != mCacheFileIndex.end())
+                        {
+                            removedFilePath.push_back(it->second.mFullFilePath);
+                            unlinkCacheFile(it->second);
+                            mCacheFileIndex.erase(it);
+                        }
+                        
+                        std::string key = v.mKey;
+                        linkCacheFile(mCacheFileIndex.emplace(std::move(key), std::move(v)).first->second);
+                    }
+                    
+                    trimCache(removedFilePath);
+                    writeCacheManifest();
+                    
+                    std::random_device rd;
+                    mRandomGenerator.seed(rd());
+                }
+                
+                flushCacheManifest();
+                
+                for (const auto& v : removedFilePath)
+                {
+                    if (std::remove(v.c_str()) != 0)
+                        Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Cache failed to delete file at '%'", v);
                 }
+                
+                // The memory cache is accessed without mCacheMutex, so it's created only here, before the cache becomes available.
+                mMemoryCache = pMemorySizeLimit > 0 ? std::make_unique<MemoryCache>(pMemorySizeLimit) : nullptr;
+                
+                mCacheInitialized.store(1);
+            }
+            else
+            {
+                Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Failed to open cache directory at '%' during build", pDirectoryPath);
+            }
+        }
+        
+        return mCacheInitialized.load() != 0;
+    }
+    
+    void NetworkManager::clearCache()
+    {
+        if (mCacheInitialized.load() != 0)
+        {
+            // A batch which is being written would be added to the cache index after it was cleared.
+            std::lock_guard<std::mutex> writerLock(mCacheWriterMutex);
+            
+            {
+                std::lock_guard<std::mutex> lock(mCacheWriteMutex);
+                mCacheWrite.clear();
+            }
+            
+            std::vector<std::string> filePath;
+            {
+                std::lock_guard<std::mutex> lock(mCacheMutex);
+                filePath.reserve(mCacheFileIndex.size());
+                
+                for (const auto& v : mCacheFileIndex)
+                    filePath.push_back(v.second.mFullFilePath);
+                
+                mCacheFileIndex.clear();
+                mCacheFileFirst = nullptr;
+                mCacheFileLast = nullptr;
+                mCacheSize = 0;
+                
+                writeCacheManifest();
+            }
+            
+            flushCacheManifest();
+            
+            if (mMemoryCache != nullptr)
+                mMemoryCache->clear();
+            
+            if (mPackCache != nullptr)
+                mPackCache->clear();
+            
+            for (auto& file : filePath)
+            {
+                if (std::remove(file.c_str()) != 0)
+                    Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Cache clear failed to delete file at '%'", file);
             }
+            
+            mCacheFileCountLimit = 0;
+            mCacheFileSizeLimit = 0;
+        }
+    }
+    
+    NetworkCacheStatistics NetworkManager::getCacheStatistics() const
+    {
+        NetworkCacheStatistics statistics;
+        statistics.mHitCount = mCacheHitCount.load();
+        statistics.mMissCount = mCacheMissCount.load();
+        statistics.mConditionalCount = mCacheConditionalCount.load();
+        statistics.mNotModifiedCount = mCacheNotModifiedCount.load();
+        statistics.mNotModifiedSize = mCacheNotModifiedSize.load();
+        statistics.mStaleCount = mCacheStaleCount.load();
+        
+        return statistics;
+    }
+    
+    uint32_t NetworkManager::getCacheStaleLifetime() const
+    {
+        return mCacheStaleLifetime.load();
+    }
+    
+    void NetworkManager::setCacheStaleLifetime(uint32_t pLifetime)
+    {
+        mCacheStaleLifetime.store(pLifetime);
+    }
+    
+    bool NetworkManager::getCacheSync() const
+    {
+        return mCacheSync.load() != 0;
+    }
+    
+    void NetworkManager::setCacheSync(bool pSync)
+    {
+        mCacheSync.store(pSync ? 1 : 0);
+    }
+    
+    uint32_t NetworkManager::getCacheCompressionThreshold() const
+    {
+        return mCacheCompressionThreshold.load();
+    }
+    
+    void NetworkManager::setCacheCompressionThreshold(uint32_t pThreshold)
+    {
+        mCacheCompressionThreshold.store(pThreshold);
+    }
+    
+    std::shared_ptr<NetworkWebSocketHandle> NetworkManager::connectWebSocket(NetworkWebSocket pParam)
+    {
+        std::shared_ptr<NetworkWebSocketHandle> handle = nullptr;
+        
+        if (mInitialized.load() == 2)
+        {
+            handle = std::shared_ptr<NetworkWebSocketHandle>(new NetworkWebSocketHandle(), [](NetworkWebSocketHandle* pThis) -> void { delete pThis; });
+            handle->mWeakThis = handle;
+            handle->initialize(mWebSocketThreadPoolId, std::move(pParam), this);
+        }
+        
+        return handle;
+    }
+    
+    /*
+     MANIFEST FORMAT
+     
+     5 bytes - beginning of a proper manifest file: 01011001 01000111 01000111 01011111 01001010
+     rest    - records, each one added by a change of the cache
+     
+     RECORD FORMAT
+     1 byte  - type of the record; 1 adds a file, 2 removes a file
+     2 bytes - number of bytes file name will occupy
+     x bytes - file name
+     only for a record which adds a file:
+     8 bytes - timestamp from the header of the file
+     4 bytes - lifetime from the header of the file
+     2 bytes - flags from the header of the file
+     4 bytes - number of bytes key will occupy
+     x bytes - key
+     8 bytes - size of the file
+     for each record:
+     4 bytes - CRC32 of the record
+    */
+    
+    template <typename T>
+    static void CACHE_MANIFEST_APPEND(std::string& pBuffer, T pValue)
+    {
+        pBuffer.append(reinterpret_cast<const char*>(&pValue), sizeof(pValue));
+    }
+    
+    static void CACHE_MANIFEST_ENCODE(std::string& pBuffer, uint8_t pType, const std::string& pFileName)
+    {
+        CACHE_MANIFEST_APPEND(pBuffer, pType);
+        CACHE_MANIFEST_APPEND(pBuffer, static_cast<uint16_t>(pFileName.size()));
+        pBuffer += pFileName;
+    }
+    
+    static void CACHE_MANIFEST_CHECKSUM(std::string& pBuffer, size_t pRecordOffset)
+    {
+        const uLong checksum = crc32(0L, reinterpret_cast<const Bytef*>(pBuffer.data() + pRecordOffset), static_cast<uInt>(pBuffer.size() - pRecordOffset));
+        CACHE_MANIFEST_APPEND(pBuffer, static_cast<uint32_t>(checksum));
+    }
+    
+    static bool CACHE_MANIFEST_WRITE(int32_t pDescriptor, const std::string& pBuffer)
+    {
+        size_t offset = 0;
+        
+        while (offset < pBuffer.size())
+        {
+            const ssize_t writeCount = write(pDescriptor, pBuffer.data() + offset, pBuffer.size() - offset);
+            if (writeCount < 0 && errno == EINTR)
+                continue;
+            
+            if (writeCount <= 0)
+                return false;
+            
+            offset += static_cast<size_t>(writeCount);
+        }
+        
+        return true;
+    }
+    
+    bool NetworkManager::loadCacheManifest(const std::string& pDirectoryPath, uint64_t pTimestamp, std::vector<CacheFileData>& pInfo, std::vector<std::string>& pRemovedFilePath) const
+    {
+        std::string content;
+        
+        {
+            std::ifstream file(pDirectoryPath + ".manifest", std::ifstream::in | std::ifstream::binary | std::ifstream::ate);
+            if (!file.is_open())
+                return false;
+            
+            const std::streamoff fileSize = file.tellg();
+            if (fileSize < static_cast<std::streamoff>(sizeof(mCacheManifestMagicWord)))
+                return false;
+            
+            content.resize(static_cast<size_t>(fileSize));
+            file.seekg(0);
+            file.read(&content[0], static_cast<std::streamsize>(content.size()));
+            
+            if (file.gcount() != static_cast<std::streamsize>(content.size()) || memcmp(content.data(), mCacheManifestMagicWord, sizeof(mCacheManifestMagicWord)) != 0)
+                return false;
+        }
+        
+        size_t offset = sizeof(mCacheManifestMagicWord);
+        
+        auto readValue = [&content, &offset](auto& lpValue) -> bool
+        {
+            if (offset + sizeof(lpValue) > content.size())
+                return false;
+            
+            memcpy(&lpValue, content.data() + offset, sizeof(lpValue));
+            offset += sizeof(lpValue);
+            
+            return true;
         };
         
-        RequestSettings requestSettings;        
+        auto readString = [&content, &offset](std::string& lpValue, size_t lpSize) -> bool
         {
-            std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
-            requestSettings = mRequestSettings;
+            if (offset + lpSize > content.size())
+                return false;
+            
+            lpValue.assign(content.data() + offset, lpSize);
+            offset += lpSize;
+            
+            return true;
+        };
+        
+        // The position of the last record which added a file keeps the LRU order.
+        std::unordered_map<std::string, std::pair<size_t, CacheFileData>> entry;
+        size_t sequence = 0;
+        
+        while (offset < content.size())
+        {
+            const size_t recordOffset = offset;
+            uint8_t type = 0;
+            uint16_t fileNameSize = 0;
+            std::string fileName;
+            CacheFileData data;
+            
+            if (!readValue(type) || !readValue(fileNameSize) || !readString(fileName, fileNameSize))
+                return false;
+            
+            if (type == 1)
+            {
+                uint32_t keySize = 0;
+                
+                if (!readValue(data.mHeader.mTimestamp) || !readValue(data.mHeader.mLifetime) || !readValue(data.mHeader.mFlags) || !readValue(keySize) ||
+                    keySize > std::numeric_limits<uint16_t>::max() || !readString(data.mKey, keySize) || !readValue(data.mSize))
+                    return false;
+                
+                data.mHeader.mKeySize = static_cast<uint16_t>(keySize);
+            }
+            else if (type != 2)
+            {
+                return false;
+            }
+            
+            const uLong checksum = crc32(0L, reinterpret_cast<const Bytef*>(content.data() + recordOffset), static_cast<uInt>(offset - recordOffset));
+            uint32_t storedChecksum = 0;
+            
+            if (!readValue(storedChecksum) || storedChecksum != static_cast<uint32_t>(checksum))
+                return false;
+            
+            if (type == 1)
+            {
+                data.mStringType = (data.mHeader.mFlags & 1) != 0;
+                data.mValidator = (data.mHeader.mFlags & 2) != 0;
+                data.mCompressed = (data.mHeader.mFlags & 4) != 0;
+                data.mVary = (data.mHeader.mFlags & 8) != 0;
+                data.mFullFilePath = pDirectoryPath + fileName;
+                data.mIsValid = true;
+                entry[fileName] = {sequence++, std::move(data)};
+            }
+            else
+            {
+                entry.erase(fileName);
+            }
         }
-
-        Hermes::getInstance()->getTaskManager()->execute(mThreadPoolId, [requestTask = std::move(requestTask), pParam = std::move(pParam), requestSettings = std::move(requestSettings)]() mutable -> void
+        
+        std::vector<std::pair<size_t, CacheFileData>> info;
+        info.reserve(entry.size());
+        
+        for (auto& v : entry)
         {
-            requestTask(std::move(pParam), std::move(requestSettings));
+            CacheFileData& data = v.second.second;
+            
+            // Only the files mentioned by the manifest are checked, a missing file or a file of a different size is skipped.
+            struct stat fileStat;
+            if (stat(data.mFullFilePath.c_str(), &fileStat) != 0)
+                continue;
+            
+            if (static_cast<uint64_t>(fileStat.st_size) == data.mSize && (CACHE_IS_ALIVE(pTimestamp, data.mHeader.mTimestamp, static_cast<uint64_t>(data.mHeader.mLifetime) + mCacheStaleLifetime.load()) || data.mValidator))
+                info.push_back(std::move(v.second));
+            else
+                pRemovedFilePath.push_back(std::move(data.mFullFilePath));
+        }
+        
+        std::sort(info.begin(), info.end(), [](const std::pair<size_t, CacheFileData>& lpData1, const std::pair<size_t, CacheFileData>& lpData2) -> bool
+        {
+            return lpData1.first < lpData2.first;
         });
+        
+        pInfo.reserve(info.size());
+        for (auto& v : info)
+            pInfo.push_back(std::move(v.second));
+        
+        return true;
     }
     
-    int64_t NetworkManager::getTimeout() const
+    // Manifest records are only encoded under mCacheMutex, they are written by flushCacheManifest once the lock is released.
+    void NetworkManager::writeCacheManifest()
     {
-        std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
-        return mRequestSettings.mTimeout;
+        mCacheManifestSnapshot.clear();
+        mCacheManifestJournal.clear();
+        mCacheManifestRecordCount = 0;
+        
+        if (mCacheDirectoryPath.size() == 0)
+            return;
+        
+        // The snapshot lists files from the least recently used one.
+        std::string& content = mCacheManifestSnapshot;
+        content.assign(mCacheManifestMagicWord, sizeof(mCacheManifestMagicWord));
+        for (const CacheFileData* data = mCacheFileLast; data != nullptr; data = data->mPrevious)
+        {
+            const size_t recordOffset = content.size();
+            CACHE_MANIFEST_ENCODE(content, 1, data->mFullFilePath.substr(mCacheDirectoryPath.size()));
+            CACHE_MANIFEST_APPEND(content, data->mHeader.mTimestamp);
+            CACHE_MANIFEST_APPEND(content, data->mHeader.mLifetime);
+            CACHE_MANIFEST_APPEND(content, data->mHeader.mFlags);
+            CACHE_MANIFEST_APPEND(content, static_cast<uint32_t>(data->mKey.size()));
+            content += data->mKey;
+            CACHE_MANIFEST_APPEND(content, data->mSize);
+            CACHE_MANIFEST_CHECKSUM(content, recordOffset);
+        }
+        
+        mCacheManifestRecordCount = mCacheFileIndex.size();
     }
     
-    void NetworkManager::setTimeout(int64_t pTimeout)
+    void NetworkManager::journalCacheFile(const CacheFileData& pData)
     {
-        if (mInitialized.load() == 2)
+        if (mCacheDirectoryPath.size() == 0)
+            return;
+        
+        std::string record;
+        CACHE_MANIFEST_ENCODE(record, 1, pData.mFullFilePath.substr(mCacheDirectoryPath.size()));
+        CACHE_MANIFEST_APPEND(record, pData.mHeader.mTimestamp);
+        CACHE_MANIFEST_APPEND(record, pData.mHeader.mLifetime);
+        CACHE_MANIFEST_APPEND(record, pData.mHeader.mFlags);
+        CACHE_MANIFEST_APPEND(record, static_cast<uint32_t>(pData.mKey.size()));
+        record += pData.mKey;
+        CACHE_MANIFEST_APPEND(record, pData.mSize);
+        CACHE_MANIFEST_CHECKSUM(record, 0);
+        
+        appendCacheManifest(record, 1);
+    }
+    
+    void NetworkManager::journalCacheFile(const std::vector<std::string>& pRemovedFilePath)
+    {
+        if (mCacheDirectoryPath.size() == 0 || pRemovedFilePath.size() == 0)
+            return;
+        
+        std::string record;
+        for (const auto& v : pRemovedFilePath)
+        {
+            const size_t recordOffset = record.size();
+            CACHE_MANIFEST_ENCODE(record, 2, v.substr(mCacheDirectoryPath.size()));
+            CACHE_MANIFEST_CHECKSUM(record, recordOffset);
+        }
+        
+        appendCacheManifest(record, pRemovedFilePath.size());
+    }
+    
+    void NetworkManager::appendCacheManifest(const std::string& pRecord, size_t pRecordCount)
+    {
+        mCacheManifestJournal += pRecord;
+        mCacheManifestRecordCount += pRecordCount;
+        
+        // The journal is compacted once most of its records are outdated.
+        if (mCacheManifestRecordCount > 2 * mCacheFileIndex.size() + 1024)
+            writeCacheManifest();
+    }
+    
+    void NetworkManager::flushCacheManifest()
+    {
+        // Flushes are serialized, so a snapshot and the records queued after it reach the file in order.
+        std::lock_guard<std::mutex> manifestLock(mCacheManifestMutex);
+        
+        std::string snapshot;
+        std::string journal;
+        std::string directoryPath;
+        
+        {
+            std::lock_guard<std::mutex> lock(mCacheMutex);
+            snapshot.swap(mCacheManifestSnapshot);
+            journal.swap(mCacheManifestJournal);
+            directoryPath = mCacheDirectoryPath;
+        }
+        
+        if (directoryPath.size() == 0 || (snapshot.size() == 0 && journal.size() == 0))
+            return;
+        
+        const std::string manifestPath = directoryPath + ".manifest";
+        
+        if (snapshot.size() > 0)
+        {
+            if (mCacheManifest >= 0)
+                close(mCacheManifest);
+            
+            mCacheManifest = -1;
+            
+            const std::string temporaryPath = manifestPath + ".tmp";
+            
+            int32_t descriptor = open(temporaryPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            bool status = descriptor >= 0 && CACHE_MANIFEST_WRITE(descriptor, snapshot);
+            
+            if (descriptor >= 0)
+                status = close(descriptor) == 0 && status;
+            
+            status = status && std::rename(temporaryPath.c_str(), manifestPath.c_str()) == 0;
+            
+            if (status)
+                mCacheManifest = open(manifestPath.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+            
+            if (mCacheManifest < 0)
+            {
+                // A stale manifest must not be used at the next start, so the full scan is forced.
+                std::remove(temporaryPath.c_str());
+                std::remove(manifestPath.c_str());
+                
+                Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Cache failed to write manifest at '%'", manifestPath);
+            }
+        }
+        
+        if (journal.size() > 0 && mCacheManifest >= 0 && !CACHE_MANIFEST_WRITE(mCacheManifest, journal))
         {
-            std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
-            mRequestSettings.mTimeout = pTimeout;
+            close(mCacheManifest);
+            mCacheManifest = -1;
+            
+            std::remove(manifestPath.c_str());
+            Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Cache failed to append manifest at '%'", directoryPath);
         }
     }
     
-    bool NetworkManager::getFlag(ENetworkFlag pFlag) const
+    /* 
+     HEADER FORMAT
+     
+     5 bytes - beginning of a proper cache file: 01011001 01000111 01000111 01011111 01000110
+     8 bytes - timestamp in miliseconds when file was created
+     4 bytes - lifetime of cache object in miliseconds
+     2 bytes - flags, the same as the flags of pack records
+     2 bytes - number of bytes key will occupy
+     
+     CONTENT FORMAT
+     x bytes - key
+     x bytes - validator block, only when marked by the flags
+     x bytes - vary block, only when marked by the flags
+     rest    - content, compressed in the format of pack records when marked by the flags
+    */
+    
+    NetworkManager::CacheFileData NetworkManager::decodeCacheHeader(const std::string& pFilePath) const
     {
-        assert(pFlag < ENetworkFlag::Count);
+        CacheFileData info;
+        std::ifstream file(pFilePath, std::ifstream::in | std::ifstream::binary);
+        
+        if (file.is_open())
+        {
+            const size_t magicWordSize = sizeof(mCacheMagicWord);
+            char magicWord[magicWordSize];
+            file.read(magicWord, magicWordSize);
+            if (!file.good() || file.gcount() != magicWordSize || memcmp(magicWord, mCacheMagicWord, magicWordSize) != 0) return info;
             
-        std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
-        return mRequestSettings.mFlag[static_cast<size_t>(pFlag)];
+            const std::streamsize readSize = sizeof(info.mHeader);
+            file.read((char*)&info.mHeader, readSize);
+            if (!file.good() || file.gcount() != readSize) return info;
+            
+            info.mStringType = (info.mHeader.mFlags & 1) != 0;
+            info.mValidator = (info.mHeader.mFlags & 2) != 0;
+            info.mCompressed = (info.mHeader.mFlags & 4) != 0;
+            info.mVary = (info.mHeader.mFlags & 8) != 0;
+            
+            const uint16_t keySize = info.mHeader.mKeySize;
+            
+            info.mKey.resize(keySize);
+            file.read(&info.mKey[0], keySize);
+            if (!file.good() || file.gcount() != keySize) return info;
+            
+            file.seekg(0, std::ifstream::end);
+            info.mSize = static_cast<uint64_t>(file.tellg());
+            
+            info.mFullFilePath = pFilePath;
+            info.mIsValid = true;
+        }
+        
+        return info;
     }
     
-    void NetworkManager::setFlag(ENetworkFlag pFlag, bool pState)
+    void NetworkManager::linkCacheFile(CacheFileData& pData)
     {
-        assert(pFlag < ENetworkFlag::Count);
+        pData.mPrevious = nullptr;
+        pData.mNext = mCacheFileFirst;
         
-        if (mInitialized.load() == 2)
-        {
-            std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
-            mRequestSettings.mFlag[static_cast<size_t>(pFlag)] = pState;
-        }
+        if (mCacheFileFirst != nullptr)
+            mCacheFileFirst->mPrevious = &pData;
+        else
+            mCacheFileLast = &pData;
+        
+        mCacheFileFirst = &pData;
+        mCacheSize += pData.mSize;
     }
     
-    int64_t NetworkManager::getProgressTimePeriod() const
+    void NetworkManager::unlinkCacheFile(CacheFileData& pData)
     {
-        std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
-        return mRequestSettings.mProgressTimePeriod;
+        if (pData.mPrevious != nullptr)
+            pData.mPrevious->mNext = pData.mNext;
+        else
+            mCacheFileFirst = pData.mNext;
+        
+        if (pData.mNext != nullptr)
+            pData.mNext->mPrevious = pData.mPrevious;
+        else
+            mCacheFileLast = pData.mPrevious;
+        
+        pData.mPrevious = nullptr;
+        pData.mNext = nullptr;
+        mCacheSize -= pData.mSize;
     }
     
-    void NetworkManager::setProgressTimePeriod(int64_t pTimePeriod)
+    void NetworkManager::trimCache(std::vector<std::string>& pRemovedFilePath)
     {
-        if (mInitialized.load() == 2)
+        while (mCacheFileLast != nullptr && (mCacheFileIndex.size() > mCacheFileCountLimit || (mCacheSizeLimit > 0 && mCacheSize > mCacheSizeLimit)))
         {
-            std::lock_guard<std::mutex> lock(mRequestSettingsMutex);
-            mRequestSettings.mProgressTimePeriod = pTimePeriod;
+            CacheFileData& last = *mCacheFileLast;
+            pRemovedFilePath.push_back(std::move(last.mFullFilePath));
+            unlinkCacheFile(last);
+            mCacheFileIndex.erase(mCacheFileIndex.find(last.mKey));
         }
     }
     
-    void NetworkManager::appendParameter(std::string& pURL, const std::vector<std::pair<std::string, std::string>>& pParameter) const
+    void NetworkManager::removeCacheFile(std::vector<std::string> pFilePath) const
     {
-        bool first = true;
+        if (pFilePath.size() == 0)
+            return;
         
-        for (size_t i = 0; i < pParameter.size(); ++i)
+        // Evicted files are deleted outside of the request which caused the eviction.
+        Hermes::getInstance()->getTaskManager()->execute(mThreadPoolId, [pFilePath = std::move(pFilePath)]() -> void
         {
-            if (pParameter[i].first.size() > 0 && pParameter[i].second.size() > 0)
+            for (const auto& v : pFilePath)
             {
-                pURL += (first) ? "?" : "&";
-                pURL += pParameter[i].first;
-                pURL += "=";
-                
-                std::string value = pParameter[i].second;
-                encodeURL(value);
-                
-                pURL += value;
-                
-                first = false;
+                if (std::remove(v.c_str()) != 0)
+                    Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Cache failed to delete file at '%'", v);
             }
-        }
-    }
-
-    void NetworkManager::decodeURL(std::string& pData) const
-    {
-        char* data = curl_unescape(pData.c_str(), static_cast<int>(pData.size()));
-        pData = data;
-        curl_free(data);
+        });
     }
     
-    void NetworkManager::encodeURL(std::string& pData) const
+    NetworkResponse NetworkManager::getResponseFromCache(const std::string& pKey, const NetworkRequest& pParam, const NetworkAPI::HeaderBlock* pHeaderBlock, CacheValidator* pValidator, bool pStale)
     {
-        auto toHex = [](const char lpData) -> const char
-        {
-            static const char hexData[] = "0123456789abcdef";
-            return hexData[lpData & 15];
-        };
+        const auto* defaultHeader = pHeaderBlock != nullptr ? &pHeaderBlock->mHeader : nullptr;
+        NetworkResponse response;
+        CacheFileData info;
         
-        auto convert = [&toHex](const char lpData) -> std::string
-        {
-            std::string output;
-            
-            output += '%';
-            output += toHex(lpData >> 4);
-            output += toHex(lpData & 15);
-
-            return output;
-        };
+        auto duration = std::chrono::system_clock::now().time_since_epoch();
+        uint64_t timestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(duration).count());
         
-        std::string output;
-
-        for (size_t i = 0; i < pData.size(); ++i)
+        if (mCacheInitialized.load() == 0)
+            return response;
+        
+        std::pair<std::shared_ptr<const std::string>, bool /* string type */> cachedContent(nullptr, false);
+        
+        if (mMemoryCache != nullptr)
+            cachedContent = mMemoryCache->get(pKey, timestamp);
+        
+        // A response waiting for the cache writer isn't in the cache index yet.
+        if (cachedContent.first == nullptr)
         {
-            const char sign = pData[i];
-            
-            if (sign == '.' || sign == '~' || sign == '-' || sign == '_' || (sign >= 'A' && sign <= 'Z') || (sign >= 'a' && sign <= 'z') || (sign >= '0' && sign <= '9'))
-                output += sign;
-            else
-                output += convert(sign);
+            std::lock_guard<std::mutex> lock(mCacheWriteMutex);
+            auto it = mCacheWrite.find(pKey);
+            if (it != mCacheWrite.end() && CACHE_IS_ALIVE(timestamp, it->second->mTimestamp, it->second->mPolicy.mLifetime) &&
+                (it->second->mPolicy.mVary.size() == 0 || CACHE_VARY_HASH(it->second->mPolicy.mVary, pParam.mHeader, defaultHeader) == it->second->mVaryHash))
+                cachedContent = std::make_pair(it->second->mContent, it->second->mStringType);
         }
         
-        pData = output;
-    }
-    
-    std::vector<std::pair<std::string, std::string>> NetworkManager::createUniqueHeader(const std::vector<std::pair<std::string, std::string>>& pHeader) const
-    {
-        std::vector<std::pair<std::string, std::string>> header;
-            
-        for (auto it = pHeader.begin(); it != pHeader.end(); it++)
+        if (cachedContent.first != nullptr)
         {
-            std::string headerType = it->first;
-            std::transform(headerType.begin(), headerType.end(), headerType.begin(), ::tolower);
+            if (cachedContent.second)
+                response.mMessage = *cachedContent.first;
+            else
+                response.mRawData.assign(cachedContent.first->begin(), cachedContent.first->end());
             
-            bool isUnique = true;
+            response.mCode = ENetworkCode::OK;
+            response.mHttpCode = 200;
+            response.mMethod = pParam.mMethod;
             
-            for (auto itB = header.begin(); itB != header.end(); itB++)
-            {
-                if (headerType.size() == itB->first.size() && headerType == itB->first)
-                {
-                    isUnique = false;                    
-                    break;
-                }
-            }
+            mCacheHitCount.fetch_add(1);
             
-            if (isUnique)
-                header.push_back({headerType, it->second});
+            return response;
         }
         
-        return header;
-    }
-
-    void NetworkManager::configureHandle(void* pHandle, ENetworkRequest pRequestType, ENetworkResponse pResponseType, const std::string& pRequestUrl, const std::string& pRequestBody, std::string* pResponseMessage, std::vector<uint8_t>* pResponseRawData, std::vector<std::pair<std::string, std::string>>* pResponseHeader, curl_slist* pHeader, int64_t pTimeout, std::array<bool, static_cast<size_t>(ENetworkFlag::Count)> pFlag, ProgressData* pProgressData, char* pErrorBuffer) const
-    {
-        switch (pRequestType)
-        {
-        case ENetworkRequest::Delete:
-            curl_easy_setopt(pHandle, CURLOPT_NOBODY, 1);
-            curl_easy_setopt(pHandle, CURLOPT_CUSTOMREQUEST, "DELETE");
-            break;
-        case ENetworkRequest::Get:
-            curl_easy_setopt(pHandle, CURLOPT_HTTPGET, 1);
-            break;
-        case ENetworkRequest::Post:
-            curl_easy_setopt(pHandle, CURLOPT_HTTPPOST, 1);
-            curl_easy_setopt(pHandle, CURLOPT_POSTFIELDS, pRequestBody.c_str());
-            curl_easy_setopt(pHandle, CURLOPT_POSTFIELDSIZE, pRequestBody.size());
-            break;
-        case ENetworkRequest::Put:
-            curl_easy_setopt(pHandle, CURLOPT_NOBODY, 0);
-            curl_easy_setopt(pHandle, CURLOPT_CUSTOMREQUEST, "PUT");
-            curl_easy_setopt(pHandle, CURLOPT_POSTFIELDS, pRequestBody.c_str());
-            curl_easy_setopt(pHandle, CURLOPT_POSTFIELDSIZE, pRequestBody.size());
-            break;
-        case ENetworkRequest::Head:
-            curl_easy_setopt(pHandle, CURLOPT_NOBODY, 1);
-            break;
-        default:
-            // wrong request type
-            assert(false);
-            break;
-        }
+        // A stale response is returned only through the validator, the request has to confirm it first or accept a stale response.
+        NetworkResponse* target = &response;
+        const uint32_t staleLifetime = mCacheStaleLifetime.load();
+        bool fresh = false;
+        bool stale = false;
         
-        switch (pResponseType)
+        if (mPackCache != nullptr)
         {
-        case ENetworkResponse::Message:
-            curl_easy_setopt(pHandle, CURLOPT_WRITEFUNCTION, CURL_WRITER_MESSAGE_CALLBACK);
-            curl_easy_setopt(pHandle, CURLOPT_WRITEDATA, pResponseMessage);
-            break;
-        case ENetworkResponse::RawData:
-            curl_easy_setopt(pHandle, CURLOPT_WRITEFUNCTION, CURL_WRITER_RAWDATA_CALLBACK);
-            curl_easy_setopt(pHandle, CURLOPT_WRITEDATA, pResponseRawData);
-            break;
-        default:
-            // wrong response type
-            assert(false);
-            break;
-        }
+            PackCache::View view;
+            bool found = mPackCache->get(pKey, timestamp, staleLifetime, view);
             
-        if (pFlag[static_cast<size_t>(ENetworkFlag::Redirect)])
-            curl_easy_setopt(pHandle, CURLOPT_FOLLOWLOCATION, 1);
-        
-        curl_easy_setopt(pHandle, pFlag[static_cast<size_t>(ENetworkFlag::TimeoutInMilliseconds)] ? CURLOPT_TIMEOUT_MS : CURLOPT_TIMEOUT, pTimeout);
-        curl_easy_setopt(pHandle, CURLOPT_HEADERDATA, pResponseHeader);
-        curl_easy_setopt(pHandle, CURLOPT_HTTPHEADER, pHeader);
-        curl_easy_setopt(pHandle, CURLOPT_URL, pRequestUrl.c_str());
-        curl_easy_setopt(pHandle, CURLOPT_ERRORBUFFER, pErrorBuffer);
-        curl_easy_setopt(pHandle, CURLOPT_SSL_VERIFYPEER, !pFlag[static_cast<size_t>(ENetworkFlag::DisableSSLVerifyPeer)] ? 1L : 0L);
-
-        if (pProgressData != nullptr)
-        {
-            curl_easy_setopt(pHandle, CURLOPT_XFERINFOFUNCTION, CURL_PROGRESS_CALLBACK);
-            curl_easy_setopt(pHandle, CURLOPT_XFERINFODATA, pProgressData);
-            curl_easy_setopt(pHandle, CURLOPT_NOPROGRESS, 0);
-        }
-    }
-    
-    void NetworkManager::resetHandle(void* pHandle) const
-    {
-        curl_easy_setopt(pHandle, CURLOPT_CUSTOMREQUEST, 0);
-        curl_easy_setopt(pHandle, CURLOPT_XFERINFOFUNCTION, nullptr);
-        curl_easy_setopt(pHandle, CURLOPT_XFERINFODATA, nullptr);
-        curl_easy_setopt(pHandle, CURLOPT_NOPROGRESS, 1);
-        curl_easy_setopt(pHandle, CURLOPT_ERRORBUFFER, 0);
-    }
-    
-    bool NetworkManager::initCache(const std::string& pDirectoryPath, unsigned pFileCountLimit, unsigned pFileSizeLimit)
-    {
-        if (mInitialized.load() == 2 && mCacheInitialized.load() == 0)
-        {
-            DIR* dir = NULL;
-            if ((dir = opendir(pDirectoryPath.c_str())) != NULL)
+            // A response stored for other values of the headers listed by Vary is treated as absent.
+            if (found && view.mVary)
+                found = CACHE_VARY_HASH(view.mVaryHeader, pParam.mHeader, defaultHeader) == view.mVaryHash;
+            
+            if (found && (view.mFresh || (pValidator != nullptr && (view.mValidator || (pStale && view.mStale)))))
             {
-                std::string dirAppendPath = pDirectoryPath[pDirectoryPath.length()-1] != '/' ? pDirectoryPath + '/' : pDirectoryPath;
-                
-                std::unordered_map<std::string, size_t> indexes;
-                std::vector<CacheFileData> info;
-                info.reserve(pFileCountLimit);
+                fresh = view.mFresh;
                 
-                auto isDir = [](const std::string& lpFilePath) -> bool
+                if (!fresh)
                 {
-                    struct stat stat_buf;
-                    stat(lpFilePath.c_str(), &stat_buf);
-                    return S_ISDIR(stat_buf.st_mode);
-                };
+                    pValidator->mETag = std::move(view.mETag);
+                    pValidator->mLastModified = std::move(view.mLastModified);
+                    pValidator->mLifetime = view.mLifetime;
+                    pValidator->mStale = view.mStale;
+                    pValidator->mVary = std::move(view.mVaryHeader);
+                    target = &pValidator->mResponse;
+                }
                 
-                auto duration = std::chrono::system_clock::now().time_since_epoch();
-                uint64_t timestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(duration).count());
+                // The mapped content is copied once, straight into the response. Compressed content is inflated straight from the mapping,
+                // which the view keeps alive, so other cache lookups don't wait for it.
+                std::string content;
+                bool valid = true;
                 
-                struct dirent *file;
-                while ((file = readdir(dir)) != NULL)
+                if (view.mCompressed)
                 {
-                    std::string fullPath = dirAppendPath + file->d_name;
-                    if (file->d_name[0] != '.' && !isDir(fullPath))
+                    size_t sizeLimit = 0;
+                    
                     {
-                        CacheFileData cache = decodeCacheHeader(fullPath);
-                        if (cache.mIsValid && timestamp >= cache.mHeader.mTimestamp && (timestamp - cache.mHeader.mTimestamp) < cache.mHeader.mLifetime)
-                            info.push_back(std::move(cache));
-                        else if (std::remove(fullPath.c_str()) != 0)
-                            Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Cache failed to delete file at '%'", fullPath);
+                        std::lock_guard<std::mutex> lock(mCacheMutex);
+                        sizeLimit = mCacheFileSizeLimit;
                     }
+                    
+                    valid = CACHE_INFLATE(view.mData, view.mSize, sizeLimit, content);
                 }
-                closedir(dir);
-                
-                std::sort(info.begin(), info.end(), [](const CacheFileData& lpFile1, const CacheFileData& lpFile2) -> bool
-                {
-                    return lpFile1.mHeader.mTimestamp < lpFile2.mHeader.mTimestamp;
-                });
                 
-                if (info.size() > pFileCountLimit)
+                if (!valid)
                 {
-                    std::rotate(info.begin(), info.begin() + static_cast<ptrdiff_t>(info.size() - pFileCountLimit), info.end());
-                    for (auto it = info.begin() + static_cast<ptrdiff_t>(pFileCountLimit); it != info.end(); it++)
-                    {
-                        if (std::remove((*it).mFullFilePath.c_str()) != 0)
-                            Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Cache failed to delete file at '%'", (*it).mFullFilePath);
-                    }
-                    info.resize(pFileCountLimit);
+                    Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Cache failed to inflate content of '%'", pParam.mMethod);
                 }
-                
-                for (size_t i = 0; i < info.size(); i++)
-                    indexes[info[i].mUrl] = i;
-                
+                else if (fresh && mMemoryCache != nullptr && !view.mVary)
                 {
-                    std::lock_guard<std::mutex> lock(mCacheMutex);
-                    mCacheDirectoryPath = std::move(dirAppendPath);
-                    mCacheFileInfo = std::move(info);
-                    mCacheFileIndex = std::move(indexes);
-                    mCacheFileSizeLimit = pFileSizeLimit;
-                    mCacheFileCountLimit = pFileCountLimit;
+                    auto sharedContent = view.mCompressed ? std::make_shared<const std::string>(std::move(content)) : std::make_shared<const std::string>(view.mData, view.mSize);
                     
-                    std::random_device rd;
-                    mRandomGenerator.seed(rd());
+                    if (view.mStringType)
+                        target->mMessage = *sharedContent;
+                    else
+                        target->mRawData.assign(sharedContent->begin(), sharedContent->end());
+                    
+                    mMemoryCache->put(pKey, std::move(sharedContent), view.mStringType, view.mTimestamp, view.mLifetime);
+                }
+                else if (view.mCompressed)
+                {
+                    if (view.mStringType)
+                        target->mMessage = std::move(content);
+                    else
+                        target->mRawData.assign(content.begin(), content.end());
+                }
+                else if (view.mStringType)
+                {
+                    target->mMessage.assign(view.mData, view.mSize);
+                }
+                else
+                {
+                    target->mRawData.assign(view.mData, view.mData + view.mSize);
                 }
                 
-                mCacheInitialized.store(1);
-            }
-            else
-            {
-                Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Failed to open cache directory at '%' during build", pDirectoryPath);
-            }
-        }
-        
-        return mCacheInitialized.load() != 0;
-    }
-    
-    void NetworkManager::clearCache()
-    {
-        if (mCacheInitialized.load() != 0)
-        {
-            std::vector<CacheFileData> info;
-            {
-                std::lock_guard<std::mutex> lock(mCacheMutex);
-                info = std::move(mCacheFileInfo);
-                mCacheFileInfo.clear();
-                mCacheFileIndex.clear();
+                if (valid)
+                {
+                    target->mCode = ENetworkCode::OK;
+                    target->mHttpCode = 200;
+                    target->mMethod = pParam.mMethod;
+                }
             }
             
-            for (auto& file : info)
-            {
-                if (std::remove(file.mFullFilePath.c_str()) != 0)
-                    Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Cache clear failed to delete file at '%'", file.mFullFilePath);
-            }
+            (fresh ? mCacheHitCount : mCacheMissCount).fetch_add(1);
             
-            mCacheFileCountLimit = 0;
-            mCacheFileSizeLimit = 0;
-        }
-    }
-    
-    std::shared_ptr<NetworkWebSocketHandle> NetworkManager::connectWebSocket(NetworkWebSocket pParam)
-    {
-        std::shared_ptr<NetworkWebSocketHandle> handle = nullptr;
-        
-        if (mInitialized.load() == 2)
-        {
-            handle = std::shared_ptr<NetworkWebSocketHandle>(new NetworkWebSocketHandle(), [](NetworkWebSocketHandle* pThis) -> void { delete pThis; });
-            handle->mWeakThis = handle;
-            handle->initialize(mWebSocketThreadPoolId, std::move(pParam), this);
+            return response;
         }
         
-        return handle;
-    }
-    
-    /* 
-     HEADER FORMAT
-     
-     5 bytes - beginning of a proper cache file: 01011001 01000111 01000111 01011111 01001000
-     8 bytes - timestamp in miliseconds when file was created
-     4 bytes - lifetime of cache object in miliseconds
-     2 bytes - first four bits are flags; first three bits for future, fourth bit says if content should be treated as string (1) or binary data (0);
-               next twelve bits are number of bytes request url will occupy
-     
-     CONTENT FORMAT
-     x bytes - request url
-     rest    - content
-    */
-    
-    NetworkManager::CacheFileData NetworkManager::decodeCacheHeader(const std::string& pFilePath) const
-    {
-        CacheFileData info;
-        std::ifstream file(pFilePath, std::ifstream::in | std::ifstream::binary);
+        std::vector<std::string> removedFilePath;
         
-        if (file.is_open())
         {
-            const size_t magicWordSize = sizeof(mCacheMagicWord);
-            char magicWord[magicWordSize];
-            file.read(magicWord, magicWordSize);
-            if (!file.good() || file.gcount() != magicWordSize || memcmp(magicWord, mCacheMagicWord, magicWordSize) != 0) return info;
-            
-            const std::streamsize readSize = sizeof(info.mHeader);
-            file.read((char*)&info.mHeader, readSize);
-            if (!file.good() || file.gcount() != readSize) return info;
-            
-            size_t urlSizeSubtract = 0;
-            uint16_t stringMask = 1 << 12;
-            if ((stringMask & info.mHeader.mFlagsAndSize) == stringMask)
+            std::lock_guard<std::mutex> lock(mCacheMutex);
+            auto fileIndex = mCacheFileIndex.find(pKey);
+            if (fileIndex != mCacheFileIndex.end())
             {
-                urlSizeSubtract += stringMask;
-                info.mStringType = true;
+                CacheFileData& data = fileIndex->second;
+                unlinkCacheFile(data);
+                
+                fresh = CACHE_IS_ALIVE(timestamp, data.mHeader.mTimestamp, data.mHeader.mLifetime);
+                stale = !fresh && CACHE_IS_ALIVE(timestamp, data.mHeader.mTimestamp, static_cast<uint64_t>(data.mHeader.mLifetime) + staleLifetime);
+                
+                if (fresh || stale || data.mValidator)
+                {
+                    linkCacheFile(data);
+                    info = data;
+                }
+                else
+                {
+                    removedFilePath.push_back(std::move(data.mFullFilePath));
+                    mCacheFileIndex.erase(fileIndex);
+                    journalCacheFile(removedFilePath);
+                }
             }
-            urlSizeSubtract += (1 << 13) & info.mHeader.mFlagsAndSize;
-            urlSizeSubtract += (1 << 14) & info.mHeader.mFlagsAndSize;
-            urlSizeSubtract += (1 << 15) & info.mHeader.mFlagsAndSize;
-            
-            uint16_t urlSize = info.mHeader.mFlagsAndSize - static_cast<uint16_t>(urlSizeSubtract);
-            
-            info.mUrl.resize(urlSize);
-            file.read(&info.mUrl[0], urlSize);
-            if (!file.good() || file.gcount() != urlSize) return info;
-            
-            info.mFullFilePath = pFilePath;
-            info.mIsValid = true;
         }
         
-        return info;
-    }
-    
-    NetworkResponse NetworkManager::getResponseFromCache(const std::string& pUrl)
-    {
-        NetworkResponse response;
-        CacheFileData info;
-        
-        if (mCacheInitialized.load() != 0)
+        // The manifest is written by the thread pool too, a lookup doesn't wait for file I/O.
+        if (removedFilePath.size() > 0)
         {
-            std::lock_guard<std::mutex> lock(mCacheMutex);
-            std::unordered_map<std::string, size_t>::const_iterator fileIndex = mCacheFileIndex.find(pUrl);
-            if (fileIndex != mCacheFileIndex.end() && fileIndex->second < mCacheFileInfo.size())
-                info = mCacheFileInfo[fileIndex->second];
+            auto weakThis = mWeakThis;
+            Hermes::getInstance()->getTaskManager()->execute(mThreadPoolId, [weakThis]() -> void
+            {
+                std::shared_ptr<NetworkManager> strongThis = weakThis.lock();
+                if (strongThis != nullptr)
+                    strongThis->flushCacheManifest();
+            });
         }
         
-        auto duration = std::chrono::system_clock::now().time_since_epoch();
-        uint64_t timestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(duration).count());
+        removeCacheFile(std::move(removedFilePath));
         
-        if (info.mIsValid && timestamp >= info.mHeader.mTimestamp && (timestamp - info.mHeader.mTimestamp) < info.mHeader.mLifetime)
+        if (info.mIsValid && (fresh || (pValidator != nullptr && (info.mValidator || (pStale && stale)))))
         {
-            std::ifstream file(info.mFullFilePath, std::ifstream::in | std::ifstream::binary);
+            std::ifstream file(info.mFullFilePath, std::ifstream::in | std::ifstream::binary | std::ifstream::ate);
             
             if (file.is_open())
             {
-                file.seekg(static_cast<std::streamsize>(sizeof(mCacheMagicWord) + sizeof(info.mHeader) + info.mUrl.size()));
+                std::streamoff offset = static_cast<std::streamoff>(sizeof(mCacheMagicWord) + sizeof(info.mHeader) + info.mKey.size());
+                const std::streamoff fileSize = file.tellg();
+                
+                file.seekg(offset);
+                
+                std::string etag;
+                std::string lastModified;
+                std::vector<std::string> vary;
+                
+                if (info.mValidator && file.good() && fileSize >= offset)
+                {
+                    // The validator block is at most two sizes and two strings of 64 KB each.
+                    std::string validator(static_cast<size_t>(std::min<std::streamoff>(fileSize - offset, 2 * (sizeof(uint16_t) + std::numeric_limits<uint16_t>::max()))), '\0');
+                    file.read(&validator[0], static_cast<std::streamsize>(validator.size()));
+                    
+                    size_t validatorSize = 0;
+                    if (file.gcount() == static_cast<std::streamsize>(validator.size()) && CACHE_VALIDATOR_DECODE(validator.data(), validator.size(), validatorSize, &etag, &lastModified))
+                        offset += static_cast<std::streamoff>(validatorSize);
+                    else
+                        offset = fileSize + 1;
+                    
+                    file.clear();
+                    file.seekg(std::min(offset, fileSize));
+                }
+                
+                if (info.mVary && file.good() && fileSize >= offset)
+                {
+                    // The vary block is at most 64 KB, createCachePolicy doesn't allow a longer list of names.
+                    std::string varyBlock(static_cast<size_t>(std::min<std::streamoff>(fileSize - offset, std::numeric_limits<uint16_t>::max())), '\0');
+                    file.read(&varyBlock[0], static_cast<std::streamsize>(varyBlock.size()));
+                    
+                    size_t varySize = 0;
+                    uint64_t varyHash = 0;
+                    
+                    // A response stored for other values of the headers listed by Vary is treated as absent.
+                    if (file.gcount() == static_cast<std::streamsize>(varyBlock.size()) && CACHE_VARY_DECODE(varyBlock.data(), varyBlock.size(), varySize, &vary, &varyHash) &&
+                        CACHE_VARY_HASH(vary, pParam.mHeader, defaultHeader) == varyHash)
+                        offset += static_cast<std::streamoff>(varySize);
+                    else
+                        offset = fileSize + 1;
+                    
+                    file.clear();
+                    file.seekg(std::min(offset, fileSize));
+                }
                 
-                if (file.good())
+                if (file.good() && fileSize >= offset)
                 {
-                    std::stringstream ss;
-                    ss << file.rdbuf();
+                    if (!fresh)
+                    {
+                        pValidator->mETag = std::move(etag);
+                        pValidator->mLastModified = std::move(lastModified);
+                        pValidator->mLifetime = info.mHeader.mLifetime;
+                        pValidator->mStale = stale;
+                        pValidator->mVary = std::move(vary);
+                        target = &pValidator->mResponse;
+                    }
                     
-                    if (info.mStringType)
+                    // Content is read at once into a buffer of the exact size, compressed content is inflated into it in parts while it's read.
+                    std::string content;
+                    bool valid = false;
+                    
+                    if (info.mCompressed)
                     {
-                        response.mMessage = ss.str();
+                        uint64_t contentSize = 0;
+                        file.read(reinterpret_cast<char*>(&contentSize), sizeof(contentSize));
+                        
+                        {
+                            std::lock_guard<std::mutex> lock(mCacheMutex);
+                            valid = file.gcount() == static_cast<std::streamsize>(sizeof(contentSize)) && contentSize <= mCacheFileSizeLimit;
+                        }
+                        
+                        if (valid)
+                        {
+                            content.resize(static_cast<size_t>(contentSize));
+                            CacheInflater inflater(&content[0], content.size());
+                            std::vector<char> buffer(16384);
+                            
+                            while (valid && file.good())
+                            {
+                                file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+                                valid = inflater.push(buffer.data(), static_cast<size_t>(file.gcount()));
+                            }
+                            
+                            valid = valid && inflater.isFinished();
+                        }
+                        
+                        if (!valid)
+                            Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Cache failed to inflate content of '%'", pParam.mMethod);
                     }
                     else
                     {
-                        const std::string& content = ss.str();
-                        response.mRawData = std::vector<uint8_t>(content.begin(), content.end());
+                        content.resize(static_cast<size_t>(fileSize - offset));
+                        file.read(&content[0], static_cast<std::streamsize>(content.size()));
+                        valid = file.gcount() == static_cast<std::streamsize>(content.size());
                     }
                     
-                    response.mCode = ENetworkCode::OK;
-                    response.mHttpCode = 200;
-                    response.mMethod = pUrl;
+                    if (valid)
+                    {
+                        if (fresh && mMemoryCache != nullptr && !info.mVary)
+                        {
+                            auto sharedContent = std::make_shared<const std::string>(std::move(content));
+                            
+                            if (info.mStringType)
+                                target->mMessage = *sharedContent;
+                            else
+                                target->mRawData.assign(sharedContent->begin(), sharedContent->end());
+                            
+                            mMemoryCache->put(pKey, std::move(sharedContent), info.mStringType, info.mHeader.mTimestamp, info.mHeader.mLifetime);
+                        }
+                        else if (info.mStringType)
+                        {
+                            target->mMessage = std::move(content);
+                        }
+                        else
+                        {
+                            target->mRawData.assign(content.begin(), content.end());
+                        }
+                        
+                        target->mCode = ENetworkCode::OK;
+                        target->mHttpCode = 200;
+                        target->mMethod = pParam.mMethod;
+                    }
                 }
             }
         }
         
+        (response.mCode == ENetworkCode::OK ? mCacheHitCount : mCacheMissCount).fetch_add(1);
+        
         return response;
     }
     
-    bool NetworkManager::cacheResponse(const NetworkResponse& lpResponse, const std::string& pUrl, uint32_t pLifetime)
+    bool NetworkManager::cacheResponse(const NetworkResponse& lpResponse, const std::string& pKey, const NetworkRequest& pParam, const NetworkAPI::HeaderBlock* pHeaderBlock, const CachePolicy& pPolicy)
     {
-        static const char lookup[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
-        
         bool status = false;
         
+        // A response which can't be used without revalidation is worth storing only with a validator.
+        const bool validator = pPolicy.mETag.size() > 0 || pPolicy.mLastModified.size() > 0;
+        if (!pPolicy.mStore || (pPolicy.mLifetime == 0 && !validator))
+            return status;
+        
+        const size_t validatorSize = validator ? 2 * sizeof(uint16_t) + pPolicy.mETag.size() + pPolicy.mLastModified.size() : 0;
+        size_t varySize = pPolicy.mVary.size() > 0 ? sizeof(uint16_t) + sizeof(uint64_t) : 0;
+        
+        for (const auto& v : pPolicy.mVary)
+            varySize += sizeof(uint16_t) + v.size();
+        
         size_t maxFileSize = 0;
         size_t dataSize = lpResponse.mRawData.size() > 0 ? lpResponse.mRawData.size() : lpResponse.mMessage.size();
         
         if (dataSize > 0 && mCacheInitialized.load() != 0)
         {
             std::lock_guard<std::mutex> lock(mCacheMutex);
-            maxFileSize = mCacheFileSizeLimit;
-            dataSize += sizeof(CacheFileData::Header) + pUrl.size();
+            maxFileSize = mCacheSizeLimit > 0 ? static_cast<size_t>(std::min(static_cast<uint64_t>(mCacheFileSizeLimit), mCacheSizeLimit)) : mCacheFileSizeLimit;
+            dataSize += sizeof(CacheFileData::Header) + pKey.size() + validatorSize + varySize;
         }
         
         if (lpResponse.mCode == ENetworkCode::OK && dataSize > 0 && dataSize <= maxFileSize)
         {
             auto duration = std::chrono::system_clock::now().time_since_epoch();
-            uint64_t timestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(duration).count());
-            CacheFileData info;
+            
+            auto data = std::make_shared<CacheWriteData>();
+            data->mKey = pKey;
+            data->mStringType = lpResponse.mMessage.size() > 0;
+            data->mContent = data->mStringType ? std::make_shared<const std::string>(lpResponse.mMessage) : std::make_shared<const std::string>(lpResponse.mRawData.begin(), lpResponse.mRawData.end());
+            data->mTimestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(duration).count());
+            data->mVaryHash = pPolicy.mVary.size() > 0 ? CACHE_VARY_HASH(pPolicy.mVary, pParam.mHeader, pHeaderBlock != nullptr ? &pHeaderBlock->mHeader : nullptr) : 0;
+            data->mPolicy = pPolicy;
+            
+            // The memory cache doesn't check the vary block, a response with Vary is served from the disk.
+            if (mMemoryCache != nullptr && pPolicy.mLifetime > 0 && pPolicy.mVary.size() == 0)
+                mMemoryCache->put(pKey, data->mContent, data->mStringType, data->mTimestamp, pPolicy.mLifetime);
+            
+            // The writer takes all queued responses at once, a newer response of the same key replaces one which is still waiting.
+            bool schedule = false;
             
             {
-                std::lock_guard<std::mutex> lock(mCacheMutex);
-                info.mFullFilePath = mCacheDirectoryPath + std::to_string(timestamp) + "_";
+                std::lock_guard<std::mutex> lock(mCacheWriteMutex);
+                mCacheWrite[pKey] = std::move(data);
+                
+                schedule = !mCacheWriteScheduled;
+                mCacheWriteScheduled = true;
+            }
+            
+            if (schedule)
+            {
+                auto weakThis = mWeakThis;
+                Hermes::getInstance()->getTaskManager()->execute(mThreadPoolId, [weakThis]() -> void
+                {
+                    if (auto strongThis = weakThis.lock())
+                        strongThis->writeCache();
+                });
+            }
+            
+            status = true;
+        }
+        
+        return status;
+    }
+    
+    void NetworkManager::writeCache()
+    {
+        std::lock_guard<std::mutex> writerLock(mCacheWriterMutex);
+        const bool sync = mCacheSync.load() != 0;
+        
+        while (true)
+        {
+            std::vector<std::shared_ptr<CacheWriteData>> data;
+            
+            {
+                std::lock_guard<std::mutex> lock(mCacheWriteMutex);
+                if (mCacheWrite.empty())
+                {
+                    mCacheWriteScheduled = false;
+                    break;
+                }
+                
+                data.reserve(mCacheWrite.size());
+                
+                for (const auto& v : mCacheWrite)
+                    data.push_back(v.second);
             }
             
+            const uint32_t compressionThreshold = mCacheCompressionThreshold.load();
+            
+            for (const auto& v : data)
+            {
+                if (compressionThreshold > 0 && v->mContent->size() >= compressionThreshold && v->mCompressedContent.size() == 0)
+                    CACHE_DEFLATE(*v->mContent, v->mCompressedContent);
+            }
+            
+            if (mPackCache != nullptr)
+                mPackCache->put(data, sync);
+            else
+                writeCacheFile(data, sync);
+            
+            // Responses stay queued until they are in the cache index, so they can be served in the meantime.
+            std::lock_guard<std::mutex> lock(mCacheWriteMutex);
+            
+            for (const auto& v : data)
+            {
+                auto it = mCacheWrite.find(v->mKey);
+                if (it != mCacheWrite.end() && it->second == v)
+                    mCacheWrite.erase(it);
+            }
+        }
+    }
+    
+    void NetworkManager::writeCacheFile(const std::vector<std::shared_ptr<CacheWriteData>>& pData, bool pSync)
+    {
+        static const char lookup[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+        
+        std::string directoryPath;
+        
+        {
+            std::lock_guard<std::mutex> lock(mCacheMutex);
+            directoryPath = mCacheDirectoryPath;
+        }
+        
+        std::vector<CacheFileData> written;
+        written.reserve(pData.size());
+        
+        for (const auto& data : pData)
+        {
+            const CachePolicy& policy = data->mPolicy;
+            const bool validator = policy.mETag.size() > 0 || policy.mLastModified.size() > 0;
+            const std::string validatorBlock = validator ? CACHE_VALIDATOR_ENCODE(policy.mETag, policy.mLastModified) : "";
+            const std::string varyBlock = policy.mVary.size() > 0 ? CACHE_VARY_ENCODE(policy.mVary, data->mVaryHash) : "";
+            
+            CacheFileData info;
+            info.mFullFilePath = directoryPath + std::to_string(data->mTimestamp) + "_";
+            
             const size_t hashCount = 5;
-            const size_t lookupLength = sizeof(lookup);
+            const size_t lookupLength = sizeof(lookup) - 1;
             size_t pathSize = info.mFullFilePath.size();
             info.mFullFilePath.resize(pathSize + hashCount);
             
@@ -2182,68 +6339,275 @@ namespace hms
             for (size_t i = pathSize; i < info.mFullFilePath.size(); i++)
                 info.mFullFilePath[i] = lookup[static_cast<size_t>(dist(mRandomGenerator))];
             
-            info.mUrl = pUrl;
-            info.mHeader.mTimestamp = timestamp;
-            info.mHeader.mLifetime = pLifetime;
+            const std::string& content = data->mCompressedContent.size() > 0 ? data->mCompressedContent : *data->mContent;
+            
+            info.mKey = data->mKey;
+            info.mHeader.mTimestamp = data->mTimestamp;
+            info.mHeader.mLifetime = policy.mLifetime;
+            info.mHeader.mKeySize = static_cast<uint16_t>(data->mKey.size());
+            info.mStringType = data->mStringType;
+            info.mValidator = validator;
+            info.mCompressed = data->mCompressedContent.size() > 0;
+            info.mVary = varyBlock.size() > 0;
+            info.mHeader.mFlags = (info.mStringType ? 1 : 0) | (info.mValidator ? 2 : 0) | (info.mCompressed ? 4 : 0) | (info.mVary ? 8 : 0);
             info.mIsValid = true;
             
-            if (lpResponse.mMessage.size() == 0)
+            // In the sync mode the file is written atomically, it appears at its path only after it was flushed.
+            DescriptorWriter writer(info.mFullFilePath, false, pSync);
+            
+            bool status = writer.isOpen();
+            status = status && writer.write(mCacheMagicWord, sizeof(mCacheMagicWord)) == sizeof(mCacheMagicWord);
+            status = status && writer.write(&info.mHeader, sizeof(info.mHeader)) == sizeof(info.mHeader);
+            status = status && writer.write(data->mKey) == data->mKey.size();
+            status = status && writer.write(validatorBlock) == validatorBlock.size();
+            status = status && writer.write(varyBlock) == varyBlock.size();
+            status = status && writer.write(content) == content.size();
+            status = status && (!pSync || writer.commit());
+            
+            if (!status)
             {
-                info.mHeader.mFlagsAndSize = pUrl.size();
+                Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Cache failed to write file at '%'", info.mFullFilePath);
+                
+                if (!pSync)
+                    std::remove(info.mFullFilePath.c_str());
+                
+                continue;
             }
-            else
+            
+            info.mSize = sizeof(mCacheMagicWord) + sizeof(info.mHeader) + data->mKey.size() + validatorBlock.size() + varyBlock.size() + content.size();
+            written.push_back(std::move(info));
+        }
+        
+        std::vector<std::string> removedFilePath;
+        
+        {
+            std::lock_guard<std::mutex> lock(mCacheMutex);
+            
+            for (auto& info : written)
             {
-                info.mStringType = true;
-                info.mHeader.mFlagsAndSize = pUrl.size() + (1 << 12);
+                auto it = mCacheFileIndex.find(info.mKey);
+                if (it != mCacheFileIndex.end())
+                {
+                    removedFilePath.push_back(std::move(it->second.mFullFilePath));
+                    unlinkCacheFile(it->second);
+                    mCacheFileIndex.erase(it);
+                }
+                
+                const std::string key = info.mKey;
+                CacheFileData& data = mCacheFileIndex.emplace(key, std::move(info)).first->second;
+                linkCacheFile(data);
+                journalCacheFile(data);
             }
             
-            std::ofstream file(info.mFullFilePath, std::fstream::out | std::fstream::trunc | std::fstream::binary);
+            trimCache(removedFilePath);
+            journalCacheFile(removedFilePath);
+        }
+        
+        flushCacheManifest();
+        removeCacheFile(std::move(removedFilePath));
+    }
+    
+    NetworkManager::CachePolicy NetworkManager::createCachePolicy(const std::vector<std::pair<std::string, std::string>>& pHeader, uint32_t pLifetime, bool pUseHeader)
+    {
+        CachePolicy policy;
+        policy.mLifetime = pLifetime;
+        
+        if (!pUseHeader)
+            return policy;
+        
+        int64_t maxAge = -1;
+        int64_t age = 0;
+        time_t date = -1;
+        time_t expires = -1;
+        bool noCache = false;
+        
+        for (const auto& v : pHeader)
+        {
+            std::string name = v.first;
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
             
-            if (file.is_open())
+            if (name == "cache-control")
             {
-                file.write(mCacheMagicWord, sizeof(mCacheMagicWord));
-                if (!file.good()) return status;
-                
-                file.write(reinterpret_cast<const char*>(&info.mHeader), sizeof(info.mHeader));
-                if (!file.good()) return status;
-                
-                file << pUrl;
-                if (!file.good()) return status;
-                
-                if (info.mStringType)
-                    file << lpResponse.mMessage;
-                else
-                    file.write(reinterpret_cast<const char*>(lpResponse.mRawData.data()), static_cast<std::streamsize>(lpResponse.mRawData.size()));
-                
-                if (!file.good()) return status;
-                
-                file.close();
+                std::istringstream ss(v.second);
+                std::string directive;
                 
+                while (std::getline(ss, directive, ','))
                 {
-                    std::lock_guard<std::mutex> lock(mCacheMutex);
-                    if (mCacheFileInfo.size() < mCacheFileCountLimit)
-                    {
-                        mCacheFileInfo.push_back(std::move(info));
-                    }
-                    else
-                    {
-                        mCacheFileIndex.erase(mCacheFileInfo[0].mUrl);
-                        
-                        std::rotate(mCacheFileInfo.begin(), mCacheFileInfo.begin() + 1, mCacheFileInfo.end());
-                        mCacheFileInfo.back() = std::move(info);
-                        
-                        for (auto it = mCacheFileIndex.begin(); it != mCacheFileIndex.end(); it++)
-                            it->second -= 1;
-                    }
+                    directive.erase(std::remove_if(directive.begin(), directive.end(), ::isspace), directive.end());
+                    std::transform(directive.begin(), directive.end(), directive.begin(), ::tolower);
                     
-                    mCacheFileIndex[pUrl] = mCacheFileInfo.size() - 1;
+                    if (directive == "no-store")
+                        policy.mStore = false;
+                    else if (directive == "no-cache")
+                        noCache = true;
+                    else if (directive.compare(0, 8, "max-age=") == 0)
+                        maxAge = std::max<int64_t>(0, std::strtoll(directive.c_str() + 8, nullptr, 10));
                 }
+            }
+            else if (name == "expires")
+            {
+                // An invalid date, like "0", means the response has already expired.
+                expires = std::max<time_t>(0, curl_getdate(v.second.c_str(), nullptr));
+            }
+            else if (name == "date")
+            {
+                date = curl_getdate(v.second.c_str(), nullptr);
+            }
+            else if (name == "age")
+            {
+                age = std::max<int64_t>(0, std::strtoll(v.second.c_str(), nullptr, 10));
+            }
+            else if (name == "etag")
+            {
+                policy.mETag = v.second;
+            }
+            else if (name == "last-modified")
+            {
+                policy.mLastModified = v.second;
+            }
+            else if (name == "vary")
+            {
+                std::istringstream ss(v.second);
+                std::string field;
                 
-                status = true;
+                while (std::getline(ss, field, ','))
+                {
+                    field.erase(std::remove_if(field.begin(), field.end(), ::isspace), field.end());
+                    std::transform(field.begin(), field.end(), field.begin(), ::tolower);
+                    
+                    // Responses are stored decoded, so Accept-Encoding doesn't select another representation here.
+                    if (field == "*")
+                        policy.mStore = false;
+                    else if (field.size() > 0 && field != "accept-encoding")
+                        policy.mVary.push_back(std::move(field));
+                }
             }
         }
         
-        return status;
+        // Names are kept in order, so the same list hashes the same regardless of the order the server used.
+        std::sort(policy.mVary.begin(), policy.mVary.end());
+        policy.mVary.erase(std::unique(policy.mVary.begin(), policy.mVary.end()), policy.mVary.end());
+        
+        size_t varySize = 0;
+        for (const auto& v : policy.mVary)
+            varySize += sizeof(uint16_t) + v.size();
+        
+        if (varySize + sizeof(uint16_t) + sizeof(uint64_t) > std::numeric_limits<uint16_t>::max())
+            policy.mStore = false;
+        
+        // Freshness from the response takes precedence over the lifetime of the request: no-cache, then max-age, then Expires.
+        int64_t lifetime = -1;
+        
+        if (noCache)
+            lifetime = 0;
+        else if (maxAge >= 0)
+            lifetime = std::max<int64_t>(0, maxAge - age);
+        else if (expires >= 0)
+            lifetime = std::max<int64_t>(0, static_cast<int64_t>(expires) - static_cast<int64_t>(date >= 0 ? date : std::time(nullptr)));
+        
+        if (lifetime >= 0)
+            policy.mLifetime = static_cast<uint32_t>(std::min<int64_t>(lifetime * 1000, std::numeric_limits<uint32_t>::max()));
+        
+        return policy;
+    }
+    
+    void NetworkManager::applyCacheValidator(const CacheValidator& pValidator, NetworkRequest& pParam)
+    {
+        if (pValidator.mResponse.mCode != ENetworkCode::OK || !pParam.mCacheHeader || (pValidator.mETag.size() == 0 && pValidator.mLastModified.size() == 0))
+            return;
+        
+        // Headers given by the request take precedence, createUniqueHeader keeps the first occurrence.
+        if (pValidator.mETag.size() > 0)
+            pParam.mHeader.push_back({"If-None-Match", pValidator.mETag});
+        
+        if (pValidator.mLastModified.size() > 0)
+            pParam.mHeader.push_back({"If-Modified-Since", pValidator.mLastModified});
+        
+        mCacheConditionalCount.fetch_add(1);
+    }
+    
+    bool NetworkManager::finishCacheValidation(CacheValidator& pValidator, NetworkResponse& pResponse, CachePolicy& pPolicy)
+    {
+        if (pValidator.mResponse.mCode != ENetworkCode::OK || pResponse.mHttpCode != 304 || (pValidator.mETag.size() == 0 && pValidator.mLastModified.size() == 0))
+            return false;
+        
+        // 304 refreshes the stored response, which is served with the headers of the 304 response. Without freshness headers the stored lifetime is kept.
+        pResponse.mCode = ENetworkCode::OK;
+        pResponse.mHttpCode = pValidator.mResponse.mHttpCode;
+        pResponse.mMessage = std::move(pValidator.mResponse.mMessage);
+        pResponse.mRawData = std::move(pValidator.mResponse.mRawData);
+        
+        pPolicy = createCachePolicy(pResponse.mHeader, pValidator.mLifetime, true);
+        
+        if (pPolicy.mETag.size() == 0)
+            pPolicy.mETag = std::move(pValidator.mETag);
+        
+        if (pPolicy.mLastModified.size() == 0)
+            pPolicy.mLastModified = std::move(pValidator.mLastModified);
+        
+        if (pPolicy.mVary.size() == 0)
+            pPolicy.mVary = std::move(pValidator.mVary);
+        
+        mCacheNotModifiedCount.fetch_add(1);
+        mCacheNotModifiedSize.fetch_add(pResponse.mMessage.size() + pResponse.mRawData.size());
+        
+        return true;
+    }
+    
+    bool NetworkManager::serveStaleResponse(CacheValidator& pValidator, NetworkResponse& pResponse)
+    {
+        if (!pValidator.mStale || pValidator.mResponse.mCode != ENetworkCode::OK)
+            return false;
+        
+        pResponse = std::move(pValidator.mResponse);
+        pValidator.mResponse = NetworkResponse();
+        
+        mCacheStaleCount.fetch_add(1);
+        
+        return true;
+    }
+    
+    void NetworkManager::revalidateCache(const NetworkRequest& pParam, const NetworkAPI::HeaderBlock* pHeaderBlock, const std::string& pKey)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mCacheRevalidationMutex);
+            if (!mCacheRevalidation.insert(pKey).second)
+                return;
+        }
+        
+        // The refresh is an ordinary request which stores its response in the cache. Only one refresh of a key is running at a time.
+        // It isn't sent through an API, so it carries the default headers of the request in its own headers.
+        NetworkRequest param;
+        param.mRequestType = pParam.mRequestType;
+        param.mResponseType = pParam.mResponseType;
+        param.mMethod = pParam.mMethod;
+        param.mParameter = pParam.mParameter;
+        param.mHeader = pHeaderBlock != nullptr ? createUniqueHeader(pParam.mHeader, pHeaderBlock) : pParam.mHeader;
+        param.mRequestBody = pParam.mRequestBody;
+        param.mRequestCompression = pParam.mRequestCompression;
+        param.mResponseCompression = pParam.mResponseCompression;
+        param.mRepeatCount = pParam.mRepeatCount;
+        param.mAllowCoalescing = pParam.mAllowCoalescing;
+        param.mAllowCache = true;
+        param.mCacheLifetime = pParam.mCacheLifetime;
+        param.mCacheHeader = pParam.mCacheHeader;
+        
+        // The key is released with the callback of the refresh, so also when the refresh is canceled or never runs.
+        auto weakThis = mWeakThis;
+        std::shared_ptr<const std::string> revalidation(new std::string(pKey), [weakThis](const std::string* lpKey) -> void
+        {
+            if (auto strongThis = weakThis.lock())
+            {
+                std::lock_guard<std::mutex> lock(strongThis->mCacheRevalidationMutex);
+                strongThis->mCacheRevalidation.erase(*lpKey);
+            }
+            
+            delete lpKey;
+        });
+        
+        param.mCallback = [revalidation](NetworkResponse) -> void {};
+        
+        request(std::move(param));
     }
 
 }
@@ -4,6 +4,7 @@
 
 #include "hmsTask.hpp"
 
+#include <algorithm>
 #include <chrono>
 #include <list>
 #if defined(__APPLE__)
@@ -67,7 +68,7 @@ namespace hms
         mCondition.notify_all();
     }
     
-    void TaskManager::ThreadPool::push(std::pair<std::function<int32_t()>, std::function<void()>> pTask)
+    void TaskManager::ThreadPool::push(std::pair<std::function<int32_t(bool)>, std::function<void()>> pTask)
     {
         if (mTerminate.load() == 0)
         {
@@ -95,9 +96,10 @@ namespace hms
     
     void TaskManager::ThreadPool::update(size_t pIndex)
     {
-        std::list<std::pair<std::function<int32_t()>, std::function<void()>>> taskPaused;
+        std::list<std::pair<std::function<int32_t(bool)>, std::function<void()>>> taskPaused;
         std::list<std::pair<std::function<bool()>, std::function<void()>>> taskContinuous;
         std::function<void()> flushCallback = nullptr;
+        std::vector<std::function<void()>> taskExpired;
 
         while (mTerminate.load() == 0)
         {
@@ -113,17 +115,24 @@ namespace hms
             else
             {
                 int32_t delay = 0;
-                for (auto it = taskPaused.begin(); it != taskPaused.end(); ++it)
+                for (auto it = taskPaused.begin(); it != taskPaused.end();)
                 {
-                    int32_t result = it->first();
-                    if (result == -1)
+                    int32_t result = it->first(false);
+                    if (result <= 0)
                     {
-                        mTask.push({[]() -> int32_t { return -1; }, std::move(it->second)});
+                        if (result == 0)
+                            mTask.push({nullptr, std::move(it->second)});
+                        else
+                            mTask.push({[](bool) -> int32_t { return -1; }, std::move(it->second)});
+                        
                         it = taskPaused.erase(it);
                     }
-                    else if (delay == 0 || result < delay)
+                    else
                     {
-                        delay = result;
+                        if (delay == 0 || result < delay)
+                            delay = result;
+                        
+                        ++it;
                     }
                 }
             
@@ -136,7 +145,19 @@ namespace hms
             
             if (mThreads[pIndex].second.mValue.load() > 0)
             {
-                std::queue<std::pair<std::function<int32_t()>, std::function<void()>>>().swap(mTask);
+                // Tasks of executeDelayed aren't dropped, their owners may wait for them to finish. They are executed right away instead.
+                for (; !mTask.empty(); mTask.pop())
+                {
+                    if (mTask.front().first != nullptr)
+                        taskPaused.push_back(std::move(mTask.front()));
+                }
+                
+                for (auto& v : taskPaused)
+                {
+                    if (v.first(true) == 0)
+                        taskExpired.push_back(std::move(v.second));
+                }
+                
                 std::queue<std::pair<std::function<bool()>, std::function<void()>>>().swap(mTaskContinuous);
                 taskPaused.clear();
                 taskContinuous.clear();
@@ -159,7 +180,7 @@ namespace hms
 
             if (!mTask.empty())
             {
-                condition = mTask.front().first == nullptr ? 0 : mTask.front().first();
+                condition = mTask.front().first == nullptr ? 0 : mTask.front().first(false);
                 if (condition <= 0)
                 {
                     task = std::move(mTask.front().second);
@@ -196,6 +217,11 @@ namespace hms
                     it = taskContinuous.erase(it);
             }
             
+            for (auto& v : taskExpired)
+                v();
+            
+            taskExpired.clear();
+            
             if (flushCallback != nullptr)
             {
                 flushCallback();
@@ -367,12 +393,17 @@ namespace hms
         }
     }
     
-    std::function<int32_t()> TaskManager::createCondition(int32_t pDelayMs) const
+    std::function<int32_t(bool)> TaskManager::createCondition(int32_t pDelayMs, bool pMainThread) const
     {
-        return [pDelayMs, startTime = std::chrono::steady_clock::now()]() -> int32_t
+        // -1 sends the task to the main thread, 0 executes it in the thread pool, a positive value is the remaining delay.
+        // A flush expires only the delay of a thread pool task, a main thread task keeps its delay and is dropped as before.
+        return [pDelayMs, pMainThread, startTime = std::chrono::steady_clock::now()](bool lpExpire) -> int32_t
         {
+            if (lpExpire)
+                return pMainThread ? std::max<int32_t>(1, pDelayMs) : 0;
+            
             auto difference = std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(std::chrono::steady_clock::now() - startTime).count();
-            return difference >= pDelayMs ? -1 : pDelayMs - difference;
+            return difference >= pDelayMs ? (pMainThread ? -1 : 0) : std::max<int32_t>(1, static_cast<int32_t>(pDelayMs - difference));
         };
     }
 
@@ -8,6 +8,7 @@
 #include "aes.h"
 
 #include <climits>
+#include <cstring>
 #include <random>
 #include <iomanip>
 #include <algorithm>
@@ -47,68 +48,234 @@ namespace tools
         return bswap_64(pX);
     }
     
-    // URLTool
+    // URLView
     
-    URLTool::URLTool(const std::string& pURL)
+    URLView::URLView(std::string_view pURL)
     {
-        const size_t protocolOffset = 3;
+        const size_t size = pURL.size();
+        if (size == 0)
+            return;
         
-        mURL = pURL;
-        
-        if (mURL.length() == 0) return;
+        auto isAlpha = [](char c) -> bool { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); };
+        auto isDigit = [](char c) -> bool { return c >= '0' && c <= '9'; };
         
-        const size_t protocolPos = mURL.find("://");
+        size_t position = 0;
         
-        if (protocolPos != std::string::npos)
+        // A scheme is only recognized with "://", so "host:port/path" keeps its host.
+        if (isAlpha(pURL[0]))
         {
-            mProtocol = mURL.data();
-            mProtocolLength = protocolPos;
+            size_t schemeEnd = 1;
+            while (schemeEnd < size && (isAlpha(pURL[schemeEnd]) || isDigit(pURL[schemeEnd]) || pURL[schemeEnd] == '+' || pURL[schemeEnd] == '-' || pURL[schemeEnd] == '.'))
+                ++schemeEnd;
             
-            mSecure = (mProtocolLength == 3 && mURL.compare(0, mProtocolLength, "wss")) == 0 || (mProtocolLength == 5 && mURL.compare(0, mProtocolLength, "https") == 0);
+            if (pURL.compare(schemeEnd, 3, "://") == 0)
+            {
+                mScheme = pURL.substr(0, schemeEnd);
+                position = schemeEnd + 3;
+            }
         }
         
-        size_t hostEndPos = mURL.find('/', mProtocolLength + protocolOffset);
+        size_t authorityEnd = position;
+        while (authorityEnd < size && pURL[authorityEnd] != '/' && pURL[authorityEnd] != '?' && pURL[authorityEnd] != '#')
+            ++authorityEnd;
         
-        if (hostEndPos == std::string::npos)
+        std::string_view authority = pURL.substr(position, authorityEnd - position);
+        bool valid = true;
+        
+        const size_t userInfoEnd = authority.rfind('@');
+        if (userInfoEnd != std::string_view::npos)
         {
-            mURL += '/';
-            hostEndPos = mURL.length() - 1;
+            mUserInfo = authority.substr(0, userInfoEnd);
+            authority.remove_prefix(userInfoEnd + 1);
         }
         
-        size_t portPos = mURL.find(':', mProtocolLength + protocolOffset);
+        size_t hostEnd = authority.size();
+        if (authority.size() > 0 && authority[0] == '[')
+        {
+            const size_t literalEnd = authority.find(']');
+            if (literalEnd != std::string_view::npos)
+                hostEnd = literalEnd + 1;
+            else
+                valid = false;
+        }
+        else
+        {
+            hostEnd = std::min(authority.find(':'), authority.size());
+        }
         
-        if (portPos != std::string::npos)
+        mHost = authority.substr(0, hostEnd);
+        
+        if (hostEnd < authority.size())
         {
-            auto port = mURL.substr(portPos + 1, hostEndPos - (portPos + 1));
-            
-            try
+            if (authority[hostEnd] == ':')
             {
-                mPort = static_cast<uint16_t>(std::stoul(port));
-                mPortLength = hostEndPos - portPos;
+                mPort = authority.substr(hostEnd + 1);
+                
+                uint32_t port = 0;
+                for (size_t i = 0; i < mPort.size() && valid; ++i)
+                {
+                    valid = isDigit(mPort[i]) && (port = port * 10 + static_cast<uint32_t>(mPort[i] - '0')) <= 65535;
+                }
+                
+                mPortNumber = valid ? static_cast<uint16_t>(port) : 0;
             }
-            catch (std::exception& e)
+            else
             {
-                Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Url parsing port conversion fail: '%'", mURL);
+                valid = false;
             }
         }
-        else
+        
+        size_t pathEnd = authorityEnd;
+        while (pathEnd < size && pURL[pathEnd] != '?' && pURL[pathEnd] != '#')
+            ++pathEnd;
+        
+        mPath = pURL.substr(authorityEnd, pathEnd - authorityEnd);
+        
+        if (pathEnd < size && pURL[pathEnd] == '?')
         {
-            portPos = hostEndPos;
+            const size_t queryEnd = std::min(pURL.find('#', pathEnd), size);
+            mQuery = pURL.substr(pathEnd + 1, queryEnd - pathEnd - 1);
+            pathEnd = queryEnd;
+        }
+        
+        if (pathEnd < size)
+            mFragment = pURL.substr(pathEnd + 1);
+        
+        mValid = valid && mHost.size() > 0;
+    }
+    
+    bool URLView::isValid() const
+    {
+        return mValid;
+    }
+    
+    std::string_view URLView::getScheme() const
+    {
+        return mScheme;
+    }
+    
+    std::string_view URLView::getUserInfo() const
+    {
+        return mUserInfo;
+    }
+    
+    std::string_view URLView::getHost() const
+    {
+        return mHost;
+    }
+    
+    std::string_view URLView::getPort() const
+    {
+        return mPort;
+    }
+    
+    std::string_view URLView::getPath() const
+    {
+        return mPath;
+    }
+    
+    std::string_view URLView::getQuery() const
+    {
+        return mQuery;
+    }
+    
+    std::string_view URLView::getFragment() const
+    {
+        return mFragment;
+    }
+    
+    uint16_t URLView::getPortNumber() const
+    {
+        return mPortNumber;
+    }
+    
+    std::string URLView::decode(std::string_view pData)
+    {
+        auto toValue = [](char c) -> int
+        {
+            if (c >= '0' && c <= '9')
+                return c - '0';
+            else if (c >= 'a' && c <= 'f')
+                return c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F')
+                return c - 'A' + 10;
+            
+            return -1;
+        };
+        
+        std::string output;
+        output.reserve(pData.size());
+        
+        for (size_t i = 0; i < pData.size(); ++i)
+        {
+            const int high = pData[i] == '%' && i + 2 < pData.size() ? toValue(pData[i + 1]) : -1;
+            const int low = high >= 0 ? toValue(pData[i + 2]) : -1;
+            
+            if (low >= 0)
+            {
+                output += static_cast<char>(high * 16 + low);
+                i += 2;
+            }
+            else
+            {
+                output += pData[i];
+            }
         }
         
-        size_t parameterPos = mURL.find('?', hostEndPos);
+        return output;
+    }
+    
+    // URLTool
+    
+    URLTool::URLTool(const std::string& pURL)
+    {
+        mURL = pURL;
+        
+        if (mURL.length() == 0) return;
+        
+        URLView url(mURL);
         
-        if (parameterPos != std::string::npos)
+        // An URL without a path gets the root path, it's a part of the request line.
+        if (url.getPath().size() == 0)
         {
-            mParameter = mURL.data() + parameterPos;
-            mParameterLength = mURL.length() - parameterPos;
+            mURL.insert(static_cast<size_t>(url.getPath().data() - mURL.data()), 1, '/');
+            url = URLView(mURL);
         }
         
-        mHost = mURL.data() + (mProtocolLength != 0 ? mProtocolLength + protocolOffset : 0);
-        mHostLength = portPos - (mProtocolLength != 0 ? mProtocolLength + protocolOffset : 0);
+        if (url.getScheme().size() > 0)
+        {
+            mProtocol = url.getScheme().data();
+            mProtocolLength = url.getScheme().size();
+            
+            auto compare = [&url](const char* lpScheme) -> bool
+            {
+                return std::equal(url.getScheme().begin(), url.getScheme().end(), lpScheme, lpScheme + strlen(lpScheme), [](char lpSign1, char lpSign2) -> bool
+                {
+                    return std::tolower(static_cast<unsigned char>(lpSign1)) == lpSign2;
+                });
+            };
+            
+            mSecure = compare("https") || compare("wss");
+        }
+        
+        if (url.getPort().size() > 0 && url.getPortNumber() == 0)
+            Hermes::getInstance()->getLogger()->print(ELogLevel::Error, "Url parsing port conversion fail: '%'", mURL);
+        
+        mHost = url.getHost().data();
+        mHostLength = url.getHost().size();
+        mPort = url.getPortNumber();
+        
+        mPath = url.getPath().data();
+        mPathLength = url.getPath().size();
+        mPortLength = static_cast<size_t>(mPath - (mHost + mHostLength));
         
-        mPath = mURL.data() + hostEndPos;
-        mPathLength = mURL.length() - mParameterLength - hostEndPos;
+        // The parameter part starts with '?' and doesn't include the fragment.
+        const size_t pathEnd = static_cast<size_t>(mPath - mURL.data()) + mPathLength;
+        if (pathEnd < mURL.length() && mURL[pathEnd] == '?')
+        {
+            mParameter = mPath + mPathLength;
+            mParameterLength = url.getQuery().size() + 1;
+        }
     }
     
     const std::string& URLTool::getURL() const
@@ -157,7 +324,7 @@ namespace tools
         if (mURL.length() == 0)
             return "";
         else
-            return (mSecure ? "https://" : "http://") + (pBase ? mURL.substr(protocolLength, mURL.length() - (mPathLength + mParameterLength + protocolLength)) : mURL.substr(protocolLength));
+            return (mSecure ? "https://" : "http://") + (pBase ? mURL.substr(protocolLength, static_cast<size_t>(mPath - mURL.data()) - protocolLength) : mURL.substr(protocolLength));
     }
 }
 
@@ -738,5 +905,107 @@ namespace crypto
         auto data = decrypt(pBuffer.data(), pBuffer.size(), pKey, pIV, pMode);
         return std::vector<uint8_t>(data.begin(), data.end());
     }
+    
+    // Encryptor
+    
+    class Encryptor::Context
+    {
+    public:
+        static const size_t cBlockLength = 16;
+        
+        aes_encrypt_ctx mContext[1];
+        uint8_t mChain[cBlockLength] = {0};
+        uint8_t mPending[cBlockLength] = {0};
+        size_t mPendingSize = 0;
+        ECryptoMode mMode = ECryptoMode::None;
+        
+        void encryptBlock(const uint8_t* pData, size_t pSize, std::vector<uint8_t>& pOutput)
+        {
+            const size_t offset = pOutput.size();
+            pOutput.resize(offset + pSize);
+            
+            if (mMode == ECryptoMode::AES_256_CBC)
+            {
+                for (size_t block = 0; block < pSize; block += cBlockLength)
+                {
+                    for (size_t i = 0; i < cBlockLength; ++i)
+                        mChain[i] ^= pData[block + i];
+                    
+                    aes_encrypt(mChain, mChain, mContext);
+                    memcpy(pOutput.data() + offset + block, mChain, cBlockLength);
+                }
+            }
+            else
+            {
+                aes_ofb_crypt(pData, pOutput.data() + offset, static_cast<int>(pSize), mChain, mContext);
+            }
+        }
+    };
+    
+    Encryptor::Encryptor(const std::string& pKey, const std::string& pIV, ECryptoMode pMode)
+    {
+        if (pKey.size() == 32 && pIV.size() == Context::cBlockLength && (pMode == ECryptoMode::AES_256_CBC || pMode == ECryptoMode::AES_256_OFB))
+        {
+            mContext = std::make_unique<Context>();
+            mContext->mMode = pMode;
+            aes_encrypt_key256(reinterpret_cast<const uint8_t*>(pKey.c_str()), mContext->mContext);
+            memcpy(mContext->mChain, pIV.data(), Context::cBlockLength);
+        }
+        else
+        {
+            Hermes::getInstance()->getLogger()->print(ELogLevel::Warning, "Invalid key/iv size or mode. Encryptor");
+        }
+    }
+    
+    Encryptor::~Encryptor()
+    {
+        if (mContext != nullptr)
+            memset(static_cast<void*>(mContext.get()), 0, sizeof(Context));
+    }
+    
+    void Encryptor::update(const uint8_t* pData, size_t pSize, std::vector<uint8_t>& pOutput)
+    {
+        if (mContext == nullptr || pSize == 0)
+            return;
+        
+        const size_t blockLength = Context::cBlockLength;
+        
+        if (mContext->mPendingSize > 0)
+        {
+            const size_t fillCount = std::min(blockLength - mContext->mPendingSize, pSize);
+            memcpy(mContext->mPending + mContext->mPendingSize, pData, fillCount);
+            mContext->mPendingSize += fillCount;
+            pData += fillCount;
+            pSize -= fillCount;
+            
+            if (mContext->mPendingSize < blockLength)
+                return;
+            
+            mContext->encryptBlock(mContext->mPending, blockLength, pOutput);
+            mContext->mPendingSize = 0;
+        }
+        
+        const size_t alignedSize = pSize - pSize % blockLength;
+        if (alignedSize > 0)
+            mContext->encryptBlock(pData, alignedSize, pOutput);
+        
+        mContext->mPendingSize = pSize - alignedSize;
+        memcpy(mContext->mPending, pData + alignedSize, mContext->mPendingSize);
+    }
+    
+    void Encryptor::finalize(std::vector<uint8_t>& pOutput)
+    {
+        if (mContext == nullptr || mContext->mPendingSize == 0)
+            return;
+        
+        memset(mContext->mPending + mContext->mPendingSize, '\x03', Context::cBlockLength - mContext->mPendingSize);
+        mContext->encryptBlock(mContext->mPending, Context::cBlockLength, pOutput);
+        mContext->mPendingSize = 0;
+    }
+    
+    bool Encryptor::isValid() const
+    {
+        return mContext != nullptr;
+    }
 }
 }